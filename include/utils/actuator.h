@@ -0,0 +1,155 @@
+#ifndef ACTUATOR_H_INCLUDED
+#define ACTUATOR_H_INCLUDED
+
+#include <map>
+#include <vector>
+#include <string>
+#include <pthread.h>
+
+#include "utils/cpufunc.h"
+#include "utils/timing.h"
+
+using namespace std;
+
+// control files held open for a single cpu; backend handles, which are file
+// descriptors for sysfs.  setspeed_fd is only open under FREQ_CTRL_SETSPEED
+// and minspeed_fd only under FREQ_CTRL_WINDOW.
+struct cpu_ctrl_fd_t {
+    int setspeed_fd;
+    int maxspeed_fd;
+    int minspeed_fd;
+
+    cpu_ctrl_fd_t() : setspeed_fd( -1 ), maxspeed_fd( -1 ), minspeed_fd( -1 ) {}
+};
+
+// Frequency actuator which opens the control files of each cpu once and
+// retunes the cpu by writing the open handles, keeping path lookups and
+// open/close off the control path.  Depending on getFreqControl() these are
+// scaling_setspeed and scaling_max_freq, or the scaling_min_freq /
+// scaling_max_freq window of the active p-state drivers.
+class FreqActuator {
+public:
+    FreqActuator();
+    ~FreqActuator();
+
+    bool open( int cpu_idx, string &err );
+    bool open( map<int, string> &cpus, string &err );
+    void close();
+
+    bool isOpen( int cpu_idx ) const;
+    // the handles may be written directly as file descriptors
+    bool hasDescriptors() const;
+
+    int setspeedFd( int cpu_idx ) const {
+        return isOpen( cpu_idx ) ? fds[cpu_idx].setspeed_fd : -1;
+    }
+    int maxspeedFd( int cpu_idx ) const {
+        return isOpen( cpu_idx ) ? fds[cpu_idx].maxspeed_fd : -1;
+    }
+    int minspeedFd( int cpu_idx ) const {
+        return isOpen( cpu_idx ) ? fds[cpu_idx].minspeed_fd : -1;
+    }
+
+    // the two handles retuning the cpu to khz, in the order they must be written
+    bool writeOrder( int cpu_idx, int khz, int &first_fd, int &second_fd ) const;
+
+    bool setSpeed( int cpu_idx, const string &speed, string &err );
+
+private:
+    FreqActuator( const FreqActuator & );
+    FreqActuator &operator=( const FreqActuator & );
+
+    CpuBackend *backend;
+    freq_ctrl_t ctrl_mode;
+    vector<cpu_ctrl_fd_t> fds;
+};
+
+// single frequency decision of a control tick
+struct freq_decision_t {
+    int cpu_idx;
+    string speed;           // requested speed; never rewritten by the batch
+    string applied_speed;   // speed written for the cpu's domain; the winning one on conflict
+    bool applied;
+    bool conflict;  // another decision asked for a different speed in the same frequency domain
+    int writer;     // index of the decision whose write covers this one
+    TIME done;      // time the write completed
+
+    freq_decision_t() : cpu_idx( -1 ), applied( false ), conflict( false ), writer( -1 ) {}
+    freq_decision_t( int _cpu, const string &_speed ) : cpu_idx( _cpu ), speed( _speed ), applied( false ), conflict( false ), writer( -1 ) {}
+};
+
+// apply latency of one batch
+struct batch_stat_t {
+    TIME submitted;
+    TIME first_done;
+    TIME last_done;
+    int applied;
+    int failed;
+    int writes;     // sysfs writes issued, one per frequency domain
+    int conflicts;  // domains that were asked for more than one speed
+
+    batch_stat_t() : applied( 0 ), failed( 0 ), writes( 0 ), conflicts( 0 ) {}
+};
+
+// Applies a whole vector of frequency decisions as one batch.  The decisions
+// are striped across a pool of writer threads so that the skew between the
+// first and last core of a control tick stays small.  Batches may be handed
+// off with submit() and collected later with wait(), or applied synchronously
+// with apply().  With a single writer the batch is applied on the caller.
+//
+// Decisions for cpus of one cpufreq policy (see discoverFrequencyDomains) are
+// written once.  When they disagree the highest speed is written and every
+// decision of that domain is flagged as a conflict.  Once a batch completes
+// each decision carries the speed written for it in applied_speed, and
+// applied tells whether that write succeeded.
+class BatchActuator {
+public:
+    BatchActuator( FreqActuator &_actuator, int _writer_count = 1 );
+    ~BatchActuator();
+
+    bool start( string &err );
+    void stop();
+
+    bool submit( vector<freq_decision_t> &decisions );
+    void wait( batch_stat_t &stat );
+    void apply( vector<freq_decision_t> &decisions, batch_stat_t &stat );
+
+    int writerCount() const {
+        return writer_count;
+    }
+
+private:
+    BatchActuator( const BatchActuator & );
+    BatchActuator &operator=( const BatchActuator & );
+
+    struct writer_arg_t {
+        BatchActuator *owner;
+        int writer_idx;
+    };
+
+    static void *writerThread( void *args );
+    void planWrites();
+    void applyStripe( int writer_idx );
+
+    FreqActuator &actuator;
+    int writer_count;
+    bool running;
+
+    vector<pthread_t> writers;
+    vector<writer_arg_t> writer_args;
+
+    pthread_mutex_t mute_batch;
+    pthread_cond_t cond_submit, cond_done;
+
+    vector<freq_decision_t> *batch;
+    vector<int> writes;         // decisions that are written
+    vector<int> domain_writer;  // per domain decision index within the batch
+    batch_stat_t batch_stat;
+    uint64_t generation;
+    int pending;
+    bool in_flight, shutdown;
+};
+
+void printBatchStat( batch_stat_t &stat );
+
+#endif // ACTUATOR_H_INCLUDED
@@ -0,0 +1,97 @@
+#ifndef ASYNC_LOG_H_INCLUDED
+#define ASYNC_LOG_H_INCLUDED
+
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <stdint.h>
+
+#include "utils/timing.h"
+
+using namespace std;
+
+const int LOG_RECORD_VALUES = 16;
+const size_t LOG_RING_RECORDS = 4096;
+
+// One line of output before formatting.  kind tells the formatter how to
+// read id and the first count values.
+struct log_record_t {
+    TIME time;
+    int kind;
+    int id;
+    int count;
+    int64_t values[LOG_RECORD_VALUES];
+};
+
+typedef void ( *log_format_t )( const log_record_t &rec );
+
+// Single producer, single consumer ring of log records.  Pushing never
+// blocks; a record that finds the ring full is dropped and counted.
+class LogRing {
+public:
+    LogRing( size_t capacity );
+
+    bool push( const log_record_t &rec );
+
+    // the oldest record, left in place until release() so that an empty
+    // ring means every record was also formatted
+    const log_record_t *front();
+    void release();
+
+    bool empty() const;
+    uint64_t dropped() const {
+        return __atomic_load_n( &drops, __ATOMIC_RELAXED );
+    }
+
+private:
+    vector<log_record_t> slots;
+    uint64_t mask;
+    uint64_t drops;
+
+    // written by the producer and consumer respectively; kept apart
+    uint64_t head __attribute__(( aligned( 64 ) ));
+    uint64_t tail __attribute__(( aligned( 64 ) ));
+};
+
+// Formats the records of any number of producer threads on a logger thread
+// of its own, so that printf and the terminal stay off the producers' time.
+// Each producer takes its own ring before start().
+class AsyncLogger {
+public:
+    AsyncLogger( log_format_t format, size_t ring_records = LOG_RING_RECORDS );
+    ~AsyncLogger();
+
+    LogRing *addProducer();
+
+    // cpu_idx pins the logger thread, -1 leaves it unbound
+    bool start( int cpu_idx, string &err );
+
+    // waits until every record pushed so far is formatted
+    void sync();
+
+    // drains the rings and ends the logger thread
+    void stop();
+
+    uint64_t logged() const {
+        return __atomic_load_n( &formatted, __ATOMIC_RELAXED );
+    }
+    uint64_t dropped() const;
+
+private:
+    AsyncLogger( const AsyncLogger & );
+    AsyncLogger &operator=( const AsyncLogger & );
+
+    static void *loggerThread( void *args );
+    uint64_t drain();
+
+    log_format_t format;
+    size_t ring_records;
+    vector<LogRing *> rings;
+
+    bool running;
+    bool stopping;
+    pthread_t thread;
+    uint64_t formatted;
+};
+
+#endif // ASYNC_LOG_H_INCLUDED
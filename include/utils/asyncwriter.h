@@ -0,0 +1,150 @@
+#ifndef ASYNC_WRITER_H_INCLUDED
+#define ASYNC_WRITER_H_INCLUDED
+
+#include <deque>
+#include <vector>
+#include <string>
+#include <pthread.h>
+
+#include "utils/timing.h"
+#include "utils/actuator.h"
+
+#ifndef IO_URING
+#define IO_URING 0
+#endif
+
+using namespace std;
+
+const int ASYNC_SPEED_LEN = 16;
+
+// record of a single queued frequency write
+struct async_write_t {
+    int cpu_idx;
+    char speed[ASYNC_SPEED_LEN];
+    int speed_len;
+    bool ok;
+    TIME submitted;
+    TIME completed;
+};
+
+// Queues frequency writes so that neither the worker threads nor the
+// controller block on sysfs.  Every completed write is kept with its submit
+// and completion time until it is collected.
+class AsyncFreqWriter {
+public:
+    virtual ~AsyncFreqWriter();
+
+    virtual bool start( string &err ) = 0;
+    virtual void stop() = 0;
+    // conflict as from setCPUThrottledSpeed; known as soon as the write is queued
+    virtual bool submit( int cpu_idx, const string &speed, bool &conflict ) = 0;
+    virtual const char *name() const = 0;
+
+    void flush();
+    void collect( vector<async_write_t> &done );
+
+    // io_uring when compiled in and supported by the kernel, else a thread pool
+    static AsyncFreqWriter *create( FreqActuator &actuator, int pool_threads, string &err );
+
+protected:
+    AsyncFreqWriter( FreqActuator &_actuator );
+
+    bool prepare( async_write_t &req, int cpu_idx, const string &speed );
+    void complete( async_write_t &req, bool ok );
+
+    FreqActuator &actuator;
+
+    pthread_mutex_t mute_done;
+    pthread_cond_t cond_done;
+    vector<async_write_t> completed;
+    uint64_t outstanding;
+
+private:
+    AsyncFreqWriter( const AsyncFreqWriter & );
+    AsyncFreqWriter &operator=( const AsyncFreqWriter & );
+};
+
+// fallback writer; a pool of threads each drains its own request queue.
+// Every cpu of a frequency domain is queued to the same thread, so writes
+// to a domain are applied in the order they were submitted.
+class PoolFreqWriter : public AsyncFreqWriter {
+public:
+    PoolFreqWriter( FreqActuator &_actuator, int _thread_count );
+    ~PoolFreqWriter();
+
+    bool start( string &err );
+    void stop();
+    bool submit( int cpu_idx, const string &speed, bool &conflict );
+    const char *name() const {
+        return "thread-pool";
+    }
+
+private:
+    struct writer_shard_t {
+        PoolFreqWriter *owner;
+        pthread_t thread;
+        pthread_mutex_t mute_queue;
+        pthread_cond_t cond_queue;
+        deque<async_write_t> queue;
+    };
+
+    static void *writerThread( void *args );
+    int shardOf( int cpu_idx ) const;
+
+    int thread_count;
+    bool shutdown;
+    int started;
+    vector<writer_shard_t *> shards;
+};
+
+#if IO_URING
+
+#include <liburing.h>
+
+// io_uring writer; setspeed and max_freq writes are submitted as a linked
+// pair and a reaper thread stamps their completion.  io-wq may complete
+// separate pairs in any order, so each frequency domain has at most one
+// pair in flight and later requests wait in submission order.
+class UringFreqWriter : public AsyncFreqWriter {
+public:
+    UringFreqWriter( FreqActuator &_actuator, int _depth = 256 );
+    ~UringFreqWriter();
+
+    bool start( string &err );
+    void stop();
+    bool submit( int cpu_idx, const string &speed, bool &conflict );
+    const char *name() const {
+        return "io_uring";
+    }
+
+private:
+    static void *reaperThread( void *args );
+    int keyOf( int cpu_idx ) const;
+    void queueWrites( int slot );
+
+    int depth;
+    bool running;
+    struct io_uring ring;
+    pthread_t reaper;
+
+    // submit waits on cond_slot while every slot is in flight
+    pthread_mutex_t mute_ring;
+    pthread_cond_t cond_slot;
+    vector<async_write_t> slots;
+    vector<int> free_slots;
+    vector<bool> slot_failed;
+    vector<int> slot_key;
+
+    // per frequency domain, or per cpu outside any known domain: requests
+    // not yet completed, the speed of the last one queued and the requests
+    // held back behind the pair in flight
+    vector<int> key_outstanding;
+    vector<int> queued_khz;
+    vector<deque<int> > key_waiting;
+};
+
+#endif
+
+void printAsyncWrites( vector<async_write_t> &writes );
+
+#endif // ASYNC_WRITER_H_INCLUDED
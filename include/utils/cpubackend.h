@@ -0,0 +1,161 @@
+#ifndef CPU_BACKEND_H_INCLUDED
+#define CPU_BACKEND_H_INCLUDED
+
+#include <map>
+#include <deque>
+#include <vector>
+#include <string>
+#include <pthread.h>
+#include <sys/types.h>
+
+using namespace std;
+
+const string SYSFS_CPU_ROOT = "/sys/devices/system/cpu";
+
+const string SYSFS_BACKEND = "sysfs";
+const string FAKE_SYSFS_BACKEND = "fake";
+const string MEMORY_BACKEND = "memory";
+
+// environment variable consulted when no backend is named on the command line
+const string CPU_BACKEND_ENV = "CPUFREQ_BACKEND";
+
+// Access to the cpu attributes normally found under /sys/devices/system/cpu.
+// Attribute names are relative to that root, e.g. "online" or
+// "cpu3/cpufreq/scaling_setspeed".  Opened attributes are addressed by a
+// handle; reads and writes always cover the whole value, as with sysfs.
+class CpuBackend {
+public:
+    virtual ~CpuBackend() {}
+
+    virtual const char *name() const = 0;
+    // root is required to change the attributes
+    virtual bool needsRoot() const = 0;
+    // handles are file descriptors that may be written outside the backend
+    virtual bool hasDescriptors() const {
+        return false;
+    }
+
+    // handle, or -1 when the attribute does not exist
+    virtual int open( const char *attr, bool writable ) = 0;
+    virtual void close( int handle ) = 0;
+    virtual ssize_t read( int handle, char *buffer, size_t len ) = 0;
+    virtual ssize_t write( int handle, const char *buffer, size_t len ) = 0;
+
+    // one-shot access; the value read is NUL terminated
+    bool readAttr( const char *attr, char *buffer, size_t len );
+    bool writeAttr( const char *attr, const char *buffer, size_t len );
+};
+
+// the kernel's sysfs, or a copy of its layout rooted elsewhere
+class SysfsBackend : public CpuBackend {
+public:
+    SysfsBackend( const string &_root = SYSFS_CPU_ROOT );
+
+    const char *name() const {
+        return "sysfs";
+    }
+    bool needsRoot() const {
+        return true;
+    }
+    bool hasDescriptors() const {
+        return true;
+    }
+
+    int open( const char *attr, bool writable );
+    void close( int handle );
+    ssize_t read( int handle, char *buffer, size_t len );
+    ssize_t write( int handle, const char *buffer, size_t len );
+
+protected:
+    string root;
+};
+
+// Directory tree laid out like sysfs, e.g. for tests or containers.  Unlike
+// sysfs, regular files keep stale bytes past a shorter write, so every write
+// also truncates and the descriptors are not handed out.
+class FakeSysfsBackend : public SysfsBackend {
+public:
+    FakeSysfsBackend( const string &_root );
+
+    const char *name() const {
+        return "fake-sysfs";
+    }
+    bool needsRoot() const {
+        return false;
+    }
+    bool hasDescriptors() const {
+        return false;
+    }
+
+    ssize_t write( int handle, const char *buffer, size_t len );
+
+    // create a default tree of cpu_count cpus; existing files are kept
+    bool populate( int cpu_count, const vector<int> &khz, const string &driver, string &err );
+};
+
+// Attributes held in memory.  A write to the attribute that controls the
+// speed (scaling_setspeed, or scaling_max_freq for the p-state drivers) is
+// reflected in scaling_cur_freq of the same cpu, standing in for the kernel.
+class MemoryBackend : public CpuBackend {
+public:
+    MemoryBackend();
+    MemoryBackend( int cpu_count, const vector<int> &khz, const string &driver = "" );
+    ~MemoryBackend();
+
+    const char *name() const {
+        return "memory";
+    }
+    bool needsRoot() const {
+        return false;
+    }
+
+    // handles stay valid until the backend is destroyed; attributes must not
+    // be created while other threads access the backend
+    int open( const char *attr, bool writable );
+    void close( int handle ) {}
+    ssize_t read( int handle, char *buffer, size_t len );
+    ssize_t write( int handle, const char *buffer, size_t len );
+
+    void set( const string &attr, const string &value );
+    // copy every later write of attr into mirror
+    void link( const string &attr, const string &mirror );
+
+private:
+    MemoryBackend( const MemoryBackend & );
+    MemoryBackend &operator=( const MemoryBackend & );
+
+    struct mem_attr_t {
+        pthread_mutex_t mute;
+        string value;
+        int mirror;     // attribute updated alongside this one, or -1
+    };
+
+    int find( const char *attr ) const;
+    int lookup( const string &attr );
+
+    pthread_mutex_t mute_attrs;
+    // sorted by name so lookups compare in place and allocate nothing
+    vector<pair<string, int> > index;
+    deque<mem_attr_t> attrs;
+};
+
+// attribute name of a cpufreq file of a cpu, e.g. "cpu3/cpufreq/scaling_setspeed"
+void cpuFreqAttr( char *attr, size_t len, int cpu_idx, const string &file );
+
+// Default cpufreq layout used by the fake and in-memory backends.  An empty
+// driver gives acpi-cpufreq with the userspace governor; intel_pstate and
+// amd-pstate-epp give their active mode, without setspeed or a frequency list.
+void buildCpuTree( int cpu_count, const vector<int> &khz, const string &driver, map<string, string> &tree );
+
+// attribute whose writes land in scaling_cur_freq under the driver
+const string &cpuSpeedFile( const string &driver );
+
+CpuBackend &cpuBackend();
+CpuBackend &hostBackend();
+
+// Selects the backend from "sysfs", "fake:<dir>[:<cpus>[:<driver>]]" or
+// "memory[:<cpus>[:<driver>]]"; an empty spec falls back to $CPUFREQ_BACKEND
+// and then sysfs.  Fails when the backend needs root and the process lacks it.
+bool initCpuBackend( const string &spec, string &err );
+
+#endif // CPU_BACKEND_H_INCLUDED
@@ -4,41 +4,94 @@
 #include <iostream>
 #include <fstream>
 #include <cstdlib>
+#include <stdint.h>
 #include <map>
+#include <vector>
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/tokenizer.hpp>
 #include <boost/lexical_cast.hpp>
 
+#include "utils/freqtable.h"
+#include "utils/cpubackend.h"
+
 using namespace std;
 
 const int BUFFER_SIZE = 4096;
 
-const string CPU0_FILE_PATH = "/sys/devices/system/cpu/cpu0/cpufreq/";
-const string CPU1_FILE_PATH = "/sys/devices/system/cpu/cpu1/cpufreq/";
-
-const string CPU_FILE = "/sys/devices/system/cpu/cpu";
+// attributes relative to the cpu root of the backend
+const string CPU_ONLINE_FILE = "online";
+const string CPU_PRESENT_FILE = "present";
+const string CPU_POSSIBLE_FILE = "possible";
 const string CPU_FREQ = "/cpufreq/";
+const string GLOBAL_BOOST_FILE = "cpufreq/boost";
+const string INTEL_NO_TURBO_FILE = "intel_pstate/no_turbo";
 
 const string SCALING_GOVERNOR_FILE = "scaling_governor";
 const string SCALING_SETSPEED_FILE = "scaling_setspeed";
 const string SCALING_SETMAXSPEED_FILE = "scaling_max_freq";
+const string SCALING_SETMINSPEED_FILE = "scaling_min_freq";
+const string SCALING_EPP_FILE = "energy_performance_preference";
+const string CPUFREQ_BOOST_FILE = "boost";
+const string SCALING_DRIVER_FILE = "scaling_driver";
+const string CPUINFO_MIN_FREQ = "cpuinfo_min_freq";
+const string CPUINFO_MAX_FREQ = "cpuinfo_max_freq";
 const string SCALING_AVAILABLE_GOVERNOR = "scaling_available_governors";
 const string SCALING_AVAILABLE_FREQ = "scaling_available_frequencies";
+const string SCALING_CUR_FREQ = "scaling_cur_freq";
+const string RELATED_CPUS_FILE = "related_cpus";
+const string AFFECTED_CPUS_FILE = "affected_cpus";
 
 const string USERSPACE = "userspace";
 const string ONDEMAND = "ondemand";
+const string SCHEDUTIL = "schedutil";
+
+const string ACPI_CPUFREQ_DRIVER = "acpi-cpufreq";
+const string INTEL_PSTATE_DRIVER = "intel_pstate";
+const string AMD_PSTATE_EPP_DRIVER = "amd-pstate-epp";
+const string EPP_PERFORMANCE = "performance";
+
+// speed granularity of drivers that list no available frequencies
+const int WINDOW_STEP_KHZ = 100000;
+
+// how a speed is imposed on a cpu
+enum freq_ctrl_t {
+    FREQ_CTRL_SETSPEED,     // userspace governor: scaling_setspeed, capped by scaling_max_freq
+    FREQ_CTRL_WINDOW        // intel_pstate / amd-pstate-epp active mode: scaling_min_freq = scaling_max_freq
+};
+
+// cpus sharing a single cpufreq policy; a speed written to any of them
+// applies to all
+struct freq_domain_t {
+    int leader;             // lowest online cpu of the policy
+    vector<int> cpus;       // related_cpus
+    vector<int> online;     // affected_cpus
+};
+
+// counters of the per-cpu speed shadow
+struct speed_shadow_stat_t {
+    uint64_t requests;      // speed changes asked for
+    uint64_t writes;        // writes that reached sysfs
+    uint64_t elided;        // requests for the speed already applied
+    uint64_t conflicts;     // requests overriding another cpu of the same frequency domain
+
+    speed_shadow_stat_t() : requests( 0 ), writes( 0 ), elided( 0 ), conflicts( 0 ) {}
+};
 
 
 void Test1() ;
 
 void Test2() ;
 
-int determineCPUCount();
+int determineCPUIdBound();
+bool parseCPUList( const char *list, vector<int> &cpus );
+bool readCPUIds( const string &attr, vector<int> &cpus, CpuBackend &backend = cpuBackend() );
+bool determineOnlineCPUs( vector<int> &cpus );
+bool determinePresentCPUs( vector<int> &cpus );
 
 void bufferdump ( char *buffer, int buffer_size );
 
-bool initUserspace(int cpu_count, map<int, string> &orig_state);
-bool resetCPUs(map<int, string> &orig_state);
+bool initUserspace(vector<int> &cpus, map<int, string> &orig_state);
+bool initSchedutil(vector<int> &cpus, map<int, string> &orig_state);
 
 bool checkCPU_Avail_Governor ( int cpu_idx, const string &governor, string &err );
 
@@ -47,8 +100,32 @@ bool checkCPU_Governor_Mode ( int cpu_idx, const string &governor, string &err )
 bool setCPU_Govenor_Mode ( int cpu_idx, const string &governor, string &err ) ;
 
 bool fillAvailableThrottlingSpeeds( map<int, string> &cpu_avail_freq, int cpu_count);
+bool fillAvailableThrottlingSpeeds( FrequencyTable &cpu_avail_freq, int cpu_count );
 
 bool getAvailableThrottlingSpeeds ( int cpu_idx, string &freqs, string &err );
 bool setCPUThrottledSpeed ( int cpu_idx, const string &speed, string &err ) ;
+bool setCPUThrottledSpeed ( int cpu_idx, const string &speed, bool &conflict, string &err ) ;
+
+freq_ctrl_t detectFreqControl( int cpu_idx );
+freq_ctrl_t getFreqControl();
+void setFreqControl( freq_ctrl_t ctrl );
+bool raiseWindowFirst( int cpu_idx, int khz );
+
+bool discoverFrequencyDomains( int cpu_bound );
+const vector<freq_domain_t> &getFrequencyDomains();
+int getFrequencyDomain( int cpu_idx );
+void printFrequencyDomains();
+
+void initSpeedShadow( int cpu_bound );
+bool syncSpeedShadow( int cpu_idx );
+void invalidateSpeedShadow( int cpu_idx );
+bool speedShadowMatches( int cpu_idx, int khz );
+bool speedRequestMatches( int cpu_idx, int khz, int current_khz );
+int getSpeedShadow( int cpu_idx );
+void updateSpeedShadow( int cpu_idx, int khz, bool ok );
+bool recordSpeedRequest( int cpu_idx, int khz );
+void clearSpeedRequest( int cpu_idx );
+void getSpeedShadowStats( speed_shadow_stat_t &stat );
+void printSpeedShadowStats();
 
 #endif // CPUFUNC_H_
@@ -0,0 +1,92 @@
+#ifndef CPU_STATE_H_INCLUDED
+#define CPU_STATE_H_INCLUDED
+
+#include <vector>
+#include <string>
+#include <pthread.h>
+#include <stdint.h>
+
+using namespace std;
+
+// cpufreq settings of one cpu; empty when the attribute does not exist
+struct cpu_state_t {
+    int cpu_idx;
+    string governor;
+    string min_freq;
+    string max_freq;
+    string setspeed;    // only held under the userspace governor
+    string epp;         // energy_performance_preference
+    string boost;       // per-policy boost
+
+    cpu_state_t() : cpu_idx( -1 ) {}
+};
+
+// outcome of a restore
+struct restore_stat_t {
+    int cpus;
+    int writes;
+    int failures;
+    uint64_t elapsed;   // TIME_ABRV units
+
+    restore_stat_t() : cpus( 0 ), writes( 0 ), failures( 0 ), elapsed( 0 ) {}
+};
+
+// Complete cpufreq state of a set of cpus, captured once before the tools
+// change anything and written back when they are done.  The restore is
+// spread over several threads and runs at most once, whether it is reached
+// on the normal exit path or from the signal handler thread.
+class CpuStateSnapshot {
+public:
+    CpuStateSnapshot();
+    ~CpuStateSnapshot();
+
+    bool capture( vector<int> &cpus, string &err );
+    bool restore( int thread_count = 8 );
+    bool restore( int thread_count, restore_stat_t &stat );
+
+    bool captured() const {
+        return !states.empty();
+    }
+    const vector<cpu_state_t> &cpuStates() const {
+        return states;
+    }
+
+    void print();
+
+private:
+    CpuStateSnapshot( const CpuStateSnapshot & );
+    CpuStateSnapshot &operator=( const CpuStateSnapshot & );
+
+    struct restore_arg_t {
+        CpuStateSnapshot *owner;
+        int first;
+        int stride;
+        int writes;
+        int failures;
+    };
+
+    static void *restoreThread( void *args );
+    void restoreCPU( cpu_state_t &state, int &writes, int &failures );
+
+    vector<cpu_state_t> states;
+    string global_boost;    // cpufreq/boost
+    string no_turbo;        // intel_pstate/no_turbo
+
+    pthread_mutex_t mute_restore;
+    bool restored;
+};
+
+// Undoes a change to the system other than cpufreq.  The signal thread runs
+// the registered hooks, latest first, before it restores the snapshot; an
+// owner that undoes its change on the normal path removes its hook.
+typedef void ( *restore_hook_t )( void *arg );
+
+void addRestoreHook( restore_hook_t hook, void *arg );
+void removeRestoreHook( restore_hook_t hook, void *arg );
+
+// Blocks SIGINT and SIGTERM in the calling thread and every thread created
+// after it, and restores the snapshot from a dedicated thread before the
+// process exits on either signal.  Call before any other thread is created.
+bool installRestoreHandler( CpuStateSnapshot &snapshot, string &err );
+
+#endif // CPU_STATE_H_INCLUDED
@@ -0,0 +1,63 @@
+#ifndef CPU_STATS_H_INCLUDED
+#define CPU_STATS_H_INCLUDED
+
+#include <map>
+#include <vector>
+#include <string>
+#include <stdint.h>
+
+using namespace std;
+
+// cpufreq statistics, relative to the cpufreq directory of a cpu
+const string STATS_TIME_IN_STATE_FILE = "stats/time_in_state";
+const string STATS_TOTAL_TRANS_FILE = "stats/total_trans";
+const string STATS_TRANS_TABLE_FILE = "stats/trans_table";
+
+// time_in_state counts in units of 10 ms
+const int STATS_TIME_UNIT_MS = 10;
+
+// share of a sample that must be spent at the requested speeds
+const double STATS_AGREEMENT_MIN = 0.9;
+
+// Kernel cpufreq statistics of one cpu, or the difference of two snapshots.
+// trans_table is kept when the kernel provides it (it is omitted once the
+// table outgrows a page).
+struct cpufreq_stats_t {
+    int cpu_idx;
+    bool valid;
+    map<int, uint64_t> time_in_state;           // kHz -> time in 10 ms units
+    uint64_t total_trans;
+    map<pair<int, int>, uint64_t> trans_table;  // (from kHz, to kHz) -> transitions
+    bool has_trans_table;
+
+    cpufreq_stats_t() : cpu_idx( -1 ), valid( false ), total_trans( 0 ), has_trans_table( false ) {}
+
+    uint64_t residencyMS() const;
+};
+
+// speeds requested during a sample, in the order they were requested
+struct speed_schedule_t {
+    vector<int> khz;
+    vector<int> seconds;
+};
+
+// agreement of the kernel statistics of a sample with its schedule
+struct schedule_check_t {
+    double agreement;       // share of the residency at requested speeds; -1 without residency
+    int expected_trans;     // speed changes in the schedule
+    int missed_trans;       // changes absent from trans_table; -1 without it
+    bool flagged;           // only judged with residency
+
+    schedule_check_t() : agreement( -1.0 ), expected_trans( 0 ), missed_trans( -1 ), flagged( false ) {}
+};
+
+bool readCpuFreqStats( int cpu_idx, cpufreq_stats_t &stats, string &err );
+// counters accumulated between two snapshots of the same cpu
+void diffCpuFreqStats( const cpufreq_stats_t &before, const cpufreq_stats_t &after, cpufreq_stats_t &delta );
+
+void checkSchedule( const cpufreq_stats_t &delta, const speed_schedule_t &schedule, schedule_check_t &check );
+
+// "<kHz>:<ms>,..." of the speeds with any residency; "-" when invalid
+void formatResidency( const cpufreq_stats_t &delta, string &out );
+
+#endif // CPU_STATS_H_INCLUDED
@@ -0,0 +1,80 @@
+#ifndef FREQ_TABLE_H_INCLUDED
+#define FREQ_TABLE_H_INCLUDED
+
+#include <map>
+#include <vector>
+#include <string>
+
+using namespace std;
+
+// upper bound on the bucket index; tables with tighter steps fall back to a
+// binary search
+const int MAX_FREQ_BUCKETS = 4096;
+
+// Sorted, contiguous table of the available cpu speeds.  Index 0 is the
+// lowest speed.  Every entry keeps its kHz value and the string written to
+// sysfs, so index to kHz lookups and stepping are constant time.  kHz to
+// index and nearest-step queries go through a bucket index and are constant
+// time too, unless the smallest gap between steps would need more than
+// MAX_FREQ_BUCKETS buckets, as an unaligned top speed of a window-mode table
+// can.  Those tables fall back to a binary search, logarithmic in the table
+// length.  Nothing allocates once the table is built.
+class FrequencyTable {
+public:
+    FrequencyTable();
+
+    void add( int khz );
+    void add( int khz, const string &speed );
+    void build( map<int, string> &avail_freq );
+    void clear();
+
+    int size() const {
+        return ( int ) khz_steps.size();
+    }
+    bool empty() const {
+        return khz_steps.empty();
+    }
+
+    int khz( int idx ) const {
+        return khz_steps[idx];
+    }
+    const string &speed( int idx ) const {
+        return speeds[idx];
+    }
+
+    int minIndex() const {
+        return 0;
+    }
+    int midIndex() const {
+        return size() / 2;
+    }
+    int maxIndex() const {
+        return size() - 1;
+    }
+
+    // steps clamp at the ends of the table
+    int nextUp( int idx ) const {
+        return idx < maxIndex() ? idx + 1 : maxIndex();
+    }
+    int nextDown( int idx ) const {
+        return idx > 0 ? idx - 1 : 0;
+    }
+
+    int indexOf( int khz ) const;
+    int nearest( int khz ) const;
+
+private:
+    void index();
+    int floorIndex( int khz ) const;
+
+    vector<int> khz_steps;
+    vector<string> speeds;
+
+    // bucketed floor index over [khz_steps.front(), khz_steps.back()]; every
+    // bucket is no wider than the smallest gap between two steps, and it is
+    // empty when that takes more than MAX_FREQ_BUCKETS
+    vector<int> bucket_floor;
+    int bucket_width;
+};
+
+#endif // FREQ_TABLE_H_INCLUDED
@@ -0,0 +1,83 @@
+#ifndef HISTOGRAM_H_INCLUDED
+#define HISTOGRAM_H_INCLUDED
+
+#include <stdint.h>
+
+using namespace std;
+
+// Every power of two range is split into 2^HIST_SUB_BITS buckets, so a
+// recorded value is known to within 1/32 (about 3%).  Values from 2^47 ns
+// (about 39 hours) up share the last bucket.
+const int HIST_SUB_BITS = 5;
+const int HIST_SUB_BUCKETS = 1 << HIST_SUB_BITS;
+const int HIST_MAX_EXPONENT = 47;
+const int HIST_BUCKETS = ( HIST_MAX_EXPONENT - HIST_SUB_BITS + 2 ) * HIST_SUB_BUCKETS;
+
+// Log bucketed histogram of latencies in ns, HDR style.  Its memory is
+// fixed, so a worker records into its own without locking or allocating;
+// the owner merges them once the workers are joined.
+class LatencyHistogram {
+public:
+    LatencyHistogram();
+
+    inline void record( uint64_t value ) {
+        counts[bucketOf( value )]++;
+        total++;
+        sum += value;
+        if( value < lowest ) {
+            lowest = value;
+        }
+        if( value > highest ) {
+            highest = value;
+        }
+    }
+
+    void merge( const LatencyHistogram &other );
+    void clear();
+
+    uint64_t count() const {
+        return total;
+    }
+    uint64_t min() const {
+        return total > 0 ? lowest : 0;
+    }
+    uint64_t max() const {
+        return highest;
+    }
+    double mean() const {
+        return total > 0 ? ( double ) sum / total : 0;
+    }
+
+    // highest value equivalent to the recorded one at percentile p (0-100)
+    uint64_t percentile( double p ) const;
+
+    static inline int bucketOf( uint64_t value ) {
+        if( value < ( uint64_t ) HIST_SUB_BUCKETS ) {
+            return ( int ) value;
+        }
+
+        int exponent = 63 - __builtin_clzll( value );
+        if( exponent > HIST_MAX_EXPONENT ) {
+            return HIST_BUCKETS - 1;
+        }
+
+        int shift = exponent - HIST_SUB_BITS;
+        return ( shift + 1 ) * HIST_SUB_BUCKETS + ( int )( value >> shift ) - HIST_SUB_BUCKETS;
+    }
+
+    static uint64_t bucketTop( int bucket );
+
+private:
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+    uint64_t sum;
+    uint64_t lowest, highest;
+};
+
+// tab separated columns of printPercentiles
+extern const char *HISTOGRAM_COLUMNS;
+
+// count, mean, p50, p90, p99, p99.9 and max, each value divided by scale
+void printPercentiles( const LatencyHistogram &hist, double scale = 1 );
+
+#endif // HISTOGRAM_H_INCLUDED
@@ -0,0 +1,100 @@
+#ifndef ISOLATION_H_INCLUDED
+#define ISOLATION_H_INCLUDED
+
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "utils/procbind.h"
+
+using namespace std;
+
+// procs binds the main thread of every process (BindAllProcTo), tasks binds
+// every thread under /proc/*/task, cgroup makes a cgroup v2 cpuset partition
+// of the measurement cpus and auto tries cgroup before tasks.  The partition
+// holds the whole current process, so none of its threads can run on the
+// housekeeping cpus while it is in place.
+enum isolation_mode_t {ISOLATE_NONE = 0, ISOLATE_PROCS, ISOLATE_TASKS, ISOLATE_CGROUP, ISOLATE_AUTO};
+
+const int ISOLATION_MODE_COUNT = 5;
+
+const string CGROUP_PARTITION_NAME = "throttling_tests";
+
+bool parseIsolationMode( const string &name, isolation_mode_t &mode );
+const char *isolationModeName( isolation_mode_t mode );
+
+// cpu time of a task, in clock ticks, and the cpu it last ran on
+struct task_time_t {
+    int pid;
+    uint64_t ticks;
+    int cpu;
+};
+
+// busy and interrupt time of a cpu from /proc/stat, in clock ticks
+struct cpu_time_t {
+    uint64_t busy;
+    uint64_t irq;
+};
+
+// Keeps the rest of the system off the measurement cpus, every online cpu
+// outside the housekeeping mask, until restore().  Also accounts the cpu
+// time foreign tasks and interrupts still spent on those cpus.  restore()
+// is also registered as a restore hook (see cpustate.h), so SIGINT and
+// SIGTERM undo the isolation as well.
+class CpuIsolation {
+public:
+    CpuIsolation();
+    ~CpuIsolation();
+
+    // falls back from cgroup to tasks under auto; mode() tells which held
+    bool isolate( isolation_mode_t mode, const CpuMask &housekeeping, string &err );
+    void restore();
+
+    isolation_mode_t mode() const {
+        return active;
+    }
+    const CpuMask &isolated() const {
+        return measure;
+    }
+
+    // cpus of mask the current process may still run on; the whole partition
+    // when a cgroup leaves none of them
+    void allowedMask( const CpuMask &mask, CpuMask &allowed ) const;
+
+    // snapshots for the foreign time report, outside the measured runs
+    void startAccounting();
+    void printForeignTime();
+
+private:
+    CpuIsolation( const CpuIsolation & );
+    CpuIsolation &operator=( const CpuIsolation & );
+
+    static void restoreHook( void *arg );
+
+    bool apply( isolation_mode_t mode, const CpuMask &housekeeping, string &err );
+    bool isolateCgroup( string &err );
+    bool isolateTasks( string &err );
+    void restoreCgroup();
+
+    isolation_mode_t active;
+    CpuMask housekeeping;
+    CpuMask measure;
+    vector<int> measure_cpus;
+
+    // original affinities of the procs and tasks modes, by pid or tid
+    map<int, CpuMask> saved;
+
+    string cgroup_root;
+    string home_cgroup;
+    bool enabled_cpuset;
+
+    map<int, cpu_time_t> start_cpu;
+    map<int, task_time_t> start_task;
+    bool accounting;
+
+    pthread_mutex_t mute_restore;
+};
+
+#endif // ISOLATION_H_INCLUDED
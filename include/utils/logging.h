@@ -5,12 +5,16 @@
 #include <vector>
 
 #include "timing.h"
+#include "runstats.h"
 
 using namespace std;
 
-void printFrequencyTable( map<int, vector<TIME> > &speed_v_lapses, int samplings );
+// Both tables end with a summary block of every speed.  A caller that
+// streamed its loops into summary as they finished passes it; otherwise it
+// is gathered from the table.
+void printFrequencyTable( map<int, vector<TIME> > &speed_v_lapses, int samplings, const FrequencySummary *summary = NULL );
 
 void printFrequencyTable2( map<int, vector<TIME> > &speed_v_lapses,
-                           map<int, vector<uint64_t> > &loop_counts, int samplings );
+                           map<int, vector<uint64_t> > &loop_counts, int samplings, const FrequencySummary *summary = NULL );
 
 #endif // LOGGING_H_INCLUDED
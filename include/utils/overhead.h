@@ -0,0 +1,55 @@
+#ifndef OVERHEAD_H_INCLUDED
+#define OVERHEAD_H_INCLUDED
+
+#include <map>
+#include <string>
+
+#include "utils/freqtable.h"
+
+using namespace std;
+
+const int OVERHEAD_REPS = 1000000;
+
+// cost in ns of one instrumentation operation at a single cpu speed
+struct overhead_t {
+    int khz;
+    double time_ns;         // GetTime
+    double mutex_ns;        // uncontended pthread_mutex_lock + unlock
+    double rand_ns;         // rand()
+    double move_bits_ns;    // nextMoveBits, the direction pick of the walks
+    double stop_check_ns;   // StopTimer::expired
+
+    overhead_t() : khz( 0 ), time_ns( 0 ), mutex_ns( 0 ), rand_ns( 0 ), move_bits_ns( 0 ), stop_check_ns( 0 ) {}
+};
+
+// Overheads by cpu speed.  Saved to a tab separated file stamped with the
+// host name so that a calibration is only reused on the machine that made it.
+class OverheadTable {
+public:
+    void set( const overhead_t &o ) {
+        by_khz[o.khz] = o;
+    }
+    bool empty() const {
+        return by_khz.empty();
+    }
+
+    // entry of the calibrated speed nearest to khz; NULL when empty
+    const overhead_t *at( int khz ) const;
+    bool covers( const FrequencyTable &freqs ) const;
+
+    bool load( const string &path, string &err );
+    bool save( const string &path, string &err ) const;
+    void print() const;
+
+private:
+    map<int, overhead_t> by_khz;
+};
+
+// times every operation on the calling thread at the current speed
+void measureOverheads( overhead_t &o, int reps = OVERHEAD_REPS );
+
+// Steps cpu_idx through every speed of freqs and measures the overheads on
+// a thread bound to it.  The cpu must accept setCPUThrottledSpeed.
+bool calibrateOverheads( int cpu_idx, const FrequencyTable &freqs, OverheadTable &table, string &err );
+
+#endif // OVERHEAD_H_INCLUDED
@@ -10,16 +10,85 @@
 #include <dirent.h>
 #include <cstring>
 #include <unistd.h>
+#include <string>
 
 using namespace std;
 
-void buildMask( vector<int> &v, cpu_set_t &mask );
+// cpu_set_t sized for every possible cpu of the host (CPU_ALLOC), so masks
+// stay valid past the 1024 cpus of a plain cpu_set_t
+class CpuMask {
+public:
+    CpuMask();
+    CpuMask( const CpuMask &other );
+    CpuMask &operator=( const CpuMask &other );
+    ~CpuMask();
 
-bool BindAllProcTo( map<int, cpu_set_t> &proc_aff, int cpu_count, cpu_set_t &bind_mask );
-void bindCurProcTo( cpu_set_t &mask );
+    void clear();
+    void set( int cpu );
+    bool isSet( int cpu ) const;
+    int count() const;
+
+    int capacity() const {
+        return cpus;
+    }
+    size_t size() const {
+        return bytes;
+    }
+    cpu_set_t *get() {
+        return mask;
+    }
+    const cpu_set_t *get() const {
+        return mask;
+    }
+
+private:
+    int cpus;
+    size_t bytes;
+    cpu_set_t *mask;
+};
+
+int cpuMaskCapacity();
+
+void buildMask( vector<int> &v, CpuMask &mask );
+
+bool BindAllProcTo( map<int, CpuMask> &proc_aff, int cpu_count, CpuMask &bind_mask );
+void bindCurProcTo( CpuMask &mask );
 
 void printCurrentProcBinding();
 
-void resetAffinities( map<int, cpu_set_t> &proc_aff );
+void resetAffinities( map<int, CpuMask> &proc_aff );
+
+// Where a cpu sits in the machine.  Ids are those of the lowest cpu in the
+// same group, so they stay unique across packages; a cpu without topology
+// attributes (e.g. under the memory backend) is a core of its own.
+struct cpu_topology_t {
+    int cpu;
+    int core;           // thread_siblings_list
+    int package;        // physical_package_id
+    int node;           // NUMA node, 0 without one
+    int llc;            // shared_cpu_list of the last level cache
+    int llc_level;
+    int llc_kb;
+    int domain;         // frequency domain index, -1 when unknown
+};
+
+// all keeps every cpu; spread and compact order cpus away from or next to
+// each other; core and domain keep one cpu per physical core or frequency
+// domain
+enum placement_t {PLACE_ALL = 0, PLACE_SPREAD, PLACE_COMPACT, PLACE_CORE, PLACE_DOMAIN};
+
+const int PLACEMENT_COUNT = 5;
+
+bool parsePlacement( const string &name, placement_t &placement );
+const char *placementName( placement_t placement );
+
+// reads the backend's topology and cache attributes of cpus once; call
+// after discoverFrequencyDomains
+bool discoverCpuTopology( const vector<int> &cpus );
+const cpu_topology_t *getCpuTopology( int cpu_idx );
+void printCpuTopology();
+
+// cpus picked and ordered by placement, at most limit of them when above 0
+void placeCpus( const vector<int> &cpus, placement_t placement, int limit, vector<int> &placed );
 
 #endif // PROC_BIND_H_INCLUDED
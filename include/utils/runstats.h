@@ -0,0 +1,78 @@
+#ifndef RUN_STATS_H_INCLUDED
+#define RUN_STATS_H_INCLUDED
+
+#include <map>
+#include <string>
+#include <cstdio>
+#include <stdint.h>
+
+#include "utils/timing.h"
+
+using namespace std;
+
+const double SUMMARY_CONFIDENCE = 0.95;
+
+// Mean and variance updated one sample at a time (Welford), so a summary
+// never needs the samples kept around.
+class RunningStat {
+public:
+    RunningStat() : n( 0 ), m( 0 ), m2( 0 ), lo( 0 ), hi( 0 ) {}
+
+    void add( double x );
+
+    uint64_t count() const {
+        return n;
+    }
+    double mean() const {
+        return m;
+    }
+    double min() const {
+        return lo;
+    }
+    double max() const {
+        return hi;
+    }
+    // sample variance; 0 below two samples
+    double variance() const {
+        return n > 1 ? m2 / ( n - 1 ) : 0;
+    }
+    double stddev() const;
+
+    // half width of the Student t confidence interval of the mean at level
+    double ciHalfWidth( double level ) const;
+
+private:
+    uint64_t n;
+    double m, m2, lo, hi;
+};
+
+// elapsed time and node visit rate of the loops run at one speed
+struct freq_summary_t {
+    RunningStat elapsed_ns;
+    RunningStat nodes_per_sec;
+};
+
+// Per speed summaries of timed loops, filled as each loop finishes.
+class FrequencySummary {
+public:
+    void add( int khz, TIME begin, TIME end );
+    void add( int khz, TIME begin, TIME end, uint64_t nodes );
+
+    bool empty() const {
+        return by_khz.empty();
+    }
+
+    // "#" prefixed block that follows the raw tables
+    void print( double level = SUMMARY_CONFIDENCE ) const;
+
+    // JSON when path ends in .json, else CSV
+    bool save( const string &path, double level, string &err ) const;
+
+private:
+    void saveJSON( FILE *file, double level ) const;
+    void saveCSV( FILE *file, double level ) const;
+
+    map<int, freq_summary_t> by_khz;
+};
+
+#endif // RUN_STATS_H_INCLUDED
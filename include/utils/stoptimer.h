@@ -0,0 +1,117 @@
+#ifndef STOP_TIMER_H_INCLUDED
+#define STOP_TIMER_H_INCLUDED
+
+#include <string>
+#include <pthread.h>
+#include <stdint.h>
+
+#include "utils/timing.h"
+#include "utils/histogram.h"
+
+using namespace std;
+
+// moves a worker makes between two looks at its stop flag
+const uint64_t LOOP_BATCH_MOVES = 1024;
+
+// Ends an untimed work loop at a deadline.  A timerfd armed at the absolute
+// CLOCK_MONOTONIC deadline wakes a helper thread which raises the flag; the
+// worker reads no clock and only checks the flag between batches.
+class StopTimer {
+public:
+    StopTimer();
+    ~StopTimer();
+
+    bool open( string &err );
+    void close();
+
+    // lowers the flag and raises it again at deadline
+    bool arm( TIME deadline, string &err );
+
+    inline bool expired() const {
+        return __atomic_load_n( &flag, __ATOMIC_ACQUIRE );
+    }
+
+    // deadline of the last arm and when the helper raised the flag for it
+    TIME deadline() const {
+        return armed_at;
+    }
+    TIME firedAt() const {
+        return __atomic_load_n( &fired_at, __ATOMIC_ACQUIRE );
+    }
+
+private:
+    StopTimer( const StopTimer & );
+    StopTimer &operator=( const StopTimer & );
+
+    static void *timerThread( void *args );
+
+    int fd;
+    bool running;
+    bool shutdown;
+    pthread_t thread;
+
+    int flag;
+    TIME armed_at;
+    TIME fired_at;
+};
+
+// xorshift64 step; picks walk directions without reading a clock
+static inline uint64_t nextMoveBits( uint64_t &state ) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+// Walks a circular graph in batches of LOOP_BATCH_MOVES until the timer
+// fires and returns the moves made.  The count is only whole batches, so a
+// stop is seen at most one batch after the helper raises the flag.
+template<class Node>
+uint64_t walkBatches( Node *&cur, StopTimer &stop, uint64_t &move_bits ) {
+    uint64_t cnt = 0;
+
+    do {
+        for( uint64_t i = 0; i < LOOP_BATCH_MOVES; ++i ) {
+            if( nextMoveBits( move_bits ) & 1 ) {
+                cur = cur->next;
+            } else {
+                cur = cur->prev->prev;
+            }
+        }
+        // keeps the walk from being discarded when the caller ignores cur
+        __asm__ __volatile__( "" : "+r"( cur ) );
+        cnt += LOOP_BATCH_MOVES;
+    } while( !stop.expired() );
+
+    return cnt;
+}
+
+// As walkBatches, also recording the length of every batch in batch_ns.
+// One clock read per batch keeps the timing cost at a fraction of a ns per
+// move.
+template<class Node>
+uint64_t walkTimedBatches( Node *&cur, StopTimer &stop, uint64_t &move_bits, LatencyHistogram &batch_ns ) {
+    uint64_t cnt = 0;
+    TIME begin, end;
+
+    GetTime( begin );
+    do {
+        for( uint64_t i = 0; i < LOOP_BATCH_MOVES; ++i ) {
+            if( nextMoveBits( move_bits ) & 1 ) {
+                cur = cur->next;
+            } else {
+                cur = cur->prev->prev;
+            }
+        }
+        __asm__ __volatile__( "" : "+r"( cur ) );
+        cnt += LOOP_BATCH_MOVES;
+
+        GetTime( end );
+        batch_ns.record( end - begin );
+        begin = end;
+    } while( !stop.expired() );
+
+    return cnt;
+}
+
+#endif // STOP_TIMER_H_INCLUDED
@@ -3,42 +3,127 @@
 
 #include <sys/time.h>
 #include <stdint.h>
+#include <time.h>
 #include <cstdio>
+#include <string>
 
-#ifndef NANO_TIME
-#define NANO_TIME 0
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#else
+#define HAVE_TSC 0
 #endif
 
-#if NANO_TIME
+const uint64_t NS_PER_SEC = 1000000000ULL;
+
+// Timestamps are nanoseconds of CLOCK_MONOTONIC in a single 64-bit word, so
+// recorded points take 8 bytes and spans are plain subtraction.
+typedef uint64_t TIME;
 
-#define FRAC_SEC_TIME 1000000000
-#define FRAC tv_nsec
-#define TIME_PRINT "%lu.%09lu"
 #define TIME_ABRV "ns"
 
-#define GetTime(x) clock_gettime(CLOCK_MONOTONIC, &x)
-typedef timespec TIME;
+static inline TIME nowTIME() {
+    timespec t;
+    clock_gettime( CLOCK_MONOTONIC, &t );
+    return ( uint64_t ) t.tv_sec * NS_PER_SEC + t.tv_nsec;
+}
 
-#else
+#define GetTime(x) (( x ) = nowTIME() )
 
-#define FRAC_SEC_TIME 1000000
-#define FRAC tv_usec
-#define TIME_PRINT "%lu.%06lu"
-#define TIME_ABRV "us"
+// whole seconds as a TIME span
+static inline TIME secondsTIME( uint64_t sec ) {
+    return sec * NS_PER_SEC;
+}
 
-#define GetTime(x) gettimeofday(&x, NULL)
-typedef timeval TIME;
+static inline int diff_TIME( TIME &res, TIME &x, TIME &y ) {
+    res = x - y;
+    return x < y;
+}
 
-#endif
+static inline int sum_TIME( TIME &res, TIME &x, TIME &y ) {
+    res = x + y;
+    return 0;
+}
+
+static inline int avg_TIME( TIME &avg, TIME &tot, int samples ) {
+    avg = tot / samples;
+    return 0;
+}
+
+// elapsed time from begin to end in TIME_ABRV units
+static inline uint64_t span_TIME( TIME begin, TIME end ) {
+    return end > begin ? end - begin : 0;
+}
+
+// seconds.nanoseconds
+int PrintTime( TIME t );
+timespec convertTimeToTimespec( TIME t );
 
-//#define PrintTime(x) printf(TIME_PRINT, x.tv_sec, x.FRAC)
+// Clock sources for fine grained timing, passed as template parameters.
+// now() returns raw ticks that are only compared with one another or
+// converted with toNS()/fromNS(); calibrate() must succeed before ticks are
+// converted.
 
-int diff_TIME( TIME &res, TIME &x, TIME &y );
-int sum_TIME( TIME &res, TIME &x, TIME &y );
-int avg_TIME( TIME &avg, TIME &tot, int samples );
+// CLOCK_MONOTONIC_RAW through the vDSO; ticks are ns, unaffected by NTP slewing
+struct MonotonicRawClock {
+    static const char *name() {
+        return "monotonic-raw";
+    }
+    static bool calibrate( std::string &err ) {
+        return true;
+    }
+    static inline uint64_t now() {
+        timespec t;
+        clock_gettime( CLOCK_MONOTONIC_RAW, &t );
+        return ( uint64_t ) t.tv_sec * NS_PER_SEC + t.tv_nsec;
+    }
+    static inline uint64_t toNS( uint64_t ticks ) {
+        return ticks;
+    }
+    static inline uint64_t fromNS( uint64_t ns ) {
+        return ns;
+    }
+};
+
+// Time stamp counter read with rdtsc, a few ns per read and independent of
+// the core clock when the TSC is invariant.  The rate is measured against
+// CLOCK_MONOTONIC_RAW once per process.
+struct TscClock {
+    static const char *name() {
+        return "tsc";
+    }
+    // fails when the TSC is not invariant; the rate is still measured
+    static bool calibrate( std::string &err );
+    static bool invariant();
+
+    static inline uint64_t now() {
+#if HAVE_TSC
+        return __rdtsc();
+#else
+        return MonotonicRawClock::now();
+#endif
+    }
+    // waits for earlier instructions to finish before reading
+    static inline uint64_t nowOrdered() {
+#if HAVE_TSC
+        unsigned int aux;
+        return __rdtscp( &aux );
+#else
+        return MonotonicRawClock::now();
+#endif
+    }
+    static inline uint64_t toNS( uint64_t ticks ) {
+        return ( uint64_t )(( unsigned __int128 ) ticks * NS_PER_SEC / ticks_per_sec );
+    }
+    static inline uint64_t fromNS( uint64_t ns ) {
+        return ( uint64_t )(( unsigned __int128 ) ns * ticks_per_sec / NS_PER_SEC );
+    }
+    static uint64_t ticksPerSec() {
+        return ticks_per_sec;
+    }
 
-void AdjustTime(TIME &t);
-int PrintTime(TIME &t);
-timespec convertTimeToTimespec( TIME &t);
+private:
+    static uint64_t ticks_per_sec;
+};
 
 #endif // TIMING_H_INCLUDED
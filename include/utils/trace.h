@@ -0,0 +1,98 @@
+#ifndef TRACE_H_INCLUDED
+#define TRACE_H_INCLUDED
+
+#include <string>
+#include <stdint.h>
+
+#include "utils/timing.h"
+
+using namespace std;
+
+const char TRACE_MAGIC[8] = "THRTRC2";
+const uint64_t TRACE_DEFAULT_RECORDS = 1 << 20;
+
+// Record types.  0 marks a slot that was reserved but never written.
+enum trace_type_t {
+    TRACE_EMPTY = 0,
+    TRACE_SAMPLE_BEGIN,
+    TRACE_THROTTLE_BEGIN,
+    TRACE_THROTTLE_END,
+    TRACE_LOOP_BEGIN,
+    TRACE_LOOP_END,
+    TRACE_SAMPLE_END
+};
+
+// one fixed size event of a worker thread
+struct trace_record_t {
+    uint64_t time;      // TIME of the event
+    uint64_t count;     // nodes visited; loop ends only
+    uint32_t khz;       // requested speed of a throttle, speed of a loop
+    uint32_t stop_lag;  // ns from the loop deadline to its end, saturated
+    uint16_t cpu;
+    uint16_t thread;
+    uint16_t sample;
+    uint8_t type;
+    uint8_t pad;
+    uint32_t event;     // index of the throttling event or loop within the sample
+};
+
+// Layout of the run, written once by the test, followed by the records.
+// reserved counts the slots handed out and may pass capacity; the records
+// past capacity were dropped.
+struct trace_header_t {
+    char magic[8];
+    uint32_t record_size;
+    uint32_t throttled;     // 1 when every event records its throttle
+    uint32_t samplings;
+    uint32_t threads;
+    uint32_t events;
+    uint32_t unused;
+    uint64_t capacity;
+    uint64_t reserved;
+};
+
+// Trace of worker events in a memory mapped file.  Any thread may append;
+// a slot is claimed with one atomic add and written in place, so appending
+// neither locks nor allocates and the page cache writes the data back.
+class TraceFile {
+public:
+    TraceFile();
+    ~TraceFile();
+
+    bool create( const string &path, uint64_t capacity, string &err );
+    bool open( const string &path, string &err );
+    void close();
+
+    void setLayout( bool throttled, int samplings, int threads, int events );
+
+    // false when the trace is full and the record was dropped
+    bool append( const trace_record_t &rec );
+    bool append( int type, int sample, int thread, int cpu, int event, TIME t, uint64_t count = 0, int khz = 0, uint64_t stop_lag = 0 );
+
+    const trace_header_t &header() const {
+        return *head;
+    }
+    uint64_t size() const;
+    uint64_t dropped() const;
+    const trace_record_t &at( uint64_t idx ) const {
+        return records[idx];
+    }
+
+private:
+    TraceFile( const TraceFile & );
+    TraceFile &operator=( const TraceFile & );
+
+    int fd;
+    bool writable;
+    size_t map_bytes;
+    void *map;
+    trace_header_t *head;
+    trace_record_t *records;
+    string file_path;
+};
+
+// Rebuilds the node visit table of the run in the format ThrotCtrl prints
+// from memory, without the cpufreq statistics columns.
+bool printTraceTable( TraceFile &trace, string &err );
+
+#endif // TRACE_H_INCLUDED
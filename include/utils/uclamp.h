@@ -0,0 +1,67 @@
+#ifndef UCLAMP_H_INCLUDED
+#define UCLAMP_H_INCLUDED
+
+#include <string>
+#include <stdint.h>
+#include <sys/types.h>
+
+using namespace std;
+
+// utilization of a fully busy cpu of the highest capacity
+const int UCLAMP_SCALE = 1024;
+
+// sched_setattr(2) flags
+const uint64_t SCHED_FLAG_KEEP_POLICY_BIT = 0x08;
+const uint64_t SCHED_FLAG_KEEP_PARAMS_BIT = 0x10;
+const uint64_t SCHED_FLAG_UTIL_CLAMP_MIN_BIT = 0x20;
+const uint64_t SCHED_FLAG_UTIL_CLAMP_MAX_BIT = 0x40;
+
+// struct sched_attr of the kernel, up to the utilization clamps (VER1)
+struct sched_attr_t {
+    uint32_t size;
+    uint32_t sched_policy;
+    uint64_t sched_flags;
+    int32_t sched_nice;
+    uint32_t sched_priority;
+    uint64_t sched_runtime;
+    uint64_t sched_deadline;
+    uint64_t sched_period;
+    uint32_t sched_util_min;
+    uint32_t sched_util_max;
+};
+
+// kernel id of the calling thread
+pid_t currentTid();
+
+bool setThreadUtilClamp( pid_t tid, int util_min, int util_max, string &err );
+bool getThreadUtilClamp( pid_t tid, int &util_min, int &util_max, string &err );
+
+// Retunes single threads instead of cores by clamping their utilization with
+// sched_setattr.  Under schedutil a cpu runs at 1.25 * max_khz * util / 1024
+// of its busiest thread, so a speed is requested by pinning util_min and
+// util_max of the thread to the utilization that maps to it.  Needs no core
+// of its own, but only takes effect while the thread runs under schedutil;
+// initSchedutil switches the governor, which needs root.
+class UclampActuator {
+public:
+    UclampActuator();
+
+    // max_khz is the speed schedutil requests at full utilization; fails when
+    // the kernel was built without CONFIG_UCLAMP_TASK
+    bool open( int _max_khz, string &err );
+
+    bool isOpen() const {
+        return max_khz > 0;
+    }
+
+    int utilFor( int khz ) const;
+    bool setSpeed( pid_t tid, const string &speed, string &err );
+    bool setSpeed( pid_t tid, int khz, string &err );
+    // lift both clamps again
+    bool release( pid_t tid, string &err );
+
+private:
+    int max_khz;
+};
+
+#endif // UCLAMP_H_INCLUDED
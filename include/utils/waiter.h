@@ -0,0 +1,72 @@
+#ifndef WAITER_H_INCLUDED
+#define WAITER_H_INCLUDED
+
+#include <string>
+#include <stdint.h>
+
+#include "utils/timing.h"
+
+using namespace std;
+
+// how a thread passes the time until an absolute deadline
+enum wait_mode_t {WAIT_SPIN = 0, WAIT_NANOSLEEP, WAIT_TIMERFD, WAIT_FUTEX};
+
+const int WAIT_MODE_COUNT = 4;
+
+bool parseWaitMode( const string &name, wait_mode_t &mode );
+const char *waitModeName( wait_mode_t mode );
+
+// wake up lateness of a series of waits
+struct wait_stat_t {
+    uint64_t waits;
+    uint64_t total_ns;
+    uint64_t max_ns;
+
+    wait_stat_t() : waits( 0 ), total_ns( 0 ), max_ns( 0 ) {}
+
+    void add( TIME deadline, TIME woke );
+    void merge( const wait_stat_t &other );
+};
+
+// Blocks the calling thread until an absolute CLOCK_MONOTONIC deadline.
+// The sleeping modes hand the core back to the scheduler; with spin_ns set
+// they wake that much early and spin the rest of the way, trading a little
+// busy time for wake up precision.
+class DeadlineWaiter {
+public:
+    DeadlineWaiter( wait_mode_t _mode = WAIT_NANOSLEEP, uint64_t _spin_ns = 0 );
+    ~DeadlineWaiter();
+
+    bool open( string &err );
+    void close();
+
+    // returns the time the thread woke
+    TIME waitUntil( TIME deadline );
+
+    wait_mode_t getMode() const {
+        return mode;
+    }
+    uint64_t spinNS() const {
+        return spin_ns;
+    }
+    wait_stat_t &stat() {
+        return wake_stat;
+    }
+
+private:
+    DeadlineWaiter( const DeadlineWaiter & );
+    DeadlineWaiter &operator=( const DeadlineWaiter & );
+
+    void sleepUntil( TIME deadline );
+
+    wait_mode_t mode;
+    uint64_t spin_ns;
+    int timer_fd;
+    int futex_word;
+    wait_stat_t wake_stat;
+};
+
+// # <label> waits (<mode>, spin <ns>): count, mean and max lateness
+void printWaitStat( const char *label, wait_mode_t mode, uint64_t spin_ns, wait_stat_t &stat );
+
+#endif // WAITER_H_INCLUDED
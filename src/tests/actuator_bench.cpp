@@ -0,0 +1,226 @@
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+#include <cstdio>
+#include <map>
+#include <unistd.h>
+
+#include <boost/program_options.hpp>
+
+#include "utils/timing.h"
+#include "utils/cpufunc.h"
+#include "utils/cpustate.h"
+#include "utils/actuator.h"
+
+using namespace std;
+namespace po = boost::program_options;
+
+const string HELP_KEY = "help";
+const string SAMPLING_KEY = "samplings";
+const string SKIP_ONDEMAND_KEY = "skip-ondemand";
+const string BACKEND_KEY = "backend";
+const string BATCH_WRITERS_KEY = "batch-writers";
+
+struct lat_stat_t {
+    uint64_t total, min, max;
+    int samples, failures;
+
+    lat_stat_t() : total( 0 ), min( ( uint64_t ) - 1 ), max( 0 ), samples( 0 ), failures( 0 ) {}
+
+    void add( TIME &t1, TIME &t2 ) {
+        uint64_t lat = span_TIME( t1, t2 );
+
+        total += lat;
+        if( lat < min ) min = lat;
+        if( lat > max ) max = lat;
+        samples++;
+    }
+};
+
+bool parseArguments( int argc, char **argv, po::variables_map &vm ) {
+    po::options_description general( "General Options" );
+    general.add_options()
+    (( HELP_KEY + ",h" ).c_str(), "Help options" )
+    (( SAMPLING_KEY + ",s" ).c_str(), po::value<int>()->default_value( 1000 ), "Frequency changes timed per CPU and write path" )
+    (( BATCH_WRITERS_KEY + ",w" ).c_str(), po::value< vector<int> >()->default_value( vector<int>( 1, 4 ), "4" )->multitoken(), "Writer thread counts compared for batched changes" )
+    ( SKIP_ONDEMAND_KEY.c_str(), "After execution, leave CPUs in USERSPACE mode" )
+    ( BACKEND_KEY.c_str(), po::value<string>()->default_value( "" ), "cpufreq backend: sysfs, fake:<dir>[:<cpus>[:<driver>]] or memory[:<cpus>[:<driver>]] (default $CPUFREQ_BACKEND, then sysfs)" )
+    ;
+
+    po::store( po::parse_command_line( argc, argv, general ), vm );
+    po::notify( vm );
+
+    if( vm.count( HELP_KEY.c_str() ) ) {
+        cout << general << "\n";
+        return false;
+    }
+
+    return true;
+}
+
+void printLatencyRow( int cpu_id, const char *path, lat_stat_t &stat ) {
+    printf( "%d\t%s\t%d\t%d\t", cpu_id, path, stat.samples, stat.failures );
+    if( stat.samples > 0 ) {
+        printf( "%.3f\t%lu\t%lu\n", ( double ) stat.total / stat.samples, stat.min, stat.max );
+    } else {
+        printf( "-\t-\t-\n" );
+    }
+}
+
+// Alternate each cpu between its lowest and highest speed and time every
+// change through the one-shot path (setCPUThrottledSpeed opens, writes and
+// closes the files) and through the persistent handles of the FreqActuator.
+void ActuatorLatencyTest( map<int, string> &userspace_cpu, map<int, string> &cpu_avail_freq, int samplings ) {
+    FreqActuator actuator;
+    string err;
+    TIME t1, t2;
+
+    const string &low = cpu_avail_freq.begin()->second;
+    const string &high = cpu_avail_freq.rbegin()->second;
+
+    if( !actuator.open( userspace_cpu, err ) ) {
+        printf( "Unable to open CPU control files: %s\n", err.c_str() );
+        return;
+    }
+
+    printf( "#CPU\tPath\tSamples\tFailures\tMean (%s)\tMin (%s)\tMax (%s)\n", TIME_ABRV, TIME_ABRV, TIME_ABRV );
+
+    for( map<int, string>::iterator cpu_it = userspace_cpu.begin(); cpu_it != userspace_cpu.end(); cpu_it++ ) {
+        lat_stat_t one_shot_stat, actuator_stat;
+
+        for( int i = 0; i < samplings; i++ ) {
+            const string &speed = ( i & 1 ) ? high : low;
+
+            GetTime( t1 );
+            bool ok = setCPUThrottledSpeed( cpu_it->first, speed, err );
+            GetTime( t2 );
+
+            if( ok ) {
+                one_shot_stat.add( t1, t2 );
+            } else {
+                one_shot_stat.failures++;
+            }
+        }
+
+        for( int i = 0; i < samplings; i++ ) {
+            const string &speed = ( i & 1 ) ? high : low;
+
+            GetTime( t1 );
+            bool ok = actuator.setSpeed( cpu_it->first, speed, err );
+            GetTime( t2 );
+
+            if( ok ) {
+                actuator_stat.add( t1, t2 );
+            } else {
+                actuator_stat.failures++;
+            }
+        }
+
+        printLatencyRow( cpu_it->first, "one-shot", one_shot_stat );
+        printLatencyRow( cpu_it->first, "actuator", actuator_stat );
+    }
+
+    actuator.close();
+}
+
+// Retune every cpu at once as a single batch and report the time until the
+// last core was written (latency) and the spread between the first and last
+// core (skew) for each writer thread count.
+void BatchLatencyTest( map<int, string> &userspace_cpu, map<int, string> &cpu_avail_freq, vector<int> writer_counts, int samplings ) {
+    FreqActuator actuator;
+    vector<freq_decision_t> decisions;
+    batch_stat_t stat;
+    string err;
+
+    if( !actuator.open( userspace_cpu, err ) ) {
+        printf( "Unable to open CPU control files: %s\n", err.c_str() );
+        return;
+    }
+
+    writer_counts.insert( writer_counts.begin(), 1 );
+
+    printf( "#Writers\tCPUs\tWrites\tBatches\tFailures\tMean Latency (%s)\tMax Latency (%s)\tMean Skew (%s)\tMax Skew (%s)\n", TIME_ABRV, TIME_ABRV, TIME_ABRV, TIME_ABRV );
+
+    for( vector<int>::iterator w_it = writer_counts.begin(); w_it != writer_counts.end(); w_it++ ) {
+        BatchActuator batch_actuator( actuator, *w_it );
+        if( !batch_actuator.start( err ) ) {
+            printf( "Unable to start batch writers: %s\n", err.c_str() );
+            continue;
+        }
+
+        uint64_t lat, skew, lat_total = 0, lat_max = 0, skew_total = 0, skew_max = 0;
+        int failures = 0, writes = 0;
+
+        for( int i = 0; i < samplings; i++ ) {
+            const string &speed = ( i & 1 ) ? cpu_avail_freq.rbegin()->second : cpu_avail_freq.begin()->second;
+
+            decisions.clear();
+            for( map<int, string>::iterator cpu_it = userspace_cpu.begin(); cpu_it != userspace_cpu.end(); cpu_it++ ) {
+                decisions.push_back( freq_decision_t( cpu_it->first, speed ) );
+            }
+
+            batch_actuator.apply( decisions, stat );
+
+            lat = span_TIME( stat.submitted, stat.last_done );
+            skew = span_TIME( stat.first_done, stat.last_done );
+            lat_total += lat;
+            skew_total += skew;
+            if( lat > lat_max ) lat_max = lat;
+            if( skew > skew_max ) skew_max = skew;
+            failures += stat.failed;
+            writes = stat.writes;
+        }
+
+        batch_actuator.stop();
+
+        printf( "%d\t%d\t%d\t%d\t%d\t%.3f\t%lu\t%.3f\t%lu\n", *w_it, ( int ) userspace_cpu.size(), writes, samplings, failures,
+                ( double ) lat_total / samplings, lat_max, ( double ) skew_total / samplings, skew_max );
+    }
+
+    actuator.close();
+}
+
+int main( int argc, char **argv ) {
+    po::variables_map vm;
+    if( !parseArguments( argc, argv, vm ) ) {
+        return 1;
+    }
+
+    string backend_err;
+    if( !initCpuBackend( vm[BACKEND_KEY.c_str()].as<string>(), backend_err ) ) {
+        cout << backend_err << endl;
+        return -1;
+    }
+
+    map<int, string> userspace_cpu;
+    map<int, string> cpu_avail_freq;
+
+    int cpu_bound = determineCPUIdBound();
+
+    vector<int> online_cpus;
+    determineOnlineCPUs( online_cpus );
+
+    CpuStateSnapshot cpu_state;
+    string state_err;
+    if( !cpu_state.capture( online_cpus, state_err ) || !installRestoreHandler( cpu_state, state_err ) ) {
+        printf( "Unable to save cpufreq state: %s\n", state_err.c_str() );
+    }
+
+    initUserspace( online_cpus, userspace_cpu );
+    fillAvailableThrottlingSpeeds( cpu_avail_freq, 1 );
+
+    discoverFrequencyDomains( cpu_bound );
+    printFrequencyDomains();
+
+    if( userspace_cpu.empty() || cpu_avail_freq.empty() ) {
+        printf( "No CPUs available in userspace mode\n" );
+    } else {
+        ActuatorLatencyTest( userspace_cpu, cpu_avail_freq, vm[SAMPLING_KEY.c_str()].as<int>() );
+        BatchLatencyTest( userspace_cpu, cpu_avail_freq, vm[BATCH_WRITERS_KEY.c_str()].as< vector<int> >(), vm[SAMPLING_KEY.c_str()].as<int>() );
+    }
+
+    if( vm.count( SKIP_ONDEMAND_KEY.c_str() ) == 0 )
+        cpu_state.restore();
+
+    return 0;
+}
@@ -0,0 +1,260 @@
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+#include <cstdio>
+#include <map>
+#include <errno.h>
+#include <unistd.h>
+
+#include <boost/program_options.hpp>
+
+#include "utils/cpufunc.h"
+#include "utils/cpustate.h"
+#include "utils/actuator.h"
+
+using namespace std;
+namespace po = boost::program_options;
+
+const string HELP_KEY = "help";
+const string RETUNES_KEY = "retunes";
+const string BATCH_WRITERS_KEY = "batch-writers";
+const string BACKEND_KEY = "backend";
+
+// Every heap allocation of the process goes through these wrappers, including
+// those made by libstdc++ on behalf of operator new.
+extern "C" {
+    void *__libc_malloc( size_t size );
+    void *__libc_calloc( size_t count, size_t size );
+    void *__libc_realloc( void *ptr, size_t size );
+    void *__libc_memalign( size_t alignment, size_t size );
+}
+
+static bool counting = false;
+static uint64_t alloc_count = 0;
+static uint64_t alloc_bytes = 0;
+
+static inline void countAlloc( size_t size ) {
+    if( __atomic_load_n( &counting, __ATOMIC_RELAXED ) ) {
+        __atomic_add_fetch( &alloc_count, 1, __ATOMIC_RELAXED );
+        __atomic_add_fetch( &alloc_bytes, size, __ATOMIC_RELAXED );
+    }
+}
+
+extern "C" void *malloc( size_t size ) {
+    countAlloc( size );
+    return __libc_malloc( size );
+}
+
+extern "C" void *calloc( size_t count, size_t size ) {
+    countAlloc( count * size );
+    return __libc_calloc( count, size );
+}
+
+extern "C" void *realloc( void *ptr, size_t size ) {
+    countAlloc( size );
+    return __libc_realloc( ptr, size );
+}
+
+extern "C" void *memalign( size_t alignment, size_t size ) {
+    countAlloc( size );
+    return __libc_memalign( alignment, size );
+}
+
+extern "C" int posix_memalign( void **ptr, size_t alignment, size_t size ) {
+    countAlloc( size );
+    return ( *ptr = __libc_memalign( alignment, size ) ) == NULL ? ENOMEM : 0;
+}
+
+extern "C" void *aligned_alloc( size_t alignment, size_t size ) {
+    countAlloc( size );
+    return __libc_memalign( alignment, size );
+}
+
+struct alloc_stat_t {
+    uint64_t retunes;
+    uint64_t failures;
+    uint64_t allocs;
+    uint64_t bytes;
+
+    alloc_stat_t() : retunes( 0 ), failures( 0 ), allocs( 0 ), bytes( 0 ) {}
+};
+
+void startCounting() {
+    __atomic_store_n( &alloc_count, 0, __ATOMIC_RELAXED );
+    __atomic_store_n( &alloc_bytes, 0, __ATOMIC_RELAXED );
+    __atomic_store_n( &counting, true, __ATOMIC_SEQ_CST );
+}
+
+void stopCounting( alloc_stat_t &stat ) {
+    __atomic_store_n( &counting, false, __ATOMIC_SEQ_CST );
+    stat.allocs = __atomic_load_n( &alloc_count, __ATOMIC_RELAXED );
+    stat.bytes = __atomic_load_n( &alloc_bytes, __ATOMIC_RELAXED );
+}
+
+bool parseArguments( int argc, char **argv, po::variables_map &vm ) {
+    po::options_description general( "General Options" );
+    general.add_options()
+    (( HELP_KEY + ",h" ).c_str(), "Help options" )
+    (( RETUNES_KEY + ",n" ).c_str(), po::value<int>()->default_value( 1000000 ), "Frequency changes issued through every control path" )
+    (( BATCH_WRITERS_KEY + ",w" ).c_str(), po::value<int>()->default_value( 2 ), "Writer threads of the batched path" )
+    ( BACKEND_KEY.c_str(), po::value<string>()->default_value( "memory" ), "cpufreq backend: sysfs, fake:<dir>[:<cpus>[:<driver>]] or memory[:<cpus>[:<driver>]]" )
+    ;
+
+    po::store( po::parse_command_line( argc, argv, general ), vm );
+    po::notify( vm );
+
+    if( vm.count( HELP_KEY.c_str() ) ) {
+        cout << general << "\n";
+        return false;
+    }
+
+    return true;
+}
+
+// speed used by the i-th retune; consecutive retunes of a cpu always differ so
+// the speed shadow never elides a write
+const string &retuneSpeed( FrequencyTable &freqs, uint64_t i, int cpus ) {
+    return freqs.speed(( i / cpus ) % freqs.size() );
+}
+
+void SingleRetuneCheck( vector<int> &cpus, FrequencyTable &freqs, int retunes, alloc_stat_t &one_shot, alloc_stat_t &actuated ) {
+    FreqActuator actuator;
+    string err;
+    int cpu_count = cpus.size();
+
+    for( vector<int>::iterator it = cpus.begin(); it != cpus.end(); it++ ) {
+        actuator.open( *it, err );
+    }
+
+    // warm up: the first write of a cpu may size lazily grown state
+    for( int i = 0; i < freqs.size() * cpu_count; i++ ) {
+        setCPUThrottledSpeed( cpus[i % cpu_count], retuneSpeed( freqs, i, cpu_count ), err );
+        actuator.setSpeed( cpus[i % cpu_count], retuneSpeed( freqs, i, cpu_count ), err );
+    }
+
+    startCounting();
+    for( int i = 0; i < retunes; i++ ) {
+        if( !setCPUThrottledSpeed( cpus[i % cpu_count], retuneSpeed( freqs, i, cpu_count ), err ) ) {
+            one_shot.failures++;
+        }
+    }
+    stopCounting( one_shot );
+    one_shot.retunes = retunes;
+
+    startCounting();
+    for( int i = 0; i < retunes; i++ ) {
+        if( !actuator.setSpeed( cpus[i % cpu_count], retuneSpeed( freqs, i, cpu_count ), err ) ) {
+            actuated.failures++;
+        }
+    }
+    stopCounting( actuated );
+    actuated.retunes = retunes;
+
+    actuator.close();
+}
+
+void BatchRetuneCheck( vector<int> &cpus, FrequencyTable &freqs, int retunes, int writer_count, alloc_stat_t &batched ) {
+    FreqActuator actuator;
+    vector<freq_decision_t> decisions;
+    batch_stat_t stat;
+    string err;
+    int cpu_count = cpus.size();
+
+    for( vector<int>::iterator it = cpus.begin(); it != cpus.end(); it++ ) {
+        actuator.open( *it, err );
+        decisions.push_back( freq_decision_t( *it, freqs.speed( 0 ) ) );
+    }
+
+    BatchActuator batch_actuator( actuator, writer_count );
+    if( !batch_actuator.start( err ) ) {
+        printf( "Unable to start batch writers: %s\n", err.c_str() );
+        return;
+    }
+
+    int batches = retunes / cpu_count;
+
+    for( int b = 0; b < freqs.size(); b++ ) {
+        for( int j = 0; j < cpu_count; j++ ) {
+            decisions[j].speed = freqs.speed( b );
+        }
+        batch_actuator.apply( decisions, stat );
+    }
+
+    startCounting();
+    for( int b = 0; b < batches; b++ ) {
+        for( int j = 0; j < cpu_count; j++ ) {
+            decisions[j].speed = freqs.speed( b % freqs.size() );
+        }
+        batch_actuator.apply( decisions, stat );
+        batched.failures += stat.failed;
+    }
+    stopCounting( batched );
+    batched.retunes = ( uint64_t ) batches * cpu_count;
+
+    batch_actuator.stop();
+    actuator.close();
+}
+
+void printAllocRow( const char *path, alloc_stat_t &stat ) {
+    printf( "%s\t%lu\t%lu\t%lu\t%lu\t%s\n", path, stat.retunes, stat.failures, stat.allocs, stat.bytes, stat.allocs == 0 ? "PASS" : "FAIL" );
+}
+
+int main( int argc, char **argv ) {
+    po::variables_map vm;
+    if( !parseArguments( argc, argv, vm ) ) {
+        return 1;
+    }
+
+    string backend_err;
+    if( !initCpuBackend( vm[BACKEND_KEY.c_str()].as<string>(), backend_err ) ) {
+        cout << backend_err << endl;
+        return -1;
+    }
+
+    map<int, string> userspace_cpu;
+    FrequencyTable cpu_avail_freq;
+    vector<int> online_cpus, cpus;
+
+    int cpu_bound = determineCPUIdBound();
+
+    determineOnlineCPUs( online_cpus );
+
+    CpuStateSnapshot cpu_state;
+    string state_err;
+    if( !cpu_state.capture( online_cpus, state_err ) || !installRestoreHandler( cpu_state, state_err ) ) {
+        printf( "Unable to save cpufreq state: %s\n", state_err.c_str() );
+    }
+
+    initUserspace( online_cpus, userspace_cpu );
+    fillAvailableThrottlingSpeeds( cpu_avail_freq, 1 );
+
+    discoverFrequencyDomains( cpu_bound );
+    initSpeedShadow( cpu_bound );
+
+    for( map<int, string>::iterator it = userspace_cpu.begin(); it != userspace_cpu.end(); it++ ) {
+        cpus.push_back( it->first );
+    }
+
+    if( cpus.empty() || cpu_avail_freq.size() < 2 ) {
+        printf( "No CPUs available in userspace mode\n" );
+        cpu_state.restore();
+        return 1;
+    }
+
+    alloc_stat_t one_shot, actuated, batched;
+    int retunes = vm[RETUNES_KEY.c_str()].as<int>();
+
+    printf( "# %s backend, %d CPUs, %d speeds\n", cpuBackend().name(), ( int ) cpus.size(), cpu_avail_freq.size() );
+
+    SingleRetuneCheck( cpus, cpu_avail_freq, retunes, one_shot, actuated );
+    BatchRetuneCheck( cpus, cpu_avail_freq, retunes, vm[BATCH_WRITERS_KEY.c_str()].as<int>(), batched );
+
+    printf( "#Path\tRetunes\tFailures\tAllocations\tBytes\tResult\n" );
+    printAllocRow( "one-shot", one_shot );
+    printAllocRow( "actuator", actuated );
+    printAllocRow( "batch", batched );
+
+    cpu_state.restore();
+
+    return ( one_shot.allocs || actuated.allocs || batched.allocs ) ? 1 : 0;
+}
@@ -0,0 +1,150 @@
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+#include <cstdio>
+#include <time.h>
+#include <unistd.h>
+
+#include <boost/program_options.hpp>
+
+#include "utils/timing.h"
+
+using namespace std;
+namespace po = boost::program_options;
+
+const string HELP_KEY = "help";
+const string READS_KEY = "reads";
+const string DURATION_KEY = "duration";
+const string INTERVAL_KEY = "interval";
+
+// the TIME source; reference clock the sources are compared against
+struct MonotonicClock {
+    static const char *name() {
+        return "monotonic";
+    }
+    static inline uint64_t now() {
+        return nowTIME();
+    }
+};
+
+// wall clock with microsecond resolution
+struct TimeOfDayClock {
+    static const char *name() {
+        return "gettimeofday";
+    }
+    static inline uint64_t now() {
+        timeval t;
+        gettimeofday( &t, NULL );
+        return ( uint64_t ) t.tv_sec * NS_PER_SEC + t.tv_usec * 1000ULL;
+    }
+};
+
+struct TscOrderedClock {
+    static const char *name() {
+        return "tsc-rdtscp";
+    }
+    static inline uint64_t now() {
+        return TscClock::nowOrdered();
+    }
+};
+
+bool parseArguments( int argc, char **argv, po::variables_map &vm ) {
+    po::options_description general( "General Options" );
+    general.add_options()
+    (( HELP_KEY + ",h" ).c_str(), "Help options" )
+    (( READS_KEY + ",n" ).c_str(), po::value<int>()->default_value( 10000000 ), "Clock reads timed per source" )
+    (( DURATION_KEY + ",d" ).c_str(), po::value<int>()->default_value( 10 ), "Length of the drift measurement (s)" )
+    (( INTERVAL_KEY + ",i" ).c_str(), po::value<int>()->default_value( 1000 ), "Drift reported every interval (ms)" )
+    ;
+
+    po::store( po::parse_command_line( argc, argv, general ), vm );
+    po::notify( vm );
+
+    if( vm.count( HELP_KEY.c_str() ) ) {
+        cout << general << "\n";
+        return false;
+    }
+
+    return true;
+}
+
+// mean cost of one read in ns, timed with CLOCK_MONOTONIC around the batch
+template<class Clock>
+void ReadCostTest( int reads ) {
+    uint64_t sink = 0;
+
+    // warm up the vDSO page and the branch predictors
+    for( int i = 0; i < 1000; ++i ) {
+        sink += Clock::now();
+    }
+
+    uint64_t start = MonotonicClock::now();
+    for( int i = 0; i < reads; ++i ) {
+        sink += Clock::now();
+    }
+    uint64_t end = MonotonicClock::now();
+
+    printf( "%s\t%d\t%.2f\t%lu\n", Clock::name(), reads, ( double )( end - start ) / reads, sink & 1 );
+}
+
+// Reads the source and CLOCK_MONOTONIC back to back every interval and
+// reports how far the source's elapsed time departs from the reference.
+template<class Clock>
+void DriftTest( uint64_t duration_ns, uint64_t interval_ns ) {
+    uint64_t ref0 = MonotonicClock::now();
+    uint64_t tick0 = Clock::now();
+    uint64_t next = ref0 + interval_ns;
+    timespec pause;
+
+    pause.tv_sec = interval_ns / 1000000000ULL;
+    pause.tv_nsec = interval_ns % 1000000000ULL;
+
+    while( true ) {
+        nanosleep( &pause, NULL );
+
+        uint64_t ref = MonotonicClock::now();
+        uint64_t tick = Clock::now();
+
+        int64_t ref_ns = ref - ref0;
+        int64_t clock_ns = Clock::toNS( tick - tick0 );
+        int64_t offset = clock_ns - ref_ns;
+
+        printf( "%s\t%.3f\t%ld\t%ld\t%ld\t%.3f\n", Clock::name(), ref_ns / 1e6, ref_ns, clock_ns, offset, ref_ns > 0 ? offset * 1e6 / ref_ns : 0.0 );
+
+        if( ref - ref0 >= duration_ns ) {
+            break;
+        }
+        next += interval_ns;
+    }
+}
+
+int main( int argc, char **argv ) {
+    po::variables_map vm;
+    if( !parseArguments( argc, argv, vm ) ) {
+        return 1;
+    }
+
+    string err;
+    if( !TscClock::calibrate( err ) ) {
+        printf( "# %s\n", err.c_str() );
+    }
+    printf( "# TSC: %lu ticks/s, %s\n", TscClock::ticksPerSec(), TscClock::invariant() ? "invariant" : "not invariant" );
+
+    int reads = vm[READS_KEY.c_str()].as<int>();
+
+    printf( "#Clock\tReads\tCost (ns/read)\tSink\n" );
+    ReadCostTest<TimeOfDayClock>( reads );
+    ReadCostTest<MonotonicClock>( reads );
+    ReadCostTest<MonotonicRawClock>( reads );
+    ReadCostTest<TscClock>( reads );
+    ReadCostTest<TscOrderedClock>( reads );
+
+    uint64_t duration_ns = ( uint64_t ) vm[DURATION_KEY.c_str()].as<int>() * 1000000000ULL;
+    uint64_t interval_ns = ( uint64_t ) vm[INTERVAL_KEY.c_str()].as<int>() * 1000000ULL;
+
+    printf( "#Clock\tElapsed (ms)\tMonotonic (ns)\tClock (ns)\tOffset (ns)\tDrift (ppm)\n" );
+    DriftTest<MonotonicRawClock>( duration_ns, interval_ns );
+    DriftTest<TscClock>( duration_ns, interval_ns );
+
+    return 0;
+}
@@ -18,6 +18,8 @@
 
 #include "utils/timing.h"
 #include "utils/cpufunc.h"
+#include "utils/cpustate.h"
+#include "utils/procbind.h"
 #include "utils/logging.h"
 
 using namespace std;
@@ -28,8 +30,7 @@ using namespace std;
 
 void ThreadTimingTest ( map<int, string > &start_v_end, int samplings, int num_threads );
 void SpeedTest ( map<int, vector<TIME> > &speed_v_lapse,  void * ( *algo ) ( void * ),
-                 pthread_attr_t &thread_attrs, cpu_set_t &cpus, int speed, int samplings );
-void printFrequencyTable ( map<int, vector<TIME> > &speed_v_lapses, int samplings );
+                 pthread_attr_t &thread_attrs, CpuMask &cpus, int speed, int samplings );
 
 const double ITERATIONS = 1000000.0;
 
@@ -117,14 +118,14 @@ void SpeedVTimeTest ( map<int, string> &cpu_avail_freq, int cpu_id = 1, int samp
     map<int, vector<TIME> > speed_v_lapses_medium;
     map<int, vector<TIME> > speed_v_lapses_slow;
 
-    cpu_set_t cpus;
+    CpuMask cpus;
     pthread_attr_t thread_attrs;
     string err;
 
-    CPU_ZERO ( &cpus );
-    CPU_SET ( cpu_id, &cpus );
+    cpus.clear();
+    cpus.set( cpu_id );
     pthread_attr_init ( &thread_attrs );
-    pthread_attr_setaffinity_np ( &thread_attrs, sizeof ( cpu_set_t ), &cpus );
+    pthread_attr_setaffinity_np ( &thread_attrs, cpus.size(), cpus.get() );
     pthread_attr_setdetachstate ( &thread_attrs, PTHREAD_CREATE_JOINABLE );
 
     for ( map<int, string>::iterator it = cpu_avail_freq.begin(); it != cpu_avail_freq.end(); it++ ) {
@@ -153,8 +154,10 @@ void SpeedVTimeTest ( map<int, string> &cpu_avail_freq, int cpu_id = 1, int samp
     speed_v_lapses_slow.clear();
 }
 
-void ThreadTimingTest ( map<int, string > &cpu_avail_freq, int samplings = 10, int num_threads = 1 ) {
-    cpu_set_t cpus[num_threads];
+// one thread pinned to each cpu of thread_cpus
+void ThreadTimingTest ( map<int, string > &cpu_avail_freq, vector<int> &thread_cpus, int samplings = 10 ) {
+    int num_threads = thread_cpus.size();
+    vector<CpuMask> cpus( num_threads );
     pthread_attr_t thread_attrs[num_threads];
     pthread_t threads[num_threads];
     string err;
@@ -165,10 +168,10 @@ void ThreadTimingTest ( map<int, string > &cpu_avail_freq, int samplings = 10, i
     map<int, vector<TIME> >::iterator sve_it;
 
     for ( int i = 0; i < num_threads; ++i ) {
-        CPU_ZERO ( &cpus[i] );
-        CPU_SET ( i, &cpus[i] );
+        cpus[i].clear();
+        cpus[i].set( thread_cpus[i] );
         pthread_attr_init ( &thread_attrs[i] );
-        pthread_attr_setaffinity_np ( &thread_attrs[i], sizeof ( cpu_set_t ), &cpus[i] );
+        pthread_attr_setaffinity_np ( &thread_attrs[i], cpus[i].size(), cpus[i].get() );
         pthread_attr_setdetachstate ( &thread_attrs[i], PTHREAD_CREATE_JOINABLE );
         start_v_end.insert ( pair<int, vector<TIME> > ( i, vector<TIME>() ) );
     }
@@ -203,9 +206,9 @@ void ThreadTimingTest ( map<int, string > &cpu_avail_freq, int samplings = 10, i
     cout << "Test #\tStart\tEnd\n";
     for ( int i = 0; i < samplings; ++i ) {
         cout << i << "\t";
-        printf ( TIME_PRINT, sample_times[2 * i].tv_sec, sample_times[2 * i].FRAC );
+        PrintTime ( sample_times[2 * i] );
         printf ( "\t" );
-        printf ( TIME_PRINT, sample_times[2 * i + 1].tv_sec, sample_times[2 * i + 1].FRAC );
+        PrintTime ( sample_times[2 * i + 1] );
         printf ( "\n" );
     }
 
@@ -213,7 +216,7 @@ void ThreadTimingTest ( map<int, string > &cpu_avail_freq, int samplings = 10, i
 }
 
 void SpeedTest ( map<int, vector<TIME> > &speed_v_lapse, void * ( *algo ) ( void * ),
-                 pthread_attr_t &thread_attrs, cpu_set_t &cpus, int speed, int samplings ) {
+                 pthread_attr_t &thread_attrs, CpuMask &cpus, int speed, int samplings ) {
     pthread_t thread;
     int rc;
     void *status;
@@ -264,6 +267,9 @@ void ThrottlingLagTest ( map<int, string> &cpu_avail_freq, int cpu_id = 1, int s
             }
         }
 
+        // time the write itself, even when the speed is unchanged
+        invalidateSpeedShadow ( cpu_id );
+
         GetTime ( t1 );
 
         if ( setCPUThrottledSpeed ( cpu_id, speed, err ) ) {
@@ -284,24 +290,38 @@ void ThrottlingLagTest ( map<int, string> &cpu_avail_freq, int cpu_id = 1, int s
 int main ( int argc, char **argv ) {
     srand ( time ( NULL ) );
 
-    if ( geteuid() !=  0 ) {
-        cout << "Must be run as root" << endl;
+    string cpu_freqs, err;
+
+    // the backend is taken from $CPUFREQ_BACKEND
+    if ( !initCpuBackend ( "", err ) ) {
+        cout << err << endl;
         return -1;
     }
 
-    string cpu_freqs, err;
-
     map<int, string> cpu_avail_freq;
     map<int, string> userspace_cpu;
 //
 //    boost::char_separator<char> sep( " \n" );
 //    boost::tokenizer<boost::char_separator<char> >::iterator tok_iter;
 
-    int cpu_count = determineCPUCount();
+    // arrays indexed by cpu id need the bound; loops walk the online ids
+    int cpu_bound = determineCPUIdBound();
 
-    cout << "The system has " << cpu_count << " available processors." << endl;
+    vector<int> online_cpus;
+    determineOnlineCPUs( online_cpus );
 
-    initUserspace(cpu_count, userspace_cpu);
+    cout << "The system has " << online_cpus.size() << " available processors." << endl;
+
+    CpuStateSnapshot cpu_state;
+    string state_err;
+    if( !cpu_state.capture( online_cpus, state_err ) || !installRestoreHandler( cpu_state, state_err ) ) {
+        printf( "Unable to save cpufreq state: %s\n", state_err.c_str() );
+    }
+
+    initUserspace( online_cpus, userspace_cpu );
+
+    discoverFrequencyDomains ( cpu_bound );
+    initSpeedShadow ( cpu_bound );
 
 //    for( i = 0; i < cpu_count; ++i ) {
 //        getAvailableThrottlingSpeeds( i, cpu_freqs, err );
@@ -312,7 +332,7 @@ int main ( int argc, char **argv ) {
 //        }
 //    }
 
-    fillAvailableThrottlingSpeeds ( cpu_avail_freq, cpu_count );
+    fillAvailableThrottlingSpeeds ( cpu_avail_freq, online_cpus.size() );
 
     for ( map<int, string>::iterator it = cpu_avail_freq.begin(); it != cpu_avail_freq.end(); ++it ) {
         cout << "Available frequencies: " << it->second << endl;
@@ -320,9 +340,11 @@ int main ( int argc, char **argv ) {
 
     SpeedVTimeTest ( cpu_avail_freq );
     ThrottlingLagTest ( cpu_avail_freq );
-    ThreadTimingTest ( cpu_avail_freq, 10, cpu_count );
+    ThreadTimingTest ( cpu_avail_freq, online_cpus, 10 );
+
+    printSpeedShadowStats();
 
-    resetCPUs(userspace_cpu);
+    cpu_state.restore();
 
     return 0;
 }
@@ -12,7 +12,7 @@ int main(int argc, char **argv) {
         return -1;
     }
 
-//    int cpu_count = determineCPUCount();
+//    int cpu_count = determineCPUIdBound();
 
     struct cpufreq_policy *policy;
 
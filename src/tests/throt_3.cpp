@@ -13,8 +13,10 @@
 
 #include "utils/timing.h"
 #include "utils/cpufunc.h"
+#include "utils/cpustate.h"
 #include "utils/procbind.h"
 #include "utils/logging.h"
+#include "utils/stoptimer.h"
 
 using namespace std;
 namespace po = boost::program_options;
@@ -27,6 +29,7 @@ const string CPU_CHILD_BIND_KEY = "child-bind";
 const string CPU_CUR_BIND_KEY = "cur-bind";
 const string SKIP_RUN_BINDING_KEY = "skip-run-bind";
 const string SKIP_ONDEMAND_KEY = "skip-ondemand";
+const string BACKEND_KEY = "backend";
 const string TEST_SINGLE_EVENT_KEY = "single-event";
 const string SAMPLING_KEY = "samplings";
 const string FREQUENCY_EVENTS_KEY = "freq-events";
@@ -79,6 +82,7 @@ bool parseArguments( int argc, char **argv, po::variables_map &vm ) {
     (( THREADS_PER_CORE_KEY + ",T" ).c_str(), po::value< int >()->default_value( 1 ), "Threads spawned per core" )
     ( SKIP_RUN_BINDING_KEY.c_str(), "Should skip building of previously running processes to specific CPU" )
     ( SKIP_ONDEMAND_KEY.c_str(), "After execution, leave CPUs in USERSPACE mode" )
+    ( BACKEND_KEY.c_str(), po::value<string>()->default_value( "" ), "cpufreq backend: sysfs, fake:<dir>[:<cpus>[:<driver>]] or memory[:<cpus>[:<driver>]] (default $CPUFREQ_BACKEND, then sysfs)" )
     ;
 
     po::options_description tests( "Test Options" );
@@ -163,27 +167,30 @@ void timeTest2( node_t *root, vector<TIME> * times, uint64_t &move_counts ) {
 
     node_t *cur = root;
 
-    TIME t1, t2, tmp;
-    GetTime( t1 );
+    uint64_t move_bits = ( uint64_t ) rand() | 1;
 
-    t2.tv_sec = t1.tv_sec + 5;
+    TIME t1, t2;
+    string err;
+    StopTimer stop_timer;
 
     move_counts = 0;
+    if( !stop_timer.open( err ) ) {
+        printf( "%s\n", err.c_str() );
+        return;
+    }
 
-    do {
-        if( rand() % 2 ) {
-            cur = cur->next;
-        } else {
-            cur = cur->prev->prev;
-        }
+    GetTime( t1 );
 
-        move_counts++;
+    if( !stop_timer.arm( t1 + secondsTIME( 5 ), err ) ) {
+        printf( "%s\n", err.c_str() );
+        return;
+    }
+    move_counts = walkBatches( cur, stop_timer, move_bits );
 
-        GetTime( tmp );
-    } while( tmp.tv_sec < t2.tv_sec );
+    GetTime( t2 );
 
     times->push_back( t1 );
-    times->push_back( tmp );
+    times->push_back( t2 );
 }
 
 void *threadableTimeTest( void *args ) {
@@ -291,7 +298,7 @@ void TestThrottledThreads( int cpu_id, int samplings ) {
     map<int, vector<TIME> > cpu_freq_times;
     map<int, vector<TIME> >::iterator cpu_freq_it;
 
-//    int cpu_count = determineCPUCount();
+//    int cpu_count = determineCPUIdBound();
 
     cout << "Determining Available Speeds" << endl;
 
@@ -299,13 +306,13 @@ void TestThrottledThreads( int cpu_id, int samplings ) {
 
     cout << "There are " << cpu_avail_freq.size() << " speeds available." << endl;
 
-    cpu_set_t cpus;
+    CpuMask cpus;
     pthread_attr_t thread_attrs;
 
-    CPU_ZERO( &cpus );
-    CPU_SET( cpu_id, &cpus );
+    cpus.clear();
+    cpus.set( cpu_id );
     pthread_attr_init( &thread_attrs );
-    pthread_attr_setaffinity_np( &thread_attrs, sizeof( cpu_set_t ), &cpus );
+    pthread_attr_setaffinity_np( &thread_attrs, cpus.size(), cpus.get() );
     pthread_attr_setdetachstate( &thread_attrs, PTHREAD_CREATE_JOINABLE );
 
     throt_thread t_args;
@@ -367,7 +374,7 @@ void TestThrottledThreads2( int cpu_id, int samplings ) {
     map<int, vector<TIME> > cpu_freq_times;
     map<int, vector<TIME> >::iterator cpu_freq_it;
 
-//    int cpu_count = determineCPUCount();
+//    int cpu_count = determineCPUIdBound();
 
     cout << "Determining Available Speeds" << endl;
 
@@ -375,13 +382,13 @@ void TestThrottledThreads2( int cpu_id, int samplings ) {
 
     cout << "There are " << cpu_avail_freq.size() << " speeds available." << endl;
 
-    cpu_set_t cpus;
+    CpuMask cpus;
     pthread_attr_t thread_attrs;
 
-    CPU_ZERO( &cpus );
-    CPU_SET( cpu_id, &cpus );
+    cpus.clear();
+    cpus.set( cpu_id );
     pthread_attr_init( &thread_attrs );
-    pthread_attr_setaffinity_np( &thread_attrs, sizeof( cpu_set_t ), &cpus );
+    pthread_attr_setaffinity_np( &thread_attrs, cpus.size(), cpus.get() );
     pthread_attr_setdetachstate( &thread_attrs, PTHREAD_CREATE_JOINABLE );
 
     throt_thread t_args;
@@ -437,13 +444,19 @@ void TestThrottledThreads2( int cpu_id, int samplings ) {
 void EventBasedTest( throt_ctrl_t *ctrl ) {
     vector<ctrl_event_t>::iterator evt_it;
 
-    uint64_t cnt;
+    uint64_t cnt, move_bits = ( uint64_t ) rand() | 1;
     string err;
 
+    StopTimer stop_timer;
+    if( !stop_timer.open( err ) ) {
+        printf( "%s\n", err.c_str() );
+        return;
+    }
+
     node_t *root = new node_t();
 //    node_t *cur = ctrl->root;
 
-    TIME t1, stop;
+    TIME t1;
     GetTime( t1 );
     ctrl->times.push_back( t1 );
 
@@ -467,20 +480,11 @@ void EventBasedTest( throt_ctrl_t *ctrl ) {
         GetTime( t1 );
         ctrl->times.push_back( t1 );
 
-        stop.tv_sec = t1.tv_sec + evt_it->loop_sec_offset;
-        stop.FRAC = t1.FRAC;
-
-        cnt = 0;
-        do {
-            GetTime( t1 );
-            //if( rand() % 2 ) {
-            if( t1.FRAC % 2 ) {
-                cur = cur->next;
-            } else {
-                cur = cur->prev->prev;
-            }
-            cnt++;
-        } while( t1.tv_sec < stop.tv_sec );
+        if( !stop_timer.arm( t1 + secondsTIME( evt_it->loop_sec_offset ), err ) ) {
+            printf( "%s\n", err.c_str() );
+            break;
+        }
+        cnt = walkBatches( cur, stop_timer, move_bits );
 
         GetTime( t1 );
         ctrl->times.push_back( t1 );
@@ -610,7 +614,7 @@ void TestParallelThreads( map<int, string> &userspace_cpu, vector<string> &freq_
     int max_threads = thread_count * userspace_cpu.size();
 
     pthread_t threads[max_threads];
-    cpu_set_t cpus[max_threads];
+    vector<CpuMask> cpus( max_threads );
 //    cpu_set_t check_cpu;
     pthread_attr_t thread_attrs[max_threads];
 
@@ -637,12 +641,12 @@ void TestParallelThreads( map<int, string> &userspace_cpu, vector<string> &freq_
     idx = 0;
     for( cpu_it = userspace_cpu.begin(), i = 0; cpu_it != userspace_cpu.end(); cpu_it++, i++ ) {
         for( j = 0; j < thread_count; ++j, ++idx ) {
-            CPU_ZERO( &cpus[idx] );
-            CPU_SET( cpu_it->first, &cpus[idx] );
+            cpus[idx].clear();
+            cpus[idx].set( cpu_it->first );
             pthread_attr_init( &thread_attrs[idx] );
             // pthread_attr_setscope(&thread_attrs[idx], PTHREAD_SCOPE_SYSTEM);   // explicitly state the each thread is its own process; (END result - no effect from either scope; something must be overriding)
 
-            int val = pthread_attr_setaffinity_np( &thread_attrs[idx], sizeof( cpu_set_t ), &cpus[idx] );
+            int val = pthread_attr_setaffinity_np( &thread_attrs[idx], cpus[idx].size(), cpus[idx].get() );
 
             if( val ) {
                 printf( "Set Affinity Fail: %s\n", strerror( val ) );
@@ -814,27 +818,28 @@ void buildEvents( vector<string> &freq_event, int evt_idx, map<int, string> &ava
 }
 
 int main( int argc, char **argv ) {
-    if( geteuid() !=  0 ) {
-        cout << "Must be run as root" << endl;
-        return -1;
-    }
-
     po::variables_map vm;
     if( !parseArguments( argc, argv, vm ) ) {
         return 1;
     }
 
+    string backend_err;
+    if( !initCpuBackend( vm[BACKEND_KEY.c_str()].as<string>(), backend_err ) ) {
+        cout << backend_err << endl;
+        return -1;
+    }
+
     srand( time( NULL ) );
 
     map<int, string> userspace_cpu;
     map<int, string> avail_cpu;
 
-    int cpu_count = determineCPUCount();
+    int cpu_count = determineCPUIdBound();
     string err;
 
-    map<int, cpu_set_t> proc_list;
+    map<int, CpuMask> proc_list;
     vector<int> v;
-    cpu_set_t proc_bind_mask, cur_bind_mask;
+    CpuMask proc_bind_mask, cur_bind_mask;
 
     v = vm[CPU_RUN_BIND_KEY.c_str()].as< vector<int> >();
     buildMask( v, proc_bind_mask );
@@ -850,7 +855,16 @@ int main( int argc, char **argv ) {
 
     printCurrentProcBinding();
 
-    initUserspace( cpu_count, userspace_cpu );
+    vector<int> online_cpus;
+    determineOnlineCPUs( online_cpus );
+
+    CpuStateSnapshot cpu_state;
+    string state_err;
+    if( !cpu_state.capture( online_cpus, state_err ) || !installRestoreHandler( cpu_state, state_err ) ) {
+        printf( "Unable to save cpufreq state: %s\n", state_err.c_str() );
+    }
+
+    initUserspace( online_cpus, userspace_cpu );
 
 //    pid_t cur_pid = getpid();
 //    int ret_val;
@@ -906,7 +920,7 @@ int main( int argc, char **argv ) {
     resetAffinities( proc_list );
 
     if( vm.count( SKIP_ONDEMAND_KEY.c_str() ) == 0 )
-        resetCPUs( userspace_cpu );
+        cpu_state.restore();
 
 
     userspace_cpu.clear();
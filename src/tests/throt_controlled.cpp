@@ -18,8 +18,21 @@
 
 #include "utils/timing.h"
 #include "utils/cpufunc.h"
+#include "utils/cpustate.h"
 #include "utils/procbind.h"
 #include "utils/logging.h"
+#include "utils/actuator.h"
+#include "utils/asyncwriter.h"
+#include "utils/uclamp.h"
+#include "utils/cpustats.h"
+#include "utils/stoptimer.h"
+#include "utils/waiter.h"
+#include "utils/overhead.h"
+#include "utils/trace.h"
+#include "utils/asynclog.h"
+#include "utils/runstats.h"
+#include "utils/histogram.h"
+#include "utils/isolation.h"
 
 using namespace std;
 namespace po = boost::program_options;
@@ -32,6 +45,7 @@ const string CPU_CHILD_BIND_KEY = "child-bind";
 const string CPU_CUR_BIND_KEY = "cur-bind";
 const string SKIP_RUN_BINDING_KEY = "skip-run-bind";
 const string SKIP_ONDEMAND_KEY = "skip-ondemand";
+const string BACKEND_KEY = "backend";
 const string TEST_SINGLE_EVENT_KEY = "single-event";
 const string SAMPLING_KEY = "samplings";
 const string FREQUENCY_EVENTS_KEY = "freq-events";
@@ -39,6 +53,23 @@ const string THREADS_PER_CORE_KEY = "thread-count";
 const string WEIGHTED_TEST_KEY = "weighted-static";
 const string WEIGHTED_D_TEST_KEY = "weighted-dynamic";
 const string LOG_FILENAME_KEY = "log-file";
+const string BATCH_WRITERS_KEY = "batch-writers";
+const string ASYNC_WRITERS_KEY = "async-writers";
+const string ACTUATOR_KEY = "actuator";
+const string WAIT_MODE_KEY = "wait-mode";
+const string WAIT_SPIN_KEY = "wait-spin";
+const string CALIBRATE_KEY = "calibrate";
+const string OVERHEAD_FILE_KEY = "overhead-file";
+const string TRACE_KEY = "trace";
+const string TRACE_RECORDS_KEY = "trace-records";
+const string LOG_CPU_KEY = "log-cpu";
+const string SUMMARY_FILE_KEY = "summary-file";
+const string ISOLATION_KEY = "isolation";
+const string PLACEMENT_KEY = "placement";
+const string PLACEMENT_CPUS_KEY = "placement-cpus";
+
+const string SYSFS_ACTUATOR = "sysfs";
+const string UCLAMP_ACTUATOR = "uclamp";
 
 const int ALGO_COUNT = 4;
 enum EventAlgoType {THREAD_SELF_THROTTLE = 0, NO_WEIGHT, SQRT_WEIGTHED, LOG_WEIGHTED, SINCOS_WEIGHTED};
@@ -56,6 +87,7 @@ struct throt_thread {
     vector<char> moves;
     vector<TIME> times;
     uint64_t move_counts;
+    LatencyHistogram batch_ns;      // length of every batch of the last walk
 
     throt_thread() : move_counts( 0 ) {}
 };
@@ -71,6 +103,7 @@ struct throt_ctrl_t {
     int *transitions;
     double *weights;
     int cpu_id;
+    pid_t tid;          // kernel id of the running worker thread; 0 before it starts and once it ends
     int thread_idx;
     int node_count;
     int sample_num;
@@ -78,12 +111,85 @@ struct throt_ctrl_t {
     EventAlgoType algorithm;
     vector<TIME> times;
     vector<uint64_t> counts;
+    vector<uint64_t> stop_lags;     // ns from each loop deadline to its end
+    vector<int> speeds;             // kHz each loop ran at; 0 when unknown
+    wait_stat_t start_wait;         // lateness of the wake up at start_point
+    map<int, LatencyHistogram> batch_ns;    // batch lengths by kHz; merged and cleared after each sample
     vector<ctrl_event_t> events;
 };
 
+// node visit latencies are kept per cpu, speed and algorithm
+struct visit_key_t {
+    int cpu_id;
+    int khz;
+    int algorithm;
+
+    visit_key_t( int _cpu_id, int _khz, int _algorithm ) : cpu_id( _cpu_id ), khz( _khz ), algorithm( _algorithm ) {}
+
+    bool operator<( const visit_key_t &other ) const {
+        if( cpu_id != other.cpu_id ) {
+            return cpu_id < other.cpu_id;
+        }
+        if( khz != other.khz ) {
+            return khz < other.khz;
+        }
+        return algorithm < other.algorithm;
+    }
+};
+
 string log_filename;
+int batch_writers = 1;
+int async_writers = 0;
+
+// queues the self throttling writes of worker threads when enabled
+AsyncFreqWriter *freq_writer = NULL;
+
+// retunes worker threads instead of cores when utilization clamping is selected
+UclampActuator *uclamp_actuator = NULL;
+
+// start barriers and controller ticks sleep until their deadline
+wait_mode_t wait_mode = WAIT_NANOSLEEP;
+uint64_t wait_spin_ns = 0;
+
+// instrumentation cost by cpu speed; empty unless calibrated or loaded
+OverheadTable overheads;
 
-void buildEvents( vector<string> &freq_event, int evt_idx, map<int, string> &avail_freq, vector<ctrl_event_t> &events );
+// workers append their events here instead of to their vectors when tracing
+TraceFile *trace = NULL;
+
+// housekeeping cpu of the controller's logger thread; -1 logs inline
+int log_cpu = -1;
+
+// the throttling tests also save their per speed summaries here
+string summary_file;
+
+// how the rest of the system is kept off the measurement cpus
+isolation_mode_t isolation_mode = ISOLATE_AUTO;
+
+// which child bind cpus the parallel tests use; 0 cpus means no limit
+placement_t placement = PLACE_ALL;
+int placement_cpus = 0;
+
+void recordTime( throt_ctrl_t *ctrl, int type, int event, TIME t, int khz = 0 ) {
+    if( trace == NULL ) {
+        ctrl->times.push_back( t );
+    } else {
+        trace->append( type, ctrl->sample_num, ctrl->thread_idx, ctrl->cpu_id, event, t, 0, khz );
+    }
+}
+
+void recordLoopEnd( throt_ctrl_t *ctrl, int event, TIME t, uint64_t cnt, uint64_t stop_lag, int khz ) {
+    if( trace == NULL ) {
+        ctrl->times.push_back( t );
+        ctrl->counts.push_back( cnt );
+        ctrl->stop_lags.push_back( stop_lag );
+        ctrl->speeds.push_back( khz );
+    } else {
+        trace->append( TRACE_LOOP_END, ctrl->sample_num, ctrl->thread_idx, ctrl->cpu_id, event, t, cnt, khz, stop_lag );
+    }
+}
+
+void buildEvents( vector<string> &freq_event, int evt_idx, FrequencyTable &avail_freq, vector<ctrl_event_t> &events );
 
 pthread_mutex_t mute_sincos, mute_sqrt, mute_log, mute_end, mute_graph_gen, mute_thread_print;
 pthread_mutex_t *mute_transitions, *mute_weights;
@@ -129,6 +235,28 @@ void signal_thread_exit() {
     pthread_mutex_unlock( &mute_end );
 }
 
+// Keeps the child bind cpus picked by the placement strategy.  Threads are
+// still started in cpu id order; the strategy decides which cpus, and with
+// --placement-cpus which of them come first.
+void placeAvailableCpus( map<int, string> &avail_cpu ) {
+    vector<int> cpus, placed;
+    map<int, string> kept;
+
+    for( map<int, string>::iterator avail_it = avail_cpu.begin(); avail_it != avail_cpu.end(); avail_it++ ) {
+        cpus.push_back( avail_it->first );
+    }
+    placeCpus( cpus, placement, placement_cpus, placed );
+
+    printf( "# %s placement:", placementName( placement ) );
+    for( size_t i = 0; i < placed.size(); i++ ) {
+        kept.insert( *avail_cpu.find( placed[i] ) );
+        printf( " %d", placed[i] );
+    }
+    printf( "\n" );
+
+    avail_cpu.swap( kept );
+}
+
 bool parseArguments( int argc, char **argv, po::variables_map &vm ) {
     po::options_description general( "General Options" );
     general.add_options()
@@ -145,6 +273,21 @@ bool parseArguments( int argc, char **argv, po::variables_map &vm ) {
     (( THREADS_PER_CORE_KEY + ",T" ).c_str(), po::value< int >()->default_value( 1 ), "Threads spawned per core" )
     ( SKIP_RUN_BINDING_KEY.c_str(), "Should skip building of previously running processes to specific CPU" )
     ( SKIP_ONDEMAND_KEY.c_str(), "After execution, leave CPUs in USERSPACE mode" )
+    ( BACKEND_KEY.c_str(), po::value<string>()->default_value( "" ), "cpufreq backend: sysfs, fake:<dir>[:<cpus>[:<driver>]] or memory[:<cpus>[:<driver>]] (default $CPUFREQ_BACKEND, then sysfs)" )
+    ( BATCH_WRITERS_KEY.c_str(), po::value< int >()->default_value( 1 ), "Writer threads used to apply a control tick's frequency changes" )
+    ( ASYNC_WRITERS_KEY.c_str(), po::value< int >()->default_value( 0 ), "Queue self throttling writes asynchronously (io_uring or this many pool threads); 0 writes synchronously" )
+    (( ACTUATOR_KEY + ",a" ).c_str(), po::value< string >()->default_value( SYSFS_ACTUATOR ), "Frequency actuator: sysfs retunes cores under the userspace governor, uclamp clamps the utilization of each thread under schedutil" )
+    ( WAIT_MODE_KEY.c_str(), po::value< string >()->default_value( waitModeName( WAIT_NANOSLEEP ) ), "How start barriers and controller ticks wait: spin, nanosleep, timerfd or futex" )
+    ( WAIT_SPIN_KEY.c_str(), po::value< int >()->default_value( 0 ), "Microseconds spun before each deadline by the sleeping wait modes" )
+    ( CALIBRATE_KEY.c_str(), "Measure instrumentation overheads at every speed before testing" )
+    ( OVERHEAD_FILE_KEY.c_str(), po::value< string >()->default_value( "" ), "Reuse the overheads saved in this file by an earlier run on this machine, calibrating and saving them when missing" )
+    ( TRACE_KEY.c_str(), po::value< string >()->default_value( "" ), "Append worker events to this memory mapped trace instead of keeping them in memory; print its tables with TraceConvert" )
+    ( TRACE_RECORDS_KEY.c_str(), po::value< uint64_t >()->default_value( TRACE_DEFAULT_RECORDS ), "Records the trace holds; later events are dropped and counted" )
+    ( LOG_CPU_KEY.c_str(), po::value< int >()->default_value( -1 ), "Format the weighted controller's output on a logger thread pinned to this housekeeping CPU; -1 prints inline" )
+    ( SUMMARY_FILE_KEY.c_str(), po::value< string >()->default_value( "" ), "Save the throttling tests' per speed summaries to this file, as JSON when it ends in .json, else CSV" )
+    ( ISOLATION_KEY.c_str(), po::value< string >()->default_value( isolationModeName( ISOLATE_AUTO ) ), "How other processes are kept on the run bind CPUs: procs binds main threads, tasks binds every thread, cgroup makes a cgroup v2 cpuset partition of the remaining CPUs and confines this process to it, auto tries cgroup then tasks unless logger or writer threads need the housekeeping CPUs, none leaves them" )
+    ( PLACEMENT_KEY.c_str(), po::value< string >()->default_value( placementName( PLACE_ALL ) ), "CPUs the parallel tests place threads on: all, spread (across nodes, packages and cores first), compact (SMT siblings first), core (one per physical core) or domain (one per frequency domain)" )
+    ( PLACEMENT_CPUS_KEY.c_str(), po::value< int >()->default_value( 0 ), "Use at most this many of the placed CPUs; 0 uses all" )
     ;
 
     po::options_description tests( "Test Options" );
@@ -172,6 +315,36 @@ bool parseArguments( int argc, char **argv, po::variables_map &vm ) {
     }
 
     log_filename = vm[LOG_FILENAME_KEY.c_str()].as<string>();
+    batch_writers = vm[BATCH_WRITERS_KEY.c_str()].as<int>();
+    async_writers = vm[ASYNC_WRITERS_KEY.c_str()].as<int>();
+
+    string actuator_kind = vm[ACTUATOR_KEY.c_str()].as<string>();
+    if( actuator_kind != SYSFS_ACTUATOR && actuator_kind != UCLAMP_ACTUATOR ) {
+        cout << "Unknown actuator: " << actuator_kind << endl;
+        return false;
+    }
+
+    if( !parseWaitMode( vm[WAIT_MODE_KEY.c_str()].as<string>(), wait_mode ) ) {
+        cout << "Unknown wait mode: " << vm[WAIT_MODE_KEY.c_str()].as<string>() << endl;
+        return false;
+    }
+    wait_spin_ns = ( uint64_t ) max( vm[WAIT_SPIN_KEY.c_str()].as<int>(), 0 ) * 1000;
+    log_cpu = vm[LOG_CPU_KEY.c_str()].as<int>();
+    summary_file = vm[SUMMARY_FILE_KEY.c_str()].as<string>();
+
+    if( !parseIsolationMode( vm[ISOLATION_KEY.c_str()].as<string>(), isolation_mode ) ) {
+        cout << "Unknown isolation mode: " << vm[ISOLATION_KEY.c_str()].as<string>() << endl;
+        return false;
+    }
+    if( vm.count( SKIP_RUN_BINDING_KEY.c_str() ) ) {
+        isolation_mode = ISOLATE_NONE;
+    }
+
+    if( !parsePlacement( vm[PLACEMENT_KEY.c_str()].as<string>(), placement ) ) {
+        cout << "Unknown placement: " << vm[PLACEMENT_KEY.c_str()].as<string>() << endl;
+        return false;
+    }
+    placement_cpus = max( vm[PLACEMENT_CPUS_KEY.c_str()].as<int>(), 0 );
 
     if( vm.count( WEIGHTED_TEST_KEY.c_str() ) && vm.count( WEIGHTED_D_TEST_KEY.c_str() ) ) {
         cout << "Static core frequency weighted node visit tests and dynamic core frequency weighted node visit test cannot be performed at the same time" << endl;
@@ -317,31 +490,34 @@ void timeTest( node_t *root, vector<char> &moves, vector<TIME> * times ) {
     times->push_back( t2 );
 }
 
-void timeTest2( node_t *root, vector<TIME> * times, uint64_t &move_counts ) {
+// walks the graph for 5 seconds, timing only whole batches
+void timeTest2( node_t *root, vector<TIME> * times, uint64_t &move_counts, LatencyHistogram &batch_ns ) {
 
     node_t *cur = root;
+    uint64_t move_bits = ( uint64_t ) rand() | 1;
 
-    TIME t1, t2, tmp;
-    GetTime( t1 );
-
-    t2.tv_sec = t1.tv_sec + 5;
+    TIME t1, t2;
+    string err;
+    StopTimer stop_timer;
 
     move_counts = 0;
+    if( !stop_timer.open( err ) ) {
+        printf( "%s\n", err.c_str() );
+        return;
+    }
 
-    do {
-        if( rand() % 2 ) {
-            cur = cur->next;
-        } else {
-            cur = cur->prev->prev;
-        }
+    GetTime( t1 );
 
-        move_counts++;
+    if( !stop_timer.arm( t1 + secondsTIME( 5 ), err ) ) {
+        printf( "%s\n", err.c_str() );
+        return;
+    }
+    move_counts = walkTimedBatches( cur, stop_timer, move_bits, batch_ns );
 
-        GetTime( tmp );
-    } while( tmp.tv_sec < t2.tv_sec );
+    GetTime( t2 );
 
     times->push_back( t1 );
-    times->push_back( tmp );
+    times->push_back( t2 );
 }
 
 void *threadableTimeTest( void *args ) {
@@ -355,7 +531,7 @@ void *threadableTimeTest( void *args ) {
 void *threadableTimeTest2( void *args ) {
     throt_thread *throt = ( throt_thread * ) args;
 
-    timeTest2( throt->root, &throt->times, throt->move_counts );
+    timeTest2( throt->root, &throt->times, throt->move_counts, throt->batch_ns );
 
     pthread_exit( NULL );
 }
@@ -393,6 +569,45 @@ bool checkGraphIsCircular( node_t *root, int expected_count ) {
 }
 
 
+const char *algoName( int algorithm ) {
+    static const char *names[] = {"self-throttle", "none", "sqrt", "log", "sincos"};
+
+    return algorithm >= THREAD_SELF_THROTTLE && algorithm <= SINCOS_WEIGHTED ? names[algorithm] : "unknown";
+}
+
+// Percentiles of the per visit cost of every timed batch.  A batch is timed
+// as a whole, so a single visit's stall is spread over LOOP_BATCH_MOVES.
+void printVisitLatency( map<visit_key_t, LatencyHistogram> &visit_latency ) {
+    printf( "# Node visit latency (ns per visit, timed in batches of %lu)\n", LOOP_BATCH_MOVES );
+    printf( "#CPU ID\tkHz\tAlgorithm\t%s\n", HISTOGRAM_COLUMNS );
+    for( map<visit_key_t, LatencyHistogram>::iterator it = visit_latency.begin(); it != visit_latency.end(); it++ ) {
+        printf( "%d\t%d\t%s\t", it->first.cpu_id, it->first.khz, algoName( it->first.algorithm ) );
+        printPercentiles( it->second, LOOP_BATCH_MOVES );
+        printf( "\n" );
+    }
+}
+
+// closes a batch of a weighted loop: records its length and starts the next
+static inline void timeBatch( LatencyHistogram *batch_ns, TIME &batch_start ) {
+    TIME now;
+
+    GetTime( now );
+    batch_ns->record( now - batch_start );
+    batch_start = now;
+}
+
+void saveSummary( FrequencySummary &summary ) {
+    string err;
+
+    if( !summary_file.empty() ) {
+        if( summary.save( summary_file, SUMMARY_CONFIDENCE, err ) ) {
+            printf( "# Summary saved to %s\n", summary_file.c_str() );
+        } else {
+            printf( "%s\n", err.c_str() );
+        }
+    }
+}
+
 void TestThrottledThreads( int cpu_id, int samplings ) {
     pthread_t thread;
     void *status;
@@ -401,9 +616,10 @@ void TestThrottledThreads( int cpu_id, int samplings ) {
 
     int node_count = 1000;
     int move_count = 10000000;
-    map<int, string> cpu_avail_freq;
+    FrequencyTable cpu_avail_freq;
     map<int, vector<TIME> > cpu_freq_times;
     map<int, vector<TIME> >::iterator cpu_freq_it;
+    FrequencySummary summary;
 
     cout << "Determining Available Speeds" << endl;
 
@@ -411,13 +627,13 @@ void TestThrottledThreads( int cpu_id, int samplings ) {
 
     cout << "There are " << cpu_avail_freq.size() << " speeds available." << endl;
 
-    cpu_set_t cpus;
+    CpuMask cpus;
     pthread_attr_t thread_attrs;
 
-    CPU_ZERO( &cpus );
-    CPU_SET( cpu_id, &cpus );
+    cpus.clear();
+    cpus.set( cpu_id );
     pthread_attr_init( &thread_attrs );
-    pthread_attr_setaffinity_np( &thread_attrs, sizeof( cpu_set_t ), &cpus );
+    pthread_attr_setaffinity_np( &thread_attrs, cpus.size(), cpus.get() );
     pthread_attr_setdetachstate( &thread_attrs, PTHREAD_CREATE_JOINABLE );
 
     throt_thread t_args;
@@ -433,13 +649,13 @@ void TestThrottledThreads( int cpu_id, int samplings ) {
         t_args.moves.clear();
         fillMoveList( t_args.moves, move_count );
 
-        for( map<int, string>::iterator freq_it = cpu_avail_freq.begin(); freq_it != cpu_avail_freq.end(); freq_it++ ) {
-            if(( cpu_freq_it = cpu_freq_times.find( freq_it->first ) ) == cpu_freq_times.end() ) {
-                cpu_freq_times.insert( pair<int, vector<TIME> > ( freq_it->first, vector<TIME>() ) );
-                cpu_freq_it = cpu_freq_times.find( freq_it->first );
+        for( int freq_idx = 0; freq_idx < cpu_avail_freq.size(); freq_idx++ ) {
+            if(( cpu_freq_it = cpu_freq_times.find( cpu_avail_freq.khz( freq_idx ) ) ) == cpu_freq_times.end() ) {
+                cpu_freq_times.insert( pair<int, vector<TIME> > ( cpu_avail_freq.khz( freq_idx ), vector<TIME>() ) );
+                cpu_freq_it = cpu_freq_times.find( cpu_avail_freq.khz( freq_idx ) );
             }
 
-            if( setCPUThrottledSpeed( cpu_id, freq_it->second, err ) ) {
+            if( setCPUThrottledSpeed( cpu_id, cpu_avail_freq.speed( freq_idx ), err ) ) {
                 if( pthread_create( &thread, &thread_attrs, threadableTimeTest, ( void * ) &t_args ) ) {
                     cout << "Error creating thread\n";
                     break;
@@ -452,6 +668,7 @@ void TestThrottledThreads( int cpu_id, int samplings ) {
 
                 cpu_freq_it->second.push_back( t_args.times[0] );
                 cpu_freq_it->second.push_back( t_args.times[1] );
+                summary.add( cpu_freq_it->first, t_args.times[0], t_args.times[1] );
 
                 t_args.times.clear();
             } else {
@@ -460,7 +677,8 @@ void TestThrottledThreads( int cpu_id, int samplings ) {
         }
     }
 
-    printFrequencyTable( cpu_freq_times, samplings );
+    printFrequencyTable( cpu_freq_times, samplings, &summary );
+    saveSummary( summary );
     cpu_freq_times.clear();
     releaseCircularGraph( t_args.root );
 }
@@ -472,11 +690,13 @@ void TestThrottledThreads2( int cpu_id, int samplings ) {
     string err;
 
     int node_count = 1000;
-    map<int, string> cpu_avail_freq;
+    FrequencyTable cpu_avail_freq;
     map<int, vector<uint64_t> > cpu_freq_loop_counts;
     map<int, vector<uint64_t> >::iterator cpu_lcnt_it;
     map<int, vector<TIME> > cpu_freq_times;
     map<int, vector<TIME> >::iterator cpu_freq_it;
+    FrequencySummary summary;
+    map<visit_key_t, LatencyHistogram> visit_latency;
 
     cout << "Determining Available Speeds" << endl;
 
@@ -484,13 +704,13 @@ void TestThrottledThreads2( int cpu_id, int samplings ) {
 
     cout << "There are " << cpu_avail_freq.size() << " speeds available." << endl;
 
-    cpu_set_t cpus;
+    CpuMask cpus;
     pthread_attr_t thread_attrs;
 
-    CPU_ZERO( &cpus );
-    CPU_SET( cpu_id, &cpus );
+    cpus.clear();
+    cpus.set( cpu_id );
     pthread_attr_init( &thread_attrs );
-    pthread_attr_setaffinity_np( &thread_attrs, sizeof( cpu_set_t ), &cpus );
+    pthread_attr_setaffinity_np( &thread_attrs, cpus.size(), cpus.get() );
     pthread_attr_setdetachstate( &thread_attrs, PTHREAD_CREATE_JOINABLE );
 
     throt_thread t_args;
@@ -503,18 +723,18 @@ void TestThrottledThreads2( int cpu_id, int samplings ) {
     for( int i = 0; i < samplings; i++ ) {
         cout << "Sampling ... " << i << endl;
         // setup thread arguments
-        for( map<int, string>::iterator freq_it = cpu_avail_freq.begin(); freq_it != cpu_avail_freq.end(); freq_it++ ) {
-            if(( cpu_freq_it = cpu_freq_times.find( freq_it->first ) ) == cpu_freq_times.end() ) {
-                cpu_freq_times.insert( pair<int, vector<TIME> > ( freq_it->first, vector<TIME>() ) );
-                cpu_freq_it = cpu_freq_times.find( freq_it->first );
+        for( int freq_idx = 0; freq_idx < cpu_avail_freq.size(); freq_idx++ ) {
+            if(( cpu_freq_it = cpu_freq_times.find( cpu_avail_freq.khz( freq_idx ) ) ) == cpu_freq_times.end() ) {
+                cpu_freq_times.insert( pair<int, vector<TIME> > ( cpu_avail_freq.khz( freq_idx ), vector<TIME>() ) );
+                cpu_freq_it = cpu_freq_times.find( cpu_avail_freq.khz( freq_idx ) );
             }
 
-            if(( cpu_lcnt_it = cpu_freq_loop_counts.find( freq_it->first ) ) == cpu_freq_loop_counts.end() ) {
-                cpu_freq_loop_counts.insert( pair<int, vector<uint64_t> > ( freq_it->first, vector<uint64_t>() ) );
-                cpu_lcnt_it = cpu_freq_loop_counts.find( freq_it->first );
+            if(( cpu_lcnt_it = cpu_freq_loop_counts.find( cpu_avail_freq.khz( freq_idx ) ) ) == cpu_freq_loop_counts.end() ) {
+                cpu_freq_loop_counts.insert( pair<int, vector<uint64_t> > ( cpu_avail_freq.khz( freq_idx ), vector<uint64_t>() ) );
+                cpu_lcnt_it = cpu_freq_loop_counts.find( cpu_avail_freq.khz( freq_idx ) );
             }
 
-            if( setCPUThrottledSpeed( cpu_id, freq_it->second, err ) ) {
+            if( setCPUThrottledSpeed( cpu_id, cpu_avail_freq.speed( freq_idx ), err ) ) {
                 if( pthread_create( &thread, &thread_attrs, threadableTimeTest2, ( void * ) &t_args ) ) {
                     cout << "Error creating thread\n";
                     break;
@@ -529,6 +749,9 @@ void TestThrottledThreads2( int cpu_id, int samplings ) {
                 cpu_freq_it->second.push_back( t_args.times[1] );
 
                 cpu_lcnt_it->second.push_back( t_args.move_counts );
+                summary.add( cpu_freq_it->first, t_args.times[0], t_args.times[1], t_args.move_counts );
+                visit_latency[visit_key_t( cpu_id, cpu_freq_it->first, NO_WEIGHT )].merge( t_args.batch_ns );
+                t_args.batch_ns.clear();
 
                 t_args.times.clear();
             } else {
@@ -537,7 +760,9 @@ void TestThrottledThreads2( int cpu_id, int samplings ) {
         }
     }
 
-    printFrequencyTable2( cpu_freq_times, cpu_freq_loop_counts, samplings );
+    printFrequencyTable2( cpu_freq_times, cpu_freq_loop_counts, samplings, &summary );
+    saveSummary( summary );
+    printVisitLatency( visit_latency );
     cpu_freq_loop_counts.clear();
     cpu_freq_times.clear();
     releaseCircularGraph( t_args.root );
@@ -546,55 +771,75 @@ void TestThrottledThreads2( int cpu_id, int samplings ) {
 void EventBasedTest( throt_ctrl_t *ctrl ) {
     vector<ctrl_event_t>::iterator evt_it;
 
-    uint64_t cnt;
+    uint64_t cnt, move_bits = 0x9e3779b97f4a7c15ULL + ctrl->thread_idx;
+    int evt, khz;
+    bool conflict = false;
     string err;
 
+    StopTimer stop_timer;
+    if( !stop_timer.open( err ) ) {
+        printf( "Thread %d: %s\n", ctrl->thread_idx, err.c_str() );
+        return;
+    }
+
     node_t *root = new node_t();
 
-    TIME t1, stop;
+    TIME t1;
     GetTime( t1 );
-    ctrl->times.push_back( t1 );
+    recordTime( ctrl, TRACE_SAMPLE_BEGIN, 0, t1 );
 
     generateCircularGraph( root, ctrl->node_count );
     node_t *cur = root;
 
-    for( evt_it = ctrl->events.begin(); evt_it != ctrl->events.end(); evt_it++ ) {
+    for( evt_it = ctrl->events.begin(), evt = 0; evt_it != ctrl->events.end(); evt_it++, evt++ ) {
+        khz = atoi( evt_it->throt_speed.c_str() );
 
         GetTime( t1 );
-        ctrl->times.push_back( t1 );
+        recordTime( ctrl, TRACE_THROTTLE_BEGIN, evt, t1, khz );
 
-        if( !setCPUThrottledSpeed( ctrl->cpu_id, evt_it->throt_speed, err ) ) {
+        if( uclamp_actuator != NULL ) {
+            if( !uclamp_actuator->setSpeed( ctrl->tid, evt_it->throt_speed, err ) ) {
+                printf( "Unable to clamp thread %d: %s\n", ctrl->tid, err.c_str() );
+                break;
+            }
+        } else if( freq_writer != NULL ) {
+            // a write the queue refuses is made synchronously; the loop goes on
+            if( !freq_writer->submit( ctrl->cpu_id, evt_it->throt_speed, conflict ) && !setCPUThrottledSpeed( ctrl->cpu_id, evt_it->throt_speed, conflict, err ) ) {
+                printf( "Unable to throttle CPU %d: %s\n", ctrl->cpu_id, err.c_str() );
+                break;
+            }
+        } else if( !setCPUThrottledSpeed( ctrl->cpu_id, evt_it->throt_speed, conflict, err ) ) {
             printf( "Unalbe to throttle CPU %d\n", ctrl->cpu_id );
             break;
         }
 
         GetTime( t1 );
-        ctrl->times.push_back( t1 );
+        recordTime( ctrl, TRACE_THROTTLE_END, evt, t1, khz );
 
         GetTime( t1 );
-        ctrl->times.push_back( t1 );
+        recordTime( ctrl, TRACE_LOOP_BEGIN, evt, t1 );
 
-        stop.tv_sec = t1.tv_sec + evt_it->loop_sec_offset;
-        stop.FRAC = t1.FRAC;
+        if( !stop_timer.arm( t1 + secondsTIME( evt_it->loop_sec_offset ), err ) ) {
+            printf( "Thread %d: %s\n", ctrl->thread_idx, err.c_str() );
+            break;
+        }
+        cnt = walkBatches( cur, stop_timer, move_bits );
 
-        cnt = 0;
-        do {
-            GetTime( t1 );
-            if( t1.FRAC % 2 ) {
-                cur = cur->next;
-            } else {
-                cur = cur->prev->prev;
-            }
-            cnt++;
-        } while( t1.tv_sec < stop.tv_sec || ( t1.tv_sec == stop.tv_sec && t1.FRAC < stop.FRAC ) );
+        // a sibling of the frequency domain may have overridden the request
+        if( uclamp_actuator == NULL && conflict ) {
+            khz = getSpeedShadow( ctrl->cpu_id );
+        }
 
         GetTime( t1 );
-        ctrl->times.push_back( t1 );
-        ctrl->counts.push_back( cnt );
+        recordLoopEnd( ctrl, evt, t1, cnt, span_TIME( stop_timer.deadline(), t1 ), khz );
+    }
+
+    if( uclamp_actuator == NULL ) {
+        clearSpeedRequest( ctrl->cpu_id );
     }
 
     GetTime( t1 );
-    ctrl->times.push_back( t1 );
+    recordTime( ctrl, TRACE_SAMPLE_END, 0, t1 );
 
     releaseCircularGraph( root );
 }
@@ -602,43 +847,41 @@ void EventBasedTest( throt_ctrl_t *ctrl ) {
 void EventNoThrottleBasedTest( throt_ctrl_t *ctrl ) {
     vector<ctrl_event_t>::iterator evt_it;
 
-    uint64_t cnt;
+    uint64_t cnt, move_bits = 0x9e3779b97f4a7c15ULL + ctrl->thread_idx;
+    int evt;
     string err;
 
+    StopTimer stop_timer;
+    if( !stop_timer.open( err ) ) {
+        printf( "Thread %d: %s\n", ctrl->thread_idx, err.c_str() );
+        return;
+    }
+
     node_t *root = new node_t();
 
-    TIME t1, stop;
+    TIME t1;
     GetTime( t1 );
-    ctrl->times.push_back( t1 );
+    recordTime( ctrl, TRACE_SAMPLE_BEGIN, 0, t1 );
 
     generateCircularGraph( root, ctrl->node_count );
     node_t *cur = root;
 
-    for( evt_it = ctrl->events.begin(); evt_it != ctrl->events.end(); evt_it++ ) {
+    for( evt_it = ctrl->events.begin(), evt = 0; evt_it != ctrl->events.end(); evt_it++, evt++ ) {
         GetTime( t1 );
-        ctrl->times.push_back( t1 );
-
-        stop.tv_sec = t1.tv_sec + evt_it->loop_sec_offset;
-        stop.FRAC = t1.FRAC;
+        recordTime( ctrl, TRACE_LOOP_BEGIN, evt, t1 );
 
-        cnt = 0;
-        do {
-            GetTime( t1 );
-            if( t1.FRAC % 2 ) {
-                cur = cur->next;
-            } else {
-                cur = cur->prev->prev;
-            }
-            cnt++;
-        } while( t1.tv_sec < stop.tv_sec || ( t1.tv_sec == stop.tv_sec && t1.FRAC < stop.FRAC ) );
+        if( !stop_timer.arm( t1 + secondsTIME( evt_it->loop_sec_offset ), err ) ) {
+            printf( "Thread %d: %s\n", ctrl->thread_idx, err.c_str() );
+            break;
+        }
+        cnt = walkBatches( cur, stop_timer, move_bits );
 
         GetTime( t1 );
-        ctrl->times.push_back( t1 );
-        ctrl->counts.push_back( cnt );
+        recordLoopEnd( ctrl, evt, t1, cnt, span_TIME( stop_timer.deadline(), t1 ), getSpeedShadow( ctrl->cpu_id ) );
     }
 
     GetTime( t1 );
-    ctrl->times.push_back( t1 );
+    recordTime( ctrl, TRACE_SAMPLE_END, 0, t1 );
 
     releaseCircularGraph( root );
 }
@@ -646,14 +889,20 @@ void EventNoThrottleBasedTest( throt_ctrl_t *ctrl ) {
 void EventNoThrottleBasedTestWeighted( throt_ctrl_t *ctrl ) {
     vector<ctrl_event_t>::iterator evt_it;
 
-    uint64_t cnt;
+    uint64_t cnt, move_bits = 0x9e3779b97f4a7c15ULL + ctrl->thread_idx;
     string err;
 
+    StopTimer stop_timer;
+    if( !stop_timer.open( err ) ) {
+        printf( "Thread %d: %s\n", ctrl->thread_idx, err.c_str() );
+        return;
+    }
+
     node_t *root = new node_t();
 
     TIME t1, stop;
     GetTime( t1 );
-    ctrl->times.push_back( t1 );
+    recordTime( ctrl, TRACE_SAMPLE_BEGIN, 0, t1 );
 
     //generateCircularGraph( root, ctrl->node_count );
     //generateRandomWeightedCircularGraph( root, ctrl->node_count, ctrl->algorithm );
@@ -688,15 +937,22 @@ void EventNoThrottleBasedTestWeighted( throt_ctrl_t *ctrl ) {
 
     int main_count = 0;
 
-    do {
-        GetTime( t1 );
-    } while( t1.tv_sec < ctrl->start_point.tv_sec || ( t1.tv_sec == ctrl->start_point.tv_sec && t1.FRAC < ctrl->start_point.FRAC ) );
+    DeadlineWaiter start_waiter( wait_mode, wait_spin_ns );
+    if( !start_waiter.open( err ) ) {
+        printf( "Thread %d: %s; spinning\n", ctrl->thread_idx, err.c_str() );
+    }
+    start_waiter.waitUntil( ctrl->start_point );
+    ctrl->start_wait = start_waiter.stat();
 
     while( !should_thread_exit() ) {
         GetTime( stop );
-        ctrl->times.push_back( stop );
+        recordTime( ctrl, TRACE_LOOP_BEGIN, main_count, stop );
 
-        stop.tv_sec = stop.tv_sec + 1;
+        stop += secondsTIME( 1 );
+        if( !stop_timer.arm( stop, err ) ) {
+            printf( "Thread %d: %s\n", ctrl->thread_idx, err.c_str() );
+            break;
+        }
 
         cnt = 0;
         val = val_base;
@@ -725,39 +981,41 @@ void EventNoThrottleBasedTestWeighted( throt_ctrl_t *ctrl ) {
             pthread_mutex_unlock( &( mute_transitions[ctrl->thread_idx] ) );
 
             val += 0.001;
-            GetTime( t1 );
-            if( t1.FRAC % 2 ) {
+            if( nextMoveBits( move_bits ) & 1 ) {
                 cur = cur->next;
             } else {
                 cur = cur->prev->prev;
             }
-            cnt++;
-        } while( t1.tv_sec < stop.tv_sec || ( t1.tv_sec == stop.tv_sec && t1.FRAC < stop.FRAC ) );
+        } while( ++cnt % LOOP_BATCH_MOVES || !stop_timer.expired() );
 
         GetTime( t1 );
-        ctrl->times.push_back( t1 );
-        ctrl->counts.push_back( cnt );
+        recordLoopEnd( ctrl, main_count, t1, cnt, span_TIME( stop, t1 ), getSpeedShadow( ctrl->cpu_id ) );
         main_count++;
     }
 
-    if( main_count < ( int ) ctrl->events.size() ) {
+    // a trace keeps every loop; its converter pads and trims instead
+    if( trace == NULL && main_count < ( int ) ctrl->events.size() ) {
         for( ; main_count < ( int ) ctrl->events.size(); main_count++ ) {
             GetTime( t1 );
             ctrl->times.push_back( t1 );
             GetTime( t1 );
             ctrl->times.push_back( t1 );
             ctrl->counts.push_back( 0 );
+            ctrl->stop_lags.push_back( 0 );
+            ctrl->speeds.push_back( 0 );
         }
-    } else {
+    } else if( trace == NULL ) {
         for( ; main_count > ( int ) ctrl->events.size(); main_count-- ) {
             ctrl->times.pop_back();
             ctrl->times.pop_back();
             ctrl->counts.pop_back();
+            ctrl->stop_lags.pop_back();
+            ctrl->speeds.pop_back();
         }
     }
 
     GetTime( t1 );
-    ctrl->times.push_back( t1 );
+    recordTime( ctrl, TRACE_SAMPLE_END, 0, t1 );
 
     releaseCircularGraph( root );
 }
@@ -776,9 +1034,17 @@ void EventNoThrottleBasedTestWeightedNoGraph( throt_ctrl_t *ctrl ) {
 
     gsl_rng_set( r, 1234567 );
 
-    TIME t1, stop;
+    StopTimer stop_timer;
+    if( !stop_timer.open( err ) ) {
+        printf( "Thread %d: %s\n", ctrl->thread_idx, err.c_str() );
+        gsl_rng_free( r );
+        return;
+    }
+
+    TIME t1, stop, batch_start;
+    LatencyHistogram *batch_ns;
     GetTime( t1 );
-    ctrl->times.push_back( t1 );
+    recordTime( ctrl, TRACE_SAMPLE_BEGIN, 0, t1 );
 
 
     double max_weight = 0.0;
@@ -794,9 +1060,12 @@ void EventNoThrottleBasedTestWeightedNoGraph( throt_ctrl_t *ctrl ) {
 
     int main_count = 0, idx = 0;
 
-    do {
-        GetTime( t1 );
-    } while( t1.tv_sec < ctrl->start_point.tv_sec || ( t1.tv_sec == ctrl->start_point.tv_sec && t1.FRAC < ctrl->start_point.FRAC ) );
+    DeadlineWaiter start_waiter( wait_mode, wait_spin_ns );
+    if( !start_waiter.open( err ) ) {
+        printf( "Thread %d: %s; spinning\n", ctrl->thread_idx, err.c_str() );
+    }
+    start_waiter.waitUntil( ctrl->start_point );
+    ctrl->start_wait = start_waiter.stat();
 
     double( *max_weight_func )( double ) = NULL;
 
@@ -829,9 +1098,17 @@ void EventNoThrottleBasedTestWeightedNoGraph( throt_ctrl_t *ctrl ) {
         pthread_mutex_unlock( &( mute_weights[ctrl->thread_idx] ) );
 
         GetTime( stop );
-        ctrl->times.push_back( stop );
+        recordTime( ctrl, TRACE_LOOP_BEGIN, main_count, stop );
 
-        stop.tv_sec = stop.tv_sec + 1;
+        // batches are filed under the speed the loop starts at
+        batch_ns = &ctrl->batch_ns[getSpeedShadow( ctrl->cpu_id )];
+        batch_start = stop;
+
+        stop += secondsTIME( 1 );
+        if( !stop_timer.arm( stop, err ) ) {
+            printf( "Thread %d: %s\n", ctrl->thread_idx, err.c_str() );
+            break;
+        }
 
         cnt = 0;
         val = val_base;
@@ -864,7 +1141,10 @@ void EventNoThrottleBasedTestWeightedNoGraph( throt_ctrl_t *ctrl ) {
             pthread_mutex_unlock( &( mute_transitions[ctrl->thread_idx] ) );
 
             val += 0.001;
-        } while( ++cnt < 500000 );
+            if( ++cnt % LOOP_BATCH_MOVES == 0 ) {
+                timeBatch( batch_ns, batch_start );
+            }
+        } while( cnt < 500000 );
 
         do {
             if(max_weight_func != NULL) {
@@ -877,36 +1157,43 @@ void EventNoThrottleBasedTestWeightedNoGraph( throt_ctrl_t *ctrl ) {
             ctrl->transitions[ trans_idx ]++;
             pthread_mutex_unlock( &( mute_transitions[ctrl->thread_idx] ) );
 
-
-            GetTime( t1 );
-            cnt++;
             val += 0.001;
-        } while( t1.tv_sec < stop.tv_sec || ( t1.tv_sec == stop.tv_sec && t1.FRAC < stop.FRAC ) );
+            if( ++cnt % LOOP_BATCH_MOVES == 0 ) {
+                timeBatch( batch_ns, batch_start );
+                if( stop_timer.expired() ) {
+                    break;
+                }
+            }
+        } while( true );
 
         GetTime( t1 );
-        ctrl->times.push_back( t1 );
-        ctrl->counts.push_back( cnt );
+        recordLoopEnd( ctrl, main_count, t1, cnt, span_TIME( stop, t1 ), getSpeedShadow( ctrl->cpu_id ) );
         main_count++;
     }
 
-    if( main_count < ( int ) ctrl->events.size() ) {
+    // a trace keeps every loop; its converter pads and trims instead
+    if( trace == NULL && main_count < ( int ) ctrl->events.size() ) {
         for( ; main_count < ( int ) ctrl->events.size(); main_count++ ) {
             GetTime( t1 );
             ctrl->times.push_back( t1 );
             GetTime( t1 );
             ctrl->times.push_back( t1 );
             ctrl->counts.push_back( 0 );
+            ctrl->stop_lags.push_back( 0 );
+            ctrl->speeds.push_back( 0 );
         }
-    } else {
+    } else if( trace == NULL ) {
         for( ; main_count > ( int ) ctrl->events.size(); main_count-- ) {
             ctrl->times.pop_back();
             ctrl->times.pop_back();
             ctrl->counts.pop_back();
+            ctrl->stop_lags.pop_back();
+            ctrl->speeds.pop_back();
         }
     }
 
     GetTime( t1 );
-    ctrl->times.push_back( t1 );
+    recordTime( ctrl, TRACE_SAMPLE_END, 0, t1 );
 
     //releaseCircularGraph( root );
     gsl_rng_free( r );
@@ -915,17 +1202,71 @@ void EventNoThrottleBasedTestWeightedNoGraph( throt_ctrl_t *ctrl ) {
 void *EventThreads( void *args ) {
     throt_ctrl_t *ctrl = ( throt_ctrl_t * ) args;
 
+    __atomic_store_n( &ctrl->tid, currentTid(), __ATOMIC_RELEASE );
+
     if( ctrl->algorithm != THREAD_SELF_THROTTLE ) {
         EventNoThrottleBasedTestWeightedNoGraph( ctrl );
     } else {
         EventBasedTest( ctrl );
     }
 
+    // the kernel may hand the id to another thread once this one is gone
+    __atomic_store_n( &ctrl->tid, 0, __ATOMIC_RELEASE );
 
     pthread_exit( NULL );
 }
 
-void printParallelThreadsTable( map<int, string> &userspace_cpu, throt_ctrl_t *throts, int samplings, int thread_count ) {
+// kernel cpufreq statistics of every cpu of the test
+void snapshotCpuFreqStats( map<int, string> &userspace_cpu, map<int, cpufreq_stats_t> &stats ) {
+    static bool reported = false;
+    string err;
+
+    for( map<int, string>::iterator cpu_it = userspace_cpu.begin(); cpu_it != userspace_cpu.end(); cpu_it++ ) {
+        if( !readCpuFreqStats( cpu_it->first, stats[cpu_it->first], err ) && !reported ) {
+            printf( "# CPU%d: %s; residency is not reported\n", cpu_it->first, err.c_str() );
+            reported = true;
+        }
+    }
+}
+
+void diffSampleStats( map<int, cpufreq_stats_t> &before, map<int, cpufreq_stats_t> &after, map<int, cpufreq_stats_t> &delta ) {
+    for( map<int, cpufreq_stats_t>::iterator it = after.begin(); it != after.end(); it++ ) {
+        diffCpuFreqStats( before[it->first], it->second, delta[it->first] );
+    }
+}
+
+void scheduleOf( vector<ctrl_event_t> &events, speed_schedule_t &schedule ) {
+    schedule = speed_schedule_t();
+    for( vector<ctrl_event_t>::iterator it = events.begin(); it != events.end(); it++ ) {
+        schedule.khz.push_back( atoi( it->throt_speed.c_str() ) );
+        schedule.seconds.push_back( it->loop_sec_offset );
+    }
+}
+
+// residency, transitions and agreement of a sample's cpu with the thread's schedule
+void printSampleStats( cpufreq_stats_t &delta, vector<ctrl_event_t> &events ) {
+    speed_schedule_t schedule;
+    schedule_check_t check;
+    string residency;
+
+    if( !delta.valid ) {
+        printf( "\t-\t-\t-\t-" );
+        return;
+    }
+
+    scheduleOf( events, schedule );
+    checkSchedule( delta, schedule, check );
+    formatResidency( delta, residency );
+
+    printf( "\t%s\t%lu", residency.c_str(), ( unsigned long ) delta.total_trans );
+    if( check.agreement < 0.0 ) {
+        printf( "\t-\t-" );
+    } else {
+        printf( "\t%.3f\t%s", check.agreement, check.flagged ? "FLAGGED" : "ok" );
+    }
+}
+
+void printParallelThreadsTable( map<int, string> &userspace_cpu, throt_ctrl_t *throts, int samplings, int thread_count, vector< map<int, cpufreq_stats_t> > &sample_stats ) {
     vector<TIME>::iterator times_it;
     vector<uint64_t>::iterator cnt_it;
     vector<ctrl_event_t>::iterator events_it;
@@ -940,14 +1281,14 @@ void printParallelThreadsTable( map<int, string> &userspace_cpu, throt_ctrl_t *t
 
     printf( "#\t\t\t\t" );
     for( i = 1; i <= event_count; ++i ) {
-        printf( "Throttle #%d\t\t\tIteration #%d\t\t\t", i, i );
+        printf( "Throttle #%d\t\t\tIteration #%d\t\t\t\t", i, i );
     }
     printf( "\n" );
     printf( "#Sample\tCPU ID\tThread ID\tBegin\t" );
     for( i = 0; i < event_count; ++i ) {
-        printf( "Start (%s)\tFrequency\tEnd (%s)\tStart (%s)\tNodes Visited\tEnd (%s)\t", TIME_ABRV, TIME_ABRV, TIME_ABRV, TIME_ABRV );
+        printf( "Start (%s)\tFrequency\tEnd (%s)\tStart (%s)\tNodes Visited\tEnd (%s)\tStop Lag (%s)\t", TIME_ABRV, TIME_ABRV, TIME_ABRV, TIME_ABRV, TIME_ABRV );
     }
-    printf( "Finish\n" );
+    printf( "Finish\tResidency (kHz:ms)\tTransitions\tAgreement\tStatus\n" );
 
     for( j = 0; j < samplings; j++ ) {
         printf( "%d", j );
@@ -984,10 +1325,11 @@ void printParallelThreadsTable( map<int, string> &userspace_cpu, throt_ctrl_t *t
                     printf( "%lu\t", throts[throt_idx].counts[j * event_count + l] );
 
                     PrintTime( t2 );
-                    printf( "\t" );
+                    printf( "\t%lu\t", throts[throt_idx].stop_lags[j * event_count + l] );
                 }
                 k += time_offset - 2;
                 PrintTime( throts[throt_idx].times[k] );
+                printSampleStats( sample_stats[j][cpu_it->first], throts[throt_idx].events );
                 printf( "\n" );
             }
         }
@@ -1009,12 +1351,12 @@ void printParallelNoThrottleThreadsTable( map<int, string> &userspace_cpu, throt
 
     printf( "#\t\t\t\t" );
     for( i = 1; i <= event_count; ++i ) {
-        printf( "Iteration #%d\t\t\t", i );
+        printf( "Iteration #%d\t\t\t\t", i );
     }
     printf( "\n" );
     printf( "#Sample\tCPU ID\tThread ID\tBegin\t" );
     for( i = 0; i < event_count; ++i ) {
-        printf( "Start (%s)\tNodes Visited\tEnd (%s)\t", TIME_ABRV, TIME_ABRV );
+        printf( "Start (%s)\tNodes Visited\tEnd (%s)\tStop Lag (%s)\t", TIME_ABRV, TIME_ABRV, TIME_ABRV );
     }
     printf( "Finish\n" );
 
@@ -1053,9 +1395,7 @@ void printParallelNoThrottleThreadsTable( map<int, string> &userspace_cpu, throt
                     printf( "%lu\t", throts[throt_idx].counts[j * event_count + l] );
 
                     PrintTime( t2 );
-                    printf( "\t" );
-
-
+                    printf( "\t%lu\t", throts[throt_idx].stop_lags[j * event_count + l] );
                 }
                 k += time_offset - 2;
                 PrintTime( throts[throt_idx].times[k] );
@@ -1065,6 +1405,226 @@ void printParallelNoThrottleThreadsTable( map<int, string> &userspace_cpu, throt
     }
 }
 
+// Raw and overhead corrected node visit rates of every loop.  The correction
+// removes the instrumentation a visit carries beyond the move itself, as
+// calibrated at the speed the loop ran at.  times_per_event is 4 when each
+// event records its throttle, else 2.  Every loop pays for a stop check per
+// batch and the weighted loops for the transition matrix mutex and a batch
+// timestamp; the walk's direction pick overlaps the pointer chase and is
+// counted as work.
+void printThroughputTable( map<int, string> &userspace_cpu, throt_ctrl_t *throts, int samplings, int thread_count, int times_per_event, bool weighted ) {
+    map<int, string>::iterator cpu_it;
+    const overhead_t *o;
+    int j, l, k, throt_idx, thd_idx;
+
+    int event_count = throts[0].events.size();
+    int time_offset = 2 + times_per_event * event_count;
+
+    printf( "#Sample\tCPU ID\tThread ID\tIteration\tkHz\tNodes Visited\tElapsed (%s)\tNodes/s\tOverhead (ns/node)\tInstrumented (%%)\tCorrected Nodes/s\n", TIME_ABRV );
+    for( j = 0; j < samplings; j++ ) {
+        throt_idx = 0;
+        for( cpu_it = userspace_cpu.begin(); cpu_it != userspace_cpu.end(); cpu_it++ ) {
+            for( thd_idx = 0; thd_idx < thread_count; ++thd_idx, ++throt_idx ) {
+                throt_ctrl_t &throt = throts[throt_idx];
+
+                for( l = 0; l < event_count; ++l ) {
+                    k = j * time_offset + 1 + times_per_event * l + times_per_event - 2;
+                    uint64_t nodes = throt.counts[j * event_count + l];
+                    uint64_t elapsed = span_TIME( throt.times[k], throt.times[k + 1] );
+                    int khz = throt.speeds[j * event_count + l];
+
+                    printf( "%d\t%d\t%d\t%d\t%d\t%lu\t%lu\t%.0f", j, cpu_it->first, throt_idx, l + 1, khz, nodes, elapsed,
+                            elapsed > 0 ? nodes * 1e9 / elapsed : 0.0 );
+
+                    if(( o = overheads.at( khz ) ) == NULL || khz <= 0 ) {
+                        printf( "\t-\t-\t-\n" );
+                        continue;
+                    }
+
+                    double per_node = ( weighted ? o->mutex_ns + o->time_ns / LOOP_BATCH_MOVES : 0.0 ) + o->stop_check_ns / LOOP_BATCH_MOVES;
+                    double work_ns = elapsed - nodes * per_node;
+
+                    // corrections near 100% instrumented are within the calibration noise
+                    printf( "\t%.3f\t%.1f", per_node, elapsed > 0 ? 100.0 * nodes * per_node / elapsed : 0.0 );
+                    if( work_ns > 0 ) {
+                        printf( "\t%.0f\n", nodes * 1e9 / work_ns );
+                    } else {
+                        printf( "\t-\n" );
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Calibrate the instrumentation overheads on cpu_idx, or reuse the ones
+// saved in path by an earlier run on this machine.
+void prepareOverheads( int cpu_idx, bool force, const string &path ) {
+    FrequencyTable freqs;
+    string err;
+
+    fillAvailableThrottlingSpeeds( freqs, 1 );
+
+    if( !force && !path.empty() ) {
+        if( overheads.load( path, err ) && overheads.covers( freqs ) ) {
+            printf( "# Instrumentation overheads loaded from %s\n", path.c_str() );
+            overheads.print();
+            return;
+        }
+        printf( "# Recalibrating overheads: %s\n", err.empty() ? "speeds changed" : err.c_str() );
+    }
+
+    printf( "# Calibrating instrumentation overheads on CPU %d at %d speeds\n", cpu_idx, freqs.size() );
+    if( !calibrateOverheads( cpu_idx, freqs, overheads, err ) ) {
+        printf( "Unable to calibrate overheads: %s\n", err.c_str() );
+    }
+    overheads.print();
+
+    if( !path.empty() && !overheads.empty() && !overheads.save( path, err ) ) {
+        printf( "%s\n", err.c_str() );
+    }
+}
+
+// Clamp every worker thread to khz; used in place of per core decisions.
+// What the weighted test's controller reports each tick.  The records are
+// formatted here, either inline or by the logger thread.
+enum ctrl_log_kind_t {
+    LOG_TICK_TIME,
+    LOG_MATRIX,         // id: thread, values: transition counts
+    LOG_THROTTLE,       // id: thread, values: old and new kHz
+    LOG_BATCH,          // values: applied, failed, writes, conflicts, latency, skew
+    LOG_UNTHROTTLED,    // id: cpu
+    LOG_CONFLICT,       // id: cpu, values: frequency domain, applied kHz
+    LOG_SWAP_BEGIN,
+    LOG_SWAP_PAIR,      // values: the two threads
+    LOG_SWAP_END
+};
+
+// ring of the controller while the logger thread runs
+LogRing *ctrl_log = NULL;
+
+void formatCtrlRecord( const log_record_t &rec ) {
+    switch( rec.kind ) {
+    case LOG_TICK_TIME:
+        PrintTime( rec.time );
+        printf( "\n" );
+        break;
+    case LOG_MATRIX:
+        printf( "%d\t", rec.id );
+        for( int i = 0; i < rec.count; i++ ) {
+            printf( "%ld\t", rec.values[i] );
+        }
+        printf( "\n" );
+        break;
+    case LOG_THROTTLE:
+        printf( "Throttling Thread %d: %ld -> %ld\n", rec.id, rec.values[0], rec.values[1] );
+        break;
+    case LOG_BATCH:
+        printf( "Batch applied %ld failed %ld writes %ld conflicts %ld latency %ld %s skew %ld %s\n", rec.values[0], rec.values[1], rec.values[2],
+                rec.values[3], rec.values[4], TIME_ABRV, rec.values[5], TIME_ABRV );
+        break;
+    case LOG_UNTHROTTLED:
+        printf( "Unable to throttle CPU %d\n", rec.id );
+        break;
+    case LOG_CONFLICT:
+        printf( "Conflicting speed for CPU %d in frequency domain %ld; applied %ld\n", rec.id, rec.values[0], rec.values[1] );
+        break;
+    case LOG_SWAP_BEGIN:
+        printf( "Swapping weights:\n" );
+        break;
+    case LOG_SWAP_PAIR:
+        printf( " %ld <-> %ld;", rec.values[0], rec.values[1] );
+        break;
+    case LOG_SWAP_END:
+        printf( "\n" );
+        break;
+    }
+}
+
+// a full ring drops the record, as the counts printed at the end show
+void logCtrlRecord( const log_record_t &rec ) {
+    if( ctrl_log != NULL ) {
+        ctrl_log->push( rec );
+    } else {
+        formatCtrlRecord( rec );
+    }
+}
+
+void logCtrl( int kind, int id = 0, int64_t v0 = 0, int64_t v1 = 0 ) {
+    log_record_t rec;
+
+    rec.time = 0;
+    rec.kind = kind;
+    rec.id = id;
+    rec.count = 2;
+    rec.values[0] = v0;
+    rec.values[1] = v1;
+
+    logCtrlRecord( rec );
+}
+
+void logCtrlTime( TIME t ) {
+    log_record_t rec;
+
+    rec.time = t;
+    rec.kind = LOG_TICK_TIME;
+    rec.count = 0;
+
+    logCtrlRecord( rec );
+}
+
+void logCtrlMatrix( int thread, const int *row, int count ) {
+    log_record_t rec;
+
+    rec.time = 0;
+    rec.kind = LOG_MATRIX;
+    rec.id = thread;
+    rec.count = min( count, LOG_RECORD_VALUES );
+    for( int i = 0; i < rec.count; i++ ) {
+        rec.values[i] = row[i];
+    }
+
+    logCtrlRecord( rec );
+}
+
+void logCtrlBatch( batch_stat_t &stat ) {
+    log_record_t rec;
+
+    rec.time = 0;
+    rec.kind = LOG_BATCH;
+    rec.id = 0;
+    rec.count = 6;
+    rec.values[0] = stat.applied;
+    rec.values[1] = stat.failed;
+    rec.values[2] = stat.writes;
+    rec.values[3] = stat.conflicts;
+    rec.values[4] = span_TIME( stat.submitted, stat.last_done );
+    rec.values[5] = span_TIME( stat.first_done, stat.last_done );
+
+    logCtrlRecord( rec );
+}
+
+// a traced run leaves its tables to TraceConvert
+void printTraceSummary() {
+    printf( "# Trace holds %lu records, %lu dropped\n", trace->size(), trace->dropped() );
+}
+
+void clampThreads( throt_ctrl_t *throts, int thread_total, int khz ) {
+    string err;
+
+    for( int idx = 0; idx < thread_total; idx++ ) {
+        // a thread not yet running is clamped on the next tick; tid 0 would
+        // clamp the controller itself
+        pid_t tid = __atomic_load_n( &throts[idx].tid, __ATOMIC_ACQUIRE );
+        if( tid == 0 ) {
+            continue;
+        }
+        if( !uclamp_actuator->setSpeed( tid, khz, err ) ) {
+            printf( "Unable to clamp Thread %d: %s\n", idx, err.c_str() );
+        }
+    }
+}
+
 void TestParallelWeightedThreads( map<int, string> &userspace_cpu, bool is_static, int samplings, int thread_count ) {
     int rc;
     void *status;
@@ -1079,10 +1639,10 @@ void TestParallelWeightedThreads( map<int, string> &userspace_cpu, bool is_stati
     printf( "Using %d processors\n", ( int )userspace_cpu.size() );
 
     int node_count = 1000000;
-    map<int, string> cpu_avail_freq;
+    FrequencyTable cpu_avail_freq;
     map<int, string>::iterator cpu_it;
 
-    map<int, string>::iterator freq_it;
+    int freq_idx;
 
     int max_threads = thread_count * userspace_cpu.size();
 
@@ -1090,7 +1650,7 @@ void TestParallelWeightedThreads( map<int, string> &userspace_cpu, bool is_stati
     mute_weights = new pthread_mutex_t[max_threads];
 
     pthread_t threads[max_threads];
-    cpu_set_t cpus[max_threads];
+    vector<CpuMask> cpus( max_threads );
     pthread_attr_t thread_attrs[max_threads];
 
     throt_ctrl_t throts[max_threads];
@@ -1099,7 +1659,41 @@ void TestParallelWeightedThreads( map<int, string> &userspace_cpu, bool is_stati
     fillAvailableThrottlingSpeeds( cpu_avail_freq, 1 );
     int i, j, idx;
 
-    TIME t_stop, reset_timer, t1;
+    FreqActuator actuator;
+    BatchActuator batch_actuator( actuator, batch_writers );
+    vector<freq_decision_t> decisions;
+    batch_stat_t batch_stat;
+
+    if( uclamp_actuator == NULL && ( !actuator.open( userspace_cpu, err ) || !batch_actuator.start( err ) ) ) {
+        printf( "Unable to initialize frequency actuator: %s\n", err.c_str() );
+        return;
+    }
+
+    TIME t_stop, reset_timer, t1, woke;
+
+    DeadlineWaiter tick_waiter( wait_mode, wait_spin_ns );
+    wait_stat_t start_stat;
+    if( !tick_waiter.open( err ) ) {
+        printf( "%s; controller will spin\n", err.c_str() );
+    }
+
+    // time from each tick's wake up to its decisions being applied
+    LatencyHistogram decide_ns;
+    map<visit_key_t, LatencyHistogram> visit_latency;
+    map<int, LatencyHistogram>::iterator hist_it;
+
+    AsyncLogger logger( formatCtrlRecord );
+    if( log_cpu >= 0 ) {
+        if( userspace_cpu.count( log_cpu ) ) {
+            printf( "# Logger shares measurement CPU %d\n", log_cpu );
+        }
+        ctrl_log = logger.addProducer();
+        if( !logger.start( log_cpu, err ) ) {
+            printf( "%s; logging inline\n", err.c_str() );
+            ctrl_log = NULL;
+            log_cpu = -1;
+        }
+    }
 
     // record node counts every second
     // MIN is simply a place holder in example because threads are not self throttling
@@ -1151,12 +1745,12 @@ void TestParallelWeightedThreads( map<int, string> &userspace_cpu, bool is_stati
     // initialize throttling controls
     for( cpu_it = userspace_cpu.begin(), i = 0; cpu_it != userspace_cpu.end(); cpu_it++, i++, algo_type++ ) {
         for( j = 0; j < thread_count; ++j, ++idx, trans_buffer_ptr += double_matrix_size, weights_ptr += ALGO_COUNT ) {
-            CPU_ZERO( &cpus[idx] );
-            CPU_SET( cpu_it->first, &cpus[idx] );
+            cpus[idx].clear();
+            cpus[idx].set( cpu_it->first );
             pthread_attr_init( &thread_attrs[idx] );
             // pthread_attr_setscope(&thread_attrs[idx], PTHREAD_SCOPE_SYSTEM);   // explicitly state the each thread is its own process; (END result - no effect from either scope; something must be overriding)
 
-            int val = pthread_attr_setaffinity_np( &thread_attrs[idx], sizeof( cpu_set_t ), &cpus[idx] );
+            int val = pthread_attr_setaffinity_np( &thread_attrs[idx], cpus[idx].size(), cpus[idx].get() );
 
             if( val ) {
                 printf( "Set Affinity Fail: %s\n", strerror( val ) );
@@ -1178,13 +1772,17 @@ void TestParallelWeightedThreads( map<int, string> &userspace_cpu, bool is_stati
         }
     }
 
+    if( trace != NULL ) {
+        trace->setLayout( false, samplings, max_threads, throts[0].events.size() );
+    }
+
     int iteration = 0;
     for( int samp = 0; samp < samplings; ++samp ) {
 
         memset( trans_buffers, 0, double_buffered_matrix_bytes );
         trans_buffer_ptr = trans_buffers;
         GetTime( t_stop );
-        t_stop.tv_sec += 5;
+        t_stop += secondsTIME( 5 );
 
         for( idx = 0; idx < max_threads; idx++, trans_buffer_ptr += double_matrix_size ) {
             throts[idx].transitions = trans_buffer_ptr;
@@ -1197,6 +1795,7 @@ void TestParallelWeightedThreads( map<int, string> &userspace_cpu, bool is_stati
         end_thread = false;
         for( cpu_it = userspace_cpu.begin(), i = 0; cpu_it != userspace_cpu.end(); cpu_it++, i++ ) {
             for( j = 0; j < thread_count; ++j, ++idx ) {
+                throts[idx].tid = 0;
                 if(( rc = pthread_create( &threads[idx], &thread_attrs[idx], EventThreads, ( void * ) &throts[idx] ) ) ) {
                     printf( "Error creating threads\n" );
                     return;
@@ -1204,36 +1803,39 @@ void TestParallelWeightedThreads( map<int, string> &userspace_cpu, bool is_stati
             }
         }
 
-        do {
-            GetTime( t1 );
-        } while( t1.tv_sec < t_stop.tv_sec || ( t1.tv_sec == t_stop.tv_sec && t1.FRAC < t_stop.FRAC ) );
+        tick_waiter.waitUntil( t_stop );
 
         if( is_static ) {
-            freq_it = cpu_avail_freq.begin();
-            freq_it++;
-            for( cpu_it = userspace_cpu.begin(); cpu_it != userspace_cpu.end() && freq_it != cpu_avail_freq.end(); cpu_it++ ) {
-                printf("CPU %d -> %d\n", cpu_it->first, freq_it->first);
-                if( !setCPUThrottledSpeed( cpu_it->first, freq_it->second, err ) ) {
-                    printf( "Unalbe to throttle CPU %d\n", cpu_it->first );
-                    break;
+            freq_idx = cpu_avail_freq.nextUp( cpu_avail_freq.minIndex() );
+            decisions.clear();
+            for( cpu_it = userspace_cpu.begin(); cpu_it != userspace_cpu.end(); cpu_it++ ) {
+                printf("CPU %d -> %d\n", cpu_it->first, cpu_avail_freq.khz( freq_idx ) );
+                decisions.push_back( freq_decision_t( cpu_it->first, cpu_avail_freq.speed( freq_idx ) ) );
+            }
+
+            if( uclamp_actuator != NULL ) {
+                clampThreads( throts, max_threads, cpu_avail_freq.khz( freq_idx ) );
+                decisions.clear();
+            } else {
+                batch_actuator.apply( decisions, batch_stat );
+                printBatchStat( batch_stat );
+            }
+            for( vector<freq_decision_t>::iterator dec_it = decisions.begin(); dec_it != decisions.end(); dec_it++ ) {
+                if( !dec_it->applied ) {
+                    printf( "Unalbe to throttle CPU %d\n", dec_it->cpu_idx );
                 }
             }
 
             GetTime( t_stop );
-            t_stop.tv_sec = t_stop.tv_sec + 22;
+            t_stop += secondsTIME( 22 );
 
             iteration = 0;
+            reset_timer = t_stop - secondsTIME( 22 );
             do {
-                GetTime( reset_timer );
-
-                reset_timer.tv_sec += 1;
+                reset_timer += secondsTIME( 1 );
+                t1 = woke = tick_waiter.waitUntil( reset_timer );
 
-                do {
-                    GetTime( t1 );
-                } while( t1.tv_sec < reset_timer.tv_sec || ( t1.tv_sec == reset_timer.tv_sec && t1.FRAC < reset_timer.FRAC ) );
-
-                PrintTime( t1 );
-                printf( "\n" );
+                logCtrlTime( t1 );
                 trans_buffer_ptr = trans_buffers;
                 if( !( iteration & 1 ) ) {
                     trans_buffer_ptr += algo_matrix_size;
@@ -1248,8 +1850,7 @@ void TestParallelWeightedThreads( map<int, string> &userspace_cpu, bool is_stati
 
 
                 GetTime( t1 );
-                PrintTime( t1 );
-                printf( "\n" );
+                logCtrlTime( t1 );
 
                 trans_buffer_ptr = trans_buffers;
                 if( iteration & 1 ) {
@@ -1258,24 +1859,21 @@ void TestParallelWeightedThreads( map<int, string> &userspace_cpu, bool is_stati
 
                 // analyze previous buffer
                 for( idx = 0; idx < max_threads; idx++, trans_buffer_ptr += algo_matrix_size ) {
-                    printf( "%d\t", idx );
-                    // print transition matrix, and clear values
+                    // log transition matrix, and clear values
+                    logCtrlMatrix( idx, trans_buffer_ptr, algo_matrix_size );
                     for( i = 0; i < algo_matrix_size; i++, trans_buffer_ptr += 1 ) {
-                        printf( "%d\t", *trans_buffer_ptr );
                         *trans_buffer_ptr = 0;
-
                     }
-                    printf( "\n" );
                 }
 
 
                 GetTime( t1 );
-                PrintTime( t1 );
-                printf( "\n" );
+                logCtrlTime( t1 );
+                decide_ns.record( span_TIME( woke, t1 ) );
 
                 // swap weight profiles after 5 iterations
                 if(( ++iteration ) % 5 == 0 ) {
-                    printf( "Swapping weights:\n" );
+                    logCtrl( LOG_SWAP_BEGIN );
                     for( idx = 0; idx < max_threads; idx++ ) {
                         pthread_mutex_lock( &( mute_weights[idx] ) );
                     }
@@ -1285,50 +1883,58 @@ void TestParallelWeightedThreads( map<int, string> &userspace_cpu, bool is_stati
                             weights_ptr = throts[idx].weights;
                             throts[idx].weights = throts[i].weights;
                             throts[i].weights = weights_ptr;
-                            printf( " %d <-> %d;", idx, i );
+                            logCtrl( LOG_SWAP_PAIR, 0, idx, i );
                         }
                     } else {
                         for( idx = 0, i = 1; i < max_threads; idx += 2, i += 2 ) {
                             weights_ptr = throts[idx].weights;
                             throts[idx].weights = throts[i].weights;
                             throts[i].weights = weights_ptr;
-                            printf( " %d <-> %d;", idx, i );
+                            logCtrl( LOG_SWAP_PAIR, 0, idx, i );
                         }
                     }
 
                     for( idx = 0; idx < max_threads; idx++ ) {
                         pthread_mutex_unlock( &( mute_weights[idx] ) );
                     }
-                    printf( "\n" );
+                    logCtrl( LOG_SWAP_END );
                 }
-            } while( t1.tv_sec < t_stop.tv_sec || ( t1.tv_sec == t_stop.tv_sec && t1.FRAC < t_stop.FRAC ) );
+            } while( t1 < t_stop );
         } else {
             // set all cores to be 1 step above the lowest operating frequency
-            freq_it = cpu_avail_freq.begin();
-            freq_it++;
-            for( cpu_it = userspace_cpu.begin(), idx = 0; cpu_it != userspace_cpu.end(); cpu_it++, idx++ ) {
-                if( !setCPUThrottledSpeed( cpu_it->first, freq_it->second, err ) ) {
-                    printf( "Unalbe to throttle CPU %d\n", cpu_it->first );
-                    break;
+            freq_idx = cpu_avail_freq.nextUp( cpu_avail_freq.minIndex() );
+            decisions.clear();
+            for( cpu_it = userspace_cpu.begin(); cpu_it != userspace_cpu.end(); cpu_it++ ) {
+                decisions.push_back( freq_decision_t( cpu_it->first, cpu_avail_freq.speed( freq_idx ) ) );
+            }
+
+            if( uclamp_actuator != NULL ) {
+                clampThreads( throts, max_threads, cpu_avail_freq.khz( freq_idx ) );
+                decisions.clear();
+            } else {
+                batch_actuator.apply( decisions, batch_stat );
+                printBatchStat( batch_stat );
+            }
+            for( vector<freq_decision_t>::iterator dec_it = decisions.begin(); dec_it != decisions.end(); dec_it++ ) {
+                if( !dec_it->applied ) {
+                    printf( "Unalbe to throttle CPU %d\n", dec_it->cpu_idx );
                 }
-                throt_profile[idx] = freq_it->first;
+            }
+
+            for( idx = 0; idx < max_threads; idx++ ) {
+                throt_profile[idx] = cpu_avail_freq.khz( freq_idx );
             }
 
             GetTime( t_stop );
 
-            t_stop.tv_sec = t_stop.tv_sec + 22;
-iteration = 0;
+            t_stop += secondsTIME( 22 );
+            iteration = 0;
+            reset_timer = t_stop - secondsTIME( 22 );
             do {
-                GetTime( reset_timer );
-
-                reset_timer.tv_sec += 1;
+                reset_timer += secondsTIME( 1 );
+                t1 = woke = tick_waiter.waitUntil( reset_timer );
 
-                do {
-                    GetTime( t1 );
-                } while( t1.tv_sec < reset_timer.tv_sec || ( t1.tv_sec == reset_timer.tv_sec && t1.FRAC < reset_timer.FRAC ) );
-
-                PrintTime( t1 );
-                printf( "\n" );
+                logCtrlTime( t1 );
                 trans_buffer_ptr = trans_buffers;
                 if( !( iteration & 1 ) ) {
                     trans_buffer_ptr += algo_matrix_size;
@@ -1343,8 +1949,7 @@ iteration = 0;
 
 
                 GetTime( t1 );
-                PrintTime( t1 );
-                printf( "\n" );
+                logCtrlTime( t1 );
 
                 trans_buffer_ptr = trans_buffers;
                 if( iteration & 1 ) {
@@ -1353,42 +1958,64 @@ iteration = 0;
 
                 // analyze previous buffer
                 for( idx = 0; idx < max_threads; idx++, trans_buffer_ptr += algo_matrix_size ) {
-                    printf( "%d\t", idx );
                     thread_throt_profile[idx].first = 0;
-                    // print transition matrix, and clear values
+                    // log transition matrix, and clear values
+                    logCtrlMatrix( idx, trans_buffer_ptr, algo_matrix_size );
                     for( i = 0; i < algo_matrix_size; i++, trans_buffer_ptr += 1 ) {
-                        printf( "%d\t", *trans_buffer_ptr );
                         if(thread_throt_profile[idx].first < *trans_buffer_ptr) {
                             thread_throt_profile[idx].first = *trans_buffer_ptr;
                             thread_throt_profile[idx].second = i;
                         }
                         *trans_buffer_ptr = 0;
                     }
-                    printf( "\n" );
                 }
 
-                for(idx = 0, cpu_it = userspace_cpu.begin(); idx < max_threads; idx++, cpu_it++) {
+                // collect every core's decision for this tick and apply them as one batch
+                decisions.clear();
+                for( idx = 0; idx < max_threads; idx++ ) {
                     if( thread_throt_profile[idx].second / ALGO_COUNT == thread_throt_profile[idx].second % ALGO_COUNT ) {
-                        for(i = thread_throt_profile[idx].second % ALGO_COUNT, freq_it = cpu_avail_freq.begin(); i > 0; i--, freq_it++);
-
-                        if(throt_profile[idx] != freq_it->first) {
-                            if( !setCPUThrottledSpeed( cpu_it->first, freq_it->second, err ) ) {
-                                printf( "Unable to throttle CPU %d\n", cpu_it->first );
-                                break;
+                        freq_idx = min( thread_throt_profile[idx].second % ALGO_COUNT, cpu_avail_freq.maxIndex() );
+
+                        if(throt_profile[idx] != cpu_avail_freq.khz( freq_idx )) {
+                            logCtrl( LOG_THROTTLE, idx, throt_profile[idx], cpu_avail_freq.khz( freq_idx ) );
+                            if( uclamp_actuator != NULL ) {
+                                // threads sharing a core keep their own speed
+                                clampThreads( &throts[idx], 1, cpu_avail_freq.khz( freq_idx ) );
+                                throt_profile[idx] = cpu_avail_freq.khz( freq_idx );
+                            } else {
+                                decisions.push_back( freq_decision_t( throts[idx].cpu_id, cpu_avail_freq.speed( freq_idx ) ) );
                             }
-                            printf("Throttling Thread %d: %d -> %d\n", idx, throt_profile[idx], freq_it->first);
-                            throt_profile[idx] = freq_it->first;
                         }
                     }
                 }
 
+                if( !decisions.empty() ) {
+                    batch_actuator.apply( decisions, batch_stat );
+                    logCtrlBatch( batch_stat );
+                    for( vector<freq_decision_t>::iterator dec_it = decisions.begin(); dec_it != decisions.end(); dec_it++ ) {
+                        if( !dec_it->applied ) {
+                            logCtrl( LOG_UNTHROTTLED, dec_it->cpu_idx );
+                        }
+                        if( dec_it->conflict ) {
+                            logCtrl( LOG_CONFLICT, dec_it->cpu_idx, getFrequencyDomain( dec_it->cpu_idx ), atoi( dec_it->applied_speed.c_str() ) );
+                        }
+                    }
+
+                    // profile what each core now runs at: a write covers its whole
+                    // domain, a conflict may have raised the request and a failed
+                    // write leaves the speed unknown so it is asked for again
+                    for( idx = 0; idx < max_threads; idx++ ) {
+                        throt_profile[idx] = getSpeedShadow( throts[idx].cpu_id );
+                    }
+                }
+
                 GetTime( t1 );
-                PrintTime( t1 );
-                printf( "\n" );
+                logCtrlTime( t1 );
+                decide_ns.record( span_TIME( woke, t1 ) );
 
                 // swap weight profiles after 5 iterations
                 if(( ++iteration ) % 5 == 0 ) {
-                    printf( "Swapping weights:\n" );
+                    logCtrl( LOG_SWAP_BEGIN );
                     for( idx = 0; idx < max_threads; idx++ ) {
                         pthread_mutex_lock( &( mute_weights[idx] ) );
                     }
@@ -1398,25 +2025,26 @@ iteration = 0;
                             weights_ptr = throts[idx].weights;
                             throts[idx].weights = throts[i].weights;
                             throts[i].weights = weights_ptr;
-                            printf( " %d <-> %d;", idx, i );
+                            logCtrl( LOG_SWAP_PAIR, 0, idx, i );
                         }
                     } else {
                         for( idx = 0, i = 1; i < max_threads; idx += 2, i += 2 ) {
                             weights_ptr = throts[idx].weights;
                             throts[idx].weights = throts[i].weights;
                             throts[i].weights = weights_ptr;
-                            printf( " %d <-> %d;", idx, i );
+                            logCtrl( LOG_SWAP_PAIR, 0, idx, i );
                         }
                     }
 
                     for( idx = 0; idx < max_threads; idx++ ) {
                         pthread_mutex_unlock( &( mute_weights[idx] ) );
                     }
-                    printf( "\n" );
+                    logCtrl( LOG_SWAP_END );
                 }
-            } while( t1.tv_sec < t_stop.tv_sec || ( t1.tv_sec == t_stop.tv_sec && t1.FRAC < t_stop.FRAC ) );
+            } while( t1 < t_stop );
         }
 
+        logger.sync();
         signal_thread_exit();
 
         idx = 0;
@@ -1426,15 +2054,45 @@ iteration = 0;
                     printf( "Error joining threads\n" );
                     return;
                 }
+                start_stat.merge( throts[idx].start_wait );
+
+                for( hist_it = throts[idx].batch_ns.begin(); hist_it != throts[idx].batch_ns.end(); hist_it++ ) {
+                    visit_latency[visit_key_t( throts[idx].cpu_id, hist_it->first, throts[idx].algorithm )].merge( hist_it->second );
+                }
+                throts[idx].batch_ns.clear();
             }
         }
     }
 
+    printWaitStat( "Start barrier", wait_mode, wait_spin_ns, start_stat );
+    printWaitStat( "Controller tick", wait_mode, wait_spin_ns, tick_waiter.stat() );
+
+    logger.stop();
+    ctrl_log = NULL;
+    printf( "# Controller tick to decision (%s logging, ns)\n", log_cpu >= 0 ? "async" : "inline" );
+    printf( "#%s\n", HISTOGRAM_COLUMNS );
+    printPercentiles( decide_ns );
+    printf( "\n" );
+    if( log_cpu >= 0 ) {
+        printf( "# Logger formatted %lu records, dropped %lu\n", logger.logged(), logger.dropped() );
+    }
+
+    batch_actuator.stop();
+    actuator.close();
+
     for( i = 0; i < max_threads; i++ ) {
         pthread_mutex_destroy( &( mute_transitions[i] ) );
     }
 
+    printVisitLatency( visit_latency );
+
+    if( trace != NULL ) {
+        printTraceSummary();
+        return;
+    }
+
     printParallelNoThrottleThreadsTable( userspace_cpu, throts, samplings, thread_count );
+    printThroughputTable( userspace_cpu, throts, samplings, thread_count, 2, true );
 }
 
 void TestParallelThreads( map<int, string> &userspace_cpu, vector<string> &freq_event, int samplings, int thread_count ) {
@@ -1451,15 +2109,14 @@ void TestParallelThreads( map<int, string> &userspace_cpu, vector<string> &freq_
     printf( "Using %d processors\n", ( int )userspace_cpu.size() );
 
     int node_count = 1000;
-    map<int, string> cpu_avail_freq;
+    FrequencyTable cpu_avail_freq;
     map<int, string>::iterator cpu_it;
 
-    map<int, string>::iterator freq_it;
 
     int max_threads = thread_count * userspace_cpu.size();
 
     pthread_t threads[max_threads];
-    cpu_set_t cpus[max_threads];
+    vector<CpuMask> cpus( max_threads );
     pthread_attr_t thread_attrs[max_threads];
 
     throt_ctrl_t throts[max_threads];
@@ -1473,12 +2130,12 @@ void TestParallelThreads( map<int, string> &userspace_cpu, vector<string> &freq_
     idx = 0;
     for( cpu_it = userspace_cpu.begin(), i = 0; cpu_it != userspace_cpu.end(); cpu_it++, i++ ) {
         for( j = 0; j < thread_count; ++j, ++idx ) {
-            CPU_ZERO( &cpus[idx] );
-            CPU_SET( cpu_it->first, &cpus[idx] );
+            cpus[idx].clear();
+            cpus[idx].set( cpu_it->first );
             pthread_attr_init( &thread_attrs[idx] );
             // pthread_attr_setscope(&thread_attrs[idx], PTHREAD_SCOPE_SYSTEM);   // explicitly state the each thread is its own process; (END result - no effect from either scope; something must be overriding)
 
-            int val = pthread_attr_setaffinity_np( &thread_attrs[idx], sizeof( cpu_set_t ), &cpus[idx] );
+            int val = pthread_attr_setaffinity_np( &thread_attrs[idx], cpus[idx].size(), cpus[idx].get() );
 
             if( val ) {
                 printf( "Set Affinity Fail: %s\n", strerror( val ) );
@@ -1486,6 +2143,7 @@ void TestParallelThreads( map<int, string> &userspace_cpu, vector<string> &freq_
             pthread_attr_setdetachstate( &thread_attrs[idx], PTHREAD_CREATE_JOINABLE );
 
             throts[idx].cpu_id = cpu_it->first;
+            throts[idx].thread_idx = idx;
             throts[idx].node_count = node_count;
             throts[idx].algorithm = THREAD_SELF_THROTTLE;
 
@@ -1493,11 +2151,21 @@ void TestParallelThreads( map<int, string> &userspace_cpu, vector<string> &freq_
         }
     }
 
+    if( trace != NULL ) {
+        trace->setLayout( true, samplings, max_threads, throts[0].events.size() );
+    }
+
+    vector< map<int, cpufreq_stats_t> > sample_stats( samplings );
+    map<int, cpufreq_stats_t> stats_before, stats_after;
+
     for( int samp = 0; samp < samplings; ++samp ) {
         printf( "Sampling...%d\n", samp );
+        snapshotCpuFreqStats( userspace_cpu, stats_before );
         idx = 0;
         for( cpu_it = userspace_cpu.begin(), i = 0; cpu_it != userspace_cpu.end(); cpu_it++, i++ ) {
             for( j = 0; j < thread_count; ++j, ++idx ) {
+                throts[idx].sample_num = samp;
+                throts[idx].tid = 0;
                 if(( rc = pthread_create( &threads[idx], &thread_attrs[idx], EventThreads, ( void * ) &throts[idx] ) ) ) {
                     printf( "Error creating threads\n" );
                     return;
@@ -1514,17 +2182,25 @@ void TestParallelThreads( map<int, string> &userspace_cpu, vector<string> &freq_
                 }
             }
         }
+
+        snapshotCpuFreqStats( userspace_cpu, stats_after );
+        diffSampleStats( stats_before, stats_after, sample_stats[samp] );
+    }
+
+    if( trace != NULL ) {
+        printTraceSummary();
+        return;
     }
 
-    printParallelThreadsTable( userspace_cpu, throts, samplings, thread_count );
+    printParallelThreadsTable( userspace_cpu, throts, samplings, thread_count, sample_stats );
+    printThroughputTable( userspace_cpu, throts, samplings, thread_count, 4, false );
 }
 
 void TestNoThreadEvent( map<int, string> &userspace_cpu, vector<string> &freq_event, int samplings ) {
     int node_count = 1000;
-    map<int, string> cpu_avail_freq;
+    FrequencyTable cpu_avail_freq;
     map<int, string>::iterator cpu_it;
 
-    map<int, string>::iterator freq_it;
 
     throt_ctrl_t throts;
 
@@ -1534,27 +2210,40 @@ void TestNoThreadEvent( map<int, string> &userspace_cpu, vector<string> &freq_ev
     printf( "Generating Circular graph\n" );
 
     throts.cpu_id = userspace_cpu.begin()->first;
+    throts.tid = currentTid();
+    throts.thread_idx = 0;
     throts.node_count = node_count;
     printf( "Adding events to list\n" );
     buildEvents( freq_event, 0, cpu_avail_freq, throts.events );
 
+    if( trace != NULL ) {
+        trace->setLayout( true, samplings, 1, throts.events.size() );
+    }
+
+    vector< map<int, cpufreq_stats_t> > sample_stats( samplings );
+    map<int, cpufreq_stats_t> stats_before, stats_after;
+    map<int, string> test_cpu;
+    test_cpu.insert( *userspace_cpu.begin() );
+
     for( int samp = 0; samp < samplings; ++samp ) {
         printf( "Sampling %d\n", samp );
+        snapshotCpuFreqStats( test_cpu, stats_before );
+        throts.sample_num = samp;
         EventBasedTest( &throts );
+        snapshotCpuFreqStats( test_cpu, stats_after );
+        diffSampleStats( stats_before, stats_after, sample_stats[samp] );
     }
 
-    printParallelThreadsTable( userspace_cpu, &throts, samplings, 1 );
-}
-
-void buildEvents( vector<string> &freq_event, int evt_idx, map<int, string> &avail_freq, vector<ctrl_event_t> &events ) {
-    map<int, string>::iterator min, mid;
-    map<int, string>::reverse_iterator max;
+    if( trace != NULL ) {
+        printTraceSummary();
+        return;
+    }
 
-    min = avail_freq.begin();
-    mid = avail_freq.begin();
-    max = avail_freq.rbegin();
+    printParallelThreadsTable( test_cpu, &throts, samplings, 1, sample_stats );
+    printThroughputTable( test_cpu, &throts, samplings, 1, 4, false );
+}
 
-    for( int m = avail_freq.size() / 2; m > 0; m--, mid++ ) {    }
+void buildEvents( vector<string> &freq_event, int evt_idx, FrequencyTable &avail_freq, vector<ctrl_event_t> &events ) {
 
     printf( "# Throttling Events %d: ", evt_idx );
     int i = 0;
@@ -1570,13 +2259,13 @@ void buildEvents( vector<string> &freq_event, int evt_idx, map<int, string> &ava
         ctrl_event_t evt;
         if( boost::algorithm::istarts_with( *tok_iter, "min" ) ) {
             printf( "MIN for " );
-            evt.throt_speed = min->second;
+            evt.throt_speed = avail_freq.speed( avail_freq.minIndex() );
         } else if( boost::algorithm::istarts_with( *tok_iter, "mid" ) ) {
             printf( "MID for " );
-            evt.throt_speed = mid->second;
+            evt.throt_speed = avail_freq.speed( avail_freq.midIndex() );
         } else if( boost::algorithm::istarts_with( *tok_iter, "max" ) ) {
             printf( "MAX for " );
-            evt.throt_speed = max->second;
+            evt.throt_speed = avail_freq.speed( avail_freq.maxIndex() );
         } else {
             printf( "Skipping Requested Frequency: %s\n", tok_iter->c_str() );
             continue;
@@ -1595,16 +2284,19 @@ void buildEvents( vector<string> &freq_event, int evt_idx, map<int, string> &ava
 }
 
 int main( int argc, char **argv ) {
-    if( geteuid() !=  0 ) {
-        cout << "Must be run as root" << endl;
-        return -1;
-    }
-
     po::variables_map vm;
     if( !parseArguments( argc, argv, vm ) ) {
         return 1;
     }
 
+    string backend_err;
+    if( !initCpuBackend( vm[BACKEND_KEY.c_str()].as<string>(), backend_err ) ) {
+        cout << backend_err << endl;
+        return -1;
+    }
+
+    printf( "# Measurement loops check a stop timer every %lu moves\n", LOOP_BATCH_MOVES );
+
 //    srand( time( NULL ) );
 //    srand( 1234567 );
 
@@ -1613,12 +2305,12 @@ int main( int argc, char **argv ) {
 
     gsl_rng_env_setup();
 
-    int cpu_count = determineCPUCount();
+    int cpu_bound = determineCPUIdBound();
     string err;
 
-    map<int, cpu_set_t> proc_list;
+    CpuIsolation isolation;
     vector<int> v;
-    cpu_set_t proc_bind_mask, cur_bind_mask;
+    CpuMask proc_bind_mask, cur_bind_mask, allowed_mask;
 
     initializeMutex();
 
@@ -1628,15 +2320,66 @@ int main( int argc, char **argv ) {
     v = vm[CPU_CUR_BIND_KEY.c_str()].as< vector<int> >();
     buildMask( v, cur_bind_mask );
 
-    if( vm.count( SKIP_RUN_BINDING_KEY.c_str() ) == 0 ) {
-        BindAllProcTo( proc_list, cpu_count, proc_bind_mask );
+    vector<int> online_cpus;
+    determineOnlineCPUs( online_cpus );
+
+    // before isolating, so that SIGINT and SIGTERM also undo the isolation
+    CpuStateSnapshot cpu_state;
+    string state_err;
+    if( !cpu_state.capture( online_cpus, state_err ) || !installRestoreHandler( cpu_state, state_err ) ) {
+        printf( "Unable to save cpufreq state: %s\n", state_err.c_str() );
+    }
+
+    // a cgroup partition confines every thread of this process, so under auto
+    // a run with harness threads meant for the housekeeping cpus, the logger
+    // or the writers, isolates by tasks instead
+    if( isolation_mode == ISOLATE_AUTO && (( log_cpu >= 0 && proc_bind_mask.isSet( log_cpu ) ) || async_writers > 0 || batch_writers > 1 ) ) {
+        printf( "# Harness threads stay on housekeeping cpus; isolating by %s\n", isolationModeName( ISOLATE_TASKS ) );
+        isolation_mode = ISOLATE_TASKS;
     }
 
-    bindCurProcTo( cur_bind_mask );
+    if( !isolation.isolate( isolation_mode, proc_bind_mask, err ) ) {
+        printf( "Unable to isolate the measurement cpus: %s\n", err.c_str() );
+    }
+
+    // pthread_create would refuse a logger pinned outside the partition
+    if( isolation.mode() == ISOLATE_CGROUP && log_cpu >= 0 && !isolation.isolated().isSet( log_cpu ) ) {
+        printf( "# --%s %d is outside the %s partition; logging inline\n", LOG_CPU_KEY.c_str(), log_cpu, isolationModeName( ISOLATE_CGROUP ) );
+        log_cpu = -1;
+    }
+
+    // a cgroup partition keeps this process off the run bind cpus too
+    isolation.allowedMask( cur_bind_mask, allowed_mask );
+    bindCurProcTo( allowed_mask );
 
     printCurrentProcBinding();
 
-    initUserspace( cpu_count, userspace_cpu );
+    string actuator_kind = vm[ACTUATOR_KEY.c_str()].as<string>();
+    UclampActuator uclamp;
+
+    if( actuator_kind == UCLAMP_ACTUATOR ) {
+        // schedutil picks the speed of each core from its clamped threads
+        initSchedutil( online_cpus, userspace_cpu );
+
+        FrequencyTable clamp_freq;
+        fillAvailableThrottlingSpeeds( clamp_freq, 1 );
+        if( clamp_freq.empty() || !uclamp.open( clamp_freq.khz( clamp_freq.maxIndex() ), err ) ) {
+            printf( "Unable to clamp thread utilization (%s); retuning cores through sysfs\n", clamp_freq.empty() ? "no speeds" : err.c_str() );
+            userspace_cpu.clear();
+            initUserspace( online_cpus, userspace_cpu );
+        } else {
+            printf( "Clamping the utilization of every thread\n" );
+            uclamp_actuator = &uclamp;
+        }
+    } else {
+        initUserspace( online_cpus, userspace_cpu );
+    }
+
+    discoverFrequencyDomains( cpu_bound );
+    printFrequencyDomains();
+    discoverCpuTopology( online_cpus );
+    printCpuTopology();
+    initSpeedShadow( cpu_bound );
 
     v = vm[CPU_CHILD_BIND_KEY.c_str()].as< vector<int> >();
 
@@ -1656,6 +2399,39 @@ int main( int argc, char **argv ) {
     int thread_count = vm[THREADS_PER_CORE_KEY.c_str()].as<int>();
     vector<string> freq_events = vm[FREQUENCY_EVENTS_KEY.c_str()].as< vector<string> >();
 
+    FreqActuator async_actuator;
+    if( async_writers > 0 && uclamp_actuator != NULL ) {
+        printf( "Utilization clamps are set synchronously; ignoring --%s\n", ASYNC_WRITERS_KEY.c_str() );
+    } else if( async_writers > 0 ) {
+        if( async_actuator.open( avail_cpu, err ) && ( freq_writer = AsyncFreqWriter::create( async_actuator, async_writers, err ) ) != NULL ) {
+            printf( "Queueing throttling writes through %s writer\n", freq_writer->name() );
+        } else {
+            printf( "Unable to start asynchronous writer (%s); writing synchronously\n", err.c_str() );
+        }
+    }
+
+    string overhead_file = vm[OVERHEAD_FILE_KEY.c_str()].as<string>();
+    if( vm.count( CALIBRATE_KEY.c_str() ) || !overhead_file.empty() ) {
+        if( uclamp_actuator != NULL || avail_cpu.empty() ) {
+            printf( "# Overhead calibration needs a cpu under the userspace governor; skipping\n" );
+        } else {
+            prepareOverheads( avail_cpu.begin()->first, vm.count( CALIBRATE_KEY.c_str() ) > 0, overhead_file );
+        }
+    }
+
+    TraceFile trace_file;
+    string trace_path = vm[TRACE_KEY.c_str()].as<string>();
+    if( !trace_path.empty() ) {
+        if( trace_file.create( trace_path, vm[TRACE_RECORDS_KEY.c_str()].as<uint64_t>(), err ) ) {
+            printf( "# Tracing worker events to %s\n", trace_path.c_str() );
+            trace = &trace_file;
+        } else {
+            printf( "Unable to trace (%s); keeping events in memory\n", err.c_str() );
+        }
+    }
+
+    isolation.startAccounting();
+
     if( vm.count( THROTTLING_KEY.c_str() ) ) {
         TestThrottledThreads2( avail_cpu.begin()->first, samplings );
     } else if( vm.count( TEST_SINGLE_EVENT_KEY ) ) {
@@ -1671,23 +2447,46 @@ int main( int argc, char **argv ) {
         }
         printf( "Testing Non-Threaded Events\n" );
         TestNoThreadEvent( avail_cpu, freq_events, samplings );
-    } else if( vm.count( WEIGHTED_TEST_KEY.c_str() ) || vm.count( WEIGHTED_D_TEST_KEY.c_str() ) ) {
-        TestParallelWeightedThreads( avail_cpu, vm.count( WEIGHTED_TEST_KEY.c_str() ) > 0, samplings, thread_count );
     } else {
-        TestParallelThreads( avail_cpu, freq_events, samplings, thread_count );
+        placeAvailableCpus( avail_cpu );
+
+        if( vm.count( WEIGHTED_TEST_KEY.c_str() ) || vm.count( WEIGHTED_D_TEST_KEY.c_str() ) ) {
+            TestParallelWeightedThreads( avail_cpu, vm.count( WEIGHTED_TEST_KEY.c_str() ) > 0, samplings, thread_count );
+        } else {
+            TestParallelThreads( avail_cpu, freq_events, samplings, thread_count );
+        }
     }
 
-    resetAffinities( proc_list );
+    if( freq_writer != NULL ) {
+        vector<async_write_t> writes;
+
+        freq_writer->flush();
+        freq_writer->collect( writes );
+        printf( "# Asynchronous throttling writes\n" );
+        printAsyncWrites( writes );
+
+        delete freq_writer;
+        freq_writer = NULL;
+    }
+    async_actuator.close();
+
+    trace = NULL;
+    trace_file.close();
+
+    printSpeedShadowStats();
+    uclamp_actuator = NULL;
+
+    isolation.printForeignTime();
+    isolation.restore();
 
     destroyMutex();
 
     if( vm.count( SKIP_ONDEMAND_KEY.c_str() ) == 0 )
-        resetCPUs( userspace_cpu );
+        cpu_state.restore();
 
 
     userspace_cpu.clear();
     avail_cpu.clear();
-    proc_list.clear();
 
     return 0;
 }
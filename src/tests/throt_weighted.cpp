@@ -14,8 +14,10 @@
 
 #include "utils/timing.h"
 #include "utils/cpufunc.h"
+#include "utils/cpustate.h"
 #include "utils/procbind.h"
 #include "utils/logging.h"
+#include "utils/stoptimer.h"
 
 using namespace std;
 namespace po = boost::program_options;
@@ -28,6 +30,7 @@ const string CPU_CHILD_BIND_KEY = "child-bind";
 const string CPU_CUR_BIND_KEY = "cur-bind";
 const string SKIP_RUN_BINDING_KEY = "skip-run-bind";
 const string SKIP_ONDEMAND_KEY = "skip-ondemand";
+const string BACKEND_KEY = "backend";
 const string TEST_SINGLE_EVENT_KEY = "single-event";
 const string SAMPLING_KEY = "samplings";
 const string FREQUENCY_EVENTS_KEY = "freq-events";
@@ -82,10 +85,10 @@ double sincos( double x ) {
 double timedelay( double x ) {
     TIME t_stop, t1;
     GetTime(t_stop);
-    t_stop.FRAC = t_stop.FRAC + 1 * x;
+    t_stop += ( TIME )( 1000 * x );
     do {
         GetTime(t1);
-    } while( t1.tv_sec < t_stop.tv_sec || (t1.tv_sec == t_stop.tv_sec && t1.FRAC < t_stop.FRAC));
+    } while( t1 < t_stop);
 
     return 0.0;
 }
@@ -105,6 +108,7 @@ bool parseArguments( int argc, char **argv, po::variables_map &vm ) {
     (( THREADS_PER_CORE_KEY + ",T" ).c_str(), po::value< int >()->default_value( 1 ), "Threads spawned per core" )
     ( SKIP_RUN_BINDING_KEY.c_str(), "Should skip building of previously running processes to specific CPU" )
     ( SKIP_ONDEMAND_KEY.c_str(), "After execution, leave CPUs in USERSPACE mode" )
+    ( BACKEND_KEY.c_str(), po::value<string>()->default_value( "" ), "cpufreq backend: sysfs, fake:<dir>[:<cpus>[:<driver>]] or memory[:<cpus>[:<driver>]] (default $CPUFREQ_BACKEND, then sysfs)" )
     ;
 
     po::options_description tests( "Test Options" );
@@ -196,27 +200,30 @@ void timeTest2( node_t *root, vector<TIME> * times, uint64_t &move_counts ) {
 
     node_t *cur = root;
 
-    TIME t1, t2, tmp;
-    GetTime( t1 );
+    uint64_t move_bits = ( uint64_t ) rand() | 1;
 
-    t2.tv_sec = t1.tv_sec + 5;
+    TIME t1, t2;
+    string err;
+    StopTimer stop_timer;
 
     move_counts = 0;
+    if( !stop_timer.open( err ) ) {
+        printf( "%s\n", err.c_str() );
+        return;
+    }
 
-    do {
-        if( rand() % 2 ) {
-            cur = cur->next;
-        } else {
-            cur = cur->prev->prev;
-        }
+    GetTime( t1 );
 
-        move_counts++;
+    if( !stop_timer.arm( t1 + secondsTIME( 5 ), err ) ) {
+        printf( "%s\n", err.c_str() );
+        return;
+    }
+    move_counts = walkBatches( cur, stop_timer, move_bits );
 
-        GetTime( tmp );
-    } while( tmp.tv_sec < t2.tv_sec );
+    GetTime( t2 );
 
     times->push_back( t1 );
-    times->push_back( tmp );
+    times->push_back( t2 );
 }
 
 void *threadableTimeTest( void *args ) {
@@ -280,7 +287,7 @@ void TestThrottledThreads( int cpu_id, int samplings ) {
     map<int, vector<TIME> > cpu_freq_times;
     map<int, vector<TIME> >::iterator cpu_freq_it;
 
-//    int cpu_count = determineCPUCount();
+//    int cpu_count = determineCPUIdBound();
 
     cout << "Determining Available Speeds" << endl;
 
@@ -288,13 +295,13 @@ void TestThrottledThreads( int cpu_id, int samplings ) {
 
     cout << "There are " << cpu_avail_freq.size() << " speeds available." << endl;
 
-    cpu_set_t cpus;
+    CpuMask cpus;
     pthread_attr_t thread_attrs;
 
-    CPU_ZERO( &cpus );
-    CPU_SET( cpu_id, &cpus );
+    cpus.clear();
+    cpus.set( cpu_id );
     pthread_attr_init( &thread_attrs );
-    pthread_attr_setaffinity_np( &thread_attrs, sizeof( cpu_set_t ), &cpus );
+    pthread_attr_setaffinity_np( &thread_attrs, cpus.size(), cpus.get() );
     pthread_attr_setdetachstate( &thread_attrs, PTHREAD_CREATE_JOINABLE );
 
     throt_thread t_args;
@@ -361,13 +368,13 @@ void TestThrottledThreads2( int cpu_id, int samplings ) {
 
     cout << "There are " << cpu_avail_freq.size() << " speeds available." << endl;
 
-    cpu_set_t cpus;
+    CpuMask cpus;
     pthread_attr_t thread_attrs;
 
-    CPU_ZERO( &cpus );
-    CPU_SET( cpu_id, &cpus );
+    cpus.clear();
+    cpus.set( cpu_id );
     pthread_attr_init( &thread_attrs );
-    pthread_attr_setaffinity_np( &thread_attrs, sizeof( cpu_set_t ), &cpus );
+    pthread_attr_setaffinity_np( &thread_attrs, cpus.size(), cpus.get() );
     pthread_attr_setdetachstate( &thread_attrs, PTHREAD_CREATE_JOINABLE );
 
     throt_thread t_args;
@@ -423,12 +430,18 @@ void TestThrottledThreads2( int cpu_id, int samplings ) {
 void EventBasedTest( throt_ctrl_t *ctrl ) {
     vector<ctrl_event_t>::iterator evt_it;
 
-    uint64_t cnt;
+    uint64_t cnt, move_bits = ( uint64_t ) rand() | 1;
     string err;
 
+    StopTimer stop_timer;
+    if( !stop_timer.open( err ) ) {
+        printf( "%s\n", err.c_str() );
+        return;
+    }
+
     node_t *root = new node_t();
 
-    TIME t1, stop;
+    TIME t1;
     GetTime( t1 );
     ctrl->times.push_back( t1 );
 
@@ -451,19 +464,11 @@ void EventBasedTest( throt_ctrl_t *ctrl ) {
         GetTime( t1 );
         ctrl->times.push_back( t1 );
 
-        stop.tv_sec = t1.tv_sec + evt_it->loop_sec_offset;
-        stop.FRAC = t1.FRAC;
-
-        cnt = 0;
-        do {
-            GetTime( t1 );
-            if( t1.FRAC % 2 ) {
-                cur = cur->next;
-            } else {
-                cur = cur->prev->prev;
-            }
-            cnt++;
-        } while( t1.tv_sec < stop.tv_sec || (t1.tv_sec == stop.tv_sec && t1.FRAC < stop.FRAC) );
+        if( !stop_timer.arm( t1 + secondsTIME( evt_it->loop_sec_offset ), err ) ) {
+            printf( "%s\n", err.c_str() );
+            break;
+        }
+        cnt = walkBatches( cur, stop_timer, move_bits );
 
         GetTime( t1 );
         ctrl->times.push_back( t1 );
@@ -479,12 +484,18 @@ void EventBasedTest( throt_ctrl_t *ctrl ) {
 void EventNoThrottleBasedTest( throt_ctrl_t *ctrl ) {
     vector<ctrl_event_t>::iterator evt_it;
 
-    uint64_t cnt;
+    uint64_t cnt, move_bits = ( uint64_t ) rand() | 1;
     string err;
 
+    StopTimer stop_timer;
+    if( !stop_timer.open( err ) ) {
+        printf( "%s\n", err.c_str() );
+        return;
+    }
+
     node_t *root = new node_t();
 
-    TIME t1, stop;
+    TIME t1;
     GetTime( t1 );
     ctrl->times.push_back( t1 );
 
@@ -495,19 +506,11 @@ void EventNoThrottleBasedTest( throt_ctrl_t *ctrl ) {
         GetTime( t1 );
         ctrl->times.push_back( t1 );
 
-        stop.tv_sec = t1.tv_sec + evt_it->loop_sec_offset;
-        stop.FRAC = t1.FRAC;
-
-        cnt = 0;
-        do {
-            GetTime( t1 );
-            if( t1.FRAC % 2 ) {
-                cur = cur->next;
-            } else {
-                cur = cur->prev->prev;
-            }
-            cnt++;
-        } while( t1.tv_sec < stop.tv_sec || (t1.tv_sec == stop.tv_sec && t1.FRAC < stop.FRAC) );
+        if( !stop_timer.arm( t1 + secondsTIME( evt_it->loop_sec_offset ), err ) ) {
+            printf( "%s\n", err.c_str() );
+            break;
+        }
+        cnt = walkBatches( cur, stop_timer, move_bits );
 
         GetTime( t1 );
         ctrl->times.push_back( t1 );
@@ -523,12 +526,18 @@ void EventNoThrottleBasedTest( throt_ctrl_t *ctrl ) {
 void EventNoThrottleBasedTestWeighted( throt_ctrl_t *ctrl, double delay_factor, double( *weight )( double ) ) {
     vector<ctrl_event_t>::iterator evt_it;
 
-    uint64_t cnt;
+    uint64_t cnt, move_bits = ( uint64_t ) rand() | 1;
     string err;
 
+    StopTimer stop_timer;
+    if( !stop_timer.open( err ) ) {
+        printf( "%s\n", err.c_str() );
+        return;
+    }
+
     node_t *root = new node_t();
 
-    TIME t1, stop;
+    TIME t1;
     GetTime( t1 );
     ctrl->times.push_back( t1 );
 
@@ -540,8 +549,10 @@ void EventNoThrottleBasedTestWeighted( throt_ctrl_t *ctrl, double delay_factor,
         GetTime( t1 );
         ctrl->times.push_back( t1 );
 
-        stop.tv_sec = t1.tv_sec + evt_it->loop_sec_offset;
-        stop.FRAC = t1.FRAC;
+        if( !stop_timer.arm( t1 + secondsTIME( evt_it->loop_sec_offset ), err ) ) {
+            printf( "%s\n", err.c_str() );
+            break;
+        }
 
         cnt = 0;
         val = val_base;
@@ -550,14 +561,12 @@ void EventNoThrottleBasedTestWeighted( throt_ctrl_t *ctrl, double delay_factor,
 //            res = weight( delay_factor );
             res = weight( val );
             val += 0.001;
-            GetTime( t1 );
-            if( t1.FRAC % 2 ) {
+            if( nextMoveBits( move_bits ) & 1 ) {
                 cur = cur->next;
             } else {
                 cur = cur->prev->prev;
             }
-            cnt++;
-        } while( t1.tv_sec < stop.tv_sec || (t1.tv_sec == stop.tv_sec && t1.FRAC < stop.FRAC));
+        } while( ++cnt % LOOP_BATCH_MOVES || !stop_timer.expired() );
 
         GetTime( t1 );
         ctrl->times.push_back( t1 );
@@ -755,7 +764,7 @@ void TestParallelWeightedThreads( map<int, string> &userspace_cpu, bool is_stati
     int max_threads = thread_count * userspace_cpu.size();
 
     pthread_t threads[max_threads];
-    cpu_set_t cpus[max_threads];
+    vector<CpuMask> cpus( max_threads );
     pthread_attr_t thread_attrs[max_threads];
 
     throt_ctrl_t throts[max_threads];
@@ -782,12 +791,12 @@ void TestParallelWeightedThreads( map<int, string> &userspace_cpu, bool is_stati
     int algo_type = NO_WEIGHT;
     for( cpu_it = userspace_cpu.begin(), i = 0; cpu_it != userspace_cpu.end(); cpu_it++, i++, algo_type++ ) {
         for( j = 0; j < thread_count; ++j, ++idx ) {
-            CPU_ZERO( &cpus[idx] );
-            CPU_SET( cpu_it->first, &cpus[idx] );
+            cpus[idx].clear();
+            cpus[idx].set( cpu_it->first );
             pthread_attr_init( &thread_attrs[idx] );
             // pthread_attr_setscope(&thread_attrs[idx], PTHREAD_SCOPE_SYSTEM);   // explicitly state the each thread is its own process; (END result - no effect from either scope; something must be overriding)
 
-            int val = pthread_attr_setaffinity_np( &thread_attrs[idx], sizeof( cpu_set_t ), &cpus[idx] );
+            int val = pthread_attr_setaffinity_np( &thread_attrs[idx], cpus[idx].size(), cpus[idx].get() );
 
             if( val ) {
                 printf( "Set Affinity Fail: %s\n", strerror( val ) );
@@ -842,10 +851,10 @@ void TestParallelWeightedThreads( map<int, string> &userspace_cpu, bool is_stati
             for(int thrt_count = 0; thrt_count < 19; thrt_count++) {
                 GetTime( t_stop );
 
-                t_stop.tv_sec = t_stop.tv_sec + 1;
+                t_stop += secondsTIME( 1 );
                 do {
                     GetTime( t1 );
-                } while(t1.tv_sec < t_stop.tv_sec || (t1.tv_sec == t_stop.tv_sec && t1.FRAC < t_stop.FRAC));
+                } while(t1 < t_stop);
 
                 for( cpu_it = userspace_cpu.begin(); cpu_it != userspace_cpu.end(); cpu_it++ ) {
                     GetTime(t1);
@@ -900,7 +909,7 @@ void TestParallelThreads( map<int, string> &userspace_cpu, vector<string> &freq_
     int max_threads = thread_count * userspace_cpu.size();
 
     pthread_t threads[max_threads];
-    cpu_set_t cpus[max_threads];
+    vector<CpuMask> cpus( max_threads );
     pthread_attr_t thread_attrs[max_threads];
 
     throt_ctrl_t throts[max_threads];
@@ -914,12 +923,12 @@ void TestParallelThreads( map<int, string> &userspace_cpu, vector<string> &freq_
     idx = 0;
     for( cpu_it = userspace_cpu.begin(), i = 0; cpu_it != userspace_cpu.end(); cpu_it++, i++ ) {
         for( j = 0; j < thread_count; ++j, ++idx ) {
-            CPU_ZERO( &cpus[idx] );
-            CPU_SET( cpu_it->first, &cpus[idx] );
+            cpus[idx].clear();
+            cpus[idx].set( cpu_it->first );
             pthread_attr_init( &thread_attrs[idx] );
             // pthread_attr_setscope(&thread_attrs[idx], PTHREAD_SCOPE_SYSTEM);   // explicitly state the each thread is its own process; (END result - no effect from either scope; something must be overriding)
 
-            int val = pthread_attr_setaffinity_np( &thread_attrs[idx], sizeof( cpu_set_t ), &cpus[idx] );
+            int val = pthread_attr_setaffinity_np( &thread_attrs[idx], cpus[idx].size(), cpus[idx].get() );
 
             if( val ) {
                 printf( "Set Affinity Fail: %s\n", strerror( val ) );
@@ -1036,27 +1045,28 @@ void buildEvents( vector<string> &freq_event, int evt_idx, map<int, string> &ava
 }
 
 int main( int argc, char **argv ) {
-    if( geteuid() !=  0 ) {
-        cout << "Must be run as root" << endl;
-        return -1;
-    }
-
     po::variables_map vm;
     if( !parseArguments( argc, argv, vm ) ) {
         return 1;
     }
 
+    string backend_err;
+    if( !initCpuBackend( vm[BACKEND_KEY.c_str()].as<string>(), backend_err ) ) {
+        cout << backend_err << endl;
+        return -1;
+    }
+
     srand( time( NULL ) );
 
     map<int, string> userspace_cpu;
     map<int, string> avail_cpu;
 
-    int cpu_count = determineCPUCount();
+    int cpu_count = determineCPUIdBound();
     string err;
 
-    map<int, cpu_set_t> proc_list;
+    map<int, CpuMask> proc_list;
     vector<int> v;
-    cpu_set_t proc_bind_mask, cur_bind_mask;
+    CpuMask proc_bind_mask, cur_bind_mask;
 
     v = vm[CPU_RUN_BIND_KEY.c_str()].as< vector<int> >();
     buildMask( v, proc_bind_mask );
@@ -1072,7 +1082,16 @@ int main( int argc, char **argv ) {
 
     printCurrentProcBinding();
 
-    initUserspace( cpu_count, userspace_cpu );
+    vector<int> online_cpus;
+    determineOnlineCPUs( online_cpus );
+
+    CpuStateSnapshot cpu_state;
+    string state_err;
+    if( !cpu_state.capture( online_cpus, state_err ) || !installRestoreHandler( cpu_state, state_err ) ) {
+        printf( "Unable to save cpufreq state: %s\n", state_err.c_str() );
+    }
+
+    initUserspace( online_cpus, userspace_cpu );
 
     v = vm[CPU_CHILD_BIND_KEY.c_str()].as< vector<int> >();
 
@@ -1118,7 +1137,7 @@ int main( int argc, char **argv ) {
     resetAffinities( proc_list );
 
     if( vm.count( SKIP_ONDEMAND_KEY.c_str() ) == 0 )
-        resetCPUs( userspace_cpu );
+        cpu_state.restore();
 
 
     userspace_cpu.clear();
@@ -0,0 +1,50 @@
+#include <iostream>
+#include <cstdio>
+
+#include <boost/program_options.hpp>
+
+#include "utils/trace.h"
+
+using namespace std;
+namespace po = boost::program_options;
+
+const string HELP_KEY = "help";
+const string INPUT_KEY = "input";
+
+bool parseArguments( int argc, char **argv, po::variables_map &vm ) {
+    po::options_description general( "General Options" );
+    general.add_options()
+    (( HELP_KEY + ",h" ).c_str(), "Help options" )
+    (( INPUT_KEY + ",i" ).c_str(), po::value<string>(), "Trace written by ThrotCtrl --trace" )
+    ;
+
+    po::positional_options_description pos;
+    pos.add( INPUT_KEY.c_str(), 1 );
+
+    po::store( po::command_line_parser( argc, argv ).options( general ).positional( pos ).run(), vm );
+    po::notify( vm );
+
+    if( vm.count( HELP_KEY.c_str() ) || !vm.count( INPUT_KEY.c_str() ) ) {
+        cout << "Usage: TraceConvert <trace>\n" << general << "\n";
+        return false;
+    }
+
+    return true;
+}
+
+int main( int argc, char **argv ) {
+    po::variables_map vm;
+    if( !parseArguments( argc, argv, vm ) ) {
+        return 1;
+    }
+
+    TraceFile trace;
+    string err;
+
+    if( !trace.open( vm[INPUT_KEY.c_str()].as<string>(), err ) || !printTraceTable( trace, err ) ) {
+        cout << err << endl;
+        return 1;
+    }
+
+    return 0;
+}
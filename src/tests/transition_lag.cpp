@@ -0,0 +1,458 @@
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+#include <cstdio>
+#include <map>
+#include <algorithm>
+#include <cmath>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <boost/program_options.hpp>
+
+#include "utils/cpufunc.h"
+#include "utils/cpustate.h"
+#include "utils/procbind.h"
+#include "utils/actuator.h"
+#include "utils/uclamp.h"
+
+using namespace std;
+namespace po = boost::program_options;
+
+const string HELP_KEY = "help";
+const string TARGET_CPU_KEY = "cpu";
+const string CPU_CUR_BIND_KEY = "cur-bind";
+const string SAMPLING_KEY = "samplings";
+const string WINDOW_KEY = "window";
+const string SETTLE_KEY = "settle";
+const string RAW_KEY = "raw";
+const string SKIP_ONDEMAND_KEY = "skip-ondemand";
+const string BACKEND_KEY = "backend";
+const string ACTUATOR_KEY = "actuator";
+
+const string SYSFS_ACTUATOR = "sysfs";
+const string UCLAMP_ACTUATOR = "uclamp";
+const string BOTH_ACTUATORS = "both";
+
+// spin chunk end stamps kept by the spinner; must be a power of 2
+const uint64_t SPIN_RING_SIZE = 1 << 22;
+const uint64_t SPIN_RING_MASK = SPIN_RING_SIZE - 1;
+
+// target duration of one chunk at the highest speed; bounds the resolution
+const uint64_t CHUNK_TARGET_NS = 1000;
+
+// operations timed by the spinner to size its chunks
+const int CALIBRATION_ITERATIONS = 1000000;
+
+// consecutive chunks that must agree before a rate change is accepted
+const int CONFIRM_CHUNKS = 3;
+
+struct spin_ctrl_t {
+    int iterations;             // dependent operations per chunk
+    uint64_t *stamps;           // chunk end times (ns)
+    volatile uint64_t pos;      // chunks completed
+    volatile bool stop;
+    volatile pid_t tid;         // kernel id of the spinner, once running
+    uint64_t sink;
+};
+
+// latency samples of one (from, to) pair
+struct pair_lag_t {
+    vector<double> call_lag;    // us spent in the actuator call
+    vector<double> rate_lag;    // us until the spin rate changed
+    vector<double> freq_lag;    // us until scaling_cur_freq reported the new speed
+    int rate_missed, freq_missed;
+
+    pair_lag_t() : rate_missed( 0 ), freq_missed( 0 ) {}
+};
+
+// samples of every (from, to) pair, per actuator
+typedef map<pair<int, int>, pair_lag_t> lag_table_t;
+
+static inline uint64_t nowNS() {
+    timespec t;
+    clock_gettime( CLOCK_MONOTONIC, &t );
+    return ( uint64_t ) t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+// a chain of dependent multiply-adds; runtime scales with the core clock
+static inline uint64_t spinChunk( uint64_t x, int iterations ) {
+    for( int i = 0; i < iterations; ++i ) {
+        x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+    }
+    return x;
+}
+
+void *spinThread( void *args ) {
+    spin_ctrl_t *spin = ( spin_ctrl_t * ) args;
+    uint64_t x = 1, pos = 0;
+
+    // size a chunk to roughly CHUNK_TARGET_NS at the highest speed; timed
+    // here so it runs on the target cpu rather than the controlling one
+    uint64_t t0 = nowNS();
+    x = spinChunk( x, CALIBRATION_ITERATIONS );
+    double ns_per_iter = ( nowNS() - t0 ) / ( double ) CALIBRATION_ITERATIONS;
+    spin->iterations = max( 1, ( int )( CHUNK_TARGET_NS / max( ns_per_iter, 0.01 ) ) );
+
+    // publishing the tid also publishes iterations
+    __atomic_store_n( &spin->tid, currentTid(), __ATOMIC_RELEASE );
+
+    while( !spin->stop ) {
+        x = spinChunk( x, spin->iterations );
+        spin->stamps[pos & SPIN_RING_MASK] = nowNS();
+        __atomic_store_n( &spin->pos, ++pos, __ATOMIC_RELEASE );
+    }
+
+    spin->sink = x;
+    pthread_exit( NULL );
+}
+
+void sleepNS( uint64_t ns ) {
+    timespec t;
+    t.tv_sec = ns / 1000000000ULL;
+    t.tv_nsec = ns % 1000000000ULL;
+    nanosleep( &t, NULL );
+}
+
+// mean chunk duration over the chunks completed in the last window_ns
+double measureChunkNS( spin_ctrl_t &spin, uint64_t window_ns ) {
+    uint64_t p0 = __atomic_load_n( &spin.pos, __ATOMIC_ACQUIRE );
+    sleepNS( window_ns );
+    uint64_t p1 = __atomic_load_n( &spin.pos, __ATOMIC_ACQUIRE );
+
+    if( p1 - p0 < 2 ) {
+        return 0.0;
+    }
+    return ( double )( spin.stamps[( p1 - 1 ) & SPIN_RING_MASK] - spin.stamps[p0 & SPIN_RING_MASK] ) / ( p1 - 1 - p0 );
+}
+
+int readCurFreq( int handle ) {
+    char buffer[32];
+    ssize_t len = cpuBackend().read( handle, buffer, sizeof( buffer ) - 1 );
+
+    if( len <= 0 ) {
+        return -1;
+    }
+    buffer[len] = '\0';
+    return atoi( buffer );
+}
+
+// Find where chunk durations cross the midpoint between the calibrated
+// durations of the old and new speed and stay across for CONFIRM_CHUNKS.
+// Returns the start of the first chunk at the new rate relative to write_ns,
+// or -1 when no change was seen.
+double detectRateChange( spin_ctrl_t &spin, uint64_t first, uint64_t last, uint64_t write_ns, double from_ns, double to_ns ) {
+    double mid = ( from_ns + to_ns ) / 2.0;
+    bool faster = to_ns < from_ns;
+    int agree = 0;
+    uint64_t change_start = 0;
+
+    for( uint64_t p = first + 1; p < last; ++p ) {
+        uint64_t start = spin.stamps[( p - 1 ) & SPIN_RING_MASK];
+        double dur = ( double )( spin.stamps[p & SPIN_RING_MASK] - start );
+
+        if(( faster && dur < mid ) || ( !faster && dur > mid ) ) {
+            if( agree++ == 0 ) {
+                change_start = start;
+            }
+            if( agree == CONFIRM_CHUNKS ) {
+                return change_start > write_ns ? ( change_start - write_ns ) / 1000.0 : 0.0;
+            }
+        } else {
+            agree = 0;
+        }
+    }
+
+    return -1.0;
+}
+
+double percentile( vector<double> &v, double p ) {
+    size_t idx = ( size_t )( p * ( v.size() - 1 ) + 0.5 );
+    return v[idx];
+}
+
+void printLagRow( const string &actuator, int from, int to, const char *source, vector<double> &lags, int missed, bool raw ) {
+    printf( "%s\t%d\t%d\t%s\t%d\t%d", actuator.c_str(), from, to, source, ( int ) lags.size(), missed );
+
+    if( lags.empty() ) {
+        printf( "\t-\t-\t-\t-\t-\t-\t-\n" );
+        return;
+    }
+
+    sort( lags.begin(), lags.end() );
+
+    double total = 0.0;
+    for( vector<double>::iterator it = lags.begin(); it != lags.end(); it++ ) {
+        total += *it;
+    }
+
+    printf( "\t%.1f\t%.1f\t%.1f\t%.1f\t%.1f\t%.1f\t%.1f", total / lags.size(), lags.front(), percentile( lags, 0.1 ),
+            percentile( lags, 0.5 ), percentile( lags, 0.9 ), percentile( lags, 0.99 ), lags.back() );
+
+    if( raw ) {
+        for( vector<double>::iterator it = lags.begin(); it != lags.end(); it++ ) {
+            printf( "\t%.1f", *it );
+        }
+    }
+    printf( "\n" );
+}
+
+bool parseArguments( int argc, char **argv, po::variables_map &vm ) {
+    po::options_description general( "General Options" );
+    general.add_options()
+    (( HELP_KEY + ",h" ).c_str(), "Help options" )
+    (( TARGET_CPU_KEY + ",c" ).c_str(), po::value<int>()->default_value( 1 ), "CPU whose transitions are measured" )
+    (( CPU_CUR_BIND_KEY + ",b" ).c_str(), po::value< vector<int> >()->default_value( vector<int>( 1, 0 ), "0" )->multitoken(), "List of available CPUs to which the controlling process can be bound." )
+    (( SAMPLING_KEY + ",s" ).c_str(), po::value<int>()->default_value( 10 ), "Transitions measured per frequency pair" )
+    (( WINDOW_KEY + ",w" ).c_str(), po::value<int>()->default_value( 20000 ), "Observation window after each write (us)" )
+    ( SETTLE_KEY.c_str(), po::value<int>()->default_value( 20000 ), "Time the core is held at the starting speed (us)" )
+    ( RAW_KEY.c_str(), "Append every latency sample to its row" )
+    ( SKIP_ONDEMAND_KEY.c_str(), "After execution, leave CPUs in USERSPACE mode" )
+    (( ACTUATOR_KEY + ",a" ).c_str(), po::value<string>()->default_value( SYSFS_ACTUATOR ), "Actuator measured: sysfs (userspace governor), uclamp (schedutil with per-thread utilization clamps) or both" )
+    ( BACKEND_KEY.c_str(), po::value<string>()->default_value( "" ), "cpufreq backend: sysfs, fake:<dir>[:<cpus>[:<driver>]] or memory[:<cpus>[:<driver>]] (default $CPUFREQ_BACKEND, then sysfs)" )
+    ;
+
+    po::store( po::parse_command_line( argc, argv, general ), vm );
+    po::notify( vm );
+
+    if( vm.count( HELP_KEY.c_str() ) ) {
+        cout << general << "\n";
+        return false;
+    }
+
+    return true;
+}
+
+// The sysfs actuator retunes the core, the uclamp actuator the spinner thread.
+bool applySpeed( FreqActuator &actuator, UclampActuator &uclamp, int cpu_id, pid_t tid, FrequencyTable &freqs, int idx, string &err ) {
+    if( uclamp.isOpen() ) {
+        return uclamp.setSpeed( tid, freqs.khz( idx ), err );
+    }
+    return actuator.setSpeed( cpu_id, freqs.speed( idx ), err );
+}
+
+// Measure how long after a write the target core actually runs at the new
+// speed, for every ordered pair of available speeds.
+void TransitionLagTest( int cpu_id, FrequencyTable &freqs, const string &kind, int samplings, uint64_t window_ns, uint64_t settle_ns, lag_table_t &lags ) {
+    FreqActuator actuator;
+    UclampActuator uclamp;
+    string err;
+    char attr[100];
+
+    if( kind == UCLAMP_ACTUATOR ) {
+        if( !uclamp.open( freqs.khz( freqs.maxIndex() ), err ) ) {
+            printf( "Unable to clamp thread utilization: %s\n", err.c_str() );
+            return;
+        }
+    } else if( !actuator.open( cpu_id, err ) ) {
+        printf( "Unable to open CPU%d control files: %s\n", cpu_id, err.c_str() );
+        return;
+    }
+
+    cpuFreqAttr( attr, sizeof( attr ), cpu_id, SCALING_CUR_FREQ );
+    int cur_fd = cpuBackend().open( attr, false );
+    if( cur_fd < 0 ) {
+        printf( "Unable to open %s; only the spin rate is observed\n", attr );
+    }
+
+    spin_ctrl_t spin;
+    spin.stamps = new uint64_t[SPIN_RING_SIZE];
+    spin.pos = 0;
+    spin.stop = false;
+    spin.tid = 0;
+    spin.iterations = 1;
+    spin.sink = 0;
+
+    // the spinner sizes its chunks at the highest speed
+    if( !uclamp.isOpen() ) {
+        actuator.setSpeed( cpu_id, freqs.speed( freqs.maxIndex() ), err );
+    }
+
+    pthread_t spinner;
+    pthread_attr_t spin_attrs;
+    CpuMask cpus;
+
+    cpus.clear();
+    cpus.set( cpu_id );
+    pthread_attr_init( &spin_attrs );
+    pthread_attr_setaffinity_np( &spin_attrs, cpus.size(), cpus.get() );
+
+    int create_err = pthread_create( &spinner, &spin_attrs, spinThread, ( void * ) &spin );
+    pthread_attr_destroy( &spin_attrs );
+
+    if( create_err ) {
+        printf( "Unable to create spin thread\n" );
+        if( cur_fd >= 0 ) {
+            cpuBackend().close( cur_fd );
+        }
+        actuator.close();
+        delete[] spin.stamps;
+        return;
+    }
+
+    pid_t tid;
+    while(( tid = __atomic_load_n( &spin.tid, __ATOMIC_ACQUIRE ) ) == 0 ) {
+        sleepNS( 1000 );
+    }
+
+    // calibrate the chunk duration at every speed
+    vector<double> chunk_ns( freqs.size() );
+    printf( "# %s calibration: %d operations per chunk\n#Frequency\tChunk (ns)\n", kind.c_str(), spin.iterations );
+    for( int i = 0; i < freqs.size(); ++i ) {
+        applySpeed( actuator, uclamp, cpu_id, tid, freqs, i, err );
+        sleepNS( settle_ns );
+        chunk_ns[i] = measureChunkNS( spin, 4 * settle_ns );
+        printf( "%d\t%.1f\n", freqs.khz( i ), chunk_ns[i] );
+    }
+
+    for( int samp = 0; samp < samplings; ++samp ) {
+        for( int from = 0; from < freqs.size(); ++from ) {
+            for( int to = 0; to < freqs.size(); ++to ) {
+                if( from == to ) {
+                    continue;
+                }
+
+                pair_lag_t &pair_lag = lags[make_pair( freqs.khz( from ), freqs.khz( to ) )];
+
+                applySpeed( actuator, uclamp, cpu_id, tid, freqs, from, err );
+                sleepNS( settle_ns );
+
+                uint64_t first = __atomic_load_n( &spin.pos, __ATOMIC_ACQUIRE );
+                uint64_t write_ns = nowNS();
+                if( !applySpeed( actuator, uclamp, cpu_id, tid, freqs, to, err ) ) {
+                    printf( "Unable to throttle CPU %d: %s\n", cpu_id, err.c_str() );
+                    continue;
+                }
+                pair_lag.call_lag.push_back(( nowNS() - write_ns ) / 1000.0 );
+
+                // poll scaling_cur_freq for the rest of the window
+                double freq_lag = -1.0;
+                uint64_t now;
+                while(( now = nowNS() ) - write_ns < window_ns ) {
+                    if( freq_lag < 0.0 && cur_fd >= 0 && readCurFreq( cur_fd ) == freqs.khz( to ) ) {
+                        freq_lag = ( now - write_ns ) / 1000.0;
+                    }
+                }
+                uint64_t last = __atomic_load_n( &spin.pos, __ATOMIC_ACQUIRE );
+
+                // pairs whose chunk durations cannot be told apart are not observed
+                double rate_lag = -1.0;
+                if( last - first < SPIN_RING_SIZE && fabs( chunk_ns[from] - chunk_ns[to] ) > 0.05 * chunk_ns[from] ) {
+                    rate_lag = detectRateChange( spin, first, last, write_ns, chunk_ns[from], chunk_ns[to] );
+                }
+
+                if( rate_lag >= 0.0 ) {
+                    pair_lag.rate_lag.push_back( rate_lag );
+                } else {
+                    pair_lag.rate_missed++;
+                }
+
+                if( freq_lag >= 0.0 ) {
+                    pair_lag.freq_lag.push_back( freq_lag );
+                } else {
+                    pair_lag.freq_missed++;
+                }
+            }
+        }
+    }
+
+    spin.stop = true;
+    pthread_join( spinner, NULL );
+
+    if( cur_fd >= 0 ) {
+        cpuBackend().close( cur_fd );
+    }
+    actuator.close();
+    delete[] spin.stamps;
+}
+
+void printLagTable( map<string, lag_table_t> &results, bool raw ) {
+    printf( "#Actuator\tFrom\tTo\tSource\tSamples\tMissed\tMean (us)\tMin (us)\tP10 (us)\tP50 (us)\tP90 (us)\tP99 (us)\tMax (us)\n" );
+    for( map<string, lag_table_t>::iterator act_it = results.begin(); act_it != results.end(); act_it++ ) {
+        for( lag_table_t::iterator it = act_it->second.begin(); it != act_it->second.end(); it++ ) {
+            printLagRow( act_it->first, it->first.first, it->first.second, "call", it->second.call_lag, 0, raw );
+            printLagRow( act_it->first, it->first.first, it->first.second, "rate", it->second.rate_lag, it->second.rate_missed, raw );
+            printLagRow( act_it->first, it->first.first, it->first.second, "cur_freq", it->second.freq_lag, it->second.freq_missed, raw );
+        }
+    }
+}
+
+int main( int argc, char **argv ) {
+    po::variables_map vm;
+    if( !parseArguments( argc, argv, vm ) ) {
+        return 1;
+    }
+
+    string backend_err;
+    if( !initCpuBackend( vm[BACKEND_KEY.c_str()].as<string>(), backend_err ) ) {
+        cout << backend_err << endl;
+        return -1;
+    }
+
+    string actuator_kind = vm[ACTUATOR_KEY.c_str()].as<string>();
+    vector<string> kinds;
+    if( actuator_kind == SYSFS_ACTUATOR || actuator_kind == BOTH_ACTUATORS ) {
+        kinds.push_back( SYSFS_ACTUATOR );
+    }
+    if( actuator_kind == UCLAMP_ACTUATOR || actuator_kind == BOTH_ACTUATORS ) {
+        kinds.push_back( UCLAMP_ACTUATOR );
+    }
+    if( kinds.empty() ) {
+        printf( "Unknown actuator: %s\n", actuator_kind.c_str() );
+        return 1;
+    }
+
+    FrequencyTable cpu_avail_freq;
+    CpuMask cur_bind_mask;
+    vector<int> v;
+
+    int cpu_id = vm[TARGET_CPU_KEY.c_str()].as<int>();
+
+    v = vm[CPU_CUR_BIND_KEY.c_str()].as< vector<int> >();
+    if( find( v.begin(), v.end(), cpu_id ) != v.end() ) {
+        printf( "The controlling process must not share CPU%d with the spin loop\n", cpu_id );
+        return 1;
+    }
+    buildMask( v, cur_bind_mask );
+    bindCurProcTo( cur_bind_mask );
+
+    vector<int> online_cpus;
+    determineOnlineCPUs( online_cpus );
+
+    CpuStateSnapshot cpu_state;
+    string state_err;
+    if( !cpu_state.capture( online_cpus, state_err ) || !installRestoreHandler( cpu_state, state_err ) ) {
+        printf( "Unable to save cpufreq state: %s\n", state_err.c_str() );
+    }
+
+    map<string, lag_table_t> results;
+
+    for( vector<string>::iterator kind_it = kinds.begin(); kind_it != kinds.end(); kind_it++ ) {
+        map<int, string> governed_cpu;
+
+        // the sysfs actuator needs the userspace governor, uclamp needs schedutil
+        if( *kind_it == UCLAMP_ACTUATOR ) {
+            initSchedutil( online_cpus, governed_cpu );
+        } else {
+            initUserspace( online_cpus, governed_cpu );
+        }
+        cpu_avail_freq.clear();
+        fillAvailableThrottlingSpeeds( cpu_avail_freq, 1 );
+
+        if( governed_cpu.find( cpu_id ) == governed_cpu.end() || cpu_avail_freq.size() < 2 ) {
+            printf( "CPU%d cannot be throttled through %s\n", cpu_id, kind_it->c_str() );
+            continue;
+        }
+
+        TransitionLagTest( cpu_id, cpu_avail_freq, *kind_it, vm[SAMPLING_KEY.c_str()].as<int>(), ( uint64_t ) vm[WINDOW_KEY.c_str()].as<int>() * 1000,
+                           ( uint64_t ) vm[SETTLE_KEY.c_str()].as<int>() * 1000, results[*kind_it] );
+    }
+
+    printLagTable( results, vm.count( RAW_KEY.c_str() ) > 0 );
+
+    if( vm.count( SKIP_ONDEMAND_KEY.c_str() ) == 0 )
+        cpu_state.restore();
+
+    return 0;
+}
@@ -0,0 +1,107 @@
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+#include <time.h>
+
+#include <boost/program_options.hpp>
+
+#include "utils/timing.h"
+#include "utils/waiter.h"
+
+using namespace std;
+namespace po = boost::program_options;
+
+const string HELP_KEY = "help";
+const string WAITS_KEY = "waits";
+const string INTERVAL_KEY = "interval";
+const string SPIN_KEY = "spin";
+
+bool parseArguments( int argc, char **argv, po::variables_map &vm ) {
+    po::options_description general( "General Options" );
+    general.add_options()
+    (( HELP_KEY + ",h" ).c_str(), "Help options" )
+    (( WAITS_KEY + ",n" ).c_str(), po::value<int>()->default_value( 1000 ), "Periodic waits timed per mode" )
+    (( INTERVAL_KEY + ",i" ).c_str(), po::value<int>()->default_value( 1000 ), "Period of the waits (us)" )
+    (( SPIN_KEY + ",s" ).c_str(), po::value<int>()->default_value( 50 ), "Spin tail of the sleeping modes (us); each mode is also run without one" )
+    ;
+
+    po::store( po::parse_command_line( argc, argv, general ), vm );
+    po::notify( vm );
+
+    if( vm.count( HELP_KEY.c_str() ) ) {
+        cout << general << "\n";
+        return false;
+    }
+
+    return true;
+}
+
+uint64_t threadCpuNS() {
+    timespec t;
+    clock_gettime( CLOCK_THREAD_CPUTIME_ID, &t );
+    return ( uint64_t ) t.tv_sec * NS_PER_SEC + t.tv_nsec;
+}
+
+// Waits for waits absolute deadlines interval_ns apart and reports the wake
+// up lateness and the share of the period the thread spent on the cpu.
+void JitterTest( wait_mode_t mode, uint64_t spin_ns, int waits, uint64_t interval_ns ) {
+    DeadlineWaiter waiter( mode, spin_ns );
+    vector<uint64_t> late;
+    string err;
+    TIME deadline, begin, woke = 0;
+
+    if( !waiter.open( err ) ) {
+        printf( "# %s: %s\n", waitModeName( mode ), err.c_str() );
+        return;
+    }
+
+    late.reserve( waits );
+
+    GetTime( begin );
+    uint64_t cpu_begin = threadCpuNS();
+
+    deadline = begin;
+    for( int i = 0; i < waits; ++i ) {
+        deadline += interval_ns;
+        woke = waiter.waitUntil( deadline );
+        late.push_back( span_TIME( deadline, woke ) );
+    }
+
+    uint64_t cpu_ns = threadCpuNS() - cpu_begin;
+    uint64_t wall_ns = span_TIME( begin, woke );
+
+    sort( late.begin(), late.end() );
+
+    printf( "%s\t%lu\t%d\t%lu\t%lu\t%lu\t%lu\t%.1f\n", waitModeName( mode ), spin_ns, waits,
+            waiter.stat().total_ns / waits, late[waits / 2], late[( size_t )( waits * 0.99 )], waiter.stat().max_ns,
+            wall_ns > 0 ? 100.0 * cpu_ns / wall_ns : 0.0 );
+}
+
+int main( int argc, char **argv ) {
+    po::variables_map vm;
+    if( !parseArguments( argc, argv, vm ) ) {
+        return 1;
+    }
+
+    int waits = vm[WAITS_KEY.c_str()].as<int>();
+    uint64_t interval_ns = ( uint64_t ) vm[INTERVAL_KEY.c_str()].as<int>() * 1000;
+    uint64_t spin_ns = ( uint64_t ) vm[SPIN_KEY.c_str()].as<int>() * 1000;
+
+    if( waits < 1 || interval_ns == 0 ) {
+        cout << "Need at least one wait and a non zero interval" << endl;
+        return 1;
+    }
+
+    printf( "#Mode\tSpin (ns)\tWaits\tMean (ns)\tP50 (ns)\tP99 (ns)\tMax (ns)\tCPU (%%)\n" );
+    JitterTest( WAIT_SPIN, 0, waits, interval_ns );
+    for( int mode = WAIT_NANOSLEEP; mode < WAIT_MODE_COUNT; ++mode ) {
+        JitterTest(( wait_mode_t ) mode, 0, waits, interval_ns );
+        if( spin_ns > 0 ) {
+            JitterTest(( wait_mode_t ) mode, spin_ns, waits, interval_ns );
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,411 @@
+#include "utils/actuator.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+FreqActuator::FreqActuator() : backend( NULL ), ctrl_mode( FREQ_CTRL_SETSPEED ) {}
+
+FreqActuator::~FreqActuator() {
+    close();
+}
+
+bool FreqActuator::open( int cpu_idx, string &err ) {
+    char attr[100];
+
+    if( cpu_idx < 0 ) {
+        err = "Invalid CPU index";
+        return false;
+    }
+
+    if( isOpen( cpu_idx ) ) {
+        return true;
+    }
+
+    // every cpu of an actuator goes through the backend and control scheme
+    // of its first open
+    if( backend == NULL ) {
+        backend = &cpuBackend();
+        ctrl_mode = getFreqControl();
+    }
+
+    if(( int ) fds.size() <= cpu_idx ) {
+        fds.resize( cpu_idx + 1 );
+    }
+
+    cpu_ctrl_fd_t &ctrl = fds[cpu_idx];
+
+    if( ctrl_mode == FREQ_CTRL_WINDOW ) {
+        cpuFreqAttr( attr, sizeof( attr ), cpu_idx, SCALING_SETMINSPEED_FILE );
+
+        if(( ctrl.minspeed_fd = backend->open( attr, true ) ) < 0 ) {
+            err = "Unable to open Min Speed file";
+            return false;
+        }
+    } else {
+        cpuFreqAttr( attr, sizeof( attr ), cpu_idx, SCALING_SETSPEED_FILE );
+
+        if(( ctrl.setspeed_fd = backend->open( attr, true ) ) < 0 ) {
+            err = "Unable to open Set Speed file";
+            return false;
+        }
+    }
+
+    cpuFreqAttr( attr, sizeof( attr ), cpu_idx, SCALING_SETMAXSPEED_FILE );
+
+    if(( ctrl.maxspeed_fd = backend->open( attr, true ) ) < 0 ) {
+        if( ctrl.setspeed_fd >= 0 ) {
+            backend->close( ctrl.setspeed_fd );
+            ctrl.setspeed_fd = -1;
+        }
+        if( ctrl.minspeed_fd >= 0 ) {
+            backend->close( ctrl.minspeed_fd );
+            ctrl.minspeed_fd = -1;
+        }
+        err = "Unable to open Max Speed file";
+        return false;
+    }
+
+    return true;
+}
+
+bool FreqActuator::open( map<int, string> &cpus, string &err ) {
+    // size the per-cpu table once so later opens never reallocate it
+    if( !cpus.empty() && ( int ) fds.size() <= cpus.rbegin()->first ) {
+        fds.resize( cpus.rbegin()->first + 1 );
+    }
+
+    for( map<int, string>::iterator cpu_it = cpus.begin(); cpu_it != cpus.end(); cpu_it++ ) {
+        if( !open( cpu_it->first, err ) ) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void FreqActuator::close() {
+    for( vector<cpu_ctrl_fd_t>::iterator it = fds.begin(); it != fds.end(); it++ ) {
+        if( it->setspeed_fd >= 0 ) {
+            backend->close( it->setspeed_fd );
+        }
+        if( it->maxspeed_fd >= 0 ) {
+            backend->close( it->maxspeed_fd );
+        }
+        if( it->minspeed_fd >= 0 ) {
+            backend->close( it->minspeed_fd );
+        }
+    }
+    fds.clear();
+    backend = NULL;
+}
+
+bool FreqActuator::isOpen( int cpu_idx ) const {
+    return cpu_idx >= 0 && cpu_idx < ( int ) fds.size() && fds[cpu_idx].maxspeed_fd >= 0;
+}
+
+bool FreqActuator::hasDescriptors() const {
+    return backend == NULL || backend->hasDescriptors();
+}
+
+// setspeed is capped by max_freq and goes first; a window is collapsed from
+// the side the speed moves towards (see raiseWindowFirst)
+bool FreqActuator::writeOrder( int cpu_idx, int khz, int &first_fd, int &second_fd ) const {
+    if( !isOpen( cpu_idx ) ) {
+        return false;
+    }
+
+    const cpu_ctrl_fd_t &ctrl = fds[cpu_idx];
+
+    if( ctrl_mode == FREQ_CTRL_SETSPEED ) {
+        first_fd = ctrl.setspeed_fd;
+        second_fd = ctrl.maxspeed_fd;
+    } else if( raiseWindowFirst( cpu_idx, khz ) ) {
+        first_fd = ctrl.maxspeed_fd;
+        second_fd = ctrl.minspeed_fd;
+    } else {
+        first_fd = ctrl.minspeed_fd;
+        second_fd = ctrl.maxspeed_fd;
+    }
+    return true;
+}
+
+bool FreqActuator::setSpeed( int cpu_idx, const string &speed, string &err ) {
+    int first_fd, second_fd;
+    int khz = atoi( speed.c_str() );
+    ssize_t len = speed.length();
+
+    if( !writeOrder( cpu_idx, khz, first_fd, second_fd ) ) {
+        err = "CPU control files are not open";
+        return false;
+    }
+
+    if( speedShadowMatches( cpu_idx, khz ) ) {
+        return true;
+    }
+
+    if( ctrl_mode == FREQ_CTRL_SETSPEED ) {
+        if( backend->write( first_fd, speed.c_str(), len ) != len ) {
+            err = "Unable to write Set Speed file";
+            updateSpeedShadow( cpu_idx, khz, false );
+            return false;
+        }
+
+        if( backend->write( second_fd, speed.c_str(), len ) != len ) {
+            err = "Unable to write Max Speed file";
+            updateSpeedShadow( cpu_idx, khz, false );
+            return false;
+        }
+
+        updateSpeedShadow( cpu_idx, khz, true );
+        return true;
+    }
+
+    // a bound refused because the window would invert is retried once the
+    // other bound has moved
+    bool first_ok = backend->write( first_fd, speed.c_str(), len ) == len;
+    bool ok = backend->write( second_fd, speed.c_str(), len ) == len;
+
+    if( ok && !first_ok ) {
+        ok = backend->write( first_fd, speed.c_str(), len ) == len;
+    }
+    if( !ok ) {
+        err = "Unable to write frequency window";
+    }
+
+    updateSpeedShadow( cpu_idx, khz, ok );
+    return ok;
+}
+
+BatchActuator::BatchActuator( FreqActuator &_actuator, int _writer_count ) :
+    actuator( _actuator ), writer_count( _writer_count < 1 ? 1 : _writer_count ), running( false ),
+    batch( NULL ), generation( 0 ), pending( 0 ), in_flight( false ), shutdown( false ) {
+    pthread_mutex_init( &mute_batch, NULL );
+    pthread_cond_init( &cond_submit, NULL );
+    pthread_cond_init( &cond_done, NULL );
+}
+
+BatchActuator::~BatchActuator() {
+    stop();
+
+    pthread_cond_destroy( &cond_done );
+    pthread_cond_destroy( &cond_submit );
+    pthread_mutex_destroy( &mute_batch );
+}
+
+bool BatchActuator::start( string &err ) {
+    if( running ) {
+        return true;
+    }
+
+    shutdown = false;
+    running = true;
+
+    // a single writer applies batches on the calling thread
+    if( writer_count == 1 ) {
+        return true;
+    }
+
+    writers.resize( writer_count );
+    writer_args.resize( writer_count );
+
+    for( int i = 0; i < writer_count; i++ ) {
+        writer_args[i].owner = this;
+        writer_args[i].writer_idx = i;
+
+        if( pthread_create( &writers[i], NULL, writerThread, ( void * ) &writer_args[i] ) ) {
+            err = "Unable to create batch writer thread";
+            writers.resize( i );
+            stop();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void BatchActuator::stop() {
+    if( !running ) {
+        return;
+    }
+
+    batch_stat_t stat;
+    wait( stat );
+
+    pthread_mutex_lock( &mute_batch );
+    shutdown = true;
+    pthread_cond_broadcast( &cond_submit );
+    pthread_mutex_unlock( &mute_batch );
+
+    for( vector<pthread_t>::iterator it = writers.begin(); it != writers.end(); it++ ) {
+        pthread_join( *it, NULL );
+    }
+
+    writers.clear();
+    writer_args.clear();
+    running = false;
+}
+
+void *BatchActuator::writerThread( void *args ) {
+    writer_arg_t *arg = ( writer_arg_t * ) args;
+    BatchActuator *owner = arg->owner;
+    uint64_t seen = 0;
+
+    while( true ) {
+        pthread_mutex_lock( &owner->mute_batch );
+        while( owner->generation == seen && !owner->shutdown ) {
+            pthread_cond_wait( &owner->cond_submit, &owner->mute_batch );
+        }
+
+        if( owner->shutdown ) {
+            pthread_mutex_unlock( &owner->mute_batch );
+            break;
+        }
+        seen = owner->generation;
+        pthread_mutex_unlock( &owner->mute_batch );
+
+        owner->applyStripe( arg->writer_idx );
+
+        pthread_mutex_lock( &owner->mute_batch );
+        if( --owner->pending == 0 ) {
+            pthread_cond_signal( &owner->cond_done );
+        }
+        pthread_mutex_unlock( &owner->mute_batch );
+    }
+
+    pthread_exit( NULL );
+}
+
+// reduce the batch to one write per frequency domain
+void BatchActuator::planWrites() {
+    vector<freq_decision_t> &decisions = *batch;
+    int domain, owner;
+
+    writes.clear();
+    domain_writer.assign( getFrequencyDomains().size(), -1 );
+
+    for( int i = 0; i < ( int ) decisions.size(); i++ ) {
+        freq_decision_t &dec = decisions[i];
+        dec.applied_speed = dec.speed;
+        dec.applied = false;
+        dec.conflict = false;
+
+        if(( domain = getFrequencyDomain( dec.cpu_idx ) ) < 0 || ( owner = domain_writer[domain] ) < 0 ) {
+            dec.writer = i;
+            writes.push_back( i );
+            if( domain >= 0 ) {
+                domain_writer[domain] = i;
+            }
+            continue;
+        }
+
+        dec.writer = owner;
+        if( dec.speed != decisions[owner].speed ) {
+            if( !decisions[owner].conflict ) {
+                batch_stat.conflicts++;
+            }
+            decisions[owner].conflict = true;
+            dec.conflict = true;
+
+            // the faster request wins so no core on the critical path is slowed
+            if( atoi( dec.speed.c_str() ) > atoi( decisions[owner].applied_speed.c_str() ) ) {
+                decisions[owner].applied_speed = dec.speed;
+            }
+        }
+    }
+
+    batch_stat.writes = writes.size();
+}
+
+void BatchActuator::applyStripe( int writer_idx ) {
+    string err;
+    vector<freq_decision_t> &decisions = *batch;
+
+    for( size_t i = writer_idx; i < writes.size(); i += writer_count ) {
+        freq_decision_t &dec = decisions[writes[i]];
+        dec.applied = actuator.setSpeed( dec.cpu_idx, dec.applied_speed, err );
+        GetTime( dec.done );
+    }
+}
+
+bool BatchActuator::submit( vector<freq_decision_t> &decisions ) {
+    if( !running ) {
+        return false;
+    }
+
+    // only one batch may be in flight at a time
+    batch_stat_t stat;
+    wait( stat );
+
+    batch = &decisions;
+    batch_stat = batch_stat_t();
+    GetTime( batch_stat.submitted );
+    planWrites();
+
+    if( writer_count == 1 ) {
+        applyStripe( 0 );
+        in_flight = true;
+        return true;
+    }
+
+    pthread_mutex_lock( &mute_batch );
+    pending = writer_count;
+    in_flight = true;
+    generation++;
+    pthread_cond_broadcast( &cond_submit );
+    pthread_mutex_unlock( &mute_batch );
+
+    return true;
+}
+
+void BatchActuator::wait( batch_stat_t &stat ) {
+    if( !in_flight ) {
+        return;
+    }
+
+    pthread_mutex_lock( &mute_batch );
+    while( pending > 0 ) {
+        pthread_cond_wait( &cond_done, &mute_batch );
+    }
+    in_flight = false;
+    pthread_mutex_unlock( &mute_batch );
+
+    vector<freq_decision_t> &decisions = *batch;
+    batch_stat.first_done = batch_stat.submitted;
+    batch_stat.last_done = batch_stat.submitted;
+
+    for( vector<freq_decision_t>::iterator it = decisions.begin(); it != decisions.end(); it++ ) {
+        if( it->writer != it - decisions.begin() ) {
+            it->applied_speed = decisions[it->writer].applied_speed;
+            it->applied = decisions[it->writer].applied;
+            it->done = decisions[it->writer].done;
+        }
+
+        if( !it->applied ) {
+            batch_stat.failed++;
+            continue;
+        }
+
+        if( batch_stat.applied == 0 || span_TIME( it->done, batch_stat.first_done ) > 0 ) {
+            batch_stat.first_done = it->done;
+        }
+        if( span_TIME( batch_stat.last_done, it->done ) > 0 ) {
+            batch_stat.last_done = it->done;
+        }
+        batch_stat.applied++;
+    }
+
+    batch = NULL;
+    stat = batch_stat;
+}
+
+void BatchActuator::apply( vector<freq_decision_t> &decisions, batch_stat_t &stat ) {
+    if( submit( decisions ) ) {
+        wait( stat );
+    }
+}
+
+void printBatchStat( batch_stat_t &stat ) {
+    printf( "Batch applied %d failed %d writes %d conflicts %d latency %lu %s skew %lu %s\n", stat.applied, stat.failed, stat.writes, stat.conflicts,
+            span_TIME( stat.submitted, stat.last_done ), TIME_ABRV,
+            span_TIME( stat.first_done, stat.last_done ), TIME_ABRV );
+}
@@ -0,0 +1,164 @@
+#include "utils/asynclog.h"
+#include "utils/procbind.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <time.h>
+
+// how long an idle logger sleeps between looks at its rings
+const uint64_t LOG_POLL_NS = 200000;
+
+LogRing::LogRing( size_t capacity ) : drops( 0 ), head( 0 ), tail( 0 ) {
+    size_t size = 1;
+
+    while( size < capacity ) {
+        size <<= 1;
+    }
+    slots.resize( size );
+    mask = size - 1;
+}
+
+bool LogRing::push( const log_record_t &rec ) {
+    uint64_t at = head;
+
+    if( at - __atomic_load_n( &tail, __ATOMIC_ACQUIRE ) > mask ) {
+        __atomic_store_n( &drops, drops + 1, __ATOMIC_RELAXED );
+        return false;
+    }
+
+    slots[at & mask] = rec;
+    __atomic_store_n( &head, at + 1, __ATOMIC_RELEASE );
+    return true;
+}
+
+const log_record_t *LogRing::front() {
+    if( tail == __atomic_load_n( &head, __ATOMIC_ACQUIRE ) ) {
+        return NULL;
+    }
+    return &slots[tail & mask];
+}
+
+void LogRing::release() {
+    __atomic_store_n( &tail, tail + 1, __ATOMIC_RELEASE );
+}
+
+bool LogRing::empty() const {
+    return __atomic_load_n( &tail, __ATOMIC_ACQUIRE ) == __atomic_load_n( &head, __ATOMIC_ACQUIRE );
+}
+
+AsyncLogger::AsyncLogger( log_format_t _format, size_t _ring_records ) : format( _format ), ring_records( _ring_records ), running( false ), stopping( false ), formatted( 0 ) {
+}
+
+AsyncLogger::~AsyncLogger() {
+    stop();
+    for( size_t i = 0; i < rings.size(); i++ ) {
+        delete rings[i];
+    }
+}
+
+LogRing *AsyncLogger::addProducer() {
+    if( running ) {
+        return NULL;
+    }
+    rings.push_back( new LogRing( ring_records ) );
+    return rings.back();
+}
+
+bool AsyncLogger::start( int cpu_idx, string &err ) {
+    pthread_attr_t attrs;
+    CpuMask mask;
+
+    if( running ) {
+        return true;
+    }
+
+    pthread_attr_init( &attrs );
+    if( cpu_idx >= 0 ) {
+        mask.set( cpu_idx );
+        int rc = pthread_attr_setaffinity_np( &attrs, mask.size(), mask.get() );
+        if( rc ) {
+            err = string( "Unable to pin logger: " ) + strerror( rc );
+            pthread_attr_destroy( &attrs );
+            return false;
+        }
+    }
+
+    stopping = false;
+    int rc = pthread_create( &thread, &attrs, loggerThread, ( void * ) this );
+    pthread_attr_destroy( &attrs );
+    if( rc ) {
+        err = string( "Unable to create logger thread: " ) + strerror( rc );
+        return false;
+    }
+
+    running = true;
+    return true;
+}
+
+void AsyncLogger::sync() {
+    timespec poll = { 0, ( long ) LOG_POLL_NS };
+
+    for( size_t i = 0; running && i < rings.size(); ) {
+        if( rings[i]->empty() ) {
+            i++;
+        } else {
+            nanosleep( &poll, NULL );
+        }
+    }
+    fflush( stdout );
+}
+
+void AsyncLogger::stop() {
+    if( !running ) {
+        return;
+    }
+
+    __atomic_store_n( &stopping, true, __ATOMIC_RELEASE );
+    pthread_join( thread, NULL );
+    running = false;
+}
+
+uint64_t AsyncLogger::dropped() const {
+    uint64_t drops = 0;
+
+    for( size_t i = 0; i < rings.size(); i++ ) {
+        drops += rings[i]->dropped();
+    }
+    return drops;
+}
+
+uint64_t AsyncLogger::drain() {
+    const log_record_t *rec;
+    uint64_t count = 0;
+
+    for( size_t i = 0; i < rings.size(); i++ ) {
+        while(( rec = rings[i]->front() ) != NULL ) {
+            format( *rec );
+            rings[i]->release();
+            count++;
+        }
+    }
+
+    if( count > 0 ) {
+        __atomic_store_n( &formatted, formatted + count, __ATOMIC_RELAXED );
+        fflush( stdout );
+    }
+    return count;
+}
+
+void *AsyncLogger::loggerThread( void *args ) {
+    AsyncLogger *logger = ( AsyncLogger * ) args;
+    timespec poll = { 0, ( long ) LOG_POLL_NS };
+
+    while( !__atomic_load_n( &logger->stopping, __ATOMIC_ACQUIRE ) ) {
+        if( logger->drain() == 0 ) {
+            nanosleep( &poll, NULL );
+        }
+    }
+
+    // records pushed before stop() still get written
+    logger->drain();
+
+    pthread_exit( NULL );
+}
@@ -0,0 +1,416 @@
+#include "utils/asyncwriter.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+
+AsyncFreqWriter::AsyncFreqWriter( FreqActuator &_actuator ) : actuator( _actuator ), outstanding( 0 ) {
+    pthread_mutex_init( &mute_done, NULL );
+    pthread_cond_init( &cond_done, NULL );
+}
+
+AsyncFreqWriter::~AsyncFreqWriter() {
+    pthread_cond_destroy( &cond_done );
+    pthread_mutex_destroy( &mute_done );
+}
+
+bool AsyncFreqWriter::prepare( async_write_t &req, int cpu_idx, const string &speed ) {
+    if( speed.length() >= ( size_t ) ASYNC_SPEED_LEN || !actuator.isOpen( cpu_idx ) ) {
+        return false;
+    }
+
+    req.cpu_idx = cpu_idx;
+    req.speed_len = speed.length();
+    memcpy( req.speed, speed.c_str(), req.speed_len + 1 );
+    req.ok = false;
+
+    pthread_mutex_lock( &mute_done );
+    outstanding++;
+    pthread_mutex_unlock( &mute_done );
+
+    GetTime( req.submitted );
+    return true;
+}
+
+void AsyncFreqWriter::complete( async_write_t &req, bool ok ) {
+    GetTime( req.completed );
+    req.ok = ok;
+
+    pthread_mutex_lock( &mute_done );
+    completed.push_back( req );
+    if( --outstanding == 0 ) {
+        pthread_cond_broadcast( &cond_done );
+    }
+    pthread_mutex_unlock( &mute_done );
+}
+
+void AsyncFreqWriter::flush() {
+    pthread_mutex_lock( &mute_done );
+    while( outstanding > 0 ) {
+        pthread_cond_wait( &cond_done, &mute_done );
+    }
+    pthread_mutex_unlock( &mute_done );
+}
+
+void AsyncFreqWriter::collect( vector<async_write_t> &done ) {
+    pthread_mutex_lock( &mute_done );
+    done.insert( done.end(), completed.begin(), completed.end() );
+    completed.clear();
+    pthread_mutex_unlock( &mute_done );
+}
+
+AsyncFreqWriter *AsyncFreqWriter::create( FreqActuator &actuator, int pool_threads, string &err ) {
+    AsyncFreqWriter *writer;
+
+#if IO_URING
+    writer = new UringFreqWriter( actuator );
+    if( writer->start( err ) ) {
+        return writer;
+    }
+    printf( "io_uring unavailable (%s); falling back to thread pool writer\n", err.c_str() );
+    delete writer;
+#endif
+
+    writer = new PoolFreqWriter( actuator, pool_threads );
+    if( !writer->start( err ) ) {
+        delete writer;
+        return NULL;
+    }
+    return writer;
+}
+
+PoolFreqWriter::PoolFreqWriter( FreqActuator &_actuator, int _thread_count ) :
+    AsyncFreqWriter( _actuator ), thread_count( _thread_count < 1 ? 1 : _thread_count ), shutdown( false ), started( 0 ) {
+    for( int i = 0; i < thread_count; i++ ) {
+        writer_shard_t *shard = new writer_shard_t;
+        shard->owner = this;
+        pthread_mutex_init( &shard->mute_queue, NULL );
+        pthread_cond_init( &shard->cond_queue, NULL );
+        shards.push_back( shard );
+    }
+}
+
+PoolFreqWriter::~PoolFreqWriter() {
+    stop();
+
+    for( size_t i = 0; i < shards.size(); i++ ) {
+        pthread_cond_destroy( &shards[i]->cond_queue );
+        pthread_mutex_destroy( &shards[i]->mute_queue );
+        delete shards[i];
+    }
+}
+
+// cpus outside any known domain are sharded alone
+int PoolFreqWriter::shardOf( int cpu_idx ) const {
+    int domain = getFrequencyDomain( cpu_idx );
+
+    return ( domain >= 0 ? domain : cpu_idx ) % thread_count;
+}
+
+bool PoolFreqWriter::start( string &err ) {
+    shutdown = false;
+
+    for( started = 0; started < thread_count; started++ ) {
+        if( pthread_create( &shards[started]->thread, NULL, writerThread, ( void * ) shards[started] ) ) {
+            err = "Unable to create writer thread";
+            stop();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void PoolFreqWriter::stop() {
+    if( started == 0 ) {
+        return;
+    }
+
+    for( int i = 0; i < started; i++ ) {
+        pthread_mutex_lock( &shards[i]->mute_queue );
+        shutdown = true;
+        pthread_cond_broadcast( &shards[i]->cond_queue );
+        pthread_mutex_unlock( &shards[i]->mute_queue );
+    }
+
+    for( int i = 0; i < started; i++ ) {
+        pthread_join( shards[i]->thread, NULL );
+    }
+    started = 0;
+}
+
+bool PoolFreqWriter::submit( int cpu_idx, const string &speed, bool &conflict ) {
+    async_write_t req;
+
+    conflict = false;
+    if( started < thread_count || !prepare( req, cpu_idx, speed ) ) {
+        return false;
+    }
+    conflict = recordSpeedRequest( cpu_idx, atoi( speed.c_str() ) );
+
+    writer_shard_t *shard = shards[shardOf( cpu_idx )];
+    pthread_mutex_lock( &shard->mute_queue );
+    shard->queue.push_back( req );
+    pthread_cond_signal( &shard->cond_queue );
+    pthread_mutex_unlock( &shard->mute_queue );
+
+    return true;
+}
+
+void *PoolFreqWriter::writerThread( void *args ) {
+    writer_shard_t *shard = ( writer_shard_t * ) args;
+    PoolFreqWriter *writer = shard->owner;
+    async_write_t req;
+    string err;
+
+    while( true ) {
+        pthread_mutex_lock( &shard->mute_queue );
+        while( shard->queue.empty() && !writer->shutdown ) {
+            pthread_cond_wait( &shard->cond_queue, &shard->mute_queue );
+        }
+
+        // pending writes are still applied on shutdown
+        if( shard->queue.empty() ) {
+            pthread_mutex_unlock( &shard->mute_queue );
+            break;
+        }
+
+        req = shard->queue.front();
+        shard->queue.pop_front();
+        pthread_mutex_unlock( &shard->mute_queue );
+
+        writer->complete( req, writer->actuator.setSpeed( req.cpu_idx, req.speed, err ) );
+    }
+
+    pthread_exit( NULL );
+}
+
+#if IO_URING
+
+const uint64_t URING_STOP_TAG = ( uint64_t ) - 1;
+
+UringFreqWriter::UringFreqWriter( FreqActuator &_actuator, int _depth ) :
+    AsyncFreqWriter( _actuator ), depth( _depth ), running( false ) {
+    pthread_mutex_init( &mute_ring, NULL );
+    pthread_cond_init( &cond_slot, NULL );
+}
+
+UringFreqWriter::~UringFreqWriter() {
+    stop();
+    pthread_cond_destroy( &cond_slot );
+    pthread_mutex_destroy( &mute_ring );
+}
+
+bool UringFreqWriter::start( string &err ) {
+    int rc;
+
+    if( !actuator.hasDescriptors() ) {
+        err = "cpufreq backend has no file descriptors";
+        return false;
+    }
+
+    if(( rc = io_uring_queue_init( depth, &ring, 0 ) ) < 0 ) {
+        err = strerror( -rc );
+        return false;
+    }
+
+    // every request takes two submission entries
+    slots.resize( depth / 2 );
+    slot_failed.assign( depth / 2, false );
+    slot_key.assign( depth / 2, -1 );
+    key_outstanding.assign( getFrequencyDomains().size() + determineCPUIdBound(), 0 );
+    queued_khz.assign( key_outstanding.size(), -1 );
+    key_waiting.assign( key_outstanding.size(), deque<int>() );
+    free_slots.clear();
+    for( int i = depth / 2 - 1; i >= 0; i-- ) {
+        free_slots.push_back( i );
+    }
+
+    if( pthread_create( &reaper, NULL, reaperThread, ( void * ) this ) ) {
+        io_uring_queue_exit( &ring );
+        err = "Unable to create completion thread";
+        return false;
+    }
+
+    running = true;
+    return true;
+}
+
+void UringFreqWriter::stop() {
+    if( !running ) {
+        return;
+    }
+
+    flush();
+
+    pthread_mutex_lock( &mute_ring );
+    struct io_uring_sqe *sqe = io_uring_get_sqe( &ring );
+    io_uring_prep_nop( sqe );
+    io_uring_sqe_set_data64( sqe, URING_STOP_TAG );
+    io_uring_submit( &ring );
+    pthread_mutex_unlock( &mute_ring );
+
+    pthread_join( reaper, NULL );
+    io_uring_queue_exit( &ring );
+    running = false;
+}
+
+// cpus outside any known domain are keyed alone, after the domains
+int UringFreqWriter::keyOf( int cpu_idx ) const {
+    int domain = getFrequencyDomain( cpu_idx );
+    int key = domain >= 0 ? domain : ( int ) getFrequencyDomains().size() + cpu_idx;
+
+    return cpu_idx >= 0 && key < ( int ) key_outstanding.size() ? key : -1;
+}
+
+bool UringFreqWriter::submit( int cpu_idx, const string &speed, bool &conflict ) {
+    int slot, key, current;
+
+    conflict = false;
+    if( !running ) {
+        return false;
+    }
+
+    int khz = atoi( speed.c_str() );
+
+    conflict = recordSpeedRequest( cpu_idx, khz );
+
+    pthread_mutex_lock( &mute_ring );
+    if(( key = keyOf( cpu_idx ) ) < 0 ) {
+        pthread_mutex_unlock( &mute_ring );
+        return false;
+    }
+
+    // the shadow only follows completed writes, so while writes to the
+    // domain are outstanding a request is compared with the last one queued
+    current = key_outstanding[key] > 0 ? queued_khz[key] : getSpeedShadow( cpu_idx );
+    if( speedRequestMatches( cpu_idx, khz, current ) ) {
+        pthread_mutex_unlock( &mute_ring );
+
+        // logged like the writes the pool writer elides
+        async_write_t elided;
+        if( !prepare( elided, cpu_idx, speed ) ) {
+            return false;
+        }
+        complete( elided, true );
+        return true;
+    }
+
+    // back-pressure delays the caller rather than dropping the write; a
+    // full ring always has requests in flight to free a slot
+    while( free_slots.empty() || io_uring_sq_space_left( &ring ) < 2 ) {
+        pthread_cond_wait( &cond_slot, &mute_ring );
+    }
+
+    slot = free_slots.back();
+    async_write_t &req = slots[slot];
+    if( !prepare( req, cpu_idx, speed ) ) {
+        pthread_mutex_unlock( &mute_ring );
+        return false;
+    }
+    free_slots.pop_back();
+    slot_failed[slot] = false;
+    slot_key[slot] = key;
+    queued_khz[key] = khz;
+
+    if( key_outstanding[key]++ > 0 ) {
+        key_waiting[key].push_back( slot );
+    } else {
+        queueWrites( slot );
+    }
+    pthread_mutex_unlock( &mute_ring );
+
+    return true;
+}
+
+// queue the linked pair of a slot's request; called under mute_ring
+void UringFreqWriter::queueWrites( int slot ) {
+    struct io_uring_sqe *sqe;
+    async_write_t &req = slots[slot];
+    int first_fd, second_fd;
+
+    // the second control file is only written once the first has succeeded;
+    // a window write refused this way leaves the shadow unknown, so the next
+    // request raises max_freq first
+    actuator.writeOrder( req.cpu_idx, atoi( req.speed ), first_fd, second_fd );
+
+    sqe = io_uring_get_sqe( &ring );
+    io_uring_prep_write( sqe, first_fd, req.speed, req.speed_len, 0 );
+    io_uring_sqe_set_flags( sqe, IOSQE_IO_LINK );
+    io_uring_sqe_set_data64( sqe, ( uint64_t ) slot << 1 );
+
+    sqe = io_uring_get_sqe( &ring );
+    io_uring_prep_write( sqe, second_fd, req.speed, req.speed_len, 0 );
+    io_uring_sqe_set_data64( sqe, (( uint64_t ) slot << 1 ) | 1 );
+
+    io_uring_submit( &ring );
+}
+
+void *UringFreqWriter::reaperThread( void *args ) {
+    UringFreqWriter *writer = ( UringFreqWriter * ) args;
+    struct io_uring_cqe *cqe;
+    uint64_t tag;
+    int slot, res, rc, key;
+
+    while( true ) {
+        // a signal delivered to the reaper must not end it, or flush() and
+        // back-pressure would wait forever
+        if(( rc = io_uring_wait_cqe( &writer->ring, &cqe ) ) == -EINTR ) {
+            continue;
+        }
+        if( rc < 0 ) {
+            break;
+        }
+
+        tag = io_uring_cqe_get_data64( cqe );
+        res = cqe->res;
+        io_uring_cqe_seen( &writer->ring, cqe );
+
+        if( tag == URING_STOP_TAG ) {
+            break;
+        }
+
+        slot = ( int )( tag >> 1 );
+        async_write_t &req = writer->slots[slot];
+
+        if( res != req.speed_len ) {
+            writer->slot_failed[slot] = true;
+        }
+
+        // the second write (or its cancellation) completes the request
+        if( tag & 1 ) {
+            updateSpeedShadow( req.cpu_idx, atoi( req.speed ), !writer->slot_failed[slot] );
+            writer->complete( req, !writer->slot_failed[slot] );
+
+            // the next request of the domain goes out once this one is done
+            pthread_mutex_lock( &writer->mute_ring );
+            key = writer->slot_key[slot];
+            writer->key_outstanding[key]--;
+            if( !writer->key_waiting[key].empty() ) {
+                writer->queueWrites( writer->key_waiting[key].front() );
+                writer->key_waiting[key].pop_front();
+            }
+            writer->free_slots.push_back( slot );
+            pthread_cond_signal( &writer->cond_slot );
+            pthread_mutex_unlock( &writer->mute_ring );
+        }
+    }
+
+    pthread_exit( NULL );
+}
+
+#endif
+
+void printAsyncWrites( vector<async_write_t> &writes ) {
+    printf( "#CPU\tFrequency\tSubmitted (%s)\tCompleted (%s)\tLatency (%s)\tStatus\n", TIME_ABRV, TIME_ABRV, TIME_ABRV );
+
+    for( vector<async_write_t>::iterator it = writes.begin(); it != writes.end(); it++ ) {
+        printf( "%d\t%s\t", it->cpu_idx, it->speed );
+        PrintTime( it->submitted );
+        printf( "\t" );
+        PrintTime( it->completed );
+        printf( "\t%lu\t%s\n", span_TIME( it->submitted, it->completed ), it->ok ? "OK" : "FAILED" );
+    }
+}
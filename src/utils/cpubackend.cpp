@@ -0,0 +1,437 @@
+#include "utils/cpubackend.h"
+#include "utils/cpufunc.h"
+#include "utils/cpustats.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// speeds of the default tree of the fake and in-memory backends
+const int DEFAULT_MIN_KHZ = 800000;
+const int DEFAULT_MAX_KHZ = 2400000;
+const int DEFAULT_STEP_KHZ = 200000;
+
+static SysfsBackend host_backend;
+static CpuBackend *cur_backend = &host_backend;
+
+bool CpuBackend::readAttr( const char *attr, char *buffer, size_t len ) {
+    int handle = open( attr, false );
+    ssize_t size;
+
+    if( handle < 0 ) {
+        return false;
+    }
+
+    size = read( handle, buffer, len - 1 );
+    close( handle );
+
+    buffer[size > 0 ? size : 0] = '\0';
+    return size >= 0;
+}
+
+bool CpuBackend::writeAttr( const char *attr, const char *buffer, size_t len ) {
+    int handle = open( attr, true );
+    ssize_t size;
+
+    if( handle < 0 ) {
+        return false;
+    }
+
+    size = write( handle, buffer, len );
+    close( handle );
+
+    return size == ( ssize_t ) len;
+}
+
+SysfsBackend::SysfsBackend( const string &_root ) : root( _root ) {}
+
+int SysfsBackend::open( const char *attr, bool writable ) {
+    char file_path[256];
+
+    snprintf( file_path, sizeof( file_path ), "%s/%s", root.c_str(), attr );
+    return ::open( file_path, ( writable ? O_WRONLY : O_RDONLY ) | O_CLOEXEC );
+}
+
+void SysfsBackend::close( int handle ) {
+    ::close( handle );
+}
+
+ssize_t SysfsBackend::read( int handle, char *buffer, size_t len ) {
+    return pread( handle, buffer, len, 0 );
+}
+
+// sysfs attributes are rewritten as a whole on every write at offset 0
+ssize_t SysfsBackend::write( int handle, const char *buffer, size_t len ) {
+    return pwrite( handle, buffer, len, 0 );
+}
+
+FakeSysfsBackend::FakeSysfsBackend( const string &_root ) : SysfsBackend( _root ) {}
+
+ssize_t FakeSysfsBackend::write( int handle, const char *buffer, size_t len ) {
+    ssize_t size = pwrite( handle, buffer, len, 0 );
+
+    if( size >= 0 && ftruncate( handle, size ) != 0 ) {
+        return -1;
+    }
+    return size;
+}
+
+bool FakeSysfsBackend::populate( int cpu_count, const vector<int> &khz, const string &driver, string &err ) {
+    map<string, string> tree;
+    char file_path[256];
+
+    buildCpuTree( cpu_count, khz, driver, tree );
+
+    for( map<string, string>::iterator it = tree.begin(); it != tree.end(); it++ ) {
+        snprintf( file_path, sizeof( file_path ), "%s/%s", root.c_str(), it->first.c_str() );
+
+        // create every missing parent directory
+        for( char *sep = strchr( file_path + 1, '/' ); sep != NULL; sep = strchr( sep + 1, '/' ) ) {
+            *sep = '\0';
+            if( mkdir( file_path, 0755 ) != 0 && errno != EEXIST ) {
+                err = string( "Unable to create " ) + file_path;
+                return false;
+            }
+            *sep = '/';
+        }
+
+        int fd = ::open( file_path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644 );
+        if( fd < 0 ) {
+            if( errno == EEXIST ) {
+                continue;
+            }
+            err = string( "Unable to create " ) + file_path;
+            return false;
+        }
+
+        ssize_t size = ::write( fd, it->second.c_str(), it->second.length() );
+        ::close( fd );
+
+        if( size != ( ssize_t ) it->second.length() ) {
+            err = string( "Unable to write " ) + file_path;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+MemoryBackend::MemoryBackend() {
+    pthread_mutex_init( &mute_attrs, NULL );
+}
+
+MemoryBackend::MemoryBackend( int cpu_count, const vector<int> &khz, const string &driver ) {
+    map<string, string> tree;
+    char attr[100], cur_attr[100];
+
+    pthread_mutex_init( &mute_attrs, NULL );
+
+    buildCpuTree( cpu_count, khz, driver, tree );
+    for( map<string, string>::iterator it = tree.begin(); it != tree.end(); it++ ) {
+        set( it->first, it->second );
+    }
+
+    for( int i = 0; i < cpu_count; i++ ) {
+        cpuFreqAttr( attr, sizeof( attr ), i, cpuSpeedFile( driver ) );
+        cpuFreqAttr( cur_attr, sizeof( cur_attr ), i, SCALING_CUR_FREQ );
+        link( attr, cur_attr );
+    }
+}
+
+MemoryBackend::~MemoryBackend() {
+    for( deque<mem_attr_t>::iterator it = attrs.begin(); it != attrs.end(); it++ ) {
+        pthread_mutex_destroy( &it->mute );
+    }
+    pthread_mutex_destroy( &mute_attrs );
+}
+
+static bool attrLess( const pair<string, int> &entry, const char *attr ) {
+    return strcmp( entry.first.c_str(), attr ) < 0;
+}
+
+// handle of an attribute, or -1
+int MemoryBackend::find( const char *attr ) const {
+    vector<pair<string, int> >::const_iterator it = lower_bound( index.begin(), index.end(), attr, attrLess );
+
+    if( it != index.end() && it->first == attr ) {
+        return it->second;
+    }
+    return -1;
+}
+
+// handle of an attribute, created empty when missing
+int MemoryBackend::lookup( const string &attr ) {
+    int handle = find( attr.c_str() );
+
+    if( handle >= 0 ) {
+        return handle;
+    }
+
+    attrs.push_back( mem_attr_t() );
+    mem_attr_t &entry = attrs.back();
+    pthread_mutex_init( &entry.mute, NULL );
+    entry.value.reserve( 32 );
+    entry.mirror = -1;
+
+    handle = attrs.size() - 1;
+    index.insert( lower_bound( index.begin(), index.end(), attr.c_str(), attrLess ), pair<string, int>( attr, handle ) );
+
+    return handle;
+}
+
+void MemoryBackend::set( const string &attr, const string &value ) {
+    pthread_mutex_lock( &mute_attrs );
+    int handle = lookup( attr );
+    pthread_mutex_unlock( &mute_attrs );
+
+    write( handle, value.c_str(), value.length() );
+}
+
+void MemoryBackend::link( const string &attr, const string &mirror ) {
+    pthread_mutex_lock( &mute_attrs );
+    int handle = lookup( attr );
+    attrs[handle].mirror = lookup( mirror );
+    pthread_mutex_unlock( &mute_attrs );
+}
+
+int MemoryBackend::open( const char *attr, bool writable ) {
+    pthread_mutex_lock( &mute_attrs );
+    int handle = find( attr );
+    pthread_mutex_unlock( &mute_attrs );
+
+    if( handle < 0 ) {
+        errno = ENOENT;
+    }
+    return handle;
+}
+
+ssize_t MemoryBackend::read( int handle, char *buffer, size_t len ) {
+    mem_attr_t &entry = attrs[handle];
+
+    pthread_mutex_lock( &entry.mute );
+    size_t size = min( len, entry.value.length() );
+    memcpy( buffer, entry.value.c_str(), size );
+    pthread_mutex_unlock( &entry.mute );
+
+    return size;
+}
+
+ssize_t MemoryBackend::write( int handle, const char *buffer, size_t len ) {
+    mem_attr_t &entry = attrs[handle];
+
+    pthread_mutex_lock( &entry.mute );
+    entry.value.assign( buffer, len );
+    pthread_mutex_unlock( &entry.mute );
+
+    if( entry.mirror >= 0 ) {
+        mem_attr_t &mirror = attrs[entry.mirror];
+
+        pthread_mutex_lock( &mirror.mute );
+        mirror.value.assign( buffer, len );
+        pthread_mutex_unlock( &mirror.mute );
+    }
+
+    return len;
+}
+
+void cpuFreqAttr( char *attr, size_t len, int cpu_idx, const string &file ) {
+    snprintf( attr, len, "cpu%d%s%s", cpu_idx, CPU_FREQ.c_str(), file.c_str() );
+}
+
+static bool isPstateDriver( const string &driver ) {
+    return driver == INTEL_PSTATE_DRIVER || driver == AMD_PSTATE_EPP_DRIVER;
+}
+
+const string &cpuSpeedFile( const string &driver ) {
+    return isPstateDriver( driver ) ? SCALING_SETMAXSPEED_FILE : SCALING_SETSPEED_FILE;
+}
+
+void buildCpuTree( int cpu_count, const vector<int> &khz, const string &driver, map<string, string> &tree ) {
+    char attr[100], value[32];
+    string freqs;
+    bool pstate = isPstateDriver( driver );
+
+    for( vector<int>::const_iterator it = khz.begin(); it != khz.end(); it++ ) {
+        sprintf( value, "%d ", *it );
+        freqs += value;
+    }
+    freqs += "\n";
+
+    // cpufreq stats that never advance, as on a kernel without transitions
+    string time_in_state, trans_table = "   From  :    To\n         : ";
+    for( vector<int>::const_iterator it = khz.begin(); it != khz.end(); it++ ) {
+        sprintf( value, "%d 0\n", *it );
+        time_in_state += value;
+        sprintf( value, "%9d ", *it );
+        trans_table += value;
+    }
+    trans_table += "\n";
+    for( vector<int>::const_iterator it = khz.begin(); it != khz.end(); it++ ) {
+        sprintf( value, "%9d: ", *it );
+        trans_table += value;
+        for( size_t j = 0; j < khz.size(); j++ ) {
+            trans_table += "        0 ";
+        }
+        trans_table += "\n";
+    }
+
+    sprintf( value, "0-%d\n", cpu_count - 1 );
+    tree[CPU_ONLINE_FILE] = value;
+    tree[CPU_PRESENT_FILE] = value;
+    tree[CPU_POSSIBLE_FILE] = value;
+    tree[GLOBAL_BOOST_FILE] = "1\n";
+
+    for( int i = 0; i < cpu_count; i++ ) {
+        sprintf( value, "%d\n", i );
+        cpuFreqAttr( attr, sizeof( attr ), i, RELATED_CPUS_FILE );
+        tree[attr] = value;
+        cpuFreqAttr( attr, sizeof( attr ), i, AFFECTED_CPUS_FILE );
+        tree[attr] = value;
+
+        cpuFreqAttr( attr, sizeof( attr ), i, SCALING_DRIVER_FILE );
+        tree[attr] = ( driver.empty() ? ACPI_CPUFREQ_DRIVER : driver ) + "\n";
+
+        sprintf( value, "%d\n", khz.front() );
+        cpuFreqAttr( attr, sizeof( attr ), i, CPUINFO_MIN_FREQ );
+        tree[attr] = value;
+        cpuFreqAttr( attr, sizeof( attr ), i, SCALING_SETMINSPEED_FILE );
+        tree[attr] = value;
+
+        cpuFreqAttr( attr, sizeof( attr ), i, STATS_TIME_IN_STATE_FILE );
+        tree[attr] = time_in_state;
+        cpuFreqAttr( attr, sizeof( attr ), i, STATS_TOTAL_TRANS_FILE );
+        tree[attr] = "0\n";
+        cpuFreqAttr( attr, sizeof( attr ), i, STATS_TRANS_TABLE_FILE );
+        tree[attr] = trans_table;
+
+        sprintf( value, "%d\n", khz.back() );
+        cpuFreqAttr( attr, sizeof( attr ), i, CPUINFO_MAX_FREQ );
+        tree[attr] = value;
+        cpuFreqAttr( attr, sizeof( attr ), i, SCALING_SETMAXSPEED_FILE );
+        tree[attr] = value;
+        cpuFreqAttr( attr, sizeof( attr ), i, SCALING_CUR_FREQ );
+        tree[attr] = value;
+
+        if( pstate ) {
+            cpuFreqAttr( attr, sizeof( attr ), i, SCALING_AVAILABLE_GOVERNOR );
+            tree[attr] = "performance powersave\n";
+            cpuFreqAttr( attr, sizeof( attr ), i, SCALING_GOVERNOR_FILE );
+            tree[attr] = "powersave\n";
+            cpuFreqAttr( attr, sizeof( attr ), i, SCALING_EPP_FILE );
+            tree[attr] = "balance_performance\n";
+            continue;
+        }
+
+        cpuFreqAttr( attr, sizeof( attr ), i, SCALING_AVAILABLE_GOVERNOR );
+        tree[attr] = "ondemand userspace schedutil performance powersave\n";
+        cpuFreqAttr( attr, sizeof( attr ), i, SCALING_GOVERNOR_FILE );
+        tree[attr] = ONDEMAND + "\n";
+        cpuFreqAttr( attr, sizeof( attr ), i, SCALING_AVAILABLE_FREQ );
+        tree[attr] = freqs;
+
+        sprintf( value, "%d\n", khz.back() );
+        cpuFreqAttr( attr, sizeof( attr ), i, SCALING_SETSPEED_FILE );
+        tree[attr] = value;
+    }
+}
+
+CpuBackend &cpuBackend() {
+    return *cur_backend;
+}
+
+// the real sysfs, whatever backend is selected
+CpuBackend &hostBackend() {
+    return host_backend;
+}
+
+bool initCpuBackend( const string &spec, string &err ) {
+    string kind, arg, driver;
+    const char *env;
+    int cpu_count;
+
+    kind = spec;
+    if( kind.empty() && ( env = getenv( CPU_BACKEND_ENV.c_str() ) ) != NULL ) {
+        kind = env;
+    }
+    if( kind.empty() ) {
+        kind = SYSFS_BACKEND;
+    }
+
+    size_t split = kind.find( ':' );
+    if( split != string::npos ) {
+        arg = kind.substr( split + 1 );
+        kind = kind.substr( 0, split );
+    }
+
+    vector<int> khz;
+    for( int f = DEFAULT_MIN_KHZ; f <= DEFAULT_MAX_KHZ; f += DEFAULT_STEP_KHZ ) {
+        khz.push_back( f );
+    }
+
+    long online = sysconf( _SC_NPROCESSORS_ONLN );
+    cpu_count = online > 0 ? ( int ) online : 1;
+
+    // trailing ":<driver>" of the fake and memory backends
+    if( kind != SYSFS_BACKEND ) {
+        split = arg.rfind( ':' );
+        string last = split == string::npos ? arg : arg.substr( split + 1 );
+        if( !last.empty() && !isdigit( last[0] ) && ( split != string::npos || kind == MEMORY_BACKEND ) ) {
+            driver = last;
+            arg = split == string::npos ? "" : arg.substr( 0, split );
+        }
+    }
+    if( !driver.empty() && driver != INTEL_PSTATE_DRIVER && driver != AMD_PSTATE_EPP_DRIVER && driver != ACPI_CPUFREQ_DRIVER ) {
+        err = "Unknown cpufreq driver: " + driver;
+        return false;
+    }
+
+    if( kind == SYSFS_BACKEND ) {
+        cur_backend = &host_backend;
+    } else if( kind == FAKE_SYSFS_BACKEND ) {
+        if( arg.empty() ) {
+            err = "The fake sysfs backend needs a directory";
+            return false;
+        }
+
+        split = arg.find( ':' );
+        if( split != string::npos ) {
+            cpu_count = atoi( arg.c_str() + split + 1 );
+            arg = arg.substr( 0, split );
+        }
+
+        FakeSysfsBackend *fake = new FakeSysfsBackend( arg );
+        if( cpu_count < 1 || !fake->populate( cpu_count, khz, driver, err ) ) {
+            if( cpu_count < 1 ) {
+                err = "Invalid CPU count";
+            }
+            delete fake;
+            return false;
+        }
+        cur_backend = fake;
+    } else if( kind == MEMORY_BACKEND ) {
+        if( !arg.empty() ) {
+            cpu_count = atoi( arg.c_str() );
+        }
+        if( cpu_count < 1 ) {
+            err = "Invalid CPU count";
+            return false;
+        }
+        cur_backend = new MemoryBackend( cpu_count, khz, driver );
+    } else {
+        err = "Unknown cpufreq backend: " + kind;
+        return false;
+    }
+
+    if( cur_backend->needsRoot() && geteuid() != 0 ) {
+        err = "Must be run as root";
+        return false;
+    }
+
+    return true;
+}
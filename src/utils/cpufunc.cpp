@@ -1,76 +1,139 @@
 #include "utils/cpufunc.h"
 
-void Test1() {
-    FILE *fp;
-    char *buffer = new char[BUFFER_SIZE];
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <unistd.h>
+
+// cpufreq policy domains discovered at startup
+static vector<freq_domain_t> freq_domains;
+static vector<int> cpu_domain;
+
+// Last speed applied to each cpu, or -1 when unknown.  Entries fill a cache
+// line each, and the array is allocated on a line boundary, since each is
+// mostly touched by the thread bound to its cpu.  The shadow is updated
+// after a write completes, so with concurrent writers to one domain it
+// follows the last completed write.  requested is the speed last asked for
+// on the cpu, which recordSpeedRequest compares across the domain; -1 when
+// none is held.
+const size_t SHADOW_LINE_SIZE = 64;
+
+struct cpu_shadow_t {
+    int khz;
+    int requested;
+    uint64_t requests;
+    uint64_t writes;
+    uint64_t elided;
+    uint64_t conflicts;
+} __attribute__(( aligned( SHADOW_LINE_SIZE ) ));
+
+static cpu_shadow_t *speed_shadow = NULL;
+static int shadow_count = 0;
+
+// control scheme of the cpufreq driver, chosen by initUserspace
+static freq_ctrl_t freq_ctrl = FREQ_CTRL_SETSPEED;
 
-    long lSize;
+void Test1() {
+    char buffer[BUFFER_SIZE];
+    char attr[100];
 
-    fp = fopen ( ( CPU0_FILE_PATH + SCALING_GOVERNOR_FILE ).c_str(), "rw" );
-    if ( fp == NULL ) {
+    cpuFreqAttr( attr, sizeof( attr ), 0, SCALING_GOVERNOR_FILE );
+    if ( !cpuBackend().readAttr( attr, buffer, BUFFER_SIZE ) ) {
         cerr << "Error opening Governor file." << endl;
     } else {
         cout << "Opened the file." << endl;
-        fseek ( fp, 0, SEEK_END );
-        lSize = ftell ( fp );
-        fseek ( fp, 0, SEEK_SET );
-
-        cout << "File Size: " << lSize << endl;
-
-        int bytes_read = fread ( buffer, lSize, 1, fp );
-
-        cout << "Read: " << bytes_read << endl;
+        cout << "File Size: " << strlen ( buffer ) << endl;
         cout << buffer << endl;
     }
-    fclose ( fp );
 }
 
 void Test2() {
-    FILE *fp;
-    char *buffer = new char[BUFFER_SIZE];
-
-    long lSize;
+    char buffer[BUFFER_SIZE];
+    char attr[100];
 
-    fp = fopen ( ( CPU0_FILE_PATH + SCALING_AVAILABLE_GOVERNOR ).c_str(), "r" );
-    if ( fp == NULL ) {
+    cpuFreqAttr( attr, sizeof( attr ), 0, SCALING_AVAILABLE_GOVERNOR );
+    if ( !cpuBackend().readAttr( attr, buffer, BUFFER_SIZE ) ) {
         cout << "Error opening governor file" << endl;
     } else {
         cout << "Opened the file" << endl;
-        fseek ( fp, 0, SEEK_END );
-        lSize = ftell ( fp );
-        fseek ( fp, 0, SEEK_SET );
 
-        if ( lSize > BUFFER_SIZE ) {
-            cout << "Buffer isn't large enough to read file. " << lSize << endl;
-        } else {
-            fread ( buffer, lSize, 1, fp );
+        //bufferdump(buffer, strlen(buffer));
+
+        if ( boost::algorithm::contains ( buffer, USERSPACE ) ) {
+            cout << "Processor can be moved controlled from userspace" << endl;
+        }
+    }
+}
+
+// Parses the kernel cpu list format ("0-3,8,10-11"); space separated lists
+// such as related_cpus are accepted as well.
+bool parseCPUList( const char *list, vector<int> &cpus ) {
+    const char *p = list;
+    char *end;
+    long first, last;
+
+    cpus.clear();
+    while( *p != '\0' ) {
+        if( *p == ',' || *p == ' ' || *p == '\n' ) {
+            p++;
+            continue;
+        }
 
-            //bufferdump(buffer, lSize);
+        first = strtol( p, &end, 10 );
+        if( end == p || first < 0 ) {
+            return false;
+        }
+        last = first;
+        p = end;
 
-            if ( boost::algorithm::contains ( buffer, USERSPACE ) ) {
-                cout << "Processor can be moved controlled from userspace" << endl;
+        if( *p == '-' ) {
+            last = strtol( ++p, &end, 10 );
+            if( end == p || last < first ) {
+                return false;
             }
+            p = end;
+        }
+
+        for( long cpu = first; cpu <= last; cpu++ ) {
+            cpus.push_back(( int ) cpu );
         }
     }
-    fclose ( fp );
+
+    return !cpus.empty();
 }
 
-int determineCPUCount() {
-    FILE *fp;
-    char *res = new char[128];
-    memset ( res, 0, sizeof ( res ) );
-    fp = popen ( "/bin/cat /proc/cpuinfo | grep -c '^processor'", "r" );
-    fread ( res, 1, sizeof ( res ) - 1, fp );
-    fclose ( fp );
+bool readCPUIds( const string &attr, vector<int> &cpus, CpuBackend &backend ) {
+    char buffer[BUFFER_SIZE];
 
-    for ( int i = 0; i < 128; ++i ) {
-        if ( res[i] < '0' || res[i] > '9' ) {
-            res[i] = ( char ) 0;
-            break;
-        }
+    if( !backend.readAttr( attr.c_str(), buffer, BUFFER_SIZE ) ) {
+        cpus.clear();
+        return false;
     }
 
-    return atoi ( res );
+    return parseCPUList( buffer, cpus );
+}
+
+bool determineOnlineCPUs( vector<int> &cpus ) {
+    return readCPUIds( CPU_ONLINE_FILE, cpus );
+}
+
+bool determinePresentCPUs( vector<int> &cpus ) {
+    return readCPUIds( CPU_PRESENT_FILE, cpus );
+}
+
+// One past the highest present cpu id, so arrays indexed by cpu id cover
+// every cpu even when some are offline.  Not a count of cpus: walk the ids
+// of determineOnlineCPUs to visit them.  Falls back to the configured
+// processor count when the backend has no cpu list.
+int determineCPUIdBound() {
+    vector<int> cpus;
+
+    if( determinePresentCPUs( cpus ) ) {
+        return *max_element( cpus.begin(), cpus.end() ) + 1;
+    }
+
+    long count = sysconf( _SC_NPROCESSORS_CONF );
+    return count > 0 ? ( int ) count : 1;
 }
 
 void bufferdump ( char *buffer, int buffer_size ) {
@@ -91,132 +154,207 @@ void bufferdump ( char *buffer, int buffer_size ) {
 }
 
 bool checkCPU_Avail_Governor ( int cpu_idx, const string &governor, string &err ) {
-    FILE *fp;
-    char *buffer = new char[BUFFER_SIZE];
-    char *file_path = new char[100];
-
-    sprintf ( file_path, "%s%d%s%s", CPU_FILE.c_str(), cpu_idx, CPU_FREQ.c_str(), SCALING_AVAILABLE_GOVERNOR.c_str() );
+    char buffer[BUFFER_SIZE];
+    char attr[100];
 
-    fp = fopen ( file_path, "r" );
+    cpuFreqAttr ( attr, sizeof ( attr ), cpu_idx, SCALING_AVAILABLE_GOVERNOR );
 
-    if ( fp == NULL ) {
+    if ( !cpuBackend().readAttr ( attr, buffer, BUFFER_SIZE ) ) {
         err = "Unable to open file.";
         return false;
     }
 
-    fread ( buffer, BUFFER_SIZE, 1, fp );
-
-    fclose ( fp );
-
     return boost::algorithm::contains ( buffer, governor );
 }
 
 bool checkCPU_Governor_Mode ( int cpu_idx, const string &governor, string &err ) {
-    FILE *fp;
-    char *buffer = new char[BUFFER_SIZE];
-    char *file_path = new char[100];
-
-    sprintf ( file_path, "%s%d%s%s", CPU_FILE.c_str(), cpu_idx, CPU_FREQ.c_str(), SCALING_GOVERNOR_FILE.c_str() );
+    char buffer[BUFFER_SIZE];
+    char attr[100];
 
-    fp = fopen ( file_path, "r" );
+    cpuFreqAttr ( attr, sizeof ( attr ), cpu_idx, SCALING_GOVERNOR_FILE );
 
-    if ( fp == NULL ) {
+    if ( !cpuBackend().readAttr ( attr, buffer, BUFFER_SIZE ) ) {
         err = "Unable to open file";
         return false;
     }
 
-    fread ( buffer, BUFFER_SIZE, 1, fp );
-
-    fclose ( fp );
-
     return boost::algorithm::contains ( buffer, governor );
 }
 
 bool setCPU_Govenor_Mode ( int cpu_idx, const string &governor, string &err ) {
-    FILE *fp;
-    char *buffer = new char[BUFFER_SIZE];
-    char *file_path = new char[100];
-
-    sprintf ( file_path, "%s%d%s%s", CPU_FILE.c_str(), cpu_idx, CPU_FREQ.c_str(), SCALING_GOVERNOR_FILE.c_str() );
+    char attr[100];
 
-    fp = fopen ( file_path, "w" );
+    cpuFreqAttr ( attr, sizeof ( attr ), cpu_idx, SCALING_GOVERNOR_FILE );
 
-    if ( fp == NULL ) {
-        err = "Unable to open file";
-        return false;
+    bool ok = cpuBackend().writeAttr ( attr, governor.c_str(), governor.length() );
+    if ( !ok ) {
+        err = "Unable to write governor file";
     }
 
-    int size = fwrite ( governor.c_str(), governor.length(), 1, fp );
-
-    fclose ( fp );
+    // the new governor picks its own speed
+    invalidateSpeedShadow( cpu_idx );
 
-    return size == 1;
+    return ok;
 }
 
 bool getAvailableThrottlingSpeeds ( int cpu_idx, string &freqs, string &err ) {
-    FILE *fp;
-    char *freq_buffer = new char[BUFFER_SIZE];
-    char *file_path = new char[100];
+    char freq_buffer[BUFFER_SIZE];
+    char attr[100];
+
+    cpuFreqAttr ( attr, sizeof ( attr ), cpu_idx, SCALING_AVAILABLE_FREQ );
 
-    sprintf ( file_path, "%s%d%s%s", CPU_FILE.c_str(), cpu_idx, CPU_FREQ.c_str(), SCALING_AVAILABLE_FREQ.c_str() );
+    if ( cpuBackend().readAttr ( attr, freq_buffer, BUFFER_SIZE ) ) {
+        freqs.assign ( freq_buffer );
+        return true;
+    }
 
-    fp = fopen ( file_path, "r" );
-    if ( fp == NULL ) {
+    // intel_pstate and amd-pstate list no frequencies; any speed in the
+    // hardware range can be requested, so offer it in fixed steps
+    int min_khz, max_khz;
+    cpuFreqAttr ( attr, sizeof ( attr ), cpu_idx, CPUINFO_MIN_FREQ );
+    if ( !cpuBackend().readAttr ( attr, freq_buffer, BUFFER_SIZE ) || sscanf ( freq_buffer, "%d", &min_khz ) != 1 ) {
+        err = "Unable to open file";
+        return false;
+    }
+    cpuFreqAttr ( attr, sizeof ( attr ), cpu_idx, CPUINFO_MAX_FREQ );
+    if ( !cpuBackend().readAttr ( attr, freq_buffer, BUFFER_SIZE ) || sscanf ( freq_buffer, "%d", &max_khz ) != 1 ) {
         err = "Unable to open file";
         return false;
     }
 
-    fread ( freq_buffer, BUFFER_SIZE, 1, fp );
-    fclose ( fp );
-
-    freqs.assign ( freq_buffer );
+    freqs.clear();
+    for ( int khz = min_khz; khz <= max_khz; khz += WINDOW_STEP_KHZ ) {
+        sprintf ( freq_buffer, "%d ", khz );
+        freqs += freq_buffer;
+    }
+    if ( ( max_khz - min_khz ) % WINDOW_STEP_KHZ != 0 ) {
+        sprintf ( freq_buffer, "%d ", max_khz );
+        freqs += freq_buffer;
+    }
 
     //bufferdump(freq_buffer, BUFFER_SIZE);
 
     return true;
 }
 
+// Pins min and max to the same speed.  The kernel may refuse a window with
+// min above max, so the bound that moves towards the new speed is written
+// first, and a refused write is retried once the other bound has moved.
+static bool setWindowSpeed ( int cpu_idx, int khz, const string &speed, string &err ) {
+    char attr[100];
+    bool raise = raiseWindowFirst ( cpu_idx, khz );
+    const string &first = raise ? SCALING_SETMAXSPEED_FILE : SCALING_SETMINSPEED_FILE;
+    const string &second = raise ? SCALING_SETMINSPEED_FILE : SCALING_SETMAXSPEED_FILE;
+
+    cpuFreqAttr ( attr, sizeof ( attr ), cpu_idx, first );
+    bool first_ok = cpuBackend().writeAttr ( attr, speed.c_str(), speed.length() );
+
+    cpuFreqAttr ( attr, sizeof ( attr ), cpu_idx, second );
+    if ( !cpuBackend().writeAttr ( attr, speed.c_str(), speed.length() ) ) {
+        err = "Unable to write frequency window";
+        return false;
+    }
+
+    if ( !first_ok ) {
+        cpuFreqAttr ( attr, sizeof ( attr ), cpu_idx, first );
+        if ( !cpuBackend().writeAttr ( attr, speed.c_str(), speed.length() ) ) {
+            err = "Unable to write frequency window";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Retune a worker's cpu and hold speed as its request until
+// clearSpeedRequest.  conflict is set when another cpu of the frequency
+// domain holds a different request; the write still goes through and
+// overrides it.
+bool setCPUThrottledSpeed ( int cpu_idx, const string &speed, bool &conflict, string &err ) {
+    conflict = recordSpeedRequest( cpu_idx, atoi( speed.c_str() ) );
+    return setCPUThrottledSpeed ( cpu_idx, speed, err );
+}
+
 bool setCPUThrottledSpeed ( int cpu_idx, const string &speed, string &err ) {
-    FILE *fp;
+    int khz = atoi( speed.c_str() );
+    char attr[100];
 
-    char *buffer = new char[BUFFER_SIZE];
-    char *file_path = new char[100];
+    if( speedShadowMatches( cpu_idx, khz ) ) {
+        return true;
+    }
 
-    sprintf ( file_path, "%s%d%s%s", CPU_FILE.c_str(), cpu_idx, CPU_FREQ.c_str(), SCALING_SETSPEED_FILE.c_str() );
+    if ( freq_ctrl == FREQ_CTRL_WINDOW ) {
+        bool ok = setWindowSpeed ( cpu_idx, khz, speed, err );
+        updateSpeedShadow( cpu_idx, khz, ok );
+        return ok;
+    }
 
-    fp = fopen ( file_path, "w" );
+    cpuFreqAttr ( attr, sizeof ( attr ), cpu_idx, SCALING_SETSPEED_FILE );
 
-    if ( fp == NULL ) {
-        err = "Unable to open Set Speed file";
+    if ( !cpuBackend().writeAttr ( attr, speed.c_str(), speed.length() ) ) {
+        err = "Unable to write Set Speed file";
+        updateSpeedShadow( cpu_idx, khz, false );
         return false;
     }
 
-    int size = fwrite ( speed.c_str(), speed.length(), 1, fp );
-    fclose ( fp );
+    cpuFreqAttr ( attr, sizeof ( attr ), cpu_idx, SCALING_SETMAXSPEED_FILE );
 
-    sprintf ( file_path, "%s%d%s%s", CPU_FILE.c_str(), cpu_idx, CPU_FREQ.c_str(), SCALING_SETMAXSPEED_FILE.c_str() );
+    if ( !cpuBackend().writeAttr ( attr, speed.c_str(), speed.length() ) ) {
+        err = "Unable to write Max Speed file";
+        updateSpeedShadow( cpu_idx, khz, false );
+        return false;
+    }
+
+    updateSpeedShadow( cpu_idx, khz, true );
+    return true;
+}
 
-    fp = fopen ( file_path, "w" );
+// Active-mode intel_pstate and amd-pstate-epp have no userspace governor; the
+// speed is set by collapsing the min/max window.  Every other driver is
+// driven through scaling_setspeed.
+freq_ctrl_t detectFreqControl( int cpu_idx ) {
+    char buffer[64];
+    char attr[100];
 
-    if ( fp == NULL ) {
-        err = "Unable to open Max Speed file";
-        return false;
+    cpuFreqAttr( attr, sizeof( attr ), cpu_idx, SCALING_DRIVER_FILE );
+    if( !cpuBackend().readAttr( attr, buffer, sizeof( buffer ) ) ) {
+        return FREQ_CTRL_SETSPEED;
     }
 
+    if( boost::algorithm::starts_with( buffer, INTEL_PSTATE_DRIVER ) || boost::algorithm::starts_with( buffer, AMD_PSTATE_EPP_DRIVER ) ) {
+        return FREQ_CTRL_WINDOW;
+    }
+    return FREQ_CTRL_SETSPEED;
+}
 
-    size = fwrite ( speed.c_str(), speed.length(), 1, fp );
-    fclose ( fp );
+freq_ctrl_t getFreqControl() {
+    return freq_ctrl;
+}
+
+void setFreqControl( freq_ctrl_t ctrl ) {
+    freq_ctrl = ctrl;
+}
 
-    return size == 1;
+// true when scaling_max_freq has to move before scaling_min_freq to reach khz
+bool raiseWindowFirst( int cpu_idx, int khz ) {
+    int cur = getSpeedShadow( cpu_idx );
+    return cur < 0 || khz >= cur;
 }
 
+// speeds of the first cpu_count online cpus; ids may have holes, so cpu i
+// is not assumed to exist
 bool fillAvailableThrottlingSpeeds( map<int, string> &cpu_avail_freq, int cpu_count) {
     string cpu_freqs, err;
     boost::char_separator<char> sep( " \n" );
     boost::tokenizer<boost::char_separator<char> >::iterator tok_iter;
+    vector<int> online;
 
-    for( int i = 0; i < cpu_count; ++i ) {
-        getAvailableThrottlingSpeeds( i, cpu_freqs, err );
+    if( !determineOnlineCPUs( online ) ) {
+        return false;
+    }
+
+    for( int i = 0; i < cpu_count && i < ( int ) online.size(); ++i ) {
+        getAvailableThrottlingSpeeds( online[i], cpu_freqs, err );
         boost::tokenizer<boost::char_separator<char> > tokens( cpu_freqs, sep );
 
         for( tok_iter = tokens.begin(); tok_iter != tokens.end(); tok_iter++ ) {
@@ -226,15 +364,295 @@ bool fillAvailableThrottlingSpeeds( map<int, string> &cpu_avail_freq, int cpu_co
     return true;
 }
 
+static bool readCPUList( int cpu_idx, const string &file, vector<int> &cpus ) {
+    char attr[100];
+
+    cpuFreqAttr( attr, sizeof( attr ), cpu_idx, file );
+
+    return readCPUIds( attr, cpus );
+}
+
+// cpu_bound sizes the cpu id index; only online cpus make domains, so
+// holes in the ids are not taken for cpus without a policy
+bool discoverFrequencyDomains( int cpu_bound ) {
+    vector<int> online;
+
+    freq_domains.clear();
+    cpu_domain.assign( cpu_bound, -1 );
+
+    determineOnlineCPUs( online );
+    for( vector<int>::iterator cpu_it = online.begin(); cpu_it != online.end(); cpu_it++ ) {
+        int i = *cpu_it;
+        if( i >= ( int ) cpu_domain.size() ) {
+            cpu_domain.resize( i + 1, -1 );
+        }
+        if( cpu_domain[i] != -1 ) {
+            continue;
+        }
+
+        freq_domain_t domain;
+        if( !readCPUList( i, RELATED_CPUS_FILE, domain.cpus ) ) {
+            // no cpufreq policy; the cpu stands alone
+            domain.cpus.assign( 1, i );
+        }
+        if( !readCPUList( i, AFFECTED_CPUS_FILE, domain.online ) ) {
+            domain.online.assign( 1, i );
+        }
+        domain.leader = domain.online.front();
+
+        for( vector<int>::iterator it = domain.cpus.begin(); it != domain.cpus.end(); it++ ) {
+            if( *it >= ( int ) cpu_domain.size() ) {
+                cpu_domain.resize( *it + 1, -1 );
+            }
+            cpu_domain[*it] = freq_domains.size();
+        }
+        // related_cpus may not list the cpu that was asked about
+        cpu_domain[i] = freq_domains.size();
+
+        freq_domains.push_back( domain );
+    }
+
+    return !freq_domains.empty();
+}
+
+const vector<freq_domain_t> &getFrequencyDomains() {
+    return freq_domains;
+}
 
-bool initUserspace(int cpu_count, map<int, string> &orig_state){
+// index into getFrequencyDomains(), or -1 when domains are unknown
+int getFrequencyDomain( int cpu_idx ) {
+    if( cpu_idx < 0 || cpu_idx >= ( int ) cpu_domain.size() ) {
+        return -1;
+    }
+    return cpu_domain[cpu_idx];
+}
+
+void printFrequencyDomains() {
+    for( size_t i = 0; i < freq_domains.size(); i++ ) {
+        printf( "Frequency domain %d (leader CPU%d):", ( int ) i, freq_domains[i].leader );
+        for( vector<int>::iterator it = freq_domains[i].cpus.begin(); it != freq_domains[i].cpus.end(); it++ ) {
+            printf( " %d", *it );
+        }
+        printf( "\n" );
+    }
+}
+
+// Size the speed shadow and load it from scaling_setspeed.  Call after
+// discoverFrequencyDomains so writes update every cpu of a policy.
+void initSpeedShadow( int cpu_bound ) {
+    cpu_shadow_t blank;
+    vector<int> online;
+    memset( &blank, 0, sizeof( blank ) );
+    blank.khz = -1;
+    blank.requested = -1;
+
+    free( speed_shadow );
+    speed_shadow = NULL;
+    shadow_count = 0;
+
+    void *lines;
+    if( cpu_bound <= 0 || posix_memalign( &lines, SHADOW_LINE_SIZE, cpu_bound * sizeof( cpu_shadow_t ) ) != 0 ) {
+        return;
+    }
+    speed_shadow = ( cpu_shadow_t * ) lines;
+    shadow_count = cpu_bound;
+    for( int i = 0; i < shadow_count; i++ ) {
+        speed_shadow[i] = blank;
+    }
+
+    determineOnlineCPUs( online );
+    for( vector<int>::iterator cpu_it = online.begin(); cpu_it != online.end(); cpu_it++ ) {
+        syncSpeedShadow( *cpu_it );
+    }
+}
+
+// reload the shadow of a cpu from sysfs; unknown unless the userspace
+// governor reports a set speed or the min/max window is closed
+bool syncSpeedShadow( int cpu_idx ) {
+    char buffer[64];
+    char attr[100];
+    int khz = -1, min_khz = -2;
+
+    if( cpu_idx < 0 || cpu_idx >= shadow_count ) {
+        return false;
+    }
+
+    if( freq_ctrl == FREQ_CTRL_WINDOW ) {
+        cpuFreqAttr( attr, sizeof( attr ), cpu_idx, SCALING_SETMINSPEED_FILE );
+        if( cpuBackend().readAttr( attr, buffer, sizeof( buffer ) ) ) {
+            sscanf( buffer, "%d", &min_khz );
+        }
+        cpuFreqAttr( attr, sizeof( attr ), cpu_idx, SCALING_SETMAXSPEED_FILE );
+    } else {
+        cpuFreqAttr( attr, sizeof( attr ), cpu_idx, SCALING_SETSPEED_FILE );
+    }
+
+    if( !cpuBackend().readAttr( attr, buffer, sizeof( buffer ) ) || sscanf( buffer, "%d", &khz ) != 1 ) {
+        khz = -1;
+    }
+    if( freq_ctrl == FREQ_CTRL_WINDOW && khz != min_khz ) {
+        khz = -1;
+    }
+
+    __atomic_store_n( &speed_shadow[cpu_idx].khz, khz, __ATOMIC_RELAXED );
+    return khz != -1;
+}
+
+void invalidateSpeedShadow( int cpu_idx ) {
+    if( cpu_idx >= 0 && cpu_idx < shadow_count ) {
+        __atomic_store_n( &speed_shadow[cpu_idx].khz, -1, __ATOMIC_RELAXED );
+    }
+}
+
+// last speed applied to the cpu, or -1 when unknown
+int getSpeedShadow( int cpu_idx ) {
+    if( cpu_idx < 0 || cpu_idx >= shadow_count ) {
+        return -1;
+    }
+    return __atomic_load_n( &speed_shadow[cpu_idx].khz, __ATOMIC_RELAXED );
+}
+
+// true when the cpu already runs at khz and the write can be skipped
+bool speedShadowMatches( int cpu_idx, int khz ) {
+    if( cpu_idx < 0 || cpu_idx >= shadow_count ) {
+        return false;
+    }
+    return speedRequestMatches( cpu_idx, khz, __atomic_load_n( &speed_shadow[cpu_idx].khz, __ATOMIC_RELAXED ) );
+}
+
+// Count a request for khz against current_khz, the speed the caller knows
+// the cpu will run at; that is the shadow unless writes are still queued.
+bool speedRequestMatches( int cpu_idx, int khz, int current_khz ) {
+    if( cpu_idx < 0 || cpu_idx >= shadow_count ) {
+        return false;
+    }
+
+    cpu_shadow_t &shadow = speed_shadow[cpu_idx];
+    __atomic_fetch_add( &shadow.requests, 1, __ATOMIC_RELAXED );
+
+    if( current_khz == khz ) {
+        __atomic_fetch_add( &shadow.elided, 1, __ATOMIC_RELAXED );
+        return true;
+    }
+    return false;
+}
+
+// Hold khz as the speed asked for on the cpu.  True, and counted, when
+// another cpu of its frequency domain holds a different request, so that
+// whichever write lands last overrides the other.
+bool recordSpeedRequest( int cpu_idx, int khz ) {
+    int domain, other;
+    bool conflict = false;
+
+    if( cpu_idx < 0 || cpu_idx >= shadow_count ) {
+        return false;
+    }
+
+    __atomic_store_n( &speed_shadow[cpu_idx].requested, khz, __ATOMIC_RELAXED );
+    if(( domain = getFrequencyDomain( cpu_idx ) ) < 0 ) {
+        return false;
+    }
+
+    const vector<int> &cpus = freq_domains[domain].cpus;
+    for( vector<int>::const_iterator it = cpus.begin(); it != cpus.end() && !conflict; it++ ) {
+        if( *it == cpu_idx || *it >= shadow_count ) {
+            continue;
+        }
+        other = __atomic_load_n( &speed_shadow[*it].requested, __ATOMIC_RELAXED );
+        conflict = other != -1 && other != khz;
+    }
+
+    if( conflict ) {
+        __atomic_fetch_add( &speed_shadow[cpu_idx].conflicts, 1, __ATOMIC_RELAXED );
+    }
+    return conflict;
+}
+
+// forget the speed asked for on the cpu once its worker is done with it
+void clearSpeedRequest( int cpu_idx ) {
+    if( cpu_idx >= 0 && cpu_idx < shadow_count ) {
+        __atomic_store_n( &speed_shadow[cpu_idx].requested, -1, __ATOMIC_RELAXED );
+    }
+}
+
+// record a write to sysfs; a successful write sets the speed of the whole
+// frequency domain, a failed one leaves the cpu unknown
+void updateSpeedShadow( int cpu_idx, int khz, bool ok ) {
+    if( cpu_idx < 0 || cpu_idx >= shadow_count ) {
+        return;
+    }
+
+    __atomic_fetch_add( &speed_shadow[cpu_idx].writes, 1, __ATOMIC_RELAXED );
+
+    int domain = getFrequencyDomain( cpu_idx );
+    if( !ok || domain < 0 ) {
+        __atomic_store_n( &speed_shadow[cpu_idx].khz, ok ? khz : -1, __ATOMIC_RELAXED );
+        return;
+    }
+
+    const vector<int> &cpus = freq_domains[domain].cpus;
+    for( vector<int>::const_iterator it = cpus.begin(); it != cpus.end(); it++ ) {
+        if( *it < shadow_count ) {
+            __atomic_store_n( &speed_shadow[*it].khz, khz, __ATOMIC_RELAXED );
+        }
+    }
+    __atomic_store_n( &speed_shadow[cpu_idx].khz, khz, __ATOMIC_RELAXED );
+}
+
+void getSpeedShadowStats( speed_shadow_stat_t &stat ) {
+    stat = speed_shadow_stat_t();
+
+    for( cpu_shadow_t *it = speed_shadow; it != speed_shadow + shadow_count; it++ ) {
+        stat.requests += __atomic_load_n( &it->requests, __ATOMIC_RELAXED );
+        stat.writes += __atomic_load_n( &it->writes, __ATOMIC_RELAXED );
+        stat.elided += __atomic_load_n( &it->elided, __ATOMIC_RELAXED );
+        stat.conflicts += __atomic_load_n( &it->conflicts, __ATOMIC_RELAXED );
+    }
+}
+
+void printSpeedShadowStats() {
+    speed_shadow_stat_t stat;
+    getSpeedShadowStats( stat );
+
+    printf( "# Speed changes requested %lu written %lu elided %lu conflicting %lu\n", stat.requests, stat.writes, stat.elided, stat.conflicts );
+}
+
+bool fillAvailableThrottlingSpeeds( FrequencyTable &cpu_avail_freq, int cpu_count ) {
+    map<int, string> avail_freq;
+
+    fillAvailableThrottlingSpeeds( avail_freq, cpu_count );
+    cpu_avail_freq.build( avail_freq );
+
+    return !cpu_avail_freq.empty();
+}
+
+bool initUserspace(vector<int> &cpus, map<int, string> &orig_state){
     string governor, err;
+    char attr[100];
+
+    if ( !cpus.empty() ) {
+        freq_ctrl = detectFreqControl( cpus.front() );
+        if ( freq_ctrl == FREQ_CTRL_WINDOW ) {
+            cout << "# Active p-state driver; speeds are set through the min/max window" << endl;
+        }
+    }
+
+    for ( vector<int>::iterator it = cpus.begin(); it != cpus.end(); it++ ) {
+        int i = *it;
 
-    for ( int i = 0; i < cpu_count; i++ ) {
         if(checkCPU_Governor_Mode(i, governor, err)) {
             orig_state.insert( pair<int, string>(i, governor));
         }
 
+        if ( freq_ctrl == FREQ_CTRL_WINDOW ) {
+            // keep the governor; a performance bias stops the hardware from
+            // choosing a lower speed inside the window
+            cpuFreqAttr ( attr, sizeof ( attr ), i, SCALING_EPP_FILE );
+            cpuBackend().writeAttr ( attr, EPP_PERFORMANCE.c_str(), EPP_PERFORMANCE.length() );
+            invalidateSpeedShadow( i );
+            continue;
+        }
+
         if ( !boost::algorithm::iequals(governor, USERSPACE) && ! setCPU_Govenor_Mode ( i, USERSPACE, err ) ) {
             //userspace_cpu.push_back ( i );
             orig_state.erase(i);
@@ -244,17 +662,20 @@ bool initUserspace(int cpu_count, map<int, string> &orig_state){
     return true;
 }
 
-bool resetCPUs(map<int, string> &orig_state){
-    string err;
+// Puts the cpus under schedutil for utilization clamping; orig_state keeps
+// the cpus that run it with their previous governor.
+bool initSchedutil(vector<int> &cpus, map<int, string> &orig_state){
+    string governor, err;
 
-    for ( map<int,string>::iterator it = orig_state.begin(); it != orig_state.end(); ++it ) {
-        cout << "Returning processor " << it->first << " to " << ONDEMAND << " mode ...";
-        if ( setCPU_Govenor_Mode ( it->first, ONDEMAND, err ) ) {
+    for ( vector<int>::iterator it = cpus.begin(); it != cpus.end(); it++ ) {
+        int i = *it;
 
-            cout << " COMPLETE" << endl;
-        } else {
-            cout << " FAILED" << endl;
-            cout << "-- ERROR: " << err << endl;
+        if(checkCPU_Governor_Mode(i, governor, err)) {
+            orig_state.insert( pair<int, string>(i, governor));
+        }
+
+        if ( !boost::algorithm::iequals(governor, SCHEDUTIL) && ! setCPU_Govenor_Mode ( i, SCHEDUTIL, err ) ) {
+            orig_state.erase(i);
         }
     }
 
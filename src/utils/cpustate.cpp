@@ -0,0 +1,292 @@
+#include "utils/cpustate.h"
+#include "utils/cpufunc.h"
+#include "utils/timing.h"
+
+#include <cstdio>
+#include <cstring>
+#include <signal.h>
+#include <unistd.h>
+
+static CpuStateSnapshot *signal_snapshot = NULL;
+
+static vector< pair<restore_hook_t, void *> > restore_hooks;
+static pthread_mutex_t mute_hooks = PTHREAD_MUTEX_INITIALIZER;
+
+// value of an attribute without trailing whitespace; empty when absent
+static bool readState( const char *attr, string &value ) {
+    char buffer[BUFFER_SIZE];
+
+    value.clear();
+    if( !cpuBackend().readAttr( attr, buffer, BUFFER_SIZE ) ) {
+        return false;
+    }
+
+    size_t len = strlen( buffer );
+    while( len > 0 && ( buffer[len - 1] == '\n' || buffer[len - 1] == ' ' ) ) {
+        len--;
+    }
+    value.assign( buffer, len );
+    return true;
+}
+
+static void readCPUState( int cpu_idx, const string &file, string &value ) {
+    char attr[100];
+
+    cpuFreqAttr( attr, sizeof( attr ), cpu_idx, file );
+    readState( attr, value );
+}
+
+static bool writeState( const char *attr, const string &value, int &writes, int &failures ) {
+    if( value.empty() ) {
+        return true;
+    }
+
+    writes++;
+    if( !cpuBackend().writeAttr( attr, value.c_str(), value.length() ) ) {
+        failures++;
+        return false;
+    }
+    return true;
+}
+
+static bool writeCPUState( int cpu_idx, const string &file, const string &value, int &writes, int &failures ) {
+    char attr[100];
+
+    cpuFreqAttr( attr, sizeof( attr ), cpu_idx, file );
+    return writeState( attr, value, writes, failures );
+}
+
+CpuStateSnapshot::CpuStateSnapshot() : restored( false ) {
+    pthread_mutex_init( &mute_restore, NULL );
+}
+
+CpuStateSnapshot::~CpuStateSnapshot() {
+    if( signal_snapshot == this ) {
+        signal_snapshot = NULL;
+    }
+    pthread_mutex_destroy( &mute_restore );
+}
+
+bool CpuStateSnapshot::capture( vector<int> &cpus, string &err ) {
+    states.clear();
+    restored = false;
+
+    for( vector<int>::iterator it = cpus.begin(); it != cpus.end(); it++ ) {
+        cpu_state_t state;
+
+        state.cpu_idx = *it;
+        readCPUState( *it, SCALING_GOVERNOR_FILE, state.governor );
+        if( state.governor.empty() ) {
+            // no cpufreq policy to restore
+            continue;
+        }
+
+        readCPUState( *it, SCALING_SETMINSPEED_FILE, state.min_freq );
+        readCPUState( *it, SCALING_SETMAXSPEED_FILE, state.max_freq );
+        readCPUState( *it, SCALING_EPP_FILE, state.epp );
+        readCPUState( *it, CPUFREQ_BOOST_FILE, state.boost );
+
+        // "<unsupported>" outside the userspace governor
+        readCPUState( *it, SCALING_SETSPEED_FILE, state.setspeed );
+        if( state.setspeed.empty() || state.setspeed[0] < '0' || state.setspeed[0] > '9' ) {
+            state.setspeed.clear();
+        }
+
+        states.push_back( state );
+    }
+
+    readState( GLOBAL_BOOST_FILE.c_str(), global_boost );
+    readState( INTEL_NO_TURBO_FILE.c_str(), no_turbo );
+
+    if( states.empty() ) {
+        err = "No cpufreq state found";
+        return false;
+    }
+    return true;
+}
+
+void CpuStateSnapshot::restoreCPU( cpu_state_t &state, int &writes, int &failures ) {
+    int cpu = state.cpu_idx;
+    int max_failures = failures;
+
+    // switching the governor may reset the limits, so it goes first
+    writeCPUState( cpu, SCALING_GOVERNOR_FILE, state.governor, writes, failures );
+
+    // the kernel rejects a window with min above max; writing max first
+    // covers raising the window, and the retry covers lowering it
+    bool max_ok = writeCPUState( cpu, SCALING_SETMAXSPEED_FILE, state.max_freq, writes, max_failures );
+    writeCPUState( cpu, SCALING_SETMINSPEED_FILE, state.min_freq, writes, failures );
+    if( !max_ok ) {
+        writeCPUState( cpu, SCALING_SETMAXSPEED_FILE, state.max_freq, writes, failures );
+    }
+
+    if( state.governor == USERSPACE ) {
+        writeCPUState( cpu, SCALING_SETSPEED_FILE, state.setspeed, writes, failures );
+    }
+
+    writeCPUState( cpu, SCALING_EPP_FILE, state.epp, writes, failures );
+    writeCPUState( cpu, CPUFREQ_BOOST_FILE, state.boost, writes, failures );
+
+    invalidateSpeedShadow( cpu );
+}
+
+void *CpuStateSnapshot::restoreThread( void *args ) {
+    restore_arg_t *arg = ( restore_arg_t * ) args;
+    vector<cpu_state_t> &states = arg->owner->states;
+
+    for( size_t i = arg->first; i < states.size(); i += arg->stride ) {
+        arg->owner->restoreCPU( states[i], arg->writes, arg->failures );
+    }
+
+    return NULL;
+}
+
+bool CpuStateSnapshot::restore( int thread_count ) {
+    restore_stat_t stat;
+    return restore( thread_count, stat );
+}
+
+bool CpuStateSnapshot::restore( int thread_count, restore_stat_t &stat ) {
+    TIME start, end;
+
+    stat = restore_stat_t();
+
+    // a second caller waits for the first restore to finish
+    pthread_mutex_lock( &mute_restore );
+    if( restored || states.empty() ) {
+        pthread_mutex_unlock( &mute_restore );
+        return true;
+    }
+
+    GetTime( start );
+
+    if( thread_count > ( int ) states.size() ) {
+        thread_count = states.size();
+    }
+    if( thread_count < 1 ) {
+        thread_count = 1;
+    }
+
+    vector<restore_arg_t> args( thread_count );
+    vector<pthread_t> threads( thread_count );
+
+    for( int i = 0; i < thread_count; i++ ) {
+        args[i].owner = this;
+        args[i].first = i;
+        args[i].stride = thread_count;
+        args[i].writes = 0;
+        args[i].failures = 0;
+    }
+
+    // the calling thread takes the first stripe
+    int started = 1;
+    for( ; started < thread_count; started++ ) {
+        if( pthread_create( &threads[started], NULL, restoreThread, ( void * ) &args[started] ) ) {
+            break;
+        }
+    }
+    for( int i = started; i < thread_count; i++ ) {
+        restoreThread(( void * ) &args[i] );
+    }
+    restoreThread(( void * ) &args[0] );
+
+    for( int i = 1; i < started; i++ ) {
+        pthread_join( threads[i], NULL );
+    }
+
+    // boost is system wide; intel_pstate names it the other way around
+    writeState( GLOBAL_BOOST_FILE.c_str(), global_boost, stat.writes, stat.failures );
+    writeState( INTEL_NO_TURBO_FILE.c_str(), no_turbo, stat.writes, stat.failures );
+
+    for( int i = 0; i < thread_count; i++ ) {
+        stat.writes += args[i].writes;
+        stat.failures += args[i].failures;
+    }
+    stat.cpus = states.size();
+
+    GetTime( end );
+    stat.elapsed = span_TIME( start, end );
+
+    restored = true;
+    pthread_mutex_unlock( &mute_restore );
+
+    printf( "# Restored cpufreq state of %d CPUs: %d writes, %d failed in %lu %s\n", stat.cpus, stat.writes, stat.failures, stat.elapsed, TIME_ABRV );
+    return stat.failures == 0;
+}
+
+void CpuStateSnapshot::print() {
+    printf( "#CPU\tGovernor\tMin\tMax\tSetspeed\tEPP\tBoost\n" );
+    for( vector<cpu_state_t>::iterator it = states.begin(); it != states.end(); it++ ) {
+        printf( "%d\t%s\t%s\t%s\t%s\t%s\t%s\n", it->cpu_idx, it->governor.c_str(),
+                it->min_freq.empty() ? "-" : it->min_freq.c_str(), it->max_freq.empty() ? "-" : it->max_freq.c_str(),
+                it->setspeed.empty() ? "-" : it->setspeed.c_str(), it->epp.empty() ? "-" : it->epp.c_str(),
+                it->boost.empty() ? "-" : it->boost.c_str() );
+    }
+}
+
+void addRestoreHook( restore_hook_t hook, void *arg ) {
+    pthread_mutex_lock( &mute_hooks );
+    restore_hooks.push_back( make_pair( hook, arg ) );
+    pthread_mutex_unlock( &mute_hooks );
+}
+
+void removeRestoreHook( restore_hook_t hook, void *arg ) {
+    pthread_mutex_lock( &mute_hooks );
+    for( size_t i = restore_hooks.size(); i-- > 0; ) {
+        if( restore_hooks[i].first == hook && restore_hooks[i].second == arg ) {
+            restore_hooks.erase( restore_hooks.begin() + i );
+            break;
+        }
+    }
+    pthread_mutex_unlock( &mute_hooks );
+}
+
+static void *signalThread( void *args ) {
+    sigset_t *signals = ( sigset_t * ) args;
+    int sig;
+
+    if( sigwait( signals, &sig ) == 0 ) {
+        printf( "\nCaught signal %d; restoring cpufreq state\n", sig );
+
+        // copied so that a hook may remove itself
+        pthread_mutex_lock( &mute_hooks );
+        vector< pair<restore_hook_t, void *> > hooks( restore_hooks );
+        pthread_mutex_unlock( &mute_hooks );
+        for( size_t i = hooks.size(); i-- > 0; ) {
+            hooks[i].first( hooks[i].second );
+        }
+
+        if( signal_snapshot != NULL ) {
+            signal_snapshot->restore();
+        }
+        fflush( stdout );
+        _exit( 128 + sig );
+    }
+
+    return NULL;
+}
+
+bool installRestoreHandler( CpuStateSnapshot &snapshot, string &err ) {
+    static sigset_t signals;
+    pthread_t thread;
+
+    sigemptyset( &signals );
+    sigaddset( &signals, SIGINT );
+    sigaddset( &signals, SIGTERM );
+
+    if( pthread_sigmask( SIG_BLOCK, &signals, NULL ) ) {
+        err = "Unable to block SIGINT/SIGTERM";
+        return false;
+    }
+
+    signal_snapshot = &snapshot;
+
+    if( pthread_create( &thread, NULL, signalThread, ( void * ) &signals ) ) {
+        pthread_sigmask( SIG_UNBLOCK, &signals, NULL );
+        err = "Unable to create signal thread";
+        return false;
+    }
+    pthread_detach( thread );
+
+    return true;
+}
@@ -0,0 +1,185 @@
+#include "utils/cpustats.h"
+#include "utils/cpufunc.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <set>
+
+uint64_t cpufreq_stats_t::residencyMS() const {
+    uint64_t total = 0;
+
+    for( map<int, uint64_t>::const_iterator it = time_in_state.begin(); it != time_in_state.end(); it++ ) {
+        total += it->second;
+    }
+    return total * STATS_TIME_UNIT_MS;
+}
+
+// Parses the table printed by the kernel:
+//    From  :    To
+//          :   800000   1000000 ...
+//    800000:        0         3 ...
+static void parseTransTable( char *buffer, cpufreq_stats_t &stats ) {
+    vector<int> to_khz;
+    char *save = NULL;
+    int line_no = 0;
+
+    for( char *line = strtok_r( buffer, "\n", &save ); line != NULL; line = strtok_r( NULL, "\n", &save ), line_no++ ) {
+        char *colon = strchr( line, ':' );
+        if( line_no == 0 || colon == NULL ) {
+            continue;
+        }
+
+        char *cur = colon + 1, *end;
+        if( line_no == 1 ) {
+            for( long khz = strtol( cur, &end, 10 ); end != cur; khz = strtol( cur, &end, 10 ) ) {
+                to_khz.push_back(( int ) khz );
+                cur = end;
+            }
+            continue;
+        }
+
+        int from = atoi( line );
+        for( size_t i = 0; i < to_khz.size(); i++ ) {
+            unsigned long long count = strtoull( cur, &end, 10 );
+            if( end == cur ) {
+                break;
+            }
+            stats.trans_table[make_pair( from, to_khz[i] )] = count;
+            cur = end;
+        }
+    }
+
+    stats.has_trans_table = !to_khz.empty();
+}
+
+bool readCpuFreqStats( int cpu_idx, cpufreq_stats_t &stats, string &err ) {
+    char buffer[BUFFER_SIZE];
+    char attr[100];
+
+    stats = cpufreq_stats_t();
+    stats.cpu_idx = cpu_idx;
+
+    cpuFreqAttr( attr, sizeof( attr ), cpu_idx, STATS_TIME_IN_STATE_FILE );
+    if( !cpuBackend().readAttr( attr, buffer, BUFFER_SIZE ) ) {
+        err = "Unable to read time_in_state (CONFIG_CPU_FREQ_STAT)";
+        return false;
+    }
+
+    char *save = NULL;
+    for( char *line = strtok_r( buffer, "\n", &save ); line != NULL; line = strtok_r( NULL, "\n", &save ) ) {
+        int khz;
+        unsigned long long time;
+        if( sscanf( line, "%d %llu", &khz, &time ) == 2 ) {
+            stats.time_in_state[khz] = time;
+        }
+    }
+
+    cpuFreqAttr( attr, sizeof( attr ), cpu_idx, STATS_TOTAL_TRANS_FILE );
+    if( cpuBackend().readAttr( attr, buffer, BUFFER_SIZE ) ) {
+        stats.total_trans = strtoull( buffer, NULL, 10 );
+    }
+
+    cpuFreqAttr( attr, sizeof( attr ), cpu_idx, STATS_TRANS_TABLE_FILE );
+    if( cpuBackend().readAttr( attr, buffer, BUFFER_SIZE ) ) {
+        parseTransTable( buffer, stats );
+    }
+
+    stats.valid = true;
+    return true;
+}
+
+// counters only grow unless the statistics were reset in between
+static uint64_t counterDelta( uint64_t before, uint64_t after ) {
+    return after >= before ? after - before : after;
+}
+
+void diffCpuFreqStats( const cpufreq_stats_t &before, const cpufreq_stats_t &after, cpufreq_stats_t &delta ) {
+    delta = cpufreq_stats_t();
+    delta.cpu_idx = after.cpu_idx;
+    delta.valid = before.valid && after.valid;
+
+    if( !delta.valid ) {
+        return;
+    }
+
+    for( map<int, uint64_t>::const_iterator it = after.time_in_state.begin(); it != after.time_in_state.end(); it++ ) {
+        map<int, uint64_t>::const_iterator prev = before.time_in_state.find( it->first );
+        delta.time_in_state[it->first] = counterDelta( prev == before.time_in_state.end() ? 0 : prev->second, it->second );
+    }
+
+    delta.total_trans = counterDelta( before.total_trans, after.total_trans );
+
+    delta.has_trans_table = before.has_trans_table && after.has_trans_table;
+    if( delta.has_trans_table ) {
+        for( map<pair<int, int>, uint64_t>::const_iterator it = after.trans_table.begin(); it != after.trans_table.end(); it++ ) {
+            map<pair<int, int>, uint64_t>::const_iterator prev = before.trans_table.find( it->first );
+            delta.trans_table[it->first] = counterDelta( prev == before.trans_table.end() ? 0 : prev->second, it->second );
+        }
+    }
+}
+
+void checkSchedule( const cpufreq_stats_t &delta, const speed_schedule_t &schedule, schedule_check_t &check ) {
+    set<int> requested( schedule.khz.begin(), schedule.khz.end() );
+    uint64_t total = 0, at_requested = 0;
+
+    check = schedule_check_t();
+    if( !delta.valid ) {
+        return;
+    }
+
+    for( map<int, uint64_t>::const_iterator it = delta.time_in_state.begin(); it != delta.time_in_state.end(); it++ ) {
+        total += it->second;
+        if( requested.count( it->first ) ) {
+            at_requested += it->second;
+        }
+    }
+    // no residency (e.g. counters that never advance, or a run shorter than
+    // their resolution) leaves the sample unjudged rather than flagged
+    if( total == 0 ) {
+        return;
+    }
+    check.agreement = ( double ) at_requested / total;
+
+    if( delta.has_trans_table ) {
+        check.missed_trans = 0;
+    }
+    for( size_t i = 1; i < schedule.khz.size(); i++ ) {
+        if( schedule.khz[i] == schedule.khz[i - 1] ) {
+            continue;
+        }
+        check.expected_trans++;
+
+        if( delta.has_trans_table ) {
+            map<pair<int, int>, uint64_t>::const_iterator it = delta.trans_table.find( make_pair( schedule.khz[i - 1], schedule.khz[i] ) );
+            if( it == delta.trans_table.end() || it->second == 0 ) {
+                check.missed_trans++;
+            }
+        }
+    }
+
+    // a sample is trusted only when the kernel reports residency at the
+    // requested speeds and at least as many transitions as were requested
+    check.flagged = check.agreement < STATS_AGREEMENT_MIN || check.missed_trans > 0 || delta.total_trans < ( uint64_t ) check.expected_trans;
+}
+
+void formatResidency( const cpufreq_stats_t &delta, string &out ) {
+    char entry[48];
+
+    out.clear();
+    if( !delta.valid ) {
+        out = "-";
+        return;
+    }
+
+    for( map<int, uint64_t>::const_iterator it = delta.time_in_state.begin(); it != delta.time_in_state.end(); it++ ) {
+        if( it->second == 0 ) {
+            continue;
+        }
+        snprintf( entry, sizeof( entry ), "%s%d:%lu", out.empty() ? "" : ",", it->first, ( unsigned long )( it->second * STATS_TIME_UNIT_MS ) );
+        out += entry;
+    }
+    if( out.empty() ) {
+        out = "0";
+    }
+}
@@ -0,0 +1,112 @@
+#include "utils/freqtable.h"
+
+#include <algorithm>
+#include <cstdio>
+
+FrequencyTable::FrequencyTable() : bucket_width( 0 ) {}
+
+void FrequencyTable::add( int khz ) {
+    char speed[16];
+    sprintf( speed, "%d", khz );
+    add( khz, speed );
+}
+
+void FrequencyTable::add( int khz, const string &speed ) {
+    vector<int>::iterator it = lower_bound( khz_steps.begin(), khz_steps.end(), khz );
+
+    if( it != khz_steps.end() && *it == khz ) {
+        return;
+    }
+
+    speeds.insert( speeds.begin() + ( it - khz_steps.begin() ), speed );
+    khz_steps.insert( it, khz );
+
+    index();
+}
+
+void FrequencyTable::build( map<int, string> &avail_freq ) {
+    clear();
+    for( map<int, string>::iterator it = avail_freq.begin(); it != avail_freq.end(); it++ ) {
+        khz_steps.push_back( it->first );
+        speeds.push_back( it->second );
+    }
+    index();
+}
+
+void FrequencyTable::clear() {
+    khz_steps.clear();
+    speeds.clear();
+    bucket_floor.clear();
+    bucket_width = 0;
+}
+
+void FrequencyTable::index() {
+    bucket_floor.clear();
+    bucket_width = 0;
+
+    if( khz_steps.size() < 2 ) {
+        return;
+    }
+
+    int min_gap = khz_steps[1] - khz_steps[0];
+    for( size_t i = 2; i < khz_steps.size(); i++ ) {
+        min_gap = min( min_gap, khz_steps[i] - khz_steps[i - 1] );
+    }
+
+    int range = khz_steps.back() - khz_steps.front();
+    if( range / min_gap + 1 > MAX_FREQ_BUCKETS ) {
+        return;
+    }
+
+    bucket_width = min_gap;
+    bucket_floor.resize( range / bucket_width + 1 );
+
+    for( int b = 0, idx = 0; b < ( int ) bucket_floor.size(); b++ ) {
+        int start = khz_steps.front() + b * bucket_width;
+        while( idx + 1 < size() && khz_steps[idx + 1] <= start ) {
+            idx++;
+        }
+        bucket_floor[b] = idx;
+    }
+}
+
+// largest index whose speed is <= khz, or -1 below the table
+int FrequencyTable::floorIndex( int khz ) const {
+    if( empty() || khz < khz_steps.front() ) {
+        return -1;
+    }
+    if( khz >= khz_steps.back() ) {
+        return maxIndex();
+    }
+
+    // logarithmic when the steps were too tight to bucket
+    if( bucket_floor.empty() ) {
+        return ( int )( upper_bound( khz_steps.begin(), khz_steps.end(), khz ) - khz_steps.begin() ) - 1;
+    }
+
+    // at most one step lies inside a bucket
+    int idx = bucket_floor[( khz - khz_steps.front() ) / bucket_width];
+    if( idx < maxIndex() && khz_steps[idx + 1] <= khz ) {
+        idx++;
+    }
+    return idx;
+}
+
+int FrequencyTable::indexOf( int khz ) const {
+    int idx = floorIndex( khz );
+    return ( idx >= 0 && khz_steps[idx] == khz ) ? idx : -1;
+}
+
+// closest step; ties resolve to the lower speed
+int FrequencyTable::nearest( int khz ) const {
+    int idx = floorIndex( khz );
+
+    if( idx < 0 ) {
+        return 0;
+    }
+    if( idx == maxIndex() ) {
+        return idx;
+    }
+
+    return ( khz - khz_steps[idx] <= khz_steps[idx + 1] - khz ) ? idx : idx + 1;
+}
@@ -0,0 +1,76 @@
+#include "utils/histogram.h"
+
+#include <cstdio>
+#include <cstring>
+
+const char *HISTOGRAM_COLUMNS = "Count\tMean\tP50\tP90\tP99\tP99.9\tMax";
+
+LatencyHistogram::LatencyHistogram() {
+    clear();
+}
+
+void LatencyHistogram::clear() {
+    memset( counts, 0, sizeof( counts ) );
+    total = 0;
+    sum = 0;
+    lowest = ~( uint64_t ) 0;
+    highest = 0;
+}
+
+void LatencyHistogram::merge( const LatencyHistogram &other ) {
+    if( other.total == 0 ) {
+        return;
+    }
+
+    for( int i = 0; i < HIST_BUCKETS; i++ ) {
+        counts[i] += other.counts[i];
+    }
+    total += other.total;
+    sum += other.sum;
+    if( other.lowest < lowest ) {
+        lowest = other.lowest;
+    }
+    if( other.highest > highest ) {
+        highest = other.highest;
+    }
+}
+
+uint64_t LatencyHistogram::bucketTop( int bucket ) {
+    if( bucket < 2 * HIST_SUB_BUCKETS ) {
+        return bucket;
+    }
+
+    int shift = bucket / HIST_SUB_BUCKETS - 1;
+    uint64_t mantissa = bucket % HIST_SUB_BUCKETS + HIST_SUB_BUCKETS;
+    return (( mantissa + 1 ) << shift ) - 1;
+}
+
+uint64_t LatencyHistogram::percentile( double p ) const {
+    if( total == 0 ) {
+        return 0;
+    }
+
+    // rank of the sample at p, counting from 1
+    uint64_t rank = ( uint64_t )( p / 100 * total + 0.5 );
+    if( rank < 1 ) {
+        rank = 1;
+    } else if( rank > total ) {
+        rank = total;
+    }
+
+    uint64_t seen = 0;
+    for( int i = 0; i < HIST_BUCKETS; i++ ) {
+        seen += counts[i];
+        if( seen >= rank ) {
+            // the bucket top may overshoot what was actually recorded
+            uint64_t top = bucketTop( i );
+            return top < highest ? top : highest;
+        }
+    }
+    return highest;
+}
+
+void printPercentiles( const LatencyHistogram &hist, double scale ) {
+    printf( "%lu\t%.2f\t%.2f\t%.2f\t%.2f\t%.2f\t%.2f", hist.count(), hist.mean() / scale, hist.percentile( 50 ) / scale, hist.percentile( 90 ) / scale,
+            hist.percentile( 99 ) / scale, hist.percentile( 99.9 ) / scale, hist.max() / scale );
+}
@@ -0,0 +1,535 @@
+#include "utils/isolation.h"
+#include "utils/cpufunc.h"
+#include "utils/cpustate.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <cctype>
+#include <climits>
+#include <algorithm>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+const char *ISOLATION_MODE_NAMES[ISOLATION_MODE_COUNT] = {"none", "procs", "tasks", "cgroup", "auto"};
+
+// fields of /proc/<pid>/task/<tid>/stat counted from the one after the
+// command name, which may itself hold spaces
+const int TASK_STAT_UTIME = 11;
+const int TASK_STAT_STIME = 12;
+const int TASK_STAT_PROCESSOR = 36;
+
+const int PROC_TEXT_SIZE = 4096;
+
+bool parseIsolationMode( const string &name, isolation_mode_t &mode ) {
+    for( int i = 0; i < ISOLATION_MODE_COUNT; i++ ) {
+        if( name == ISOLATION_MODE_NAMES[i] ) {
+            mode = ( isolation_mode_t ) i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *isolationModeName( isolation_mode_t mode ) {
+    return ISOLATION_MODE_NAMES[mode];
+}
+
+static bool readText( const string &path, string &text ) {
+    char buffer[PROC_TEXT_SIZE];
+    int fd = open( path.c_str(), O_RDONLY );
+
+    if( fd < 0 ) {
+        return false;
+    }
+
+    text.clear();
+    for( ssize_t n = read( fd, buffer, sizeof( buffer ) ); n > 0; n = read( fd, buffer, sizeof( buffer ) ) ) {
+        text.append( buffer, n );
+    }
+    close( fd );
+    return true;
+}
+
+static bool writeText( const string &path, const string &text, string &err ) {
+    int fd = open( path.c_str(), O_WRONLY );
+
+    if( fd < 0 || write( fd, text.c_str(), text.size() ) != ( ssize_t ) text.size() ) {
+        err = "Unable to write " + text + " to " + path + ": " + strerror( errno );
+        if( fd >= 0 ) {
+            close( fd );
+        }
+        return false;
+    }
+
+    close( fd );
+    return true;
+}
+
+static bool hasWord( const string &text, const string &word ) {
+    size_t at = 0;
+
+    while(( at = text.find( word, at ) ) != string::npos ) {
+        bool begins = at == 0 || isspace( text[at - 1] );
+        bool ends = at + word.size() == text.size() || isspace( text[at + word.size()] );
+        if( begins && ends ) {
+            return true;
+        }
+        at += word.size();
+    }
+    return false;
+}
+
+static string cpuList( const vector<int> &cpus ) {
+    string list;
+    char cpu[16];
+
+    for( size_t i = 0; i < cpus.size(); i++ ) {
+        snprintf( cpu, sizeof( cpu ), i == 0 ? "%d" : ",%d", cpus[i] );
+        list += cpu;
+    }
+    return list;
+}
+
+// mount point of the unified hierarchy, also under a hybrid v1 layout
+static bool findCgroup2Root( string &root ) {
+    string mounts;
+    char dir[PATH_MAX], type[64];
+
+    if( !readText( "/proc/self/mounts", mounts ) ) {
+        return false;
+    }
+
+    char *save = NULL;
+    for( char *line = strtok_r( &mounts[0], "\n", &save ); line != NULL; line = strtok_r( NULL, "\n", &save ) ) {
+        if( sscanf( line, "%*s %4095s %63s", dir, type ) == 2 && strcmp( type, "cgroup2" ) == 0 ) {
+            root = dir;
+            return true;
+        }
+    }
+    return false;
+}
+
+// cgroup of the current process relative to the unified hierarchy root
+static bool findHomeCgroup( string &home ) {
+    string groups;
+
+    if( !readText( "/proc/self/cgroup", groups ) ) {
+        return false;
+    }
+
+    char *save = NULL;
+    for( char *line = strtok_r( &groups[0], "\n", &save ); line != NULL; line = strtok_r( NULL, "\n", &save ) ) {
+        if( strncmp( line, "0::", 3 ) == 0 ) {
+            home = line + 3;
+            return true;
+        }
+    }
+    return false;
+}
+
+// per cpu lines of /proc/stat: cpuN user nice system idle iowait irq softirq steal
+static void readCpuTimes( map<int, cpu_time_t> &times ) {
+    string stat;
+    unsigned long long user, nice, system, idle, iowait, irq, softirq, steal;
+    int cpu;
+
+    times.clear();
+    if( !readText( "/proc/stat", stat ) ) {
+        return;
+    }
+
+    char *save = NULL;
+    for( char *line = strtok_r( &stat[0], "\n", &save ); line != NULL; line = strtok_r( NULL, "\n", &save ) ) {
+        if( sscanf( line, "cpu%d %llu %llu %llu %llu %llu %llu %llu %llu", &cpu, &user, &nice, &system, &idle, &iowait, &irq, &softirq, &steal ) == 9 ) {
+            cpu_time_t &time = times[cpu];
+            time.irq = irq + softirq;
+            time.busy = user + nice + system + steal + time.irq;
+        }
+    }
+}
+
+static bool readTaskTime( const char *path, task_time_t &task ) {
+    string stat;
+
+    if( !readText( path, stat ) ) {
+        return false;
+    }
+
+    size_t comm_end = stat.rfind( ')' );
+    if( comm_end == string::npos ) {
+        return false;
+    }
+
+    char *save = NULL;
+    int field = 0;
+    task.ticks = 0;
+    task.cpu = -1;
+    for( char *tok = strtok_r( &stat[comm_end + 1], " ", &save ); tok != NULL; tok = strtok_r( NULL, " ", &save ), field++ ) {
+        if( field == TASK_STAT_UTIME || field == TASK_STAT_STIME ) {
+            task.ticks += strtoull( tok, NULL, 10 );
+        } else if( field == TASK_STAT_PROCESSOR ) {
+            task.cpu = atoi( tok );
+            return true;
+        }
+    }
+    return false;
+}
+
+// Calls visit( pid, tid, arg ) for every thread of every process but this one.
+static void forEachForeignTask( void ( *visit )( int pid, int tid, void *arg ), void *arg ) {
+    DIR *proc = opendir( "/proc" );
+    struct dirent *proc_ent, *task_ent;
+    char path[64];
+    int self = getpid();
+
+    if( proc == NULL ) {
+        return;
+    }
+
+    while(( proc_ent = readdir( proc ) ) != NULL ) {
+        int pid = atoi( proc_ent->d_name );
+        if( pid <= 0 || pid == self ) {
+            continue;
+        }
+
+        snprintf( path, sizeof( path ), "/proc/%d/task", pid );
+        DIR *tasks = opendir( path );
+        if( tasks == NULL ) {
+            continue;
+        }
+
+        while(( task_ent = readdir( tasks ) ) != NULL ) {
+            int tid = atoi( task_ent->d_name );
+            if( tid > 0 ) {
+                visit( pid, tid, arg );
+            }
+        }
+        closedir( tasks );
+    }
+    closedir( proc );
+}
+
+static void collectTaskTime( int pid, int tid, void *arg ) {
+    map<int, task_time_t> &times = *( map<int, task_time_t> * ) arg;
+    char path[64];
+    task_time_t task;
+
+    snprintf( path, sizeof( path ), "/proc/%d/task/%d/stat", pid, tid );
+    if( readTaskTime( path, task ) ) {
+        task.pid = pid;
+        times[tid] = task;
+    }
+}
+
+struct task_bind_t {
+    map<int, CpuMask> *saved;
+    const CpuMask *mask;
+    int tasks;
+    int failed;
+};
+
+static void bindTask( int pid, int tid, void *arg ) {
+    task_bind_t &bind = *( task_bind_t * ) arg;
+    CpuMask mask;
+
+    bind.tasks++;
+    if( sched_getaffinity(( pid_t ) tid, mask.size(), mask.get() ) != 0 ) {
+        bind.failed++;
+        return;
+    }
+    // per cpu kernel threads refuse to move and are left where they are
+    if( sched_setaffinity(( pid_t ) tid, bind.mask->size(), bind.mask->get() ) != 0 ) {
+        bind.failed++;
+        return;
+    }
+    bind.saved->insert( pair<int, CpuMask>( tid, mask ) );
+}
+
+CpuIsolation::CpuIsolation() : active( ISOLATE_NONE ), enabled_cpuset( false ), accounting( false ) {
+    pthread_mutex_init( &mute_restore, NULL );
+}
+
+CpuIsolation::~CpuIsolation() {
+    restore();
+    pthread_mutex_destroy( &mute_restore );
+}
+
+void CpuIsolation::restoreHook( void *arg ) {
+    (( CpuIsolation * ) arg )->restore();
+}
+
+// The hook is in place before anything changes, and a signal arriving
+// meanwhile waits on mute_restore, so a partly made isolation is undone too.
+bool CpuIsolation::isolate( isolation_mode_t mode, const CpuMask &_housekeeping, string &err ) {
+    restore();
+
+    pthread_mutex_lock( &mute_restore );
+    addRestoreHook( restoreHook, this );
+
+    bool ok = apply( mode, _housekeeping, err );
+    if( active == ISOLATE_NONE && !enabled_cpuset ) {
+        removeRestoreHook( restoreHook, this );
+    }
+
+    pthread_mutex_unlock( &mute_restore );
+    return ok;
+}
+
+bool CpuIsolation::apply( isolation_mode_t mode, const CpuMask &_housekeeping, string &err ) {
+    vector<int> online;
+
+    housekeeping = _housekeeping;
+    measure.clear();
+    measure_cpus.clear();
+
+    if( !readCPUIds( CPU_ONLINE_FILE, online, hostBackend() ) ) {
+        err = "Unable to read the online cpus";
+        return false;
+    }
+
+    int kept = 0;
+    for( size_t i = 0; i < online.size(); i++ ) {
+        if( housekeeping.isSet( online[i] ) ) {
+            kept++;
+        } else {
+            measure.set( online[i] );
+            measure_cpus.push_back( online[i] );
+        }
+    }
+    if( kept == 0 ) {
+        err = "No online cpu is left for housekeeping";
+        return false;
+    }
+
+    switch( mode ) {
+    case ISOLATE_NONE:
+        return true;
+    case ISOLATE_PROCS:
+        if( !BindAllProcTo( saved, determineCPUIdBound(), housekeeping ) ) {
+            err = "Unable to scan /proc";
+            return false;
+        }
+        active = ISOLATE_PROCS;
+        return true;
+    case ISOLATE_TASKS:
+        return isolateTasks( err );
+    case ISOLATE_CGROUP:
+        return isolateCgroup( err );
+    case ISOLATE_AUTO:
+        if( isolateCgroup( err ) ) {
+            return true;
+        }
+        printf( "# No cgroup partition (%s); binding every thread instead\n", err.c_str() );
+        return isolateTasks( err );
+    }
+    return false;
+}
+
+bool CpuIsolation::isolateTasks( string &err ) {
+    task_bind_t bind = { &saved, &housekeeping, 0, 0 };
+
+    forEachForeignTask( bindTask, &bind );
+    if( bind.tasks == 0 ) {
+        err = "No tasks found under /proc";
+        return false;
+    }
+
+    printf( "# Bound %d of %d foreign threads to the housekeeping cpus\n", bind.tasks - bind.failed, bind.tasks );
+    active = ISOLATE_TASKS;
+    return true;
+}
+
+bool CpuIsolation::isolateCgroup( string &err ) {
+    string text, dir;
+    char pid[16];
+
+    if( measure_cpus.empty() ) {
+        err = "no cpu outside the housekeeping cpus";
+        return false;
+    }
+    if( !findCgroup2Root( cgroup_root ) || !findHomeCgroup( home_cgroup ) ) {
+        err = "no cgroup v2 hierarchy";
+        return false;
+    }
+    if( !readText( cgroup_root + "/cgroup.controllers", text ) || !hasWord( text, "cpuset" ) ) {
+        err = "cpuset controller not available to cgroup v2";
+        return false;
+    }
+
+    // a partition must sit under the root or another partition
+    if( !readText( cgroup_root + "/cgroup.subtree_control", text ) ) {
+        err = "unable to read " + cgroup_root + "/cgroup.subtree_control";
+        return false;
+    }
+    if( !hasWord( text, "cpuset" ) ) {
+        if( !writeText( cgroup_root + "/cgroup.subtree_control", "+cpuset", err ) ) {
+            return false;
+        }
+        enabled_cpuset = true;
+    }
+
+    dir = cgroup_root + "/" + CGROUP_PARTITION_NAME;
+    if( mkdir( dir.c_str(), 0755 ) != 0 && errno != EEXIST ) {
+        err = "Unable to create " + dir + ": " + strerror( errno );
+        restoreCgroup();
+        return false;
+    }
+    active = ISOLATE_CGROUP;
+
+    if( !readText( cgroup_root + "/cpuset.mems.effective", text ) ) {
+        readText( dir + "/cpuset.mems.effective", text );
+    }
+    snprintf( pid, sizeof( pid ), "%d", getpid() );
+
+    // Becoming a partition root takes the cpus away from every other cgroup
+    // at once, so the kernel migrates all foreign threads in one write.
+    if( !writeText( dir + "/cpuset.cpus", cpuList( measure_cpus ), err ) ||
+            !writeText( dir + "/cpuset.mems", text, err ) ||
+            !writeText( dir + "/cpuset.cpus.partition", "root", err ) ||
+            !readText( dir + "/cpuset.cpus.partition", text ) ) {
+        restoreCgroup();
+        return false;
+    }
+    if( text.compare( 0, 4, "root" ) != 0 || text.find( "invalid" ) != string::npos ) {
+        err = "partition refused: " + text.substr( 0, text.find( '\n' ) );
+        restoreCgroup();
+        return false;
+    }
+    if( !writeText( dir + "/cgroup.procs", pid, err ) ) {
+        restoreCgroup();
+        return false;
+    }
+
+    printf( "# Isolated cpus %s in cgroup partition %s\n", cpuList( measure_cpus ).c_str(), dir.c_str() );
+    return true;
+}
+
+void CpuIsolation::restoreCgroup() {
+    string dir = cgroup_root + "/" + CGROUP_PARTITION_NAME;
+    string err;
+    char pid[16];
+
+    snprintf( pid, sizeof( pid ), "%d", getpid() );
+    if( active == ISOLATE_CGROUP ) {
+        if( !writeText( cgroup_root + home_cgroup + "/cgroup.procs", pid, err ) ) {
+            writeText( cgroup_root + "/cgroup.procs", pid, err );
+        }
+        writeText( dir + "/cpuset.cpus.partition", "member", err );
+        if( rmdir( dir.c_str() ) != 0 ) {
+            printf( "Unable to remove %s: %s\n", dir.c_str(), strerror( errno ) );
+        }
+    }
+    // another cgroup may have started using the controller since
+    if( enabled_cpuset ) {
+        writeText( cgroup_root + "/cgroup.subtree_control", "-cpuset", err );
+        enabled_cpuset = false;
+    }
+    active = ISOLATE_NONE;
+}
+
+void CpuIsolation::restore() {
+    pthread_mutex_lock( &mute_restore );
+
+    if( active != ISOLATE_NONE ) {
+        printf( "# Undoing %s isolation\n", isolationModeName( active ) );
+    }
+    if( active == ISOLATE_CGROUP || enabled_cpuset ) {
+        restoreCgroup();
+    } else if( active == ISOLATE_PROCS ) {
+        resetAffinities( saved );
+    } else if( active == ISOLATE_TASKS ) {
+        // threads that ended during the run are gone, not errors
+        for( map<int, CpuMask>::iterator task_it = saved.begin(); task_it != saved.end(); task_it++ ) {
+            if( sched_setaffinity(( pid_t ) task_it->first, task_it->second.size(), task_it->second.get() ) != 0 && errno != ESRCH ) {
+                printf( "Error resetting thread affinity: %d -> %s\n", task_it->first, strerror( errno ) );
+            }
+        }
+    }
+
+    saved.clear();
+    active = ISOLATE_NONE;
+    removeRestoreHook( restoreHook, this );
+
+    pthread_mutex_unlock( &mute_restore );
+}
+
+void CpuIsolation::allowedMask( const CpuMask &mask, CpuMask &allowed ) const {
+    allowed = mask;
+    if( active != ISOLATE_CGROUP ) {
+        return;
+    }
+
+    allowed.clear();
+    for( size_t i = 0; i < measure_cpus.size(); i++ ) {
+        if( mask.isSet( measure_cpus[i] ) ) {
+            allowed.set( measure_cpus[i] );
+        }
+    }
+    if( allowed.count() == 0 ) {
+        allowed = measure;
+    }
+}
+
+void CpuIsolation::startAccounting() {
+    readCpuTimes( start_cpu );
+    start_task.clear();
+    forEachForeignTask( collectTaskTime, &start_task );
+    accounting = true;
+}
+
+// Foreign tasks are charged to the cpu they last ran on, so a task that
+// moved during the run may be charged to the wrong cpu and one that exited
+// is missed; interrupt time is charged exactly.
+void CpuIsolation::printForeignTime() {
+    map<int, cpu_time_t> end_cpu;
+    map<int, task_time_t> end_task;
+    map<int, uint64_t> task_ticks;
+    map<int, int> task_count;
+    double ms_per_tick = 1000.0 / sysconf( _SC_CLK_TCK );
+
+    if( !accounting ) {
+        return;
+    }
+    accounting = false;
+
+    if( measure_cpus.empty() ) {
+        printf( "# No cpus isolated; no foreign time to report\n" );
+        return;
+    }
+
+    readCpuTimes( end_cpu );
+    forEachForeignTask( collectTaskTime, &end_task );
+
+    for( map<int, task_time_t>::iterator task_it = end_task.begin(); task_it != end_task.end(); task_it++ ) {
+        if( !measure.isSet( task_it->second.cpu ) ) {
+            continue;
+        }
+
+        uint64_t ticks = task_it->second.ticks;
+        map<int, task_time_t>::iterator start_it = start_task.find( task_it->first );
+        if( start_it != start_task.end() && start_it->second.pid == task_it->second.pid ) {
+            ticks = ticks > start_it->second.ticks ? ticks - start_it->second.ticks : 0;
+        }
+        if( ticks > 0 ) {
+            task_ticks[task_it->second.cpu] += ticks;
+            task_count[task_it->second.cpu]++;
+        }
+    }
+
+    printf( "# Foreign cpu time on the isolated cpus (%s)\n", isolationModeName( active ) );
+    printf( "#CPU\tBusy (ms)\tIRQ (ms)\tForeign Tasks (ms)\tForeign Tasks\tForeign (%%)\n" );
+    for( size_t i = 0; i < measure_cpus.size(); i++ ) {
+        int cpu = measure_cpus[i];
+        cpu_time_t begin = start_cpu[cpu], end = end_cpu[cpu];
+        uint64_t busy = end.busy > begin.busy ? end.busy - begin.busy : 0;
+        uint64_t irq = end.irq > begin.irq ? end.irq - begin.irq : 0;
+        uint64_t foreign = irq + task_ticks[cpu];
+
+        printf( "%d\t%.0f\t%.0f\t%.0f\t%d\t%.2f\n", cpu, busy * ms_per_tick, irq * ms_per_tick, task_ticks[cpu] * ms_per_tick,
+                task_count[cpu], busy > 0 ? 100.0 * min( foreign, busy ) / busy : 0.0 );
+    }
+}
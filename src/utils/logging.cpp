@@ -2,9 +2,10 @@
 
 #include <cstdio>
 
-void printFrequencyTable( map<int, vector<TIME> > &speed_v_lapses, int samplings ) {
+void printFrequencyTable( map<int, vector<TIME> > &speed_v_lapses, int samplings, const FrequencySummary *summary ) {
     map<int, vector<TIME> >::iterator speed_it;
     vector<TIME>::iterator tick_it;
+    FrequencySummary gathered;
 
     // print table header
 //    printf("#FREQUENCY\tTime Stamp 1\tTime Stamp 2\tDifference\tRunning Total\n");
@@ -20,6 +21,7 @@ void printFrequencyTable( map<int, vector<TIME> > &speed_v_lapses, int samplings
             tick1 = *tick_it;
             tick_it++;
             tick2 = *tick_it;
+            gathered.add( speed_it->first, tick1, tick2 );
 //            diff_TIME( diff, tick2, tick1 );
 //            sum_TIME( total, total, diff );
             //printf( "\t%d.%09d\t%d.%09d\t%d.%09d\t%d.%09d\n", tick1.tv_sec, tick1.FRAC, tick2.tv_sec, tick2.FRAC, diff.tv_sec, diff.FRAC, total.tv_sec, total.FRAC );
@@ -37,20 +39,17 @@ void printFrequencyTable( map<int, vector<TIME> > &speed_v_lapses, int samplings
 //            PrintTime(total);
             printf( "\n" );
         }
-
-//        avg_TIME( avg, total, samplings );
-//        printf( "Average\t" );
-//        printf( TIME_PRINT, avg.tv_sec, avg.FRAC );
-//        PrintTime(avg);
-//        printf( "\n" );
     }
+
+    ( summary != NULL ? summary : &gathered )->print();
 }
 
-void printFrequencyTable2( map<int, vector<TIME> > &speed_v_lapses, map<int, vector<uint64_t> > &loop_counts, int samplings ) {
+void printFrequencyTable2( map<int, vector<TIME> > &speed_v_lapses, map<int, vector<uint64_t> > &loop_counts, int samplings, const FrequencySummary *summary ) {
     map<int, vector<TIME> >::iterator speed_it;
     map<int, vector<uint64_t> >::iterator lcnt_it;
     vector<TIME>::iterator tick_it;
     vector<uint64_t>::iterator loop_it;
+    FrequencySummary gathered;
 
     // print table header
     printf("#FREQUENCY\tBegin (%s)\tEnd (%s)\tNodes Visited\n", TIME_ABRV, TIME_ABRV);
@@ -67,6 +66,7 @@ void printFrequencyTable2( map<int, vector<TIME> > &speed_v_lapses, map<int, vec
             tick1 = *tick_it;
             tick_it++;
             tick2 = *tick_it;
+            gathered.add( speed_it->first, tick1, tick2, *loop_it );
 //            diff_TIME( diff, tick2, tick1 );
 //            sum_TIME( total, total, diff );
             //printf( "\t%d.%09d\t%d.%09d\t%d.%09d\t%d.%09d\n", tick1.tv_sec, tick1.FRAC, tick2.tv_sec, tick2.FRAC, diff.tv_sec, diff.FRAC, total.tv_sec, total.FRAC );
@@ -85,11 +85,7 @@ void printFrequencyTable2( map<int, vector<TIME> > &speed_v_lapses, map<int, vec
             printf( "\t%lu", *loop_it);
             printf( "\n" );
         }
-
-//        avg_TIME( avg, total, samplings );
-//        printf( "Average\t" );
-//        printf( TIME_PRINT, avg.tv_sec, avg.FRAC );
-//        PrintTime(avg);
-//        printf( "\n" );
     }
+
+    ( summary != NULL ? summary : &gathered )->print();
 }
@@ -0,0 +1,267 @@
+#include "utils/overhead.h"
+#include "utils/timing.h"
+#include "utils/cpufunc.h"
+#include "utils/procbind.h"
+#include "utils/stoptimer.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <pthread.h>
+#include <unistd.h>
+
+const int OVERHEAD_ROUNDS = 3;
+const uint64_t OVERHEAD_SETTLE_NS = 20000000;
+const char *OVERHEAD_MAGIC = "# overhead calibration of";
+
+const overhead_t *OverheadTable::at( int khz ) const {
+    if( by_khz.empty() ) {
+        return NULL;
+    }
+
+    map<int, overhead_t>::const_iterator up = by_khz.lower_bound( khz );
+    if( up == by_khz.end() ) {
+        return &( --up )->second;
+    }
+    if( up == by_khz.begin() || up->first == khz ) {
+        return &up->second;
+    }
+
+    map<int, overhead_t>::const_iterator down = up;
+    --down;
+    return khz - down->first <= up->first - khz ? &down->second : &up->second;
+}
+
+bool OverheadTable::covers( const FrequencyTable &freqs ) const {
+    for( int i = 0; i < freqs.size(); i++ ) {
+        if( by_khz.find( freqs.khz( i ) ) == by_khz.end() ) {
+            return false;
+        }
+    }
+    return !freqs.empty();
+}
+
+static string hostName() {
+    char host[256];
+
+    if( gethostname( host, sizeof( host ) ) ) {
+        return "unknown";
+    }
+    host[sizeof( host ) - 1] = '\0';
+    return host;
+}
+
+bool OverheadTable::load( const string &path, string &err ) {
+    char line[512];
+    string stamp = string( OVERHEAD_MAGIC ) + " " + hostName();
+    FILE *file = fopen( path.c_str(), "r" );
+
+    if( file == NULL ) {
+        err = string( "Unable to open " ) + path + ": " + strerror( errno );
+        return false;
+    }
+
+    if( fgets( line, sizeof( line ), file ) == NULL || strncmp( line, stamp.c_str(), stamp.length() ) != 0
+            || ( line[stamp.length()] != '\n' && line[stamp.length()] != '\0' ) ) {
+        err = path + " was not calibrated on this machine";
+        fclose( file );
+        return false;
+    }
+
+    by_khz.clear();
+    while( fgets( line, sizeof( line ), file ) != NULL ) {
+        overhead_t o;
+        if( line[0] == '#' ) {
+            continue;
+        }
+        if( sscanf( line, "%d %lf %lf %lf %lf %lf", &o.khz, &o.time_ns, &o.mutex_ns, &o.rand_ns, &o.move_bits_ns, &o.stop_check_ns ) == 6 ) {
+            set( o );
+        }
+    }
+    fclose( file );
+
+    if( by_khz.empty() ) {
+        err = path + " holds no overheads";
+        return false;
+    }
+    return true;
+}
+
+bool OverheadTable::save( const string &path, string &err ) const {
+    FILE *file = fopen( path.c_str(), "w" );
+
+    if( file == NULL ) {
+        err = string( "Unable to create " ) + path + ": " + strerror( errno );
+        return false;
+    }
+
+    fprintf( file, "%s %s\n", OVERHEAD_MAGIC, hostName().c_str() );
+    fprintf( file, "#kHz\tGetTime (ns)\tMutex (ns)\trand (ns)\tMove Bits (ns)\tStop Check (ns)\n" );
+    for( map<int, overhead_t>::const_iterator it = by_khz.begin(); it != by_khz.end(); it++ ) {
+        const overhead_t &o = it->second;
+        fprintf( file, "%d\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f\n", o.khz, o.time_ns, o.mutex_ns, o.rand_ns, o.move_bits_ns, o.stop_check_ns );
+    }
+
+    if( fclose( file ) ) {
+        err = string( "Unable to write " ) + path + ": " + strerror( errno );
+        return false;
+    }
+    return true;
+}
+
+void OverheadTable::print() const {
+    printf( "#kHz\tGetTime (ns)\tMutex (ns)\trand (ns)\tMove Bits (ns)\tStop Check (ns)\n" );
+    for( map<int, overhead_t>::const_iterator it = by_khz.begin(); it != by_khz.end(); it++ ) {
+        const overhead_t &o = it->second;
+        printf( "%d\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f\n", o.khz, o.time_ns, o.mutex_ns, o.rand_ns, o.move_bits_ns, o.stop_check_ns );
+    }
+}
+
+// Each operation is timed in a tight loop; the fastest of a few rounds is
+// kept so that an interrupt or migration does not inflate the estimate.
+void measureOverheads( overhead_t &o, int reps ) {
+    TIME t, begin, end;
+    uint64_t sink = 0, bits = 0x9e3779b97f4a7c15ULL;
+    double best;
+    int i, round;
+
+    pthread_mutex_t mute;
+    pthread_mutex_init( &mute, NULL );
+    StopTimer stop;
+
+    for( best = -1, round = 0; round < OVERHEAD_ROUNDS; round++ ) {
+        GetTime( begin );
+        for( i = 0; i < reps; i++ ) {
+            GetTime( t );
+            sink += t;
+        }
+        GetTime( end );
+        if( best < 0 || span_TIME( begin, end ) < best * reps ) {
+            best = ( double ) span_TIME( begin, end ) / reps;
+        }
+    }
+    o.time_ns = best;
+
+    for( best = -1, round = 0; round < OVERHEAD_ROUNDS; round++ ) {
+        GetTime( begin );
+        for( i = 0; i < reps; i++ ) {
+            pthread_mutex_lock( &mute );
+            pthread_mutex_unlock( &mute );
+        }
+        GetTime( end );
+        if( best < 0 || span_TIME( begin, end ) < best * reps ) {
+            best = ( double ) span_TIME( begin, end ) / reps;
+        }
+    }
+    o.mutex_ns = best;
+
+    for( best = -1, round = 0; round < OVERHEAD_ROUNDS; round++ ) {
+        GetTime( begin );
+        for( i = 0; i < reps; i++ ) {
+            sink += rand();
+        }
+        GetTime( end );
+        if( best < 0 || span_TIME( begin, end ) < best * reps ) {
+            best = ( double ) span_TIME( begin, end ) / reps;
+        }
+    }
+    o.rand_ns = best;
+
+    for( best = -1, round = 0; round < OVERHEAD_ROUNDS; round++ ) {
+        GetTime( begin );
+        for( i = 0; i < reps; i++ ) {
+            sink += nextMoveBits( bits ) & 1;
+        }
+        GetTime( end );
+        if( best < 0 || span_TIME( begin, end ) < best * reps ) {
+            best = ( double ) span_TIME( begin, end ) / reps;
+        }
+    }
+    o.move_bits_ns = best;
+
+    for( best = -1, round = 0; round < OVERHEAD_ROUNDS; round++ ) {
+        GetTime( begin );
+        for( i = 0; i < reps; i++ ) {
+            sink += stop.expired();
+        }
+        GetTime( end );
+        if( best < 0 || span_TIME( begin, end ) < best * reps ) {
+            best = ( double ) span_TIME( begin, end ) / reps;
+        }
+    }
+    o.stop_check_ns = best;
+
+    pthread_mutex_destroy( &mute );
+
+    // keep the timed loops from being discarded
+    __asm__ __volatile__( "" : : "r"( sink ) );
+}
+
+struct calibrate_args_t {
+    int cpu_idx;
+    const FrequencyTable *freqs;
+    OverheadTable *table;
+    bool ok;
+    string err;
+};
+
+static void *calibrateThread( void *args ) {
+    calibrate_args_t *cal = ( calibrate_args_t * ) args;
+    TIME settle;
+
+    for( int i = 0; i < cal->freqs->size(); i++ ) {
+        overhead_t o;
+
+        if( !setCPUThrottledSpeed( cal->cpu_idx, cal->freqs->speed( i ), cal->err ) ) {
+            cal->ok = false;
+            break;
+        }
+
+        // let the speed change land before timing anything
+        GetTime( settle );
+        settle += OVERHEAD_SETTLE_NS;
+        timespec at = convertTimeToTimespec( settle );
+        while( clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &at, NULL ) == EINTR );
+
+        measureOverheads( o );
+        o.khz = cal->freqs->khz( i );
+        cal->table->set( o );
+    }
+
+    pthread_exit( NULL );
+}
+
+bool calibrateOverheads( int cpu_idx, const FrequencyTable &freqs, OverheadTable &table, string &err ) {
+    calibrate_args_t cal;
+    pthread_attr_t attrs;
+    pthread_t thread;
+    CpuMask mask;
+
+    if( freqs.empty() ) {
+        err = "No speeds to calibrate";
+        return false;
+    }
+
+    cal.cpu_idx = cpu_idx;
+    cal.freqs = &freqs;
+    cal.table = &table;
+    cal.ok = true;
+
+    mask.set( cpu_idx );
+    pthread_attr_init( &attrs );
+    pthread_attr_setaffinity_np( &attrs, mask.size(), mask.get() );
+
+    int rc = pthread_create( &thread, &attrs, calibrateThread, ( void * ) &cal );
+    pthread_attr_destroy( &attrs );
+    if( rc ) {
+        err = "Unable to create calibration thread";
+        return false;
+    }
+    pthread_join( thread, NULL );
+
+    if( !cal.ok ) {
+        err = cal.err;
+    }
+    return cal.ok;
+}
@@ -1,11 +1,76 @@
 #include "utils/procbind.h"
+#include "utils/cpufunc.h"
 
-bool BindAllProcTo( map<int, cpu_set_t> &proc_aff, int cpu_count, cpu_set_t &bind_mask ) {
+#include <algorithm>
+#include <cstdio>
+
+// The kernel rejects affinity masks smaller than its possible cpu count, so
+// masks are sized from /sys/devices/system/cpu/possible once.
+int cpuMaskCapacity() {
+    static int capacity = 0;
+
+    if( capacity == 0 ) {
+        vector<int> cpus;
+
+        if( readCPUIds( CPU_POSSIBLE_FILE, cpus, hostBackend() ) ) {
+            capacity = *max_element( cpus.begin(), cpus.end() ) + 1;
+        }
+        capacity = max( capacity, max( determineCPUIdBound(), CPU_SETSIZE ) );
+    }
+
+    return capacity;
+}
+
+CpuMask::CpuMask() : cpus( cpuMaskCapacity() ) {
+    bytes = CPU_ALLOC_SIZE( cpus );
+    mask = CPU_ALLOC( cpus );
+    clear();
+}
+
+CpuMask::CpuMask( const CpuMask &other ) : cpus( other.cpus ), bytes( other.bytes ) {
+    mask = CPU_ALLOC( cpus );
+    memcpy( mask, other.mask, bytes );
+}
+
+CpuMask &CpuMask::operator=( const CpuMask &other ) {
+    if( this != &other ) {
+        if( cpus != other.cpus ) {
+            CPU_FREE( mask );
+            cpus = other.cpus;
+            bytes = other.bytes;
+            mask = CPU_ALLOC( cpus );
+        }
+        memcpy( mask, other.mask, bytes );
+    }
+    return *this;
+}
+
+CpuMask::~CpuMask() {
+    CPU_FREE( mask );
+}
+
+void CpuMask::clear() {
+    CPU_ZERO_S( bytes, mask );
+}
+
+void CpuMask::set( int cpu ) {
+    CPU_SET_S( cpu, bytes, mask );
+}
+
+bool CpuMask::isSet( int cpu ) const {
+    return CPU_ISSET_S( cpu, bytes, mask );
+}
+
+int CpuMask::count() const {
+    return CPU_COUNT_S( bytes, mask );
+}
+
+bool BindAllProcTo( map<int, CpuMask> &proc_aff, int cpu_count, CpuMask &bind_mask ) {
     struct dirent **namelist;
     int n = scandir( "/proc", &namelist, NULL, NULL );
     int pid;
 
-    cpu_set_t mask;
+    CpuMask mask;
 //    cpu_set_t bind_mask;
 //
 //    CPU_ZERO(&bind_mask);
@@ -18,7 +83,7 @@ bool BindAllProcTo( map<int, cpu_set_t> &proc_aff, int cpu_count, cpu_set_t &bin
 
     while( n-- ) {
         if( namelist[n]->d_type == DT_DIR && ( pid = atoi( namelist[n]->d_name ) ) != 0 ) {
-            if( sched_getaffinity(( pid_t )pid, sizeof( cpu_set_t ), &mask ) == 0 ) {
+            if( sched_getaffinity(( pid_t )pid, mask.size(), mask.get() ) == 0 ) {
 //                printf( "Found: %s -> d ", namelist[n]->d_name );
 //
 //                for( int i = 0; i < cpu_count; i++ ) {
@@ -29,8 +94,8 @@ bool BindAllProcTo( map<int, cpu_set_t> &proc_aff, int cpu_count, cpu_set_t &bin
 //
 //                printf( "\t" );
 
-                if( sched_setaffinity(( pid_t )pid, sizeof( cpu_set_t ), &bind_mask ) == 0 ) {
-                    proc_aff.insert( pair<int, cpu_set_t>( pid, mask ) );
+                if( sched_setaffinity(( pid_t )pid, bind_mask.size(), bind_mask.get() ) == 0 ) {
+                    proc_aff.insert( pair<int, CpuMask>( pid, mask ) );
 
 //                    if( sched_getaffinity(( pid_t )pid, sizeof( cpu_set_t ), &mask ) == 0 ) {
 //                        for( int i = 0; i < cpu_count; i++ ) {
@@ -55,36 +120,36 @@ bool BindAllProcTo( map<int, cpu_set_t> &proc_aff, int cpu_count, cpu_set_t &bin
     return true;
 }
 
-void resetAffinities( map<int, cpu_set_t> &proc_aff ) {
-    for( map<int, cpu_set_t>::iterator proc_it = proc_aff.begin(); proc_it != proc_aff.end(); proc_it++ ) {
-        if( sched_setaffinity(( pid_t )proc_it->first, sizeof( cpu_set_t ), &proc_it->second ) != 0 ) {
+void resetAffinities( map<int, CpuMask> &proc_aff ) {
+    for( map<int, CpuMask>::iterator proc_it = proc_aff.begin(); proc_it != proc_aff.end(); proc_it++ ) {
+        if( sched_setaffinity(( pid_t )proc_it->first, proc_it->second.size(), proc_it->second.get() ) != 0 ) {
             printf( "Error resetting Process Affinity: %d %d -> %s\n", proc_it->first, errno, strerror( errno ) );
         }
     }
 }
 
-void buildMask( vector<int> &v, cpu_set_t &mask ) {
-    CPU_ZERO( &mask );
+void buildMask( vector<int> &v, CpuMask &mask ) {
+    mask.clear();
     for( vector<int>::iterator v_it = v.begin(); v_it != v.end(); v_it++ ) {
-        CPU_SET_S( *v_it, sizeof( cpu_set_t ), &mask );
+        mask.set( *v_it );
     }
 }
 
-void bindCurProcTo( cpu_set_t &mask ) {
+void bindCurProcTo( CpuMask &mask ) {
     int pid = getpid();
-    if( sched_setaffinity(( pid_t )pid, sizeof( cpu_set_t ), &mask ) ) {
+    if( sched_setaffinity(( pid_t )pid, mask.size(), mask.get() ) ) {
         printf( "Error setting current process affinity: %d %d -> %s\n", pid, errno, strerror( errno ) );
     }
 }
 
 void printCurrentProcBinding() {
     pid_t pid = getpid();
-    cpu_set_t mask;
+    CpuMask mask;
 
-    if( sched_getaffinity( pid, sizeof( cpu_set_t ), &mask )  == 0 ) {
+    if( sched_getaffinity( pid, mask.size(), mask.get() )  == 0 ) {
         printf("Current Process %d -> ", pid);
-        for( int i = 0, j = 0; j < CPU_COUNT_S( sizeof(cpu_set_t), &mask); i++ ) {
-            if( CPU_ISSET_S( i, sizeof( cpu_set_t ), &mask ) ) {
+        for( int i = 0, j = 0; j < mask.count(); i++ ) {
+            if( mask.isSet( i ) ) {
                 printf( "%d,", i );
                 ++j;
             }
@@ -95,3 +160,244 @@ void printCurrentProcBinding() {
     }
 }
 
+const char *PLACEMENT_NAMES[PLACEMENT_COUNT] = {"all", "spread", "compact", "core", "domain"};
+
+// filled once by discoverCpuTopology, by cpu id
+static map<int, cpu_topology_t> cpu_topology;
+
+bool parsePlacement( const string &name, placement_t &placement ) {
+    for( int i = 0; i < PLACEMENT_COUNT; i++ ) {
+        if( name == PLACEMENT_NAMES[i] ) {
+            placement = ( placement_t ) i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *placementName( placement_t placement ) {
+    return PLACEMENT_NAMES[placement];
+}
+
+static bool readCpuAttr( int cpu_idx, const char *name, char *buffer, size_t len ) {
+    char attr[100];
+
+    snprintf( attr, sizeof( attr ), "cpu%d/%s", cpu_idx, name );
+    return cpuBackend().readAttr( attr, buffer, len );
+}
+
+// lowest cpu of the list in attribute name, or cpu_idx without one
+static int lowestListedCpu( int cpu_idx, const char *name ) {
+    char buffer[BUFFER_SIZE];
+    vector<int> cpus;
+
+    if( readCpuAttr( cpu_idx, name, buffer, BUFFER_SIZE ) && parseCPUList( buffer, cpus ) && !cpus.empty() ) {
+        return *min_element( cpus.begin(), cpus.end() );
+    }
+    return cpu_idx;
+}
+
+// the data or unified cache of the highest level
+static void readLastLevelCache( cpu_topology_t &topo ) {
+    char name[64], buffer[BUFFER_SIZE];
+
+    topo.llc = topo.cpu;
+    topo.llc_level = 0;
+    topo.llc_kb = 0;
+
+    for( int index = 0; ; index++ ) {
+        snprintf( name, sizeof( name ), "cache/index%d/level", index );
+        if( !readCpuAttr( topo.cpu, name, buffer, BUFFER_SIZE ) ) {
+            break;
+        }
+        int level = atoi( buffer );
+
+        snprintf( name, sizeof( name ), "cache/index%d/type", index );
+        if( !readCpuAttr( topo.cpu, name, buffer, BUFFER_SIZE ) || strncmp( buffer, "Instruction", 11 ) == 0 || level < topo.llc_level ) {
+            continue;
+        }
+
+        topo.llc_level = level;
+        snprintf( name, sizeof( name ), "cache/index%d/shared_cpu_list", index );
+        topo.llc = lowestListedCpu( topo.cpu, name );
+
+        snprintf( name, sizeof( name ), "cache/index%d/size", index );
+        if( readCpuAttr( topo.cpu, name, buffer, BUFFER_SIZE ) ) {
+            char *unit;
+            topo.llc_kb = ( int ) strtol( buffer, &unit, 10 );
+            if( *unit == 'M' ) {
+                topo.llc_kb *= 1024;
+            }
+        }
+    }
+}
+
+// NUMA nodes are not cpu attributes, so they always come from the host
+static void readNumaNodes( map<int, int> &cpu_node ) {
+    char attr[64], buffer[BUFFER_SIZE];
+    vector<int> nodes, cpus;
+    SysfsBackend node_sysfs( "/sys/devices/system/node" );
+
+    if( !node_sysfs.readAttr( "online", buffer, BUFFER_SIZE ) || !parseCPUList( buffer, nodes ) ) {
+        return;
+    }
+
+    for( size_t i = 0; i < nodes.size(); i++ ) {
+        snprintf( attr, sizeof( attr ), "node%d/cpulist", nodes[i] );
+        if( node_sysfs.readAttr( attr, buffer, BUFFER_SIZE ) && parseCPUList( buffer, cpus ) ) {
+            for( size_t j = 0; j < cpus.size(); j++ ) {
+                cpu_node[cpus[j]] = nodes[i];
+            }
+        }
+    }
+}
+
+bool discoverCpuTopology( const vector<int> &cpus ) {
+    char buffer[BUFFER_SIZE];
+    map<int, int> cpu_node;
+
+    if( !cpu_topology.empty() ) {
+        return true;
+    }
+
+    readNumaNodes( cpu_node );
+
+    for( size_t i = 0; i < cpus.size(); i++ ) {
+        cpu_topology_t topo;
+
+        topo.cpu = cpus[i];
+        topo.core = lowestListedCpu( topo.cpu, "topology/thread_siblings_list" );
+        topo.package = readCpuAttr( topo.cpu, "topology/physical_package_id", buffer, BUFFER_SIZE ) ? atoi( buffer ) : 0;
+        topo.node = cpu_node.count( topo.cpu ) ? cpu_node[topo.cpu] : 0;
+        topo.domain = getFrequencyDomain( topo.cpu );
+        readLastLevelCache( topo );
+
+        cpu_topology[topo.cpu] = topo;
+    }
+
+    return !cpu_topology.empty();
+}
+
+const cpu_topology_t *getCpuTopology( int cpu_idx ) {
+    map<int, cpu_topology_t>::iterator topo_it = cpu_topology.find( cpu_idx );
+
+    return topo_it == cpu_topology.end() ? NULL : &topo_it->second;
+}
+
+void printCpuTopology() {
+    printf( "#CPU\tCore\tPackage\tNode\tLLC\tLLC Level\tLLC (KB)\tDomain\n" );
+    for( map<int, cpu_topology_t>::iterator topo_it = cpu_topology.begin(); topo_it != cpu_topology.end(); topo_it++ ) {
+        cpu_topology_t &topo = topo_it->second;
+        printf( "%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\n", topo.cpu, topo.core, topo.package, topo.node, topo.llc, topo.llc_level, topo.llc_kb, topo.domain );
+    }
+}
+
+// position of a cpu among the placed cpus of its core, of its core among
+// the cores of its package and so on up to the node
+struct placement_rank_t {
+    int cpu;
+    int node;
+    int package;
+    int core;
+    int smt_rank;
+    int core_rank;
+    int package_rank;
+    int node_rank;
+    int domain_rank;
+};
+
+// interleaves nodes, then packages, then cores before using a second SMT
+// sibling of any core
+static bool spreadOrder( const placement_rank_t &a, const placement_rank_t &b ) {
+    if( a.smt_rank != b.smt_rank ) {
+        return a.smt_rank < b.smt_rank;
+    }
+    if( a.core_rank != b.core_rank ) {
+        return a.core_rank < b.core_rank;
+    }
+    if( a.package_rank != b.package_rank ) {
+        return a.package_rank < b.package_rank;
+    }
+    if( a.node_rank != b.node_rank ) {
+        return a.node_rank < b.node_rank;
+    }
+    return a.cpu < b.cpu;
+}
+
+// fills SMT siblings, then cores of a package, then packages of a node
+static bool compactOrder( const placement_rank_t &a, const placement_rank_t &b ) {
+    if( a.node != b.node ) {
+        return a.node < b.node;
+    }
+    if( a.package != b.package ) {
+        return a.package < b.package;
+    }
+    if( a.core != b.core ) {
+        return a.core < b.core;
+    }
+    return a.cpu < b.cpu;
+}
+
+void placeCpus( const vector<int> &cpus, placement_t placement, int limit, vector<int> &placed ) {
+    vector<int> sorted( cpus );
+    vector<placement_rank_t> ranks;
+    map<int, int> node_rank, packages_in_node;
+    map<pair<int, int>, int> package_rank, cores_in_package;
+    map<int, int> core_rank, cpus_in_core, cpus_in_domain;
+
+    sort( sorted.begin(), sorted.end() );
+    placed.clear();
+
+    for( size_t i = 0; i < sorted.size(); i++ ) {
+        const cpu_topology_t *topo = getCpuTopology( sorted[i] );
+        placement_rank_t rank;
+
+        rank.cpu = sorted[i];
+        rank.node = topo != NULL ? topo->node : 0;
+        rank.package = topo != NULL ? topo->package : 0;
+        rank.core = topo != NULL ? topo->core : sorted[i];
+        // a cpu of unknown domain is a domain of its own
+        int domain = topo != NULL && topo->domain >= 0 ? topo->domain : -1 - sorted[i];
+        pair<int, int> package( rank.node, rank.package );
+
+        if( !node_rank.count( rank.node ) ) {
+            int count = ( int ) node_rank.size();
+            node_rank[rank.node] = count;
+        }
+        if( !package_rank.count( package ) ) {
+            package_rank[package] = packages_in_node[rank.node]++;
+        }
+        if( !core_rank.count( rank.core ) ) {
+            core_rank[rank.core] = cores_in_package[package]++;
+        }
+
+        rank.node_rank = node_rank[rank.node];
+        rank.package_rank = package_rank[package];
+        rank.core_rank = core_rank[rank.core];
+        rank.smt_rank = cpus_in_core[rank.core]++;
+        rank.domain_rank = cpus_in_domain[domain]++;
+        ranks.push_back( rank );
+    }
+
+    if( placement == PLACE_ALL ) {
+        placed = sorted;
+    } else {
+        vector<placement_rank_t> kept;
+
+        for( size_t i = 0; i < ranks.size(); i++ ) {
+            if(( placement == PLACE_CORE && ranks[i].smt_rank > 0 ) || ( placement == PLACE_DOMAIN && ranks[i].domain_rank > 0 ) ) {
+                continue;
+            }
+            kept.push_back( ranks[i] );
+        }
+
+        stable_sort( kept.begin(), kept.end(), placement == PLACE_COMPACT ? compactOrder : spreadOrder );
+        for( size_t i = 0; i < kept.size(); i++ ) {
+            placed.push_back( kept[i].cpu );
+        }
+    }
+
+    if( limit > 0 && ( int ) placed.size() > limit ) {
+        placed.resize( limit );
+    }
+}
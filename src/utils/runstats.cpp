@@ -0,0 +1,124 @@
+#include "utils/runstats.h"
+
+#include <cmath>
+#include <cstring>
+#include <cerrno>
+
+#include <gsl/gsl_cdf.h>
+
+void RunningStat::add( double x ) {
+    double delta = x - m;
+
+    n++;
+    m += delta / n;
+    m2 += delta * ( x - m );
+
+    if( n == 1 || x < lo ) {
+        lo = x;
+    }
+    if( n == 1 || x > hi ) {
+        hi = x;
+    }
+}
+
+double RunningStat::stddev() const {
+    return sqrt( variance() );
+}
+
+double RunningStat::ciHalfWidth( double level ) const {
+    if( n < 2 ) {
+        return 0;
+    }
+    return gsl_cdf_tdist_Pinv( 0.5 + level / 2, n - 1 ) * stddev() / sqrt(( double ) n );
+}
+
+void FrequencySummary::add( int khz, TIME begin, TIME end ) {
+    by_khz[khz].elapsed_ns.add( span_TIME( begin, end ) );
+}
+
+void FrequencySummary::add( int khz, TIME begin, TIME end, uint64_t nodes ) {
+    freq_summary_t &s = by_khz[khz];
+    uint64_t elapsed = span_TIME( begin, end );
+
+    s.elapsed_ns.add( elapsed );
+    if( elapsed > 0 ) {
+        s.nodes_per_sec.add(( double ) nodes * NS_PER_SEC / elapsed );
+    }
+}
+
+void FrequencySummary::print( double level ) const {
+    printf( "# Summary, confidence intervals at %.0f%%\n", level * 100 );
+    printf( "#kHz\tSamples\tMean (%s)\tStd Dev (%s)\tMin (%s)\tMax (%s)\tCI (%s)\tMean Nodes/s\tStd Dev Nodes/s\tCI Nodes/s\n",
+            TIME_ABRV, TIME_ABRV, TIME_ABRV, TIME_ABRV, TIME_ABRV );
+
+    for( map<int, freq_summary_t>::const_iterator it = by_khz.begin(); it != by_khz.end(); it++ ) {
+        const RunningStat &e = it->second.elapsed_ns;
+        const RunningStat &r = it->second.nodes_per_sec;
+
+        printf( "#%d\t%lu\t%.0f\t%.0f\t%.0f\t%.0f\t%.0f", it->first, e.count(), e.mean(), e.stddev(), e.min(), e.max(), e.ciHalfWidth( level ) );
+        if( r.count() > 0 ) {
+            printf( "\t%.0f\t%.0f\t%.0f\n", r.mean(), r.stddev(), r.ciHalfWidth( level ) );
+        } else {
+            printf( "\t-\t-\t-\n" );
+        }
+    }
+}
+
+static void saveStatJSON( FILE *file, const char *name, const RunningStat &s, double level ) {
+    fprintf( file, "\"%s\": {\"count\": %lu, \"mean\": %.3f, \"stddev\": %.3f, \"min\": %.3f, \"max\": %.3f, \"ci\": %.3f}",
+             name, s.count(), s.mean(), s.stddev(), s.min(), s.max(), s.ciHalfWidth( level ) );
+}
+
+void FrequencySummary::saveJSON( FILE *file, double level ) const {
+    fprintf( file, "{\n  \"confidence\": %.3f,\n  \"frequencies\": [", level );
+    for( map<int, freq_summary_t>::const_iterator it = by_khz.begin(); it != by_khz.end(); it++ ) {
+        fprintf( file, "%s\n    {\"khz\": %d, ", it == by_khz.begin() ? "" : ",", it->first );
+        saveStatJSON( file, "elapsed_ns", it->second.elapsed_ns, level );
+        if( it->second.nodes_per_sec.count() > 0 ) {
+            fprintf( file, ", " );
+            saveStatJSON( file, "nodes_per_sec", it->second.nodes_per_sec, level );
+        }
+        fprintf( file, "}" );
+    }
+    fprintf( file, "\n  ]\n}\n" );
+}
+
+static void saveStatCSV( FILE *file, const RunningStat &s, double level ) {
+    if( s.count() == 0 ) {
+        fprintf( file, ",0,,,,," );
+        return;
+    }
+    fprintf( file, ",%lu,%.3f,%.3f,%.3f,%.3f,%.3f", s.count(), s.mean(), s.stddev(), s.min(), s.max(), s.ciHalfWidth( level ) );
+}
+
+void FrequencySummary::saveCSV( FILE *file, double level ) const {
+    fprintf( file, "khz,confidence,elapsed_count,elapsed_mean_ns,elapsed_stddev_ns,elapsed_min_ns,elapsed_max_ns,elapsed_ci_ns,"
+             "rate_count,rate_mean_nodes_per_sec,rate_stddev_nodes_per_sec,rate_min_nodes_per_sec,rate_max_nodes_per_sec,rate_ci_nodes_per_sec\n" );
+    for( map<int, freq_summary_t>::const_iterator it = by_khz.begin(); it != by_khz.end(); it++ ) {
+        fprintf( file, "%d,%.3f", it->first, level );
+        saveStatCSV( file, it->second.elapsed_ns, level );
+        saveStatCSV( file, it->second.nodes_per_sec, level );
+        fprintf( file, "\n" );
+    }
+}
+
+bool FrequencySummary::save( const string &path, double level, string &err ) const {
+    FILE *file = fopen( path.c_str(), "w" );
+
+    if( file == NULL ) {
+        err = string( "Unable to create " ) + path + ": " + strerror( errno );
+        return false;
+    }
+
+    if( path.length() >= 5 && path.compare( path.length() - 5, 5, ".json" ) == 0 ) {
+        saveJSON( file, level );
+    } else {
+        saveCSV( file, level );
+    }
+
+    if( fclose( file ) ) {
+        err = string( "Unable to write " ) + path + ": " + strerror( errno );
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,107 @@
+#include "utils/stoptimer.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+StopTimer::StopTimer() : fd( -1 ), running( false ), shutdown( false ), flag( 0 ), armed_at( 0 ), fired_at( 0 ) {
+}
+
+StopTimer::~StopTimer() {
+    close();
+}
+
+bool StopTimer::open( string &err ) {
+    if( running ) {
+        return true;
+    }
+
+    fd = timerfd_create( CLOCK_MONOTONIC, TFD_CLOEXEC );
+    if( fd < 0 ) {
+        err = string( "Unable to create stop timer: " ) + strerror( errno );
+        return false;
+    }
+
+    shutdown = false;
+    if( pthread_create( &thread, NULL, timerThread, ( void * ) this ) ) {
+        err = "Unable to create stop timer thread";
+        ::close( fd );
+        fd = -1;
+        return false;
+    }
+
+    running = true;
+    return true;
+}
+
+void StopTimer::close() {
+    if( !running ) {
+        return;
+    }
+
+    // an immediate expiry wakes the helper to see the shutdown
+    __atomic_store_n( &shutdown, true, __ATOMIC_RELEASE );
+    itimerspec now;
+    memset( &now, 0, sizeof( now ) );
+    now.it_value.tv_nsec = 1;
+    timerfd_settime( fd, 0, &now, NULL );
+
+    pthread_join( thread, NULL );
+    ::close( fd );
+    fd = -1;
+    running = false;
+}
+
+bool StopTimer::arm( TIME deadline, string &err ) {
+    if( !running ) {
+        err = "Stop timer is not open";
+        return false;
+    }
+
+    // the helper ignores an expiry that is earlier than the current deadline
+    __atomic_store_n( &armed_at, deadline, __ATOMIC_RELEASE );
+    __atomic_store_n( &flag, 0, __ATOMIC_RELEASE );
+
+    itimerspec at;
+    memset( &at, 0, sizeof( at ) );
+    at.it_value = convertTimeToTimespec( deadline );
+    if( timerfd_settime( fd, TFD_TIMER_ABSTIME, &at, NULL ) ) {
+        err = string( "Unable to arm stop timer: " ) + strerror( errno );
+        return false;
+    }
+
+    return true;
+}
+
+void *StopTimer::timerThread( void *args ) {
+    StopTimer *timer = ( StopTimer * ) args;
+    uint64_t expirations;
+    TIME now;
+
+    while( true ) {
+        if( read( timer->fd, &expirations, sizeof( expirations ) ) != sizeof( expirations ) ) {
+            if( errno == EINTR ) {
+                continue;
+            }
+            break;
+        }
+
+        if( __atomic_load_n( &timer->shutdown, __ATOMIC_ACQUIRE ) ) {
+            break;
+        }
+
+        GetTime( now );
+        if( now < __atomic_load_n( &timer->armed_at, __ATOMIC_ACQUIRE ) ) {
+            continue;
+        }
+
+        __atomic_store_n( &timer->fired_at, now, __ATOMIC_RELEASE );
+        __atomic_store_n( &timer->flag, 1, __ATOMIC_RELEASE );
+    }
+
+    // never leave a worker spinning on a dead timer
+    __atomic_store_n( &timer->flag, 1, __ATOMIC_RELEASE );
+    pthread_exit( NULL );
+}
@@ -1,88 +1,77 @@
 #include "utils/timing.h"
 
-int diff_TIME( TIME &res, TIME &x, TIME &y ) {
-//    if( x.FRAC < y.FRAC ) {
-//        long int sec = ( y.FRAC - x.FRAC ) / FRAC_SEC_TIME + 1;
-//        y.FRAC -= FRAC_SEC_TIME * sec;
-//        y.tv_sec += sec;
-//    }
-//
-//    if( x.FRAC - y.FRAC > FRAC_SEC_TIME ) {
-//        long int sec = ( x.FRAC - y.FRAC ) / FRAC_SEC_TIME;
-//        y.FRAC += FRAC_SEC_TIME * sec;
-//        y.tv_sec -= sec;
-//    }
+#if HAVE_TSC
+#include <cpuid.h>
+#endif
 
-    uint64_t x_frac = x.FRAC + ( FRAC_SEC_TIME * x.tv_sec );
-    uint64_t y_frac = y.FRAC + ( FRAC_SEC_TIME * y.tv_sec );
+// window over which the TSC rate is measured
+const uint64_t TSC_CALIBRATION_NS = 50000000;
 
+// non-zero so that conversions before calibration do not divide by zero
+uint64_t TscClock::ticks_per_sec = 1000000000ULL;
 
-//    res.tv_sec = x.tv_sec - y.tv_sec;
-//    res.FRAC = x.FRAC - y.FRAC;
-    x_frac -= y_frac;
-    res.tv_sec = x_frac / FRAC_SEC_TIME;
-    res.FRAC = x_frac % FRAC_SEC_TIME;
-
-    return x.tv_sec < y.tv_sec;
+int PrintTime( TIME t ) {
+    return printf( "%lu.%09lu", ( unsigned long )( t / NS_PER_SEC ), ( unsigned long )( t % NS_PER_SEC ) );
 }
 
-int sum_TIME( TIME &res, TIME &x, TIME &y ) {
-//    long int nsec = x.FRAC + y.FRAC;
-//    long int sec = x.tv_sec + y.tv_sec;
-//
-//    if( nsec > FRAC_SEC_TIME ) {
-//        sec += nsec / FRAC_SEC_TIME;
-//        nsec = nsec % FRAC_SEC_TIME;
-//    }
-//
-//    res.tv_sec = sec;
-//    res.FRAC = nsec;
-
-    uint64_t x_frac = x.FRAC + ( FRAC_SEC_TIME * x.tv_sec );
-    uint64_t y_frac = y.FRAC + ( FRAC_SEC_TIME * y.tv_sec );
-
-    x_frac += y_frac;
-
-    res.tv_sec = x_frac / FRAC_SEC_TIME;
-    res.FRAC = x_frac % FRAC_SEC_TIME;
-
-    return 0;
-}
-
-//int avg_TIME( TIME &avg, TIME &tot, int samples ) {
-//    avg.tv_sec = tot.tv_sec / samples;
-//    avg.FRAC = (tot.FRAC + (tot.tv_sec % samples) * FRAC_SEC_TIME) / samples;
-//    return 0;
-//}
-
-int avg_TIME( TIME &avg, TIME &tot, int samples ) {
-    uint64_t tmp = tot.FRAC + ( FRAC_SEC_TIME * tot.tv_sec );
-    tmp /= samples;
-
-    avg.tv_sec = tmp / FRAC_SEC_TIME;
-    avg.FRAC = tmp % FRAC_SEC_TIME;
-}
-
-int PrintTime( TIME &t ) {
-    AdjustTime( t );
-    return printf( TIME_PRINT, t.tv_sec, t.FRAC );
+timespec convertTimeToTimespec( TIME t ) {
+    timespec _t;
+    _t.tv_sec = t / NS_PER_SEC;
+    _t.tv_nsec = t % NS_PER_SEC;
+    return _t;
 }
 
-void AdjustTime( TIME &t ) {
-    uint64_t x_frac = t.FRAC + ( FRAC_SEC_TIME * t.tv_sec );
-
-    t.tv_sec = x_frac / FRAC_SEC_TIME;
-    t.FRAC = x_frac % FRAC_SEC_TIME;
+// CPUID 0x80000007 EDX bit 8: the TSC runs at a constant rate in every
+// P-, C- and T-state
+bool TscClock::invariant() {
+#if HAVE_TSC
+    unsigned int eax, ebx, ecx, edx;
+
+    if( !__get_cpuid( 0x80000007, &eax, &ebx, &ecx, &edx ) ) {
+        return false;
+    }
+    return ( edx & ( 1 << 8 ) ) != 0;
+#else
+    return false;
+#endif
 }
 
-timespec convertTimeToTimespec( TIME &t ) {
-    timespec _t;
-    _t.tv_sec = t.tv_sec;
-    #if NANO_TIME
-        _t.tv_nsec = t.tv_nsec;
-    #else
-        _t.tv_nsec = t.tv_usec * 1000;
-    #endif
-    return _t;
-
+bool TscClock::calibrate( std::string &err ) {
+#if HAVE_TSC
+    static bool calibrated = false;
+    uint64_t ns0, ns1, tsc0, tsc1;
+
+    if( !calibrated ) {
+        // the first reads fault in the vDSO data and would skew the start
+        for( int i = 0; i < 100; ++i ) {
+            MonotonicRawClock::now();
+            nowOrdered();
+        }
+
+        // bracket each clock_gettime with TSC reads and keep the midpoint
+        tsc0 = nowOrdered();
+        ns0 = MonotonicRawClock::now();
+        tsc0 = ( tsc0 + nowOrdered() ) / 2;
+
+        do {
+            ns1 = MonotonicRawClock::now();
+        } while( ns1 - ns0 < TSC_CALIBRATION_NS );
+
+        tsc1 = nowOrdered();
+        ns1 = MonotonicRawClock::now();
+        tsc1 = ( tsc1 + nowOrdered() ) / 2;
+
+        ticks_per_sec = ( uint64_t )(( unsigned __int128 )( tsc1 - tsc0 ) * NS_PER_SEC / ( ns1 - ns0 ) );
+        calibrated = true;
+    }
+
+    if( !invariant() ) {
+        err = "TSC is not invariant";
+        return false;
+    }
+    return true;
+#else
+    err = "No time stamp counter on this architecture";
+    return false;
+#endif
 }
@@ -0,0 +1,289 @@
+#include "utils/trace.h"
+
+#include <map>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+TraceFile::TraceFile() : fd( -1 ), writable( false ), map_bytes( 0 ), map( NULL ), head( NULL ), records( NULL ) {
+}
+
+TraceFile::~TraceFile() {
+    close();
+}
+
+bool TraceFile::create( const string &path, uint64_t capacity, string &err ) {
+    close();
+
+    if( capacity == 0 ) {
+        err = "A trace needs room for at least one record";
+        return false;
+    }
+
+    fd = ::open( path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 );
+    if( fd < 0 ) {
+        err = string( "Unable to create " ) + path + ": " + strerror( errno );
+        return false;
+    }
+
+    // the file stays sparse until records land, so capacity costs nothing up front
+    map_bytes = sizeof( trace_header_t ) + capacity * sizeof( trace_record_t );
+    if( ftruncate( fd, map_bytes ) ) {
+        err = string( "Unable to size " ) + path + ": " + strerror( errno );
+        ::close( fd );
+        fd = -1;
+        return false;
+    }
+
+    map = mmap( NULL, map_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    if( map == MAP_FAILED ) {
+        err = string( "Unable to map " ) + path + ": " + strerror( errno );
+        map = NULL;
+        ::close( fd );
+        fd = -1;
+        return false;
+    }
+
+    head = ( trace_header_t * ) map;
+    records = ( trace_record_t * )( head + 1 );
+    writable = true;
+    file_path = path;
+
+    memcpy( head->magic, TRACE_MAGIC, sizeof( head->magic ) );
+    head->record_size = sizeof( trace_record_t );
+    head->capacity = capacity;
+    head->reserved = 0;
+    return true;
+}
+
+bool TraceFile::open( const string &path, string &err ) {
+    struct stat st;
+
+    close();
+
+    fd = ::open( path.c_str(), O_RDONLY | O_CLOEXEC );
+    if( fd < 0 ) {
+        err = string( "Unable to open " ) + path + ": " + strerror( errno );
+        return false;
+    }
+
+    if( fstat( fd, &st ) || ( size_t ) st.st_size < sizeof( trace_header_t ) ) {
+        err = path + " is not a trace";
+        close();
+        return false;
+    }
+
+    map_bytes = st.st_size;
+    map = mmap( NULL, map_bytes, PROT_READ, MAP_SHARED, fd, 0 );
+    if( map == MAP_FAILED ) {
+        err = string( "Unable to map " ) + path + ": " + strerror( errno );
+        map = NULL;
+        close();
+        return false;
+    }
+
+    head = ( trace_header_t * ) map;
+    records = ( trace_record_t * )( head + 1 );
+    file_path = path;
+
+    if( memcmp( head->magic, TRACE_MAGIC, sizeof( head->magic ) ) != 0 || head->record_size != sizeof( trace_record_t ) ) {
+        err = path + " is not a trace of this version";
+        close();
+        return false;
+    }
+    if( map_bytes < sizeof( trace_header_t ) + size() * sizeof( trace_record_t ) ) {
+        err = path + " is truncated";
+        close();
+        return false;
+    }
+    return true;
+}
+
+// Trims a written trace to the records it holds.
+void TraceFile::close() {
+    if( map != NULL ) {
+        size_t used = sizeof( trace_header_t ) + size() * sizeof( trace_record_t );
+
+        munmap( map, map_bytes );
+        if( writable && ftruncate( fd, used ) ) {
+            fprintf( stderr, "Unable to trim %s: %s\n", file_path.c_str(), strerror( errno ) );
+        }
+        map = NULL;
+        head = NULL;
+        records = NULL;
+    }
+    if( fd >= 0 ) {
+        ::close( fd );
+        fd = -1;
+    }
+    writable = false;
+    map_bytes = 0;
+}
+
+void TraceFile::setLayout( bool throttled, int samplings, int threads, int events ) {
+    head->throttled = throttled ? 1 : 0;
+    head->samplings = samplings;
+    head->threads = threads;
+    head->events = events;
+}
+
+bool TraceFile::append( const trace_record_t &rec ) {
+    uint64_t idx = __atomic_fetch_add( &head->reserved, 1, __ATOMIC_RELAXED );
+
+    if( idx >= head->capacity ) {
+        return false;
+    }
+    records[idx] = rec;
+    return true;
+}
+
+bool TraceFile::append( int type, int sample, int thread, int cpu, int event, TIME t, uint64_t count, int khz, uint64_t stop_lag ) {
+    trace_record_t rec;
+
+    rec.time = t;
+    rec.count = count;
+    rec.khz = khz > 0 ? khz : 0;
+    rec.stop_lag = stop_lag > 0xffffffffULL ? 0xffffffffU : ( uint32_t ) stop_lag;
+    rec.cpu = cpu;
+    rec.thread = thread;
+    rec.sample = sample;
+    rec.type = type;
+    rec.pad = 0;
+    rec.event = event > 0 ? event : 0;
+    return append( rec );
+}
+
+uint64_t TraceFile::size() const {
+    uint64_t reserved = __atomic_load_n( &head->reserved, __ATOMIC_RELAXED );
+    return reserved < head->capacity ? reserved : head->capacity;
+}
+
+uint64_t TraceFile::dropped() const {
+    uint64_t reserved = __atomic_load_n( &head->reserved, __ATOMIC_RELAXED );
+    return reserved > head->capacity ? reserved - head->capacity : 0;
+}
+
+struct trace_loop_t {
+    TIME throt_start, throt_end, start, end;
+    uint64_t count, stop_lag;
+    int khz;
+
+    trace_loop_t() : throt_start( 0 ), throt_end( 0 ), start( 0 ), end( 0 ), count( 0 ), stop_lag( 0 ), khz( 0 ) {}
+};
+
+struct trace_row_t {
+    int cpu;
+    TIME begin, finish;
+    vector<trace_loop_t> loops;
+
+    trace_row_t() : cpu( -1 ), begin( 0 ), finish( 0 ) {}
+};
+
+// Gathers the records by sample and thread.  Loops past the layout's event
+// count are dropped and loops that never ran print as zeros, as the in
+// memory tables pad and trim them.
+bool printTraceTable( TraceFile &trace, string &err ) {
+    const trace_header_t &head = trace.header();
+    map< pair<int, int>, trace_row_t > rows;
+    map< pair<int, int>, trace_row_t >::iterator row_it;
+    uint64_t idx, skipped = 0;
+    unsigned int l;
+
+    int event_count = head.events;
+    bool throttled = head.throttled != 0;
+
+    if( event_count == 0 ) {
+        err = "The trace has no layout; the run did not finish its setup";
+        return false;
+    }
+
+    for( idx = 0; idx < trace.size(); idx++ ) {
+        const trace_record_t &rec = trace.at( idx );
+        trace_row_t &row = rows[make_pair(( int ) rec.sample, ( int ) rec.thread )];
+
+        if( row.loops.empty() ) {
+            row.loops.resize( event_count );
+        }
+        row.cpu = rec.cpu;
+
+        if( rec.type == TRACE_SAMPLE_BEGIN ) {
+            row.begin = rec.time;
+            continue;
+        } else if( rec.type == TRACE_SAMPLE_END ) {
+            row.finish = rec.time;
+            continue;
+        } else if( rec.type == TRACE_EMPTY || rec.event >= ( unsigned int ) event_count ) {
+            skipped++;
+            continue;
+        }
+
+        trace_loop_t &loop = row.loops[rec.event];
+        if( rec.type == TRACE_THROTTLE_BEGIN ) {
+            loop.throt_start = rec.time;
+            loop.khz = rec.khz;
+        } else if( rec.type == TRACE_THROTTLE_END ) {
+            loop.throt_end = rec.time;
+        } else if( rec.type == TRACE_LOOP_BEGIN ) {
+            loop.start = rec.time;
+        } else if( rec.type == TRACE_LOOP_END ) {
+            loop.end = rec.time;
+            loop.count = rec.count;
+            loop.stop_lag = rec.stop_lag;
+        }
+    }
+
+    printf( "# %lu records, %lu dropped, %lu outside the layout\n", trace.size(), trace.dropped(), skipped );
+
+    printf( "#\t\t\t\t" );
+    for( int i = 1; i <= event_count; ++i ) {
+        if( throttled ) {
+            printf( "Throttle #%d\t\t\t", i );
+        }
+        printf( "Iteration #%d\t\t\t\t", i );
+    }
+    printf( "\n" );
+    printf( "#Sample\tCPU ID\tThread ID\tBegin\t" );
+    for( int i = 0; i < event_count; ++i ) {
+        if( throttled ) {
+            printf( "Start (%s)\tFrequency\tEnd (%s)\t", TIME_ABRV, TIME_ABRV );
+        }
+        printf( "Start (%s)\tNodes Visited\tEnd (%s)\tStop Lag (%s)\t", TIME_ABRV, TIME_ABRV, TIME_ABRV );
+    }
+    printf( "Finish\n" );
+
+    int last_sample = -1;
+    for( row_it = rows.begin(); row_it != rows.end(); row_it++ ) {
+        trace_row_t &row = row_it->second;
+
+        if( row_it->first.first != last_sample ) {
+            last_sample = row_it->first.first;
+            printf( "%d", last_sample );
+        }
+        printf( "\t%d\t%d\t", row.cpu, row_it->first.second );
+        PrintTime( row.begin );
+        printf( "\t" );
+
+        for( l = 0; l < row.loops.size(); l++ ) {
+            trace_loop_t &loop = row.loops[l];
+
+            if( throttled ) {
+                PrintTime( loop.throt_start );
+                printf( "\t%d\t", loop.khz );
+                PrintTime( loop.throt_end );
+                printf( "\t" );
+            }
+            PrintTime( loop.start );
+            printf( "\t%lu\t", loop.count );
+            PrintTime( loop.end );
+            printf( "\t%lu\t", loop.stop_lag );
+        }
+        PrintTime( row.finish );
+        printf( "\n" );
+    }
+    return true;
+}
@@ -0,0 +1,101 @@
+#include "utils/uclamp.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+// size of struct sched_attr with the utilization clamps
+const uint32_t SCHED_ATTR_SIZE_VER1 = 56;
+
+pid_t currentTid() {
+    return ( pid_t ) syscall( SYS_gettid );
+}
+
+bool setThreadUtilClamp( pid_t tid, int util_min, int util_max, string &err ) {
+    sched_attr_t attr;
+
+    memset( &attr, 0, sizeof( attr ) );
+    attr.size = SCHED_ATTR_SIZE_VER1;
+    // policy, nice and priority are left untouched
+    attr.sched_flags = SCHED_FLAG_KEEP_POLICY_BIT | SCHED_FLAG_KEEP_PARAMS_BIT | SCHED_FLAG_UTIL_CLAMP_MIN_BIT | SCHED_FLAG_UTIL_CLAMP_MAX_BIT;
+    attr.sched_util_min = util_min;
+    attr.sched_util_max = util_max;
+
+    if( syscall( SYS_sched_setattr, tid, &attr, 0 ) != 0 ) {
+        err = errno == EOPNOTSUPP ? "Kernel built without utilization clamping" : string( "sched_setattr: " ) + strerror( errno );
+        return false;
+    }
+    return true;
+}
+
+bool getThreadUtilClamp( pid_t tid, int &util_min, int &util_max, string &err ) {
+    sched_attr_t attr;
+
+    memset( &attr, 0, sizeof( attr ) );
+    if( syscall( SYS_sched_getattr, tid, &attr, sizeof( attr ), 0 ) != 0 ) {
+        err = string( "sched_getattr: " ) + strerror( errno );
+        return false;
+    }
+    if( attr.size < SCHED_ATTR_SIZE_VER1 ) {
+        err = "Kernel does not report utilization clamps";
+        return false;
+    }
+
+    util_min = attr.sched_util_min;
+    util_max = attr.sched_util_max;
+    return true;
+}
+
+UclampActuator::UclampActuator() : max_khz( 0 ) {}
+
+bool UclampActuator::open( int _max_khz, string &err ) {
+    int util_min, util_max;
+
+    if( _max_khz <= 0 ) {
+        err = "Invalid maximum speed";
+        return false;
+    }
+
+    // rewriting the clamps of the calling thread probes for uclamp support
+    if( !getThreadUtilClamp( currentTid(), util_min, util_max, err ) ||
+            !setThreadUtilClamp( currentTid(), util_min, util_max, err ) ) {
+        return false;
+    }
+
+    max_khz = _max_khz;
+    return true;
+}
+
+// inverse of the schedutil frequency selection: util = khz / (1.25 * max_khz)
+int UclampActuator::utilFor( int khz ) const {
+    if( max_khz <= 0 ) {
+        return UCLAMP_SCALE;
+    }
+
+    int64_t util = ( int64_t ) khz * UCLAMP_SCALE * 4 / ( 5 * ( int64_t ) max_khz );
+
+    if( util < 0 ) {
+        return 0;
+    }
+    return util > UCLAMP_SCALE ? UCLAMP_SCALE : ( int ) util;
+}
+
+bool UclampActuator::setSpeed( pid_t tid, const string &speed, string &err ) {
+    return setSpeed( tid, atoi( speed.c_str() ), err );
+}
+
+bool UclampActuator::setSpeed( pid_t tid, int khz, string &err ) {
+    if( !isOpen() ) {
+        err = "Utilization clamping is not set up";
+        return false;
+    }
+
+    int util = utilFor( khz );
+    return setThreadUtilClamp( tid, util, util, err );
+}
+
+bool UclampActuator::release( pid_t tid, string &err ) {
+    return setThreadUtilClamp( tid, 0, UCLAMP_SCALE, err );
+}
@@ -0,0 +1,116 @@
+#include "utils/waiter.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+const char *WAIT_MODE_NAMES[WAIT_MODE_COUNT] = {"spin", "nanosleep", "timerfd", "futex"};
+
+bool parseWaitMode( const string &name, wait_mode_t &mode ) {
+    for( int i = 0; i < WAIT_MODE_COUNT; i++ ) {
+        if( name == WAIT_MODE_NAMES[i] ) {
+            mode = ( wait_mode_t ) i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *waitModeName( wait_mode_t mode ) {
+    return WAIT_MODE_NAMES[mode];
+}
+
+void wait_stat_t::add( TIME deadline, TIME woke ) {
+    uint64_t late = span_TIME( deadline, woke );
+
+    waits++;
+    total_ns += late;
+    if( late > max_ns ) {
+        max_ns = late;
+    }
+}
+
+void wait_stat_t::merge( const wait_stat_t &other ) {
+    waits += other.waits;
+    total_ns += other.total_ns;
+    if( other.max_ns > max_ns ) {
+        max_ns = other.max_ns;
+    }
+}
+
+DeadlineWaiter::DeadlineWaiter( wait_mode_t _mode, uint64_t _spin_ns ) : mode( _mode ), spin_ns( _spin_ns ), timer_fd( -1 ), futex_word( 0 ) {
+}
+
+DeadlineWaiter::~DeadlineWaiter() {
+    close();
+}
+
+bool DeadlineWaiter::open( string &err ) {
+    if( mode != WAIT_TIMERFD || timer_fd >= 0 ) {
+        return true;
+    }
+
+    timer_fd = timerfd_create( CLOCK_MONOTONIC, TFD_CLOEXEC );
+    if( timer_fd < 0 ) {
+        err = string( "Unable to create wait timer: " ) + strerror( errno );
+        return false;
+    }
+    return true;
+}
+
+void DeadlineWaiter::close() {
+    if( timer_fd >= 0 ) {
+        ::close( timer_fd );
+        timer_fd = -1;
+    }
+}
+
+void DeadlineWaiter::sleepUntil( TIME deadline ) {
+    timespec at = convertTimeToTimespec( deadline );
+
+    if( mode == WAIT_NANOSLEEP ) {
+        while( clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &at, NULL ) == EINTR );
+    } else if( mode == WAIT_TIMERFD ) {
+        itimerspec its;
+        uint64_t expirations;
+
+        memset( &its, 0, sizeof( its ) );
+        its.it_value = at;
+        if( timerfd_settime( timer_fd, TFD_TIMER_ABSTIME, &its, NULL ) == 0 ) {
+            while( read( timer_fd, &expirations, sizeof( expirations ) ) < 0 && errno == EINTR );
+        }
+    } else if( mode == WAIT_FUTEX ) {
+        // nobody wakes the word; the absolute CLOCK_MONOTONIC timeout does
+        while( syscall( SYS_futex, &futex_word, FUTEX_WAIT_BITSET | FUTEX_PRIVATE_FLAG, 0, &at, NULL, FUTEX_BITSET_MATCH_ANY ) == 0 || errno == EINTR );
+    }
+}
+
+TIME DeadlineWaiter::waitUntil( TIME deadline ) {
+    TIME now;
+
+    if( mode != WAIT_SPIN && ( mode != WAIT_TIMERFD || timer_fd >= 0 ) ) {
+        if( deadline > spin_ns ) {
+            GetTime( now );
+            if( now + spin_ns < deadline ) {
+                sleepUntil( deadline - spin_ns );
+            }
+        }
+    }
+
+    // spin mode, the spin tail of the sleeping modes, and any early return
+    do {
+        GetTime( now );
+    } while( now < deadline );
+
+    wake_stat.add( deadline, now );
+    return now;
+}
+
+void printWaitStat( const char *label, wait_mode_t mode, uint64_t spin_ns, wait_stat_t &stat ) {
+    printf( "# %s waits (%s, spin %lu ns): %lu, lateness mean %lu max %lu ns\n", label, waitModeName( mode ), spin_ns, stat.waits,
+            stat.waits > 0 ? stat.total_ns / stat.waits : 0, stat.max_ns );
+}